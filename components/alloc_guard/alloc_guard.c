@@ -0,0 +1,441 @@
+/*
+ * alloc_guard.c
+ *
+ * This file implements the allocation guard. On the device the heap hooks
+ * of ESP-IDF (CONFIG_HEAP_USE_HOOKS, selected by CONFIG_ALLOC_GUARD) are
+ * called after every allocation and before every free; they look up the
+ * region of the calling task and, inside one, walk the stack to find the
+ * call site. The hooks run inside the heap, possibly with the flash cache
+ * off, so they and everything they touch live in IRAM and DRAM and they
+ * must not allocate themselves.
+ *
+ * On Linux the host build links with --wrap=malloc and friends, and the
+ * region is a thread local. Only calls from the objects of the test itself
+ * are wrapped, not those made inside the C library.
+ *
+ * Violations are merged by call site, so a leak in a per-packet path shows
+ * as one entry with a count rather than filling the table.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ESP_PLATFORM
+    #define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#ifdef ESP_PLATFORM
+    #include "freertos/FreeRTOS.h"
+    #include "freertos/task.h"
+    #include "esp_attr.h"
+    #include "esp_console.h"
+    #include "esp_cpu_utils.h"
+    #include "esp_debug_helpers.h"
+    #include "esp_heap_caps.h"
+    #include "esp_memory_utils.h"
+    #include "esp_system.h"
+#else
+    #include <pthread.h>
+    #include <stdlib.h>
+    #define IRAM_ATTR
+    #define DRAM_ATTR
+#endif
+#include "alloc_guard.h"
+
+
+#define ALLOC_GUARD_DEPTH   12              // Call site frames kept per violation, innermost first
+#define ALLOC_GUARD_SITES   16              // Distinct call sites kept
+#define GUARD_SLOTS         8               // Tasks that can be inside a region at once
+#define SKIP_FRAMES         2               // check() and the heap hook
+
+
+// One call site that allocated or freed inside a region
+typedef struct {
+    alloc_region_t  region;
+    bool            is_free;
+    uint8_t         depth;
+    uint32_t        size;                   // Of the first allocation, 0 for free
+    uint32_t        count;                  // Times this site was hit
+    char            task[16];
+    uintptr_t       pc[ALLOC_GUARD_DEPTH];
+    uintptr_t       sp[ALLOC_GUARD_DEPTH];
+} alloc_site_t;
+
+#ifdef ESP_PLATFORM
+// Region of one task
+typedef struct {
+    TaskHandle_t    task;
+    alloc_region_t  region;
+} guard_slot_t;
+#endif
+
+
+// Local variables
+static const char *const        region_names[ALLOC_REGION_COUNT] = {
+    "none", "dns", "http_get", "metrics", "ota_write", "kernels"
+};
+#if CONFIG_ALLOC_GUARD
+static DRAM_ATTR alloc_site_t   sites[ALLOC_GUARD_SITES];
+static DRAM_ATTR int            num_sites;
+static DRAM_ATTR uint32_t       violations; // Including those at sites that did not fit
+#ifdef ESP_PLATFORM
+static DRAM_ATTR guard_slot_t   slots[GUARD_SLOTS];
+static DRAM_ATTR volatile int   armed;      // Slots in use, lets the hooks return early
+static portMUX_TYPE             s_lock = portMUX_INITIALIZER_UNLOCKED;
+#define GUARD_LOCK()            portENTER_CRITICAL_SAFE(&s_lock)
+#define GUARD_UNLOCK()          portEXIT_CRITICAL_SAFE(&s_lock)
+#else
+static _Thread_local alloc_region_t current;
+static pthread_mutex_t          s_lock = PTHREAD_MUTEX_INITIALIZER;
+#define GUARD_LOCK()            pthread_mutex_lock(&s_lock)
+#define GUARD_UNLOCK()          pthread_mutex_unlock(&s_lock)
+#endif
+#endif
+
+
+#if CONFIG_ALLOC_GUARD
+/**
+ * @brief Counts a violation against its call site.
+ */
+static IRAM_ATTR void record(alloc_region_t region, bool is_free, size_t size, const char *task,
+                             const uintptr_t *pc, const uintptr_t *sp, int depth)
+{
+    GUARD_LOCK();
+    violations++;
+    alloc_site_t *site = NULL;
+    for (int i = 0; i < num_sites && site == NULL; i++) {
+        alloc_site_t *s = &sites[i];
+        bool same = s->region == region && s->is_free == is_free && s->depth == depth;
+        for (int f = 0; same && f < depth; f++) {
+            same = s->pc[f] == pc[f];
+        }
+        site = same ? s : NULL;
+    }
+    if (site == NULL && num_sites < ALLOC_GUARD_SITES) {
+        site = &sites[num_sites++];
+        site->region = region;
+        site->is_free = is_free;
+        site->size = size;
+        site->count = 0;
+        site->depth = depth;
+        for (int f = 0; f < depth; f++) {
+            site->pc[f] = pc[f];
+            site->sp[f] = sp[f];
+        }
+        int n = 0;
+        while (n < (int)sizeof(site->task) - 1 && task[n] != '\0') {
+            site->task[n] = task[n];
+            n++;
+        }
+        site->task[n] = '\0';
+    }
+    if (site != NULL) {
+        site->count++;
+    }
+    GUARD_UNLOCK();
+}
+#endif
+
+
+#if CONFIG_ALLOC_GUARD && defined(ESP_PLATFORM)
+/**
+ * @brief Guards the calling task until alloc_guard_exit(). Regions nest.
+ *
+ * @param region Path about to run.
+ *
+ * @return The previous region, to be passed to alloc_guard_exit().
+ */
+alloc_region_t alloc_guard_enter(alloc_region_t region)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    alloc_region_t previous = ALLOC_REGION_NONE;
+    guard_slot_t *slot = NULL;
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < GUARD_SLOTS; i++) {
+        if (slots[i].task == self) {
+            slot = &slots[i];
+            previous = slot->region;
+            break;
+        }
+        if (slots[i].task == NULL && slot == NULL) {
+            slot = &slots[i];
+        }
+    }
+    // With all slots taken the path runs unguarded
+    if (slot != NULL) {
+        if (slot->task == NULL) {
+            armed++;
+        }
+        slot->task = self;
+        slot->region = region;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return previous;
+}
+
+
+/**
+ * @brief Restores the region returned by alloc_guard_enter().
+ */
+void alloc_guard_exit(alloc_region_t previous)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < GUARD_SLOTS; i++) {
+        if (slots[i].task == self) {
+            slots[i].region = previous;
+            if (previous == ALLOC_REGION_NONE) {
+                slots[i].task = NULL;
+                armed--;
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Records the call site if the calling task is in a region. Not
+ *        inlined, so the frames skipped are always this and the hook.
+ */
+static IRAM_ATTR __attribute__((noinline)) void check(bool is_free, size_t size)
+{
+    if (armed == 0 || xPortInIsrContext()) {
+        return;
+    }
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    alloc_region_t region = ALLOC_REGION_NONE;
+    for (int i = 0; i < GUARD_SLOTS; i++) {
+        if (slots[i].task == self) {
+            region = slots[i].region;
+            break;
+        }
+    }
+    if (region == ALLOC_REGION_NONE) {
+        return;
+    }
+
+    uintptr_t pc[ALLOC_GUARD_DEPTH];
+    uintptr_t sp[ALLOC_GUARD_DEPTH];
+    int depth = 0;
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+    esp_backtrace_frame_t bt = { 0 };
+    esp_backtrace_get_start(&bt.pc, &bt.sp, &bt.next_pc);
+    for (int frame = 0; depth < ALLOC_GUARD_DEPTH; frame++) {
+        if (frame >= SKIP_FRAMES) {
+            pc[depth] = esp_cpu_process_stack_pc(bt.pc);
+            sp[depth] = bt.sp;
+            depth++;
+        }
+        if (esp_cpu_process_stack_pc(bt.next_pc) == 0 || !esp_stack_ptr_is_sane(bt.sp) ||
+            !esp_backtrace_get_next_frame(&bt)) {
+            break;
+        }
+    }
+#endif
+    record(region, is_free, size, pcTaskGetName(NULL), pc, sp, depth);
+
+#if CONFIG_ALLOC_GUARD_ABORT
+    esp_system_abort(is_free ? "free() on a guarded path" : "malloc() on a guarded path");
+#endif
+}
+
+
+/**
+ * @brief Heap hook, called after every successful allocation.
+ */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    check(false, size);
+}
+
+
+/**
+ * @brief Heap hook, called before every free.
+ */
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+    check(true, 0);
+}
+
+#elif CONFIG_ALLOC_GUARD
+
+alloc_region_t alloc_guard_enter(alloc_region_t region)
+{
+    alloc_region_t previous = current;
+    current = region;
+    return previous;
+}
+
+
+void alloc_guard_exit(alloc_region_t previous)
+{
+    current = previous;
+}
+
+
+/**
+ * @brief Records the caller if the calling thread is in a region.
+ */
+static void check(bool is_free, size_t size, void *caller)
+{
+    if (current == ALLOC_REGION_NONE) {
+        return;
+    }
+    char task[16] = "";
+    pthread_getname_np(pthread_self(), task, sizeof(task));
+    uintptr_t pc = (uintptr_t)caller;
+    uintptr_t sp = 0;
+    record(current, is_free, size, task, &pc, &sp, 1);
+#if CONFIG_ALLOC_GUARD_ABORT
+    abort();
+#endif
+}
+
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+    check(false, size, __builtin_return_address(0));
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    check(false, n * size, __builtin_return_address(0));
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    check(false, size, __builtin_return_address(0));
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr != NULL) {
+        check(true, 0, __builtin_return_address(0));
+    }
+    __real_free(ptr);
+}
+
+#endif
+
+
+/**
+ * @brief Returns the number of heap calls made on guarded paths since boot
+ *        or the last alloc_guard_reset().
+ */
+uint32_t alloc_guard_violations(void)
+{
+#if CONFIG_ALLOC_GUARD
+    return violations;
+#else
+    return 0;
+#endif
+}
+
+
+/**
+ * @brief Forgets all recorded violations.
+ */
+void alloc_guard_reset(void)
+{
+#if CONFIG_ALLOC_GUARD
+    GUARD_LOCK();
+    violations = 0;
+    num_sites = 0;
+    GUARD_UNLOCK();
+#endif
+}
+
+
+/**
+ * @brief Prints the recorded call sites to stdout. The backtraces are in
+ *        the panic handler's format, so idf.py monitor decodes them.
+ */
+void alloc_guard_print(void)
+{
+#if CONFIG_ALLOC_GUARD
+    GUARD_LOCK();
+    uint32_t total = violations;
+    int count = num_sites;
+    GUARD_UNLOCK();
+    printf("%lu heap calls on guarded paths, %d call sites\n", (unsigned long)total, count);
+
+    for (int i = 0; i < count; i++) {
+        alloc_site_t site;
+        GUARD_LOCK();
+        site = sites[i];
+        GUARD_UNLOCK();
+        if (site.is_free) {
+            printf("%-10s free            x%-6lu task %s\n", alloc_region_name(site.region),
+                   (unsigned long)site.count, site.task);
+        } else {
+            printf("%-10s malloc %6lu B  x%-6lu task %s\n", alloc_region_name(site.region),
+                   (unsigned long)site.size, (unsigned long)site.count, site.task);
+        }
+        printf("Backtrace:");
+        for (int f = 0; f < site.depth; f++) {
+            printf(" 0x%08lx:0x%08lx", (unsigned long)site.pc[f], (unsigned long)site.sp[f]);
+        }
+        printf("\n");
+    }
+    if (total > 0 && count == ALLOC_GUARD_SITES) {
+        printf("Call site table full, further sites are only counted\n");
+    }
+#else
+    printf("The allocation guard is off, enable CONFIG_ALLOC_GUARD\n");
+#endif
+}
+
+
+/**
+ * @brief Returns the name of a region as printed by alloc_guard_print().
+ */
+const char *alloc_region_name(alloc_region_t region)
+{
+    return (region < ALLOC_REGION_COUNT) ? region_names[region] : "?";
+}
+
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Handler for the 'alloc_guard' console command.
+ */
+static int alloc_guard_cmd(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        alloc_guard_reset();
+        return 0;
+    }
+    alloc_guard_print();
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'alloc_guard' console command.
+ */
+void register_alloc_guard(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "alloc_guard",
+        .help = "List heap calls made on allocation-free paths (DNS, cached pages, metrics, OTA writes)",
+        .hint = "[reset]",
+        .func = &alloc_guard_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * alloc_guard.h
+ *
+ * Allocation guard for the steady-state hot paths. Once the device is up,
+ * answering DNS, serving the cached pages, recording metrics and writing
+ * OTA data must not touch the heap. A task marks such a path with
+ * alloc_guard_enter()/alloc_guard_exit(); with CONFIG_ALLOC_GUARD any
+ * malloc or free the task makes inside it is recorded with its call site
+ * (or aborts, with CONFIG_ALLOC_GUARD_ABORT).
+ *
+ * The same source builds on Linux, where malloc and free are wrapped by the
+ * linker, so host tests fail when a guarded kernel starts allocating; see
+ * tools/host/CMakeLists.txt.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ALLOC_GUARD_H
+#define ALLOC_GUARD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#ifdef ESP_PLATFORM
+    #include "sdkconfig.h"
+#endif
+
+
+// Code path that must not allocate
+typedef enum {
+    ALLOC_REGION_NONE = 0,
+    ALLOC_REGION_DNS,                       // Parsing a query and building the answer
+    ALLOC_REGION_HTTP_GET,                  // Sending a cached page
+    ALLOC_REGION_METRICS,                   // Recording trace spans
+    ALLOC_REGION_OTA_WRITE,                 // ota_session_push(): parsing, relaying and writing image data
+    ALLOC_REGION_KERNELS,                   // Scan, compare, CRC and URI decode kernels (kernel_bench)
+    ALLOC_REGION_COUNT
+} alloc_region_t;
+
+
+// Functions
+#if CONFIG_ALLOC_GUARD
+alloc_region_t  alloc_guard_enter(alloc_region_t region);
+void            alloc_guard_exit(alloc_region_t previous);
+#else
+static inline alloc_region_t alloc_guard_enter(alloc_region_t region)
+{
+    return ALLOC_REGION_NONE;
+}
+static inline void alloc_guard_exit(alloc_region_t previous)
+{
+}
+#endif
+uint32_t    alloc_guard_violations(void);
+void        alloc_guard_reset(void);
+void        alloc_guard_print(void);
+const char *alloc_region_name(alloc_region_t region);
+void        register_alloc_guard(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
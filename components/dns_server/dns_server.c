@@ -11,12 +11,14 @@
 #include "esp_system.h"
 #include "esp_check.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include "lwip/netdb.h"
 #include "dns_server.h"
+#include "alloc_guard.h"
 
 #define DNS_PORT (53)
 #define DNS_MAX_LEN (256)
@@ -25,6 +27,12 @@
 #define QR_FLAG (1 << 7)
 #define QD_TYPE_A (0x0001)
 #define ANS_TTL_SEC (300)
+#define DEFAULT_BURST_MS (100)
+#ifdef CONFIG_STACK_SIZE_DNS_SERVER
+#define DNS_TASK_STACK_SIZE CONFIG_STACK_SIZE_DNS_SERVER
+#else
+#define DNS_TASK_STACK_SIZE (4096)
+#endif
 
 static const char *TAG = "example_dns_redirect_server";
 
@@ -60,6 +68,10 @@ typedef struct __attribute__((__packed__))
 struct dns_server_handle {
     bool started;
     TaskHandle_t task;
+    dns_server_busy_cb_t busy_cb;
+    uint32_t burst_ms;
+    dns_server_reply_cb_t reply_cb;
+    dns_server_shed_cb_t shed_cb;
     int num_of_entries;
     dns_entry_pair_t entry[];
 };
@@ -183,6 +195,24 @@ static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t
     return reply_len;
 }
 
+/*
+    Reports the start or end of a burst of queries. While a burst is running the
+    socket has a receive timeout, so its end is noticed; otherwise it blocks.
+*/
+static void set_busy(dns_server_handle_t h, int sock, bool *busy, bool new_busy)
+{
+    if (h->busy_cb == NULL || *busy == new_busy) {
+        return;
+    }
+    *busy = new_busy;
+    struct timeval tv = {
+        .tv_sec = new_busy ? h->burst_ms / 1000 : 0,
+        .tv_usec = new_busy ? (h->burst_ms % 1000) * 1000 : 0,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    h->busy_cb(new_busy);
+}
+
 /*
     Sets up a socket and listen for DNS queries,
     replies to all type A queries with the IP of the softAP
@@ -194,6 +224,8 @@ void dns_server_task(void *pvParameters)
     int addr_family;
     int ip_protocol;
     dns_server_handle_t handle = pvParameters;
+    bool busy = false;
+    bool quiet = false;     // Shedding load: the UART log costs more than the answer
 
     while (handle->started) {
 
@@ -219,23 +251,36 @@ void dns_server_task(void *pvParameters)
         ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
 
         while (handle->started) {
-            ESP_LOGI(TAG, "Waiting for data");
+            if (!quiet) {
+                ESP_LOGI(TAG, "Waiting for data");
+            }
             struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
             socklen_t socklen = sizeof(source_addr);
             int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
+            int64_t received_us = esp_timer_get_time();
 
+            // No query for burst_ms, the burst is over
+            if (len < 0 && busy && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                set_busy(handle, sock, &busy, false);
+                continue;
+            }
             // Error occurred during receiving
             if (len < 0) {
                 ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+                set_busy(handle, sock, &busy, false);
                 close(sock);
+                sock = -1;
                 break;
             }
             // Data received
             else {
-                // Get the sender's ip address as string
-                if (source_addr.sin6_family == PF_INET) {
+                set_busy(handle, sock, &busy, true);
+                quiet = handle->shed_cb && handle->shed_cb();
+
+                // Get the sender's ip address as string, only needed for the log
+                if (!quiet && source_addr.sin6_family == PF_INET) {
                     inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                } else if (source_addr.sin6_family == PF_INET6) {
+                } else if (!quiet && source_addr.sin6_family == PF_INET6) {
                     inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
                 }
 
@@ -243,17 +288,28 @@ void dns_server_task(void *pvParameters)
                 rx_buffer[len] = 0;
 
                 char reply[DNS_MAX_LEN];
+                // lwIP allocates in recvfrom() and sendto(), the answer itself must not
+                alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_DNS);
                 int reply_len = parse_dns_request(rx_buffer, len, reply, DNS_MAX_LEN, handle);
+                alloc_guard_exit(guard);
 
-                ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
+                if (!quiet) {
+                    ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
+                }
                 if (reply_len <= 0) {
                     ESP_LOGE(TAG, "Failed to prepare a DNS reply");
                 } else {
                     int err = sendto(sock, reply, reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
                     if (err < 0) {
                         ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+                        set_busy(handle, sock, &busy, false);
                         break;
                     }
+                    if (handle->reply_cb) {
+                        uint32_t client_ip = (source_addr.sin6_family == PF_INET) ?
+                                             ((struct sockaddr_in *)&source_addr)->sin_addr.s_addr : 0;
+                        handle->reply_cb(received_us, esp_timer_get_time() - received_us, client_ip);
+                    }
                 }
             }
         }
@@ -267,16 +323,41 @@ void dns_server_task(void *pvParameters)
     vTaskDelete(NULL);
 }
 
+#if CONFIG_STATIC_ALLOCATION
+// A single server, with room for DNS_SERVER_MAX_ITEMS entries
+static union {
+    struct dns_server_handle handle;
+    uint8_t mem[sizeof(struct dns_server_handle) + DNS_SERVER_MAX_ITEMS * sizeof(dns_entry_pair_t)];
+} s_server;
+static StaticTask_t s_task_tcb;
+static StackType_t s_task_stack[DNS_TASK_STACK_SIZE];
+#endif
+
 dns_server_handle_t start_dns_server(dns_server_config_t *config)
 {
+#if CONFIG_STATIC_ALLOCATION
+    ESP_RETURN_ON_FALSE(!s_server.handle.started && s_server.handle.task == NULL, NULL, TAG, "DNS server already started");
+    ESP_RETURN_ON_FALSE(config->num_of_entries <= DNS_SERVER_MAX_ITEMS, NULL, TAG, "Too many dns server entries");
+    dns_server_handle_t handle = &s_server.handle;
+    memset(&s_server, 0, sizeof(s_server));
+#else
     dns_server_handle_t handle = calloc(1, sizeof(struct dns_server_handle) + config->num_of_entries * sizeof(dns_entry_pair_t));
     ESP_RETURN_ON_FALSE(handle, NULL, TAG, "Failed to allocate dns server handle");
+#endif
 
     handle->started = true;
+    handle->busy_cb = config->busy_cb;
+    handle->burst_ms = config->burst_ms ? config->burst_ms : DEFAULT_BURST_MS;
+    handle->reply_cb = config->reply_cb;
+    handle->shed_cb = config->shed_cb;
     handle->num_of_entries = config->num_of_entries;
     memcpy(handle->entry, config->item, config->num_of_entries * sizeof(dns_entry_pair_t));
 
-    xTaskCreate(dns_server_task, "dns_server", 4096, handle, 5, &handle->task);
+#if CONFIG_STATIC_ALLOCATION
+    handle->task = xTaskCreateStatic(dns_server_task, "dns_server", DNS_TASK_STACK_SIZE, handle, 5, s_task_stack, &s_task_tcb);
+#else
+    xTaskCreate(dns_server_task, "dns_server", DNS_TASK_STACK_SIZE, handle, 5, &handle->task);
+#endif
     return handle;
 }
 
@@ -285,6 +366,10 @@ void stop_dns_server(dns_server_handle_t handle)
     if (handle) {
         handle->started = false;
         vTaskDelete(handle->task);
+#if CONFIG_STATIC_ALLOCATION
+        handle->task = NULL;
+#else
         free(handle);
+#endif
     }
 }
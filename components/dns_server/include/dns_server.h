@@ -6,6 +6,9 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,6 +34,31 @@ typedef struct dns_entry_pair {
     esp_ip4_addr_t ip;      /**<! Constant IP address to answer this query, if "if_key==NULL" */
 } dns_entry_pair_t;
 
+/**
+ * @brief Callback told when the server starts and stops answering a burst of queries,
+ * e.g. to hold a power management lock while clients are resolving names
+ *
+ * @param busy true before the first query of a burst, false once the burst has ended
+ */
+typedef void (*dns_server_busy_cb_t)(bool busy);
+
+/**
+ * @brief Callback told after each reply has been sent, e.g. to trace DNS latency
+ *
+ * @param received_us esp_timer_get_time() when the query was received
+ * @param reply_us Time from receiving the query until the reply was sent
+ * @param client_ip IPv4 address of the client in network order, 0 for IPv6 clients
+ */
+typedef void (*dns_server_reply_cb_t)(int64_t received_us, uint32_t reply_us, uint32_t client_ip);
+
+/**
+ * @brief Callback asked for each query whether the device is shedding load; if so the query
+ * is answered without logging it
+ *
+ * @return true to take the cheapest path
+ */
+typedef bool (*dns_server_shed_cb_t)(void);
+
 /**
  * @brief DNS server config struct defining the rules for answering DNS (A type) queries
  *
@@ -50,6 +78,10 @@ typedef struct dns_entry_pair {
 typedef struct dns_server_config {
     int num_of_entries;                             /**<! Number of rules specified in the config struct */
     dns_entry_pair_t item[DNS_SERVER_MAX_ITEMS];    /**<! Array of pairs */
+    dns_server_busy_cb_t busy_cb;                   /**<! Optional, called at the start and end of each burst of queries */
+    uint32_t burst_ms;                              /**<! A burst ends when no query arrived for this long, 0 for 100 ms */
+    dns_server_reply_cb_t reply_cb;                 /**<! Optional, called after each reply */
+    dns_server_shed_cb_t shed_cb;                   /**<! Optional, asked for each query */
 } dns_server_config_t;
 
 /**
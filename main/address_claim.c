@@ -0,0 +1,144 @@
+/*
+ * address_claim.c
+ *
+ * This file decides what the node does with the address claims it hears,
+ * see address_claim.h. Each claim from another node marks its address as
+ * taken, so a node that loses its address moves to one nobody has claimed
+ * rather than trying them in turn.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "address_claim.h"
+
+
+static bool is_taken(const address_claim_t *ac, uint8_t address)
+{
+    return ac->taken[address / 32] & (1u << (address % 32));
+}
+
+
+static void set_taken(address_claim_t *ac, uint8_t address)
+{
+    ac->taken[address / 32] |= 1u << (address % 32);
+}
+
+
+/**
+ * @brief Sets up the claim of an address. Nothing counts as sent until
+ *        address_claim_sent().
+ *
+ * @param ac        The claim.
+ * @param name      64-bit NAME, with ADDRESS_CLAIM_ARBITRARY set if the node
+ *                  may move.
+ * @param address   Preferred address.
+ */
+void address_claim_init(address_claim_t *ac, uint64_t name, uint8_t address)
+{
+    memset(ac, 0, sizeof(*ac));
+    ac->name = name;
+    ac->address = address;
+}
+
+
+/**
+ * @brief Records that the claim went out from ac->address. Only the first
+ *        since the address was chosen starts the wait; a claim sent again
+ *        in defence does not.
+ */
+void address_claim_sent(address_claim_t *ac, uint32_t now_ms)
+{
+    if (!ac->sent) {
+        ac->sent = true;
+        ac->sent_ms = now_ms;
+    }
+}
+
+
+/**
+ * @brief Takes in an address claim from another node.
+ *
+ * @param ac        The claim.
+ * @param source    Address the claim came from.
+ * @param data      The 8 bytes of the claim, the other node's NAME.
+ *
+ * @return What the node must send: on ADDRESS_CLAIM_DEFEND and
+ *         ADDRESS_CLAIM_MOVED its claim, from ac->address; on
+ *         ADDRESS_CLAIM_LOST the cannot-claim, from N2K_NULL_ADDRESS.
+ */
+address_claim_action_t address_claim_received(address_claim_t *ac, uint8_t source, const uint8_t *data)
+{
+    if (source >= N2K_NULL_ADDRESS) {
+        return ADDRESS_CLAIM_IGNORE;
+    }
+    set_taken(ac, source);
+    if (source != ac->address) {
+        return ADDRESS_CLAIM_IGNORE;
+    }
+
+    ac->stats.contested++;
+    uint64_t name = address_claim_get_name(data);
+    if (ac->name < name) {
+        ac->stats.defended++;
+        return ADDRESS_CLAIM_DEFEND;
+    }
+    if (ac->name == name) {
+        ac->stats.same_name++;              // Would move in step with the other, so gives up
+    }
+
+    // Lost: the next free address after this one, wrapping round
+    if ((ac->name & ADDRESS_CLAIM_ARBITRARY) && ac->name != name) {
+        const int count = ADDRESS_CLAIM_LAST - ADDRESS_CLAIM_FIRST + 1;
+        int start = (ac->address >= ADDRESS_CLAIM_FIRST && ac->address <= ADDRESS_CLAIM_LAST)
+                  ? ac->address - ADDRESS_CLAIM_FIRST + 1 : 0;
+        for (int i = 0; i < count; i++) {
+            uint8_t address = ADDRESS_CLAIM_FIRST + (start + i) % count;
+            if (!is_taken(ac, address)) {
+                ac->address = address;
+                ac->sent = false;
+                ac->stats.moved++;
+                return ADDRESS_CLAIM_MOVED;
+            }
+        }
+    }
+    ac->address = N2K_NULL_ADDRESS;
+    ac->sent = false;
+    return ADDRESS_CLAIM_LOST;
+}
+
+
+/**
+ * @brief Whether the node may send other PGNs: it holds an address and
+ *        claimed it at least ADDRESS_CLAIM_WAIT_MS ago.
+ */
+bool address_claim_ready(const address_claim_t *ac, uint32_t now_ms)
+{
+    return ac->address != N2K_NULL_ADDRESS && ac->sent &&
+           (int32_t)(now_ms - ac->sent_ms) >= ADDRESS_CLAIM_WAIT_MS;
+}
+
+
+/**
+ * @brief Writes a NAME as the 8 bytes of a claim, least significant first.
+ */
+void address_claim_put_name(uint64_t name, uint8_t *data)
+{
+    for (int i = 0; i < 8; i++) {
+        data[i] = name >> (8 * i);
+    }
+}
+
+
+/**
+ * @brief Reads the NAME from the 8 bytes of a claim.
+ */
+uint64_t address_claim_get_name(const uint8_t *data)
+{
+    uint64_t name = 0;
+    for (int i = 7; i >= 0; i--) {
+        name = (name << 8) | data[i];
+    }
+    return name;
+}
@@ -0,0 +1,81 @@
+/*
+ * address_claim.h
+ *
+ * ISO 11783-5 (J1939-81) address arbitration for an arbitrary address
+ * capable node. The node claims an address with its 64-bit NAME. When
+ * another node claims the same address, the lower NAME keeps it. If this
+ * node's NAME is the lower one, it sends its claim again. Otherwise it
+ * moves to the next address in 128-247 that no other node has claimed and
+ * claims that. With none left, it claims the null address (254) ("cannot
+ * claim") and sends nothing else. So does a node that hears its own NAME
+ * from another: two units given the same identity would only move in step.
+ * Other traffic waits until 250 ms after the claim for the current address
+ * went out.
+ *
+ * The caller sends the claims; this module only decides. It has no
+ * ESP-IDF dependencies so it can be exercised on a Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ADDRESS_CLAIM_H
+#define ADDRESS_CLAIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "n2k_frame.h"
+
+#define ADDRESS_CLAIM_PGN       60928
+#define ADDRESS_CLAIM_WAIT_MS   250         // Nothing else sent this long after the claim
+#define ADDRESS_CLAIM_FIRST     128         // Addresses a node may move to
+#define ADDRESS_CLAIM_LAST      247
+#define ADDRESS_CLAIM_ARBITRARY (1ull << 63)    // NAME bit: may move to another address
+
+
+// What a received claim requires of this node
+typedef enum {
+    ADDRESS_CLAIM_IGNORE = 0,               // Not for this node's address
+    ADDRESS_CLAIM_DEFEND,                   // This node's NAME wins: send the claim again
+    ADDRESS_CLAIM_MOVED,                    // Lost: claim the new address
+    ADDRESS_CLAIM_LOST,                     // Lost with no address left: claim the null address
+} address_claim_action_t;
+
+
+// Counters
+typedef struct {
+    uint32_t    contested;                  // Claims for this node's address
+    uint32_t    defended;
+    uint32_t    moved;
+    uint32_t    same_name;                  // Contested with this node's own NAME
+} address_claim_stats_t;
+
+
+// State of the node's claim
+typedef struct {
+    uint64_t                name;
+    uint8_t                 address;        // Claimed or being claimed; N2K_NULL_ADDRESS once none is left
+    bool                    sent;           // The claim for address has gone out
+    uint32_t                sent_ms;
+    uint32_t                taken[8];       // Addresses other nodes have claimed, a bit each
+    address_claim_stats_t   stats;
+} address_claim_t;
+
+
+// Functions
+void                    address_claim_init(address_claim_t *ac, uint64_t name, uint8_t address);
+void                    address_claim_sent(address_claim_t *ac, uint32_t now_ms);
+address_claim_action_t  address_claim_received(address_claim_t *ac, uint8_t source, const uint8_t *data);
+bool                    address_claim_ready(const address_claim_t *ac, uint32_t now_ms);
+void                    address_claim_put_name(uint64_t name, uint8_t *data);
+uint64_t                address_claim_get_name(const uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * can_ring.h
+ *
+ * Lock-free receive ring between one producer, the TWAI interrupt, and one
+ * consumer, the NMEA task. The interrupt decodes each frame straight into
+ * its slot and publishes it; the task dispatches the frames where they lie
+ * and releases them, so a frame is written once and never copied through
+ * a queue.
+ *
+ * can_ring_push() tells the producer when the ring was empty before the
+ * frame, the only time the consumer can be waiting, so it wakes the
+ * consumer once per burst rather than once per frame. The consumer drains
+ * until the ring is empty before it waits again. The head and tail are
+ * each written by one side only; the store of one and the load of the
+ * other are sequentially consistent on both sides, so a frame published
+ * as the consumer finds the ring empty is either seen by the consumer or
+ * reported to the producer as the ring becoming non-empty, never missed.
+ *
+ * Everything is inline so the producer side compiles into the interrupt
+ * handler. This header has no ESP-IDF dependencies so it can be exercised
+ * on a Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef CAN_RING_H
+#define CAN_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "n2k_frame.h"
+
+
+// The ring
+typedef struct {
+    n2k_frame_t *frames;
+    uint32_t    mask;                       // Slots - 1, slots a power of two
+    uint32_t    head;                       // Next slot filled, written by the producer
+    uint32_t    tail;                       // Next slot read, written by the consumer
+    uint32_t    dropped;                    // Frames lost with the ring full, by the producer
+    uint32_t    max_used;                   // Most slots in use, by the consumer
+} can_ring_t;
+
+
+/**
+ * @brief Sets up an empty ring.
+ *
+ * @param r         The ring.
+ * @param frames    Its slots.
+ * @param count     Number of slots, a power of two.
+ */
+static inline void can_ring_init(can_ring_t *r, n2k_frame_t *frames, uint32_t count)
+{
+    r->frames = frames;
+    r->mask = count - 1;
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    r->max_used = 0;
+}
+
+
+/**
+ * @brief Producer: returns the slot for the next frame, or NULL if the
+ *        ring is full and the frame is to be dropped. The slot is not
+ *        seen by the consumer until can_ring_push().
+ */
+static inline n2k_frame_t *can_ring_slot(can_ring_t *r)
+{
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) {
+        r->dropped++;
+        return NULL;
+    }
+    return &r->frames[head & r->mask];
+}
+
+
+/**
+ * @brief Producer: publishes the frame written into the slot.
+ *
+ * @return Whether the ring was empty before it, and so the consumer is to
+ *         be woken.
+ */
+static inline bool can_ring_push(can_ring_t *r)
+{
+    uint32_t head = r->head;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == head;
+}
+
+
+/**
+ * @brief Consumer: returns the frames ready that lie together in the ring,
+ *        up to max; a run that wraps is returned in two calls.
+ *
+ * @param r         The ring.
+ * @param frames    Set to the first of them.
+ * @param max       Most to return.
+ *
+ * @return How many, 0 if the ring is empty.
+ */
+static inline int can_ring_peek(can_ring_t *r, const n2k_frame_t **frames, int max)
+{
+    uint32_t tail = r->tail;
+    uint32_t ready = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) - tail;
+    uint32_t to_end = r->mask + 1 - (tail & r->mask);
+
+    if (ready > r->max_used) {
+        r->max_used = ready;
+    }
+    if (ready > to_end) {
+        ready = to_end;
+    }
+    if (ready > (uint32_t)max) {
+        ready = max;
+    }
+    *frames = &r->frames[tail & r->mask];
+    return ready;
+}
+
+
+/**
+ * @brief Consumer: hands back slots it has finished with, from the oldest.
+ */
+static inline void can_ring_pop(can_ring_t *r, int count)
+{
+    __atomic_store_n(&r->tail, r->tail + count, __ATOMIC_SEQ_CST);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
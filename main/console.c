@@ -21,6 +21,22 @@
 //#include "cmd_wifi.h"
 //#include "cmd_nvs.h"
 #include "settings.h"
+#include "serial_ota.h"
+#include "image_catalog.h"
+#include "ota_pull.h"
+#include "kernel_bench.h"
+#include "perf_lock.h"
+#include "flash_stall.h"
+#include "profiler.h"
+#include "ram_budget.h"
+#include "alloc_guard.h"
+#include "stack_usage.h"
+#include "debug_flags.h"
+#include "load_shed.h"
+#include "join_kpi.h"
+#include "dhcp_server.h"
+#include "mdns_responder.h"
+#include "nmea_task.h"
 
 
 /*
@@ -70,7 +86,7 @@ void start_console(void *arg)
 {
     esp_console_repl_t *repl = NULL;
     esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
-    repl_config.task_stack_size += 1024;
+    repl_config.task_stack_size = CONFIG_STACK_SIZE_CONSOLE;
     
     /* Prompt to be printed before each line.
      * This can be customized, made dynamic, etc.
@@ -91,6 +107,22 @@ void start_console(void *arg)
     /* Register console commands */
     esp_console_register_help_command();
     register_system_common();
+    register_serial_ota();
+    register_image_commands();
+    register_ota_pull();
+    register_kernel_bench();
+    register_perf_commands();
+    register_flash_stall();
+    register_profiler();
+    register_ram_budget();
+    register_alloc_guard();
+    register_stack_usage();
+    register_debug_flags();
+    register_load_shed();
+    register_join_kpi();
+    register_dhcp_server();
+    register_mdns_responder();
+    register_nmea();
 
 /*
 #if SOC_LIGHT_SLEEP_SUPPORTED
@@ -0,0 +1,76 @@
+/*
+ * debug_flags.c
+ *
+ * This file implements the debug flag cache and the 'debug' console
+ * command. The word is in internal DRAM, so it can also be tested from
+ * IRAM code while the flash cache is off, and is written with a single
+ * store, so readers never see a torn value.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "debug_flags.h"
+#ifdef ESP_PLATFORM
+    #include "esp_attr.h"
+    #include "esp_console.h"
+    #include "settings.h"
+#else
+    #define DRAM_ATTR
+#endif
+
+
+// Local variables
+DRAM_ATTR uint32_t  debug_flags_word;
+
+
+/**
+ * @brief Replaces the cached flags. Called by the settings code when the
+ *        flags are loaded or changed; use set_debug_flags() to change them.
+ */
+void debug_flags_update(uint32_t flags)
+{
+    debug_flags_word = flags;
+}
+
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Handler for the 'debug' console command.
+ */
+static int debug_cmd(int argc, char **argv)
+{
+    if (argc > 1) {
+        char *end;
+        unsigned long flags = strtoul(argv[1], &end, 0);
+        if (*end != '\0' || flags > 0xFFFF) {
+            printf("Flags must be a number up to 0xFFFF\n");
+            return 1;
+        }
+        set_debug_flags(flags);
+    }
+    printf("Debug flags 0x%04lx\n", (unsigned long)debug_flags_word);
+    printf("  0x%04x task stats     %s\n", DEBUG_SHOW_TASK_STATS, debug_enabled(DEBUG_SHOW_TASK_STATS) ? "on" : "off");
+    printf("  0x%04x log requests   %s\n", DEBUG_LOG_REQUESTS, debug_enabled(DEBUG_LOG_REQUESTS) ? "on" : "off");
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'debug' console command.
+ */
+void register_debug_flags(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "debug",
+        .help = "Show the debug flags, or set them (saved in NVS)",
+        .hint = "[flags]",
+        .func = &debug_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * debug_flags.h
+ *
+ * Runtime debug flags. The flags are kept in NVS (get_debug_flags() and
+ * set_debug_flags() in settings.h) and cached in one word, loaded by
+ * settings_init() and rewritten by set_debug_flags(), so hot paths can
+ * test them with debug_enabled() for the cost of a load and a branch
+ * predicted not taken, instead of an NVS lookup. kbench measures it
+ * ("dbg_flag").
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef DEBUG_FLAGS_H
+#define DEBUG_FLAGS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define DEBUG_SHOW_TASK_STATS   0x0001
+#define DEBUG_LOG_REQUESTS      0x0002      // Log every HTTP request with its status and duration
+
+
+// Cached flags, test with debug_enabled()
+extern uint32_t debug_flags_word;
+
+
+/**
+ * @brief Tests a debug flag. Inline, reads the cached word only.
+ */
+static inline bool debug_enabled(uint32_t flag)
+{
+    return __builtin_expect((debug_flags_word & flag) != 0, 0);
+}
+
+
+// Functions
+void    debug_flags_update(uint32_t flags);
+void    register_debug_flags(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,518 @@
+/*
+ * dhcp_proto.c
+ *
+ * This file implements the DHCP server core described in dhcp_proto.h. It
+ * is driven by the messages handed to dhcp_proto_handle(), which builds
+ * the reply (if any) and says where to send it, so it is independent of
+ * the network stack.
+ *
+ * Relayed messages are ignored (the softAP is its own only link) and so is
+ * INFORM, which phones do not send. Clients are told apart by hardware
+ * address; the client identifier option is not used.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "dhcp_proto.h"
+
+
+#define BOOTREQUEST         1
+#define BOOTREPLY           2
+#define MAGIC_COOKIE        0x63825363
+
+// Offsets into the fixed part of a message
+#define OFS_OP              0
+#define OFS_HTYPE           1
+#define OFS_HLEN            2
+#define OFS_XID             4
+#define OFS_FLAGS           10
+#define OFS_CIADDR          12
+#define OFS_YIADDR          16
+#define OFS_GIADDR          24
+#define OFS_CHADDR          28
+#define OFS_MAGIC           236
+
+// Options
+#define OPT_PAD             0
+#define OPT_SUBNET_MASK     1
+#define OPT_ROUTER          3
+#define OPT_DNS_SERVER      6
+#define OPT_REQUESTED_IP    50
+#define OPT_LEASE_TIME      51
+#define OPT_MSG_TYPE        53
+#define OPT_SERVER_ID       54
+#define OPT_T1              58
+#define OPT_T2              59
+#define OPT_RAPID_COMMIT    80
+#define OPT_END             255
+
+#define OFFER_HOLD_S        60              // An offer reserves its address this long
+#define DECLINE_HOLD_S      600             // A declined address is not offered again for this long
+
+
+// Options of a client message that the server acts on
+typedef struct {
+    uint8_t     type;
+    uint32_t    requested_ip;               // 0 if absent
+    uint32_t    server_id;                  // 0 if absent
+    bool        rapid_commit;
+} options_t;
+
+
+// Big-endian helpers
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+/**
+ * @brief Checks the fixed part of a client message and reads its options.
+ *
+ * @return false if the message is malformed, relayed or has no type.
+ */
+static bool parse(const uint8_t *msg, size_t len, options_t *opt)
+{
+    if (len < DHCP_MIN_MSG_LEN || msg[OFS_OP] != BOOTREQUEST || msg[OFS_HTYPE] != 1 || msg[OFS_HLEN] != 6 ||
+        get_u32(&msg[OFS_MAGIC]) != MAGIC_COOKIE || get_u32(&msg[OFS_GIADDR]) != 0) {
+        return false;
+    }
+
+    memset(opt, 0, sizeof(*opt));
+    const uint8_t *p = msg + DHCP_MIN_MSG_LEN;
+    const uint8_t *end = msg + len;
+    while (p < end && *p != OPT_END) {
+        if (*p == OPT_PAD) {
+            p++;
+            continue;
+        }
+        if (end - p < 2 || end - p < 2 + p[1]) {
+            return false;
+        }
+        switch (p[0]) {
+            case OPT_MSG_TYPE:
+                opt->type = (p[1] >= 1) ? p[2] : 0;
+                break;
+            case OPT_REQUESTED_IP:
+                opt->requested_ip = (p[1] == 4) ? get_u32(&p[2]) : 0;
+                break;
+            case OPT_SERVER_ID:
+                opt->server_id = (p[1] == 4) ? get_u32(&p[2]) : 0;
+                break;
+            case OPT_RAPID_COMMIT:
+                opt->rapid_commit = true;
+                break;
+        }
+        p += 2 + p[1];
+    }
+    return opt->type != 0;
+}
+
+
+/**
+ * @brief Returns the table index of a pool address, -1 if outside the pool.
+ */
+static int pool_index(const dhcp_proto_server_t *server, uint32_t ip)
+{
+    uint32_t i = ip - server->cfg.pool_start;
+    return (i < server->cfg.pool_size) ? (int)i : -1;
+}
+
+
+/**
+ * @brief Returns the table index of the address kept for a client, -1 if none.
+ */
+static int find_mac(const dhcp_proto_server_t *server, const uint8_t *mac)
+{
+    for (uint32_t i = 0; i < server->cfg.pool_size; i++) {
+        const dhcp_lease_t *l = &server->leases[i];
+        if (l->state != DHCP_LEASE_FREE && l->state != DHCP_LEASE_DECLINED && memcmp(l->mac, mac, 6) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Ends the offers and leases that ran out, and the hold on declined
+ *        addresses.
+ */
+static void age(dhcp_proto_server_t *server, uint32_t now_s)
+{
+    for (uint32_t i = 0; i < server->cfg.pool_size; i++) {
+        dhcp_lease_t *l = &server->leases[i];
+        if ((int32_t)(now_s - l->expires_s) < 0) {
+            continue;
+        }
+        if (l->state == DHCP_LEASE_OFFERED || l->state == DHCP_LEASE_BOUND) {
+            l->state = DHCP_LEASE_EXPIRED;
+        } else if (l->state == DHCP_LEASE_DECLINED) {
+            l->state = DHCP_LEASE_FREE;
+        }
+    }
+}
+
+
+/**
+ * @brief Picks an address for a client that has none kept: the one it asked
+ *        for if unused, else the first unused one, else the one whose last
+ *        client has been gone longest.
+ *
+ * @return The table index, -1 if every address is offered, bound or held.
+ */
+static int allocate(dhcp_proto_server_t *server, const uint8_t *mac, uint32_t requested_ip)
+{
+    int idx = pool_index(server, requested_ip);
+    if (idx < 0 || server->leases[idx].state != DHCP_LEASE_FREE) {
+        idx = -1;
+        for (uint32_t i = 0; i < server->cfg.pool_size; i++) {
+            const dhcp_lease_t *l = &server->leases[i];
+            if (l->state == DHCP_LEASE_FREE) {
+                idx = i;
+                break;
+            }
+            if (l->state == DHCP_LEASE_EXPIRED &&
+                (idx < 0 || (int32_t)(l->expires_s - server->leases[idx].expires_s) < 0)) {
+                idx = i;
+            }
+        }
+        if (idx < 0) {
+            return -1;
+        }
+    }
+
+    dhcp_lease_t *l = &server->leases[idx];
+    memcpy(l->mac, mac, 6);
+    l->state = DHCP_LEASE_EXPIRED;
+    l->bound_before = 0;
+    return idx;
+}
+
+
+/**
+ * @brief Checks the address a client asks to keep. It may have it if the
+ *        address is kept for it, or unused (the table was lost, or the
+ *        client moved to it from its kept one).
+ *
+ * @return The table index of the address, -1 if the client must be NAKed.
+ */
+static int reclaim(dhcp_proto_server_t *server, int idx, const uint8_t *mac, uint32_t ip)
+{
+    int want = pool_index(server, ip);
+    if (want < 0 || want == idx) {
+        return want;
+    }
+    if (server->leases[want].state != DHCP_LEASE_FREE) {
+        return -1;
+    }
+    if (idx >= 0) {
+        memset(&server->leases[idx], 0, sizeof(dhcp_lease_t));
+    }
+    return allocate(server, mac, ip);
+}
+
+
+/**
+ * @brief Leases an address and counts the ACK.
+ */
+static void bind_lease(dhcp_proto_server_t *server, int idx, int64_t now_us, dhcp_proto_reply_t *info)
+{
+    dhcp_lease_t *l = &server->leases[idx];
+    dhcp_proto_stats_t *st = &server->stats;
+
+    if (l->state == DHCP_LEASE_BOUND) {
+        st->renewals++;
+    } else {
+        uint32_t us = now_us - l->started_us;
+        st->returning += l->bound_before;
+        st->exchanges++;
+        st->exchange_us += us;
+        st->exchange_max_us = (us > st->exchange_max_us) ? us : st->exchange_max_us;
+        info->bound = true;
+        info->exchange_us = us;
+    }
+    l->state = DHCP_LEASE_BOUND;
+    l->bound_before = 1;
+    l->expires_s = now_us / 1000000 + server->cfg.lease_s;
+}
+
+
+/**
+ * @brief Builds a reply to a client message.
+ *
+ * @return The reply length.
+ */
+static size_t build(const dhcp_proto_server_t *server, const uint8_t *msg, uint8_t type, uint32_t yiaddr,
+                    bool rapid_commit, uint8_t *reply)
+{
+    const dhcp_proto_config_t *cfg = &server->cfg;
+
+    memset(reply, 0, DHCP_REPLY_LEN);
+    reply[OFS_OP] = BOOTREPLY;
+    reply[OFS_HTYPE] = 1;
+    reply[OFS_HLEN] = 6;
+    memcpy(&reply[OFS_XID], &msg[OFS_XID], 4);
+    memcpy(&reply[OFS_FLAGS], &msg[OFS_FLAGS], 2);
+    if (type != DHCP_NAK) {
+        memcpy(&reply[OFS_CIADDR], &msg[OFS_CIADDR], 4);
+        put_u32(&reply[OFS_YIADDR], yiaddr);
+    }
+    memcpy(&reply[OFS_CHADDR], &msg[OFS_CHADDR], 16);
+    put_u32(&reply[OFS_MAGIC], MAGIC_COOKIE);
+
+    uint8_t *p = reply + DHCP_MIN_MSG_LEN;
+    *p++ = OPT_MSG_TYPE;
+    *p++ = 1;
+    *p++ = type;
+    *p++ = OPT_SERVER_ID;
+    *p++ = 4;
+    put_u32(p, cfg->server_ip);
+    p += 4;
+    if (type != DHCP_NAK) {
+        const struct {
+            uint8_t     code;
+            uint32_t    value;
+        } words[] = {
+            { OPT_LEASE_TIME,   cfg->lease_s },
+            { OPT_T1,           cfg->lease_s / 2 },
+            { OPT_T2,           cfg->lease_s / 8 * 7 },
+            { OPT_SUBNET_MASK,  cfg->netmask },
+            { OPT_ROUTER,       cfg->server_ip },
+            { OPT_DNS_SERVER,   cfg->server_ip },
+        };
+        for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+            *p++ = words[i].code;
+            *p++ = 4;
+            put_u32(p, words[i].value);
+            p += 4;
+        }
+        if (rapid_commit) {
+            *p++ = OPT_RAPID_COMMIT;
+            *p++ = 0;
+        }
+    }
+    *p = OPT_END;
+    return DHCP_REPLY_LEN;
+}
+
+
+/**
+ * @brief Sets up a server.
+ *
+ * @param server  Server state.
+ * @param cfg     Configuration, copied.
+ * @param leases  Lease table of cfg->pool_size entries.
+ * @param restore Keep the clients in the table from an earlier run. Their
+ *                leases count as expired: each gets its address back when
+ *                it asks, until the address is needed for someone else.
+ */
+void dhcp_proto_init(dhcp_proto_server_t *server, const dhcp_proto_config_t *cfg, dhcp_lease_t *leases,
+                     bool restore)
+{
+    memset(server, 0, sizeof(*server));
+    server->cfg = *cfg;
+    server->leases = leases;
+    for (uint32_t i = 0; i < cfg->pool_size; i++) {
+        dhcp_lease_t *l = &leases[i];
+        if (!restore || l->state == DHCP_LEASE_FREE || l->state == DHCP_LEASE_DECLINED ||
+            l->state > DHCP_LEASE_DECLINED) {
+            memset(l, 0, sizeof(*l));
+        } else {
+            l->state = DHCP_LEASE_EXPIRED;
+            l->bound_before = (l->bound_before != 0);
+            l->expires_s = 0;
+        }
+    }
+}
+
+
+/**
+ * @brief Handles a message from a client.
+ *
+ * @param server    Server state.
+ * @param msg       The message (UDP payload).
+ * @param len       Its length.
+ * @param now_us    Time on a monotonic microsecond clock.
+ * @param reply     Buffer for the reply.
+ * @param reply_max Its size, at least DHCP_REPLY_LEN.
+ * @param info      Where to send the reply and what it did, set if a reply
+ *                  was built.
+ *
+ * @return The length of the reply to send, 0 for none.
+ */
+size_t dhcp_proto_handle(dhcp_proto_server_t *server, const uint8_t *msg, size_t len, int64_t now_us,
+                         uint8_t *reply, size_t reply_max, dhcp_proto_reply_t *info)
+{
+    dhcp_proto_stats_t *st = &server->stats;
+    options_t opt;
+
+    st->received++;
+    if (reply_max < DHCP_REPLY_LEN || !parse(msg, len, &opt)) {
+        st->ignored++;
+        return 0;
+    }
+
+    uint32_t now_s = now_us / 1000000;
+    const uint8_t *mac = &msg[OFS_CHADDR];
+    uint32_t ciaddr = get_u32(&msg[OFS_CIADDR]);
+    age(server, now_s);
+
+    memset(info, 0, sizeof(*info));
+    memcpy(info->mac, mac, 6);
+    info->broadcast = true;
+    int idx = find_mac(server, mac);
+    bool rapid = false;
+    uint8_t type = DHCP_NAK;
+
+    switch (opt.type) {
+        case DHCP_DISCOVER:
+            st->discovers++;
+            if (idx < 0) {
+                idx = allocate(server, mac, opt.requested_ip);
+            }
+            if (idx < 0) {
+                st->exhausted++;
+                return 0;
+            }
+            if (server->leases[idx].state != DHCP_LEASE_OFFERED) {
+                server->leases[idx].started_us = now_us;        // Not a retransmission
+            }
+            if (server->cfg.rapid_commit && opt.rapid_commit) {
+                bind_lease(server, idx, now_us, info);
+                st->rapid_commits++;
+                rapid = true;
+                type = DHCP_ACK;
+            } else {
+                server->leases[idx].state = DHCP_LEASE_OFFERED;
+                server->leases[idx].expires_s = now_s + OFFER_HOLD_S;
+                type = DHCP_OFFER;
+            }
+            break;
+
+        case DHCP_REQUEST:
+            st->requests++;
+            if (opt.server_id != 0) {
+                // SELECTING: the client chose between the offers it got
+                if (opt.server_id != server->cfg.server_ip) {
+                    if (idx >= 0 && server->leases[idx].state == DHCP_LEASE_OFFERED) {
+                        server->leases[idx].state = DHCP_LEASE_EXPIRED;
+                    }
+                    st->ignored++;
+                    return 0;
+                }
+                if (idx >= 0 && pool_index(server, opt.requested_ip) == idx &&
+                    (server->leases[idx].state == DHCP_LEASE_OFFERED || server->leases[idx].state == DHCP_LEASE_BOUND)) {
+                    bind_lease(server, idx, now_us, info);
+                    type = DHCP_ACK;
+                }
+            } else if (ciaddr != 0 || opt.requested_ip != 0) {
+                // RENEWING or REBINDING (ciaddr set), or INIT-REBOOT: the client asks
+                // for the address it had, e.g. after coming back in range
+                idx = reclaim(server, idx, mac, ciaddr ? ciaddr : opt.requested_ip);
+                if (idx >= 0) {
+                    if (server->leases[idx].state != DHCP_LEASE_BOUND) {
+                        server->leases[idx].started_us = now_us;
+                    }
+                    bind_lease(server, idx, now_us, info);
+                    type = DHCP_ACK;
+                    info->broadcast = (ciaddr == 0);
+                    info->dest_ip = ciaddr;
+                }
+            } else {
+                st->ignored++;
+                return 0;
+            }
+            break;
+
+        case DHCP_DECLINE: {
+            // The client found the address in use
+            int bad = pool_index(server, opt.requested_ip);
+            if (bad >= 0 && bad == idx) {
+                dhcp_lease_t *l = &server->leases[bad];
+                memset(l->mac, 0, 6);
+                l->state = DHCP_LEASE_DECLINED;
+                l->bound_before = 0;
+                l->expires_s = now_s + DECLINE_HOLD_S;
+            }
+            st->declines++;
+            return 0;
+        }
+
+        case DHCP_RELEASE:
+            if (idx >= 0 && pool_index(server, ciaddr) == idx) {
+                server->leases[idx].state = DHCP_LEASE_EXPIRED;
+                server->leases[idx].expires_s = now_s;
+            }
+            st->releases++;
+            return 0;
+
+        default:
+            st->ignored++;
+            return 0;
+    }
+
+    if (type == DHCP_NAK) {
+        st->naks++;
+    } else {
+        info->yiaddr = server->cfg.pool_start + idx;
+        st->offers += (type == DHCP_OFFER);
+        st->acks += (type == DHCP_ACK);
+    }
+    info->type = type;
+    return build(server, msg, type, info->yiaddr, rapid, reply);
+}
+
+
+/**
+ * @brief Clears the counters.
+ */
+void dhcp_proto_reset_stats(dhcp_proto_server_t *server)
+{
+    memset(&server->stats, 0, sizeof(server->stats));
+}
+
+
+/**
+ * @brief Returns the name of a lease state.
+ */
+const char *dhcp_lease_state_name(uint8_t state)
+{
+    switch (state) {
+        case DHCP_LEASE_FREE:       return "free";
+        case DHCP_LEASE_OFFERED:    return "offered";
+        case DHCP_LEASE_BOUND:      return "bound";
+        case DHCP_LEASE_EXPIRED:    return "expired";
+        case DHCP_LEASE_DECLINED:   return "declined";
+        default:                    return "unknown";
+    }
+}
+
+
+/**
+ * @brief Returns the name of a message type.
+ */
+const char *dhcp_msg_name(uint8_t type)
+{
+    switch (type) {
+        case DHCP_DISCOVER: return "discover";
+        case DHCP_OFFER:    return "offer";
+        case DHCP_REQUEST:  return "request";
+        case DHCP_DECLINE:  return "decline";
+        case DHCP_ACK:      return "ack";
+        case DHCP_NAK:      return "nak";
+        case DHCP_RELEASE:  return "release";
+        case DHCP_INFORM:   return "inform";
+        default:            return "unknown";
+    }
+}
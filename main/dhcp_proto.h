@@ -0,0 +1,138 @@
+/*
+ * dhcp_proto.h
+ *
+ * DHCP server core for the softAP (RFC 2131), tuned for the time from
+ * association to the lease:
+ *
+ *  - Rapid commit (RFC 4039): a DISCOVER carrying option 80 is answered
+ *    with the ACK straight away, saving the OFFER/REQUEST round trip.
+ *  - Sticky addresses: each pool address remembers the last client it was
+ *    leased to, and is only given to another client once no unused or
+ *    older address is left. A returning client gets its previous address
+ *    back, and its INIT-REBOOT REQUEST is ACKed instead of NAKed.
+ *  - The lease table is supplied by the caller, so it can be kept in
+ *    memory that survives a restart (e.g. after an OTA update).
+ *
+ * Each exchange is timed from the first DISCOVER (or the REQUEST) to the
+ * ACK. Addresses are in host order, e.g. 0xC0A80401 for 192.168.4.1.
+ *
+ * This module has no ESP-IDF dependencies so the server can be exercised on
+ * a Linux host (see tools/host).
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef DHCP_PROTO_H
+#define DHCP_PROTO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DHCP_SERVER_PORT        67
+#define DHCP_CLIENT_PORT        68
+#define DHCP_MIN_MSG_LEN        240                         // Fixed fields and magic cookie
+#define DHCP_REPLY_LEN          300                         // Length of every reply, the BOOTP minimum
+
+// Message types (option 53)
+#define DHCP_DISCOVER           1
+#define DHCP_OFFER              2
+#define DHCP_REQUEST            3
+#define DHCP_DECLINE            4
+#define DHCP_ACK                5
+#define DHCP_NAK                6
+#define DHCP_RELEASE            7
+#define DHCP_INFORM             8
+
+
+// State of a pool address
+typedef enum {
+    DHCP_LEASE_FREE = 0,                    // Never leased, or declined long enough ago
+    DHCP_LEASE_OFFERED,                     // Offered, waiting for the REQUEST
+    DHCP_LEASE_BOUND,                       // Leased
+    DHCP_LEASE_EXPIRED,                     // Lease over, kept for the same client while possible
+    DHCP_LEASE_DECLINED,                    // In use by someone else, held back for a while
+} dhcp_lease_state_t;
+
+
+// One pool address, the table index is its offset from the pool start
+typedef struct {
+    uint8_t     mac[6];
+    uint8_t     state;                      // dhcp_lease_state_t
+    uint8_t     bound_before;               // Leased to this client in an earlier exchange
+    uint32_t    expires_s;                  // Seconds on the caller's clock
+    int64_t     started_us;                 // Start of the exchange in progress
+} dhcp_lease_t;
+
+
+// Server configuration
+typedef struct {
+    uint32_t    server_ip;                  // Also offered as router and DNS server
+    uint32_t    netmask;
+    uint32_t    pool_start;
+    uint32_t    pool_size;                  // Entries in the lease table
+    uint32_t    lease_s;
+    bool        rapid_commit;
+} dhcp_proto_config_t;
+
+
+// Counters
+typedef struct {
+    uint32_t    received;                   // Messages handled
+    uint32_t    ignored;                    // Malformed, relayed or not for this server
+    uint32_t    discovers;
+    uint32_t    requests;
+    uint32_t    offers;
+    uint32_t    acks;
+    uint32_t    naks;
+    uint32_t    rapid_commits;              // ACKs sent for a DISCOVER
+    uint32_t    returning;                  // ACKs giving a client the address it had before
+    uint32_t    renewals;                   // ACKs extending a bound lease
+    uint32_t    declines;
+    uint32_t    releases;
+    uint32_t    exhausted;                  // DISCOVERs left unanswered, no address free
+    uint32_t    exchanges;                  // ACKs ending a DISCOVER or INIT-REBOOT exchange
+    uint64_t    exchange_us;                // Total time of those exchanges
+    uint32_t    exchange_max_us;
+} dhcp_proto_stats_t;
+
+
+// Server state
+typedef struct {
+    dhcp_proto_config_t cfg;
+    dhcp_lease_t        *leases;            // cfg.pool_size entries, owned by the caller
+    dhcp_proto_stats_t  stats;
+} dhcp_proto_server_t;
+
+
+// What to do with a reply built by dhcp_proto_handle()
+typedef struct {
+    uint8_t     type;                       // DHCP_OFFER, DHCP_ACK or DHCP_NAK
+    bool        broadcast;                  // Send to 255.255.255.255, else unicast to dest_ip
+    uint32_t    dest_ip;
+    uint32_t    yiaddr;                     // Address offered or leased
+    uint8_t     mac[6];
+    bool        bound;                      // An ACK that starts a lease (not a renewal)
+    uint32_t    exchange_us;                // Time of the exchange ended by this ACK, 0 if none
+} dhcp_proto_reply_t;
+
+
+// Functions
+void        dhcp_proto_init(dhcp_proto_server_t *server, const dhcp_proto_config_t *cfg, dhcp_lease_t *leases,
+                            bool restore);
+size_t      dhcp_proto_handle(dhcp_proto_server_t *server, const uint8_t *msg, size_t len, int64_t now_us,
+                              uint8_t *reply, size_t reply_max, dhcp_proto_reply_t *info);
+void        dhcp_proto_reset_stats(dhcp_proto_server_t *server);
+const char *dhcp_lease_state_name(uint8_t state);
+const char *dhcp_msg_name(uint8_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
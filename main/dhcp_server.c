@@ -0,0 +1,331 @@
+/*
+ * dhcp_server.c
+ *
+ * This file connects the DHCP server core (dhcp_proto.c) to the softAP.
+ * The AP netif is created without the esp_netif DHCP server, and a raw
+ * lwIP UDP pcb on port 67 takes its place, so messages are handled in the
+ * lwIP task like the built-in server's: no task or socket of its own.
+ * Replies go out on the AP interface, broadcast unless the client already
+ * has its address.
+ *
+ * The lease table lives in RTC memory and is taken over after a software
+ * reset, so the phones that rejoin once an update has booted get their
+ * addresses back straight away.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_netif_net_stack.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "sdkconfig.h"
+#include "trace.h"
+#include "dhcp_server.h"
+
+
+#define LEASE_S             (CONFIG_DHCP_LEASE_MINUTES * 60)
+
+#if CONFIG_DHCP_FAST_SERVER
+
+#define POOL_SIZE           CONFIG_DHCP_POOL_SIZE
+#define RX_MAX              576             // Largest message a client may send unasked (RFC 2131)
+#define SAVED_MAGIC         0x44484331      // "DHC1"
+#ifdef CONFIG_DHCP_RAPID_COMMIT
+    #define RAPID_COMMIT    true
+#else
+    #define RAPID_COMMIT    false
+#endif
+#ifdef CONFIG_DHCP_KEEP_LEASES
+    #define KEEP_LEASES     true
+#else
+    #define KEEP_LEASES     false
+#endif
+
+
+// Lease table kept across a software reset
+typedef struct {
+    uint32_t        magic;
+    uint32_t        pool_start;
+    uint32_t        pool_size;
+    dhcp_lease_t    leases[POOL_SIZE];
+} saved_leases_t;
+
+
+// Local variables
+static const char               *TAG = "dhcp_server";
+static RTC_NOINIT_ATTR saved_leases_t saved;
+static dhcp_proto_server_t      server;
+static esp_netif_t              *ap_netif;
+static struct udp_pcb           *pcb;
+static bool                     restored;
+static uint8_t                  rx_buf[RX_MAX];
+static portMUX_TYPE             s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+/**
+ * @brief Handles a DHCP message from a client. Runs in the lwIP task.
+ */
+static void dhcp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    static uint8_t reply[DHCP_REPLY_LEN];
+    struct netif *netif = esp_netif_get_netif_impl(ap_netif);
+
+    if (ip_current_input_netif() != netif) {
+        pbuf_free(p);
+        return;
+    }
+    size_t len = pbuf_copy_partial(p, rx_buf, sizeof(rx_buf), 0);
+    pbuf_free(p);
+
+    dhcp_proto_reply_t info;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    size_t n = dhcp_proto_handle(&server, rx_buf, len, now, reply, sizeof(reply), &info);
+    portEXIT_CRITICAL(&s_lock);
+    if (n == 0) {
+        return;
+    }
+
+    struct pbuf *q = pbuf_alloc(PBUF_TRANSPORT, n, PBUF_RAM);
+    if (q == NULL) {
+        return;
+    }
+    pbuf_take(q, reply, n);
+    ip_addr_t dest;
+    if (info.broadcast) {
+        ip_addr_set_ip4_u32(&dest, IPADDR_BROADCAST);
+    } else {
+        ip_addr_set_ip4_u32(&dest, lwip_htonl(info.dest_ip));
+    }
+    udp_sendto_if(upcb, q, &dest, DHCP_CLIENT_PORT, netif);
+    pbuf_free(q);
+
+    trace_span(TRACE_DHCP, now - info.exchange_us, info.exchange_us, info.type, 0);
+    if (info.bound) {
+        // Tell the rest of the firmware, as the built-in server would
+        ip_event_ap_staipassigned_t evt = {
+            .esp_netif = ap_netif,
+            .ip.addr = lwip_htonl(info.yiaddr),
+        };
+        memcpy(evt.mac, info.mac, 6);
+        esp_event_post(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, &evt, sizeof(evt), 0);
+        ESP_LOGI(TAG, MACSTR " leased " IPSTR " in %lu us", MAC2STR(info.mac), IP2STR(&evt.ip),
+                 (unsigned long)info.exchange_us);
+    }
+}
+
+
+/**
+ * @brief Sets up the server and its pcb. Runs in the lwIP task.
+ */
+static esp_err_t start_in_lwip(void *ctx)
+{
+    esp_netif_ip_info_t ip_info;
+    ESP_ERROR_CHECK(esp_netif_get_ip_info(ap_netif, &ip_info));
+
+    const dhcp_proto_config_t cfg = {
+        .server_ip = lwip_ntohl(ip_info.ip.addr),
+        .netmask = lwip_ntohl(ip_info.netmask.addr),
+        .pool_start = lwip_ntohl(ip_info.ip.addr) + 1,
+        .pool_size = POOL_SIZE,
+        .lease_s = LEASE_S,
+        .rapid_commit = RAPID_COMMIT,
+    };
+    restored = KEEP_LEASES && saved.magic == SAVED_MAGIC &&
+               esp_reset_reason() == ESP_RST_SW && saved.pool_start == cfg.pool_start &&
+               saved.pool_size == cfg.pool_size;
+    dhcp_proto_init(&server, &cfg, saved.leases, restored);
+    saved.magic = SAVED_MAGIC;
+    saved.pool_start = cfg.pool_start;
+    saved.pool_size = cfg.pool_size;
+
+    pcb = udp_new();
+    if (pcb == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ip_set_option(pcb, SOF_BROADCAST);
+    if (udp_bind(pcb, IP4_ADDR_ANY, DHCP_SERVER_PORT) != ERR_OK) {
+        udp_remove(pcb);
+        pcb = NULL;
+        return ESP_FAIL;
+    }
+    udp_recv(pcb, dhcp_recv, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Starts serving leases once the AP is up.
+ */
+static void ap_started(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    if (pcb != NULL) {
+        return;
+    }
+    esp_err_t err = esp_netif_tcpip_exec(start_in_lwip, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start: %s", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "Serving %d addresses, lease %d min, rapid commit %s%s", POOL_SIZE, CONFIG_DHCP_LEASE_MINUTES,
+             RAPID_COMMIT ? "on" : "off", restored ? ", leases kept from the previous boot" : "");
+}
+
+
+/**
+ * @brief Creates the softAP netif, served by the fast DHCP server.
+ *
+ * @return The netif, as esp_netif_create_default_wifi_ap() would.
+ */
+esp_netif_t *dhcp_server_create_netif(void)
+{
+    esp_netif_inherent_config_t base = ESP_NETIF_INHERENT_DEFAULT_WIFI_AP();
+    base.flags &= ~ESP_NETIF_DHCP_SERVER;
+    ap_netif = esp_netif_create_wifi(WIFI_IF_AP, &base);
+    ESP_ERROR_CHECK(esp_wifi_set_default_wifi_ap_handlers());
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_START, ap_started, NULL));
+    return ap_netif;
+}
+
+
+/**
+ * @brief Returns the server counters.
+ *
+ * @return false if the built-in server is in use.
+ */
+bool dhcp_server_get_stats(dhcp_proto_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = server.stats;
+    portEXIT_CRITICAL(&s_lock);
+    return true;
+}
+
+
+/**
+ * @brief Handler for the 'dhcp' console command.
+ */
+static int dhcp_cmd(int argc, char **argv)
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0) {
+            printf("dhcp: expected 'reset'\n");
+            return 1;
+        }
+        portENTER_CRITICAL(&s_lock);
+        dhcp_proto_reset_stats(&server);
+        portEXIT_CRITICAL(&s_lock);
+    }
+
+    dhcp_proto_stats_t s;
+    dhcp_lease_t leases[POOL_SIZE];
+    portENTER_CRITICAL(&s_lock);
+    s = server.stats;
+    memcpy(leases, saved.leases, sizeof(leases));
+    portEXIT_CRITICAL(&s_lock);
+
+    printf("Fast server, %d addresses, lease %d min, rapid commit %s\n", POOL_SIZE, CONFIG_DHCP_LEASE_MINUTES,
+           RAPID_COMMIT ? "on" : "off");
+    printf("%lu messages, %lu ignored: %lu discover, %lu request, %lu decline, %lu release\n",
+           (unsigned long)s.received, (unsigned long)s.ignored, (unsigned long)s.discovers,
+           (unsigned long)s.requests, (unsigned long)s.declines, (unsigned long)s.releases);
+    printf("Sent %lu offer, %lu ack, %lu nak; %lu rapid commit, %lu returning, %lu renewal, %lu unanswered (pool full)\n",
+           (unsigned long)s.offers, (unsigned long)s.acks, (unsigned long)s.naks, (unsigned long)s.rapid_commits,
+           (unsigned long)s.returning, (unsigned long)s.renewals, (unsigned long)s.exhausted);
+    printf("%lu exchanges, mean %lu us, max %lu us\n", (unsigned long)s.exchanges,
+           s.exchanges ? (unsigned long)(s.exchange_us / s.exchanges) : 0UL, (unsigned long)s.exchange_max_us);
+
+    int64_t now_s = esp_timer_get_time() / 1000000;
+    printf("\n%-15s %-17s %-9s %s\n", "address", "station", "state", "expires");
+    for (int i = 0; i < POOL_SIZE; i++) {
+        const dhcp_lease_t *l = &leases[i];
+        if (l->state == DHCP_LEASE_FREE) {
+            continue;
+        }
+        esp_ip4_addr_t ip = { .addr = lwip_htonl(server.cfg.pool_start + i) };
+        char addr[16];
+        snprintf(addr, sizeof(addr), IPSTR, IP2STR(&ip));
+        printf("%-15s " MACSTR " %-9s", addr, MAC2STR(l->mac), dhcp_lease_state_name(l->state));
+        if (l->state == DHCP_LEASE_EXPIRED) {
+            printf(" -\n");
+        } else {
+            printf(" %lld s\n", (long long)((int32_t)(l->expires_s - (uint32_t)now_s)));
+        }
+    }
+    return 0;
+}
+
+#else
+
+// Local variables
+static const char   *TAG = "dhcp_server";
+
+
+/**
+ * @brief Creates the softAP netif with the esp_netif DHCP server, set to
+ *        the configured lease time.
+ */
+esp_netif_t *dhcp_server_create_netif(void)
+{
+    esp_netif_t *netif = esp_netif_create_default_wifi_ap();
+    uint32_t lease = LEASE_S / CONFIG_LWIP_DHCPS_LEASE_UNIT;
+    esp_netif_dhcps_stop(netif);
+    if (esp_netif_dhcps_option(netif, ESP_NETIF_OP_SET, ESP_NETIF_IP_ADDRESS_LEASE_TIME, &lease,
+                               sizeof(lease)) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to set the lease time");
+    }
+    esp_netif_dhcps_start(netif);
+    return netif;
+}
+
+
+/**
+ * @brief Returns the server counters.
+ *
+ * @return false if the built-in server is in use.
+ */
+bool dhcp_server_get_stats(dhcp_proto_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    return false;
+}
+
+
+/**
+ * @brief Handler for the 'dhcp' console command.
+ */
+static int dhcp_cmd(int argc, char **argv)
+{
+    printf("Built-in esp_netif server, lease %d min; enable CONFIG_DHCP_FAST_SERVER for counters\n",
+           CONFIG_DHCP_LEASE_MINUTES);
+    return 0;
+}
+
+#endif
+
+
+/**
+ * @brief Registers the 'dhcp' console command.
+ */
+void register_dhcp_server(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "dhcp",
+        .help = "Show DHCP server counters, exchange times and leases, optionally clear the counters",
+        .hint = "[reset]",
+        .func = &dhcp_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,35 @@
+/*
+ * dhcp_server.h
+ *
+ * DHCP for the softAP. With CONFIG_DHCP_FAST_SERVER the leases are handed
+ * out by the server in dhcp_proto.c instead of the one built into
+ * esp_netif, for rapid commit and sticky addresses that survive the
+ * reboot at the end of an OTA update. Either way the lease time comes from
+ * the "DHCP server" menu, and every lease is announced with
+ * IP_EVENT_AP_STAIPASSIGNED.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef DHCP_SERVER_H
+#define DHCP_SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "esp_netif.h"
+#include "dhcp_proto.h"
+
+
+// Functions
+esp_netif_t    *dhcp_server_create_netif(void);
+bool            dhcp_server_get_stats(dhcp_proto_stats_t *stats);
+void            register_dhcp_server(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * fast_packet.c
+ *
+ * This file reassembles fast-packet messages in the fixed pool described
+ * in fast_packet.h. Each context is on two lists: the chain of its hash
+ * bucket, for finding it from a frame, and the list ordered by the time
+ * of its last frame, for timeouts and eviction. Free contexts are chained
+ * through the same link as the buckets. Every operation touches a bounded
+ * number of contexts; only a bucket chain is walked, and with 32 buckets
+ * and a pool of a few contexts it is rarely longer than one.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "fast_packet.h"
+
+
+/**
+ * @brief Packs the source, PGN and sequence ID of a message into 29 bits.
+ */
+static uint32_t make_key(uint8_t source, uint32_t pgn, uint8_t seq)
+{
+    return ((uint32_t)source << 21) | ((pgn & 0x3FFFF) << 3) | (seq & 0x07);
+}
+
+
+static unsigned bucket_of(uint32_t key)
+{
+    return (key * 0x9E3779B1u) >> 27;       // Top 5 bits, FAST_PACKET_BUCKETS
+}
+
+
+/**
+ * @brief Returns the context of a message in progress, FAST_PACKET_NONE if
+ *        there is none.
+ */
+static uint8_t find(const fast_packet_pool_t *pool, uint32_t key)
+{
+    uint8_t i = pool->buckets[bucket_of(key)];
+    while (i != FAST_PACKET_NONE && pool->ctx[i].key != key) {
+        i = pool->ctx[i].chain;
+    }
+    return i;
+}
+
+
+/**
+ * @brief Makes a context the newest on the age list.
+ */
+static void touch(fast_packet_pool_t *pool, uint8_t i, uint32_t now_ms)
+{
+    fast_packet_ctx_t *c = &pool->ctx[i];
+    c->updated_ms = now_ms;
+    if (pool->newest == i) {
+        return;
+    }
+    // Unlink, if linked
+    if (c->older != FAST_PACKET_NONE) {
+        pool->ctx[c->older].newer = c->newer;
+    } else if (pool->oldest == i) {
+        pool->oldest = c->newer;
+    }
+    if (c->newer != FAST_PACKET_NONE) {
+        pool->ctx[c->newer].older = c->older;
+    }
+    // Append
+    c->older = pool->newest;
+    c->newer = FAST_PACKET_NONE;
+    if (pool->newest != FAST_PACKET_NONE) {
+        pool->ctx[pool->newest].newer = i;
+    }
+    pool->newest = i;
+    if (pool->oldest == FAST_PACKET_NONE) {
+        pool->oldest = i;
+    }
+}
+
+
+/**
+ * @brief Takes a context off both lists and puts it on the free list. Its
+ *        data stays as it is until the context is taken again.
+ */
+static void release(fast_packet_pool_t *pool, uint8_t i)
+{
+    fast_packet_ctx_t *c = &pool->ctx[i];
+
+    uint8_t *link = &pool->buckets[bucket_of(c->key)];
+    while (*link != i) {
+        link = &pool->ctx[*link].chain;
+    }
+    *link = c->chain;
+
+    if (c->older != FAST_PACKET_NONE) {
+        pool->ctx[c->older].newer = c->newer;
+    } else {
+        pool->oldest = c->newer;
+    }
+    if (c->newer != FAST_PACKET_NONE) {
+        pool->ctx[c->newer].older = c->older;
+    } else {
+        pool->newest = c->older;
+    }
+
+    c->chain = pool->free_list;
+    pool->free_list = i;
+    pool->in_use--;
+}
+
+
+/**
+ * @brief Takes a free context for a new message, giving up the one that
+ *        has waited longest for a frame if none is free.
+ */
+static uint8_t acquire(fast_packet_pool_t *pool, uint32_t key, uint32_t now_ms)
+{
+    if (pool->free_list == FAST_PACKET_NONE) {
+        pool->stats.evicted++;
+        release(pool, pool->oldest);
+    }
+    uint8_t i = pool->free_list;
+    fast_packet_ctx_t *c = &pool->ctx[i];
+    pool->free_list = c->chain;
+
+    unsigned b = bucket_of(key);
+    c->key = key;
+    c->chain = pool->buckets[b];
+    pool->buckets[b] = i;
+    c->older = c->newer = FAST_PACKET_NONE;
+    touch(pool, i, now_ms);
+
+    pool->in_use++;
+    if ((uint32_t)pool->in_use > pool->stats.in_use_max) {
+        pool->stats.in_use_max = pool->in_use;
+    }
+    return i;
+}
+
+
+/**
+ * @brief Sets up a pool.
+ *
+ * @param pool      The pool.
+ * @param contexts  Storage for the contexts.
+ * @param count     Number of contexts, 1 to 254.
+ */
+void fast_packet_init(fast_packet_pool_t *pool, fast_packet_ctx_t *contexts, int count)
+{
+    memset(pool, 0, sizeof(*pool));
+    memset(contexts, 0, count * sizeof(*contexts));
+    memset(pool->buckets, FAST_PACKET_NONE, sizeof(pool->buckets));
+    pool->ctx = contexts;
+    pool->count = (count > 254) ? 254 : count;
+    pool->oldest = pool->newest = FAST_PACKET_NONE;
+    pool->free_list = FAST_PACKET_NONE;
+    for (int i = pool->count - 1; i >= 0; i--) {
+        contexts[i].chain = pool->free_list;
+        pool->free_list = i;
+    }
+}
+
+
+/**
+ * @brief Adds a frame of a fast-packet PGN.
+ *
+ * @param pool  The pool.
+ * @param msg   The frame.
+ * @param len   Set to the message length when it completes.
+ *
+ * @return The message once its last frame is in, else NULL. The data stays
+ *         valid until the next call.
+ */
+const uint8_t *fast_packet_add(fast_packet_pool_t *pool, const n2k_msg_t *msg, uint8_t *len)
+{
+    pool->stats.frames++;
+    if (msg->len < 2) {
+        pool->stats.bad_length++;
+        return NULL;
+    }
+    uint8_t counter = msg->data[0] & 0x1F;
+    uint32_t key = make_key(msg->source, msg->pgn, msg->data[0] >> 5);
+    uint8_t i = find(pool, key);
+    fast_packet_ctx_t *c;
+    size_t n;
+
+    if (counter == 0) {
+        if (i != FAST_PACKET_NONE) {
+            pool->stats.restarted++;
+            release(pool, i);
+        }
+        uint8_t total = msg->data[1];
+        if (total == 0 || total > FAST_PACKET_MAX_LEN) {
+            pool->stats.bad_length++;
+            return NULL;
+        }
+        i = acquire(pool, key, msg->time_ms);
+        c = &pool->ctx[i];
+        c->len = total;
+        c->received = 0;
+        c->next_frame = 1;
+        n = msg->len - 2;
+        n = (n > 6) ? 6 : n;
+        n = (n > total) ? total : n;
+        memcpy(c->data, &msg->data[2], n);
+    } else {
+        if (i == FAST_PACKET_NONE) {
+            pool->stats.orphans++;
+            return NULL;
+        }
+        c = &pool->ctx[i];
+        if (counter != c->next_frame) {
+            pool->stats.out_of_order++;
+            release(pool, i);
+            return NULL;
+        }
+        touch(pool, i, msg->time_ms);
+        c->next_frame++;
+        n = msg->len - 1;
+        n = (n > 7) ? 7 : n;
+        n = (n > (size_t)(c->len - c->received)) ? (size_t)(c->len - c->received) : n;
+        memcpy(&c->data[c->received], &msg->data[1], n);
+    }
+
+    c->received += n;
+    if (c->received < c->len) {
+        return NULL;
+    }
+    pool->stats.completed++;
+    release(pool, i);
+    *len = c->len;
+    return c->data;
+}
+
+
+/**
+ * @brief Drops the messages that have had no frame for
+ *        FAST_PACKET_TIMEOUT_MS. Call now and then, e.g. once per batch.
+ */
+void fast_packet_expire(fast_packet_pool_t *pool, uint32_t now_ms)
+{
+    while (pool->oldest != FAST_PACKET_NONE &&
+           (int32_t)(now_ms - pool->ctx[pool->oldest].updated_ms) > FAST_PACKET_TIMEOUT_MS) {
+        pool->stats.timeouts++;
+        release(pool, pool->oldest);
+    }
+}
+
+
+/**
+ * @brief Clears the counters.
+ */
+void fast_packet_reset_stats(fast_packet_pool_t *pool)
+{
+    memset(&pool->stats, 0, sizeof(pool->stats));
+    pool->stats.in_use_max = pool->in_use;
+}
@@ -0,0 +1,91 @@
+/*
+ * fast_packet.h
+ *
+ * NMEA 2000 fast-packet reassembly. A fast-packet PGN carries up to 223
+ * bytes in up to 32 frames: the first holds a 3-bit sequence ID, frame
+ * counter 0, the total length and 6 bytes, each following one the same
+ * sequence ID, the next counter and 7 bytes.
+ *
+ * Messages in progress live in a fixed pool of contexts supplied by the
+ * caller, so a busy bus never allocates. A context is found from the
+ * source, PGN and sequence ID through a small hash table, and contexts are
+ * kept in the order they last got a frame, so the stalest is the one
+ * checked for timeout and the one given up when the pool is full. Every
+ * message lost is counted by reason.
+ *
+ * This module has no ESP-IDF dependencies so it can be exercised on a
+ * Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef FAST_PACKET_H
+#define FAST_PACKET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "n2k_frame.h"
+
+#define FAST_PACKET_MAX_LEN     223
+#define FAST_PACKET_TIMEOUT_MS  750         // Longest gap between frames of a message
+#define FAST_PACKET_BUCKETS     32          // Hash table size, power of two
+#define FAST_PACKET_NONE        0xFF        // Index of no context
+
+
+// A message being reassembled
+typedef struct {
+    uint32_t    key;                        // Source, PGN and sequence ID, see make_key()
+    uint32_t    updated_ms;                 // Time of its last frame
+    uint8_t     len;                        // Total length
+    uint8_t     received;                   // Bytes so far
+    uint8_t     next_frame;                 // Frame counter expected next
+    uint8_t     chain;                      // Next context in the same bucket
+    uint8_t     older;                      // Neighbours in the order of their last frame
+    uint8_t     newer;
+    uint8_t     data[FAST_PACKET_MAX_LEN];
+} fast_packet_ctx_t;
+
+
+// Counters
+typedef struct {
+    uint32_t    frames;
+    uint32_t    completed;
+    uint32_t    timeouts;                   // Dropped, no frame for FAST_PACKET_TIMEOUT_MS
+    uint32_t    evicted;                    // Dropped, the pool was full
+    uint32_t    out_of_order;               // Dropped, a frame was missed or repeated
+    uint32_t    restarted;                  // Dropped, a new message with the same key began
+    uint32_t    orphans;                    // Frames of no message in progress
+    uint32_t    bad_length;                 // Frames under 2 bytes, first frames with a length of 0 or over 223
+    uint32_t    in_use_max;
+} fast_packet_stats_t;
+
+
+// Reassembly engine
+typedef struct {
+    fast_packet_ctx_t   *ctx;
+    int                 count;              // Contexts, up to 254
+    int                 in_use;
+    uint8_t             buckets[FAST_PACKET_BUCKETS];
+    uint8_t             oldest;
+    uint8_t             newest;
+    uint8_t             free_list;          // Chained through chain
+    fast_packet_stats_t stats;
+} fast_packet_pool_t;
+
+
+// Functions
+void            fast_packet_init(fast_packet_pool_t *pool, fast_packet_ctx_t *contexts, int count);
+const uint8_t  *fast_packet_add(fast_packet_pool_t *pool, const n2k_msg_t *msg, uint8_t *len);
+void            fast_packet_expire(fast_packet_pool_t *pool, uint32_t now_ms);
+void            fast_packet_reset_stats(fast_packet_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
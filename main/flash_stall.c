@@ -0,0 +1,319 @@
+/*
+ * flash_stall.c
+ *
+ * This file implements flash stall accounting. The SPI flash driver brackets
+ * every erase and write with spi_flash_disable_interrupts_caches_and_other_cpu()
+ * and spi_flash_enable_interrupts_caches_and_other_cpu(). With
+ * CONFIG_FLASH_STALL_TRACE the linker wraps both (see CMakeLists.txt), so
+ * each cache-disabled window is timed from just before the other CPU is
+ * stopped until the cache is back on.
+ *
+ * The cause is taken from the operation tag of the calling task, set with
+ * flash_stall_op_begin() around the OTA and NVS calls. Tags are kept per
+ * task because an NVS commit on one task can overlap an OTA on another.
+ *
+ * The wrappers run while the cache is off, so they and everything they
+ * touch live in IRAM and DRAM.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "trace.h"
+#include "flash_stall.h"
+
+
+#define OP_SLOTS            4               // Tasks that can hold an operation tag at once
+#define RECENT_WINDOWS      16              // Windows listed by the console command
+
+
+// Operation tag of one task
+typedef struct {
+    TaskHandle_t    task;
+    flash_op_t      op;
+} op_slot_t;
+
+
+// Local variables
+static DRAM_ATTR op_slot_t              op_slots[OP_SLOTS];
+static DRAM_ATTR flash_stall_stats_t    stats[FLASH_OP_COUNT];
+static DRAM_ATTR uint32_t               histogram[FLASH_STALL_BUCKETS];
+static DRAM_ATTR uint64_t               total_us;
+static DRAM_ATTR int64_t                window_start;
+static DRAM_ATTR flash_op_t             window_op;
+static portMUX_TYPE                     s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+// Local function prototypes
+void __real_spi_flash_disable_interrupts_caches_and_other_cpu(void);
+void __real_spi_flash_enable_interrupts_caches_and_other_cpu(void);
+
+
+/**
+ * @brief Tags the flash operations of the calling task, so the windows
+ *        they cause are attributed to op. Tags nest.
+ *
+ * @param op Operation about to start.
+ *
+ * @return The previous tag, to be passed to flash_stall_op_end().
+ */
+flash_op_t flash_stall_op_begin(flash_op_t op)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    flash_op_t previous = FLASH_OP_OTHER;
+    op_slot_t *slot = NULL;
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < OP_SLOTS; i++) {
+        if (op_slots[i].task == self) {
+            slot = &op_slots[i];
+            previous = slot->op;
+            break;
+        }
+        if (op_slots[i].task == NULL && slot == NULL) {
+            slot = &op_slots[i];
+        }
+    }
+    // With all slots taken the operation stays untagged
+    if (slot != NULL) {
+        slot->task = self;
+        slot->op = op;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return previous;
+}
+
+
+/**
+ * @brief Restores the tag returned by flash_stall_op_begin().
+ */
+void flash_stall_op_end(flash_op_t previous)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < OP_SLOTS; i++) {
+        if (op_slots[i].task == self) {
+            op_slots[i].op = previous;
+            if (previous == FLASH_OP_OTHER) {
+                op_slots[i].task = NULL;
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+#if CONFIG_FLASH_STALL_TRACE
+/**
+ * @brief Returns the tag of the calling task.
+ */
+static IRAM_ATTR flash_op_t current_op(void)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < OP_SLOTS; i++) {
+        if (op_slots[i].task == self) {
+            return op_slots[i].op;
+        }
+    }
+    return FLASH_OP_OTHER;
+}
+
+
+/**
+ * @brief Starts timing a cache-disabled window.
+ */
+void IRAM_ATTR __wrap_spi_flash_disable_interrupts_caches_and_other_cpu(void)
+{
+    flash_op_t op = current_op();
+    int64_t start = esp_timer_get_time();
+    __real_spi_flash_disable_interrupts_caches_and_other_cpu();
+
+    // Set only now, the driver serializes the windows
+    window_op = op;
+    window_start = start;
+}
+
+
+/**
+ * @brief Ends timing a cache-disabled window and records it.
+ */
+void IRAM_ATTR __wrap_spi_flash_enable_interrupts_caches_and_other_cpu(void)
+{
+    flash_op_t op = window_op;
+    int64_t start = window_start;
+    __real_spi_flash_enable_interrupts_caches_and_other_cpu();
+    uint32_t dur = esp_timer_get_time() - start;
+
+    int bucket = 0;
+    while (bucket < FLASH_STALL_BUCKETS - 1 && dur >= (16u << bucket)) {
+        bucket++;
+    }
+
+    portENTER_CRITICAL_SAFE(&s_lock);
+    stats[op].count++;
+    stats[op].total_us += dur;
+    if (dur > stats[op].max_us) {
+        stats[op].max_us = dur;
+    }
+    histogram[bucket]++;
+    total_us += dur;
+    portEXIT_CRITICAL_SAFE(&s_lock);
+
+    trace_span(TRACE_FLASH, start, dur, op, dur);
+}
+#endif
+
+
+/**
+ * @brief Returns the totals of one operation.
+ */
+void flash_stall_get_stats(flash_op_t op, flash_stall_stats_t *out)
+{
+    portENTER_CRITICAL(&s_lock);
+    *out = stats[op];
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Returns the window duration histogram, see flash_stall_bucket_limit_us().
+ */
+void flash_stall_get_histogram(uint32_t out[FLASH_STALL_BUCKETS])
+{
+    portENTER_CRITICAL(&s_lock);
+    memcpy(out, histogram, sizeof(histogram));
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Returns the exclusive upper limit of a histogram bucket in us,
+ *        0 for the last bucket, which is unbounded.
+ */
+uint32_t flash_stall_bucket_limit_us(int bucket)
+{
+    return (bucket < FLASH_STALL_BUCKETS - 1) ? 16u << bucket : 0;
+}
+
+
+/**
+ * @brief Returns the time the cache has been disabled since start up or
+ *        the last reset. The difference over a request is the stall it saw.
+ */
+uint64_t flash_stall_total_us(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint64_t total = total_us;
+    portEXIT_CRITICAL(&s_lock);
+    return total;
+}
+
+
+/**
+ * @brief Clears the statistics and the histogram.
+ */
+void flash_stall_reset(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    memset(stats, 0, sizeof(stats));
+    memset(histogram, 0, sizeof(histogram));
+    total_us = 0;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Returns the name of an operation as used in the console and JSON.
+ */
+const char *flash_op_name(flash_op_t op)
+{
+    switch (op) {
+        case FLASH_OP_OTHER:        return "other";
+        case FLASH_OP_OTA_ERASE:    return "ota_erase";
+        case FLASH_OP_OTA_WRITE:    return "ota_write";
+        case FLASH_OP_OTA_FINISH:   return "ota_finish";
+        case FLASH_OP_NVS:          return "nvs";
+        default:                    return "unknown";
+    }
+}
+
+
+/**
+ * @brief Handler for the 'flash_stalls' console command.
+ */
+static int flash_stalls_cmd(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        flash_stall_reset();
+        return 0;
+    }
+#if !CONFIG_FLASH_STALL_TRACE
+    printf("Flash stall tracing is not enabled (CONFIG_FLASH_STALL_TRACE)\n");
+#endif
+
+    printf("%-10s %8s %12s %10s %10s\n", "operation", "windows", "total us", "mean us", "max us");
+    for (int i = 0; i < FLASH_OP_COUNT; i++) {
+        flash_stall_stats_t st;
+        flash_stall_get_stats(i, &st);
+        printf("%-10s %8lu %12llu %10lu %10lu\n", flash_op_name(i), (unsigned long)st.count,
+               (unsigned long long)st.total_us, st.count ? (unsigned long)(st.total_us / st.count) : 0UL,
+               (unsigned long)st.max_us);
+    }
+
+    uint32_t hist[FLASH_STALL_BUCKETS];
+    flash_stall_get_histogram(hist);
+    printf("\nWindow duration:\n");
+    for (int i = 0; i < FLASH_STALL_BUCKETS; i++) {
+        uint32_t limit = flash_stall_bucket_limit_us(i);
+        if (limit) {
+            printf("  < %6lu us %8lu\n", (unsigned long)limit, (unsigned long)hist[i]);
+        } else {
+            printf("  >=%6lu us %8lu\n", (unsigned long)flash_stall_bucket_limit_us(i - 1), (unsigned long)hist[i]);
+        }
+    }
+
+    // Most recent windows, from the trace ring
+    trace_event_t *events = malloc(CONFIG_TRACE_RING_SIZE * sizeof(trace_event_t));
+    if (events == NULL) {
+        return 1;
+    }
+    size_t count = trace_snapshot(events, CONFIG_TRACE_RING_SIZE);
+    int shown = 0;
+    int64_t now = esp_timer_get_time();
+    printf("\nRecent windows:\n");
+    for (size_t i = count; i-- > 0 && shown < RECENT_WINDOWS; ) {
+        if (events[i].kind == TRACE_FLASH) {
+            printf("  %8lld ms ago %-10s %6lu us\n", (now - events[i].start_us) / 1000,
+                   flash_op_name(events[i].detail), (unsigned long)events[i].dur_us);
+            shown++;
+        }
+    }
+    free(events);
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'flash_stalls' console command.
+ */
+void register_flash_stall(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "flash_stalls",
+        .help = "Show the flash cache-disabled windows by cause, their histogram and the latest ones",
+        .hint = "[reset]",
+        .func = &flash_stalls_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,62 @@
+/*
+ * flash_stall.h
+ *
+ * Flash stall accounting. Every flash erase and write (esp_ota_begin,
+ * esp_ota_write, nvs_commit, ...) runs with the flash cache disabled, which
+ * stalls both CPUs for anything not in IRAM. This module measures each of
+ * those windows, attributes it to the operation that caused it and keeps a
+ * duration histogram; each window is also recorded in the trace ring, see
+ * trace.h.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef FLASH_STALL_H
+#define FLASH_STALL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+#define FLASH_STALL_BUCKETS     12          // <16 us, <32 us, ... <16 ms, >= 16 ms
+
+
+// Operation a cache-disabled window is attributed to
+typedef enum {
+    FLASH_OP_OTHER = 0,                     // Untagged, e.g. a flash read or a component's own write
+    FLASH_OP_OTA_ERASE,                     // esp_ota_begin(): partition erase
+    FLASH_OP_OTA_WRITE,                     // esp_ota_write(): image data, including sector erases
+    FLASH_OP_OTA_FINISH,                    // esp_ota_end() and esp_ota_set_boot_partition()
+    FLASH_OP_NVS,                           // set_setting(): nvs_set_* and nvs_commit
+    FLASH_OP_COUNT
+} flash_op_t;
+
+
+// Per operation totals
+typedef struct {
+    uint32_t    count;                      // Cache-disabled windows
+    uint32_t    max_us;                     // Longest window
+    uint64_t    total_us;                   // Sum of all windows
+} flash_stall_stats_t;
+
+
+// Functions
+flash_op_t  flash_stall_op_begin(flash_op_t op);
+void        flash_stall_op_end(flash_op_t previous);
+void        flash_stall_get_stats(flash_op_t op, flash_stall_stats_t *stats);
+void        flash_stall_get_histogram(uint32_t histogram[FLASH_STALL_BUCKETS]);
+uint32_t    flash_stall_bucket_limit_us(int bucket);
+uint64_t    flash_stall_total_us(void);
+void        flash_stall_reset(void);
+const char *flash_op_name(flash_op_t op);
+void        register_flash_stall(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
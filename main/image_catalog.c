@@ -0,0 +1,424 @@
+/*
+ * image_catalog.c
+ *
+ * This file maintains the catalog of firmware images stored in the app
+ * partitions. The version and ELF hash come straight from each image's app
+ * descriptor; the whole-image SHA-256 and the install sequence number are
+ * kept in NVS so they only have to be computed once per image.
+ *
+ * New images are written to the OTA slot holding the oldest image, so the
+ * most recent releases stay available for an instant switch back.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_app_desc.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "settings.h"
+#include "ota_writer.h"
+#include "image_catalog.h"
+
+
+#define CATALOG_KEY_PREFIX  "cat_"
+#define CATALOG_SEQ_KEY     "cat_seq"
+
+
+// Per-image record persisted in NVS, keyed by partition label
+typedef struct {
+    uint32_t    seq;
+    uint8_t     elf_sha256[32];
+    uint8_t     image_sha256[32];
+} catalog_record_t;
+
+
+// Local function prototypes
+extern void request_reboot(void);
+
+
+// Local variables
+static const char               *TAG = "catalog";
+static image_catalog_entry_t    entries[IMAGE_CATALOG_MAX_SLOTS];
+static int                      num_entries;
+static SemaphoreHandle_t        catalog_mutex;
+
+
+/**
+ * @brief Builds the NVS key for a partition's catalog record.
+ */
+static void record_key(const esp_partition_t *partition, char *key, size_t size)
+{
+    snprintf(key, size, CATALOG_KEY_PREFIX "%s", partition->label);
+}
+
+
+/**
+ * @brief Returns true if the partition is one of the OTA slots.
+ */
+static bool is_ota_slot(const esp_partition_t *partition)
+{
+    return partition->subtype >= ESP_PARTITION_SUBTYPE_APP_OTA_MIN &&
+           partition->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_MAX;
+}
+
+
+/**
+ * @brief Returns true if both pointers refer to the same partition.
+ */
+static bool same_partition(const esp_partition_t *a, const esp_partition_t *b)
+{
+    return a && b && a->address == b->address;
+}
+
+
+/**
+ * @brief Re-reads the app descriptor of a slot and reconciles it with the
+ *        stored record. The image hash is only recomputed when the slot
+ *        contents changed since the record was written.
+ */
+static void refresh_entry(image_catalog_entry_t *entry)
+{
+    const esp_partition_t *partition = entry->partition;
+    memset(entry, 0, sizeof(*entry));
+    entry->partition = partition;
+
+    esp_app_desc_t desc;
+    if (esp_ota_get_partition_description(partition, &desc) != ESP_OK) {
+        return;
+    }
+    entry->valid = true;
+    strlcpy(entry->version, desc.version, sizeof(entry->version));
+    strlcpy(entry->date, desc.date, sizeof(entry->date));
+    memcpy(entry->elf_sha256, desc.app_elf_sha256, sizeof(entry->elf_sha256));
+
+    char key[16];
+    catalog_record_t record;
+    size_t size = sizeof(record);
+    record_key(partition, key, sizeof(key));
+    if (get_setting(key, &record, &size, false) == ESP_OK && size == sizeof(record) &&
+        memcmp(record.elf_sha256, desc.app_elf_sha256, sizeof(record.elf_sha256)) == 0) {
+        entry->seq = record.seq;
+        memcpy(entry->image_sha256, record.image_sha256, sizeof(entry->image_sha256));
+        return;
+    }
+
+    // Unknown image (e.g. flashed over USB), hash it once and remember it
+    ESP_LOGI(TAG, "Hashing image in %s", partition->label);
+    if (esp_partition_get_sha256(partition, entry->image_sha256) != ESP_OK) {
+        entry->valid = false;
+        return;
+    }
+    record.seq = 0;
+    memcpy(record.elf_sha256, entry->elf_sha256, sizeof(record.elf_sha256));
+    memcpy(record.image_sha256, entry->image_sha256, sizeof(record.image_sha256));
+    set_setting(key, &record, sizeof(record), false);
+}
+
+
+/**
+ * @brief Updates the running/boot flags of all entries.
+ */
+static void refresh_flags(void)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *boot = esp_ota_get_boot_partition();
+    for (int i = 0; i < num_entries; i++) {
+        entries[i].running = same_partition(entries[i].partition, running);
+        entries[i].boot = same_partition(entries[i].partition, boot);
+    }
+}
+
+
+/**
+ * @brief Scans all app partitions and builds the catalog.
+ *
+ * Must be called after settings_init(). Hashing an image that is not yet in
+ * the catalog takes a few hundred milliseconds per slot, later boots only
+ * read the app descriptors.
+ */
+void image_catalog_init(void)
+{
+    if (catalog_mutex == NULL) {
+#if CONFIG_STATIC_ALLOCATION
+        static StaticSemaphore_t catalog_mutex_buf;
+        catalog_mutex = xSemaphoreCreateMutexStatic(&catalog_mutex_buf);
+#else
+        catalog_mutex = xSemaphoreCreateMutex();
+#endif
+    }
+
+    xSemaphoreTake(catalog_mutex, portMAX_DELAY);
+    num_entries = 0;
+    esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+    while (it != NULL && num_entries < IMAGE_CATALOG_MAX_SLOTS) {
+        entries[num_entries].partition = esp_partition_get(it);
+        refresh_entry(&entries[num_entries]);
+        num_entries++;
+        it = esp_partition_next(it);
+    }
+    esp_partition_iterator_release(it);
+    refresh_flags();
+    xSemaphoreGive(catalog_mutex);
+
+    for (int i = 0; i < num_entries; i++) {
+        ESP_LOGI(TAG, "%-8s %-24s seq %-4lu %s%s", entries[i].partition->label,
+                 entries[i].valid ? entries[i].version : "(empty)", (unsigned long)entries[i].seq,
+                 entries[i].running ? "running " : "", entries[i].boot ? "boot" : "");
+    }
+}
+
+
+/**
+ * @brief Copies the catalog entries.
+ *
+ * @param entries_out Array receiving the entries.
+ * @param max_entries Size of the array.
+ *
+ * @return The number of entries copied.
+ */
+int image_catalog_list(image_catalog_entry_t *entries_out, int max_entries)
+{
+    if (catalog_mutex == NULL) {
+        return 0;
+    }
+    xSemaphoreTake(catalog_mutex, portMAX_DELAY);
+    int count = (num_entries < max_entries) ? num_entries : max_entries;
+    memcpy(entries_out, entries, count * sizeof(image_catalog_entry_t));
+    xSemaphoreGive(catalog_mutex);
+    return count;
+}
+
+
+/**
+ * @brief Selects the OTA slot the next update should be written to.
+ *
+ * Empty slots are used first, then the slot holding the oldest install.
+ * The running image and the image selected for the next boot are never
+ * chosen.
+ *
+ * @return The partition to write, or NULL if there is none.
+ */
+const esp_partition_t *image_catalog_next_update_partition(void)
+{
+    if (catalog_mutex == NULL) {
+        return esp_ota_get_next_update_partition(NULL);
+    }
+
+    const esp_partition_t *best = NULL;
+    uint32_t best_seq = UINT32_MAX;
+    bool best_valid = true;
+
+    xSemaphoreTake(catalog_mutex, portMAX_DELAY);
+    refresh_flags();
+    for (int i = 0; i < num_entries; i++) {
+        const image_catalog_entry_t *e = &entries[i];
+        if (!is_ota_slot(e->partition) || e->running || e->boot) {
+            continue;
+        }
+        if ((best_valid && !e->valid) || (best_valid == e->valid && e->seq < best_seq)) {
+            best = e->partition;
+            best_seq = e->seq;
+            best_valid = e->valid;
+        }
+    }
+    xSemaphoreGive(catalog_mutex);
+
+    return best ? best : esp_ota_get_next_update_partition(NULL);
+}
+
+
+/**
+ * @brief Records a freshly installed image in the catalog.
+ *
+ * @param partition The partition the image was written to.
+ */
+void image_catalog_record_install(const esp_partition_t *partition)
+{
+    if (catalog_mutex == NULL || partition == NULL) {
+        return;
+    }
+
+    uint32_t seq = 0;
+    size_t size = sizeof(seq);
+    get_setting(CATALOG_SEQ_KEY, &seq, &size, false);
+    seq++;
+    set_setting(CATALOG_SEQ_KEY, &seq, sizeof(seq), false);
+
+    xSemaphoreTake(catalog_mutex, portMAX_DELAY);
+    for (int i = 0; i < num_entries; i++) {
+        image_catalog_entry_t *e = &entries[i];
+        if (!same_partition(e->partition, partition)) {
+            continue;
+        }
+
+        refresh_entry(e);
+
+        char key[16];
+        record_key(partition, key, sizeof(key));
+
+        catalog_record_t record = { .seq = seq };
+        memcpy(record.elf_sha256, e->elf_sha256, sizeof(record.elf_sha256));
+        memcpy(record.image_sha256, e->image_sha256, sizeof(record.image_sha256));
+        set_setting(key, &record, sizeof(record), false);
+        e->seq = seq;
+    }
+    refresh_flags();
+    xSemaphoreGive(catalog_mutex);
+}
+
+
+/**
+ * @brief Drops the image in a slot from the catalog, before the slot is
+ *        erased for an update or after an update to it is aborted. Its
+ *        record is cleared too, so the partial image left in the slot is
+ *        hashed and verified when it is next seen rather than trusted.
+ *
+ * @param partition The slot.
+ */
+void image_catalog_invalidate(const esp_partition_t *partition)
+{
+    if (catalog_mutex == NULL || partition == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(catalog_mutex, portMAX_DELAY);
+    for (int i = 0; i < num_entries; i++) {
+        image_catalog_entry_t *e = &entries[i];
+        if (!same_partition(e->partition, partition)) {
+            continue;
+        }
+        memset(e, 0, sizeof(*e));
+        e->partition = partition;
+
+        char key[16];
+        catalog_record_t record = { 0 };
+        record_key(partition, key, sizeof(key));
+        set_setting(key, &record, sizeof(record), false);
+    }
+    refresh_flags();
+    xSemaphoreGive(catalog_mutex);
+}
+
+
+/**
+ * @brief Selects a cataloged image for the next boot.
+ *
+ * The image is verified by esp_ota_set_boot_partition(). The caller is
+ * responsible for rebooting.
+ *
+ * @param label Partition label, e.g. "ota_1" or "factory".
+ *
+ * @return
+ *     - ESP_OK: The image will be booted on the next restart.
+ *     - ESP_ERR_NOT_FOUND: No valid image in a partition with that label.
+ *     - Other error codes from esp_ota_set_boot_partition().
+ */
+esp_err_t image_catalog_activate(const char *label)
+{
+    const esp_partition_t *partition = NULL;
+    if (catalog_mutex == NULL || label == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(catalog_mutex, portMAX_DELAY);
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].valid && strcmp(entries[i].partition->label, label) == 0) {
+            partition = entries[i].partition;
+        }
+    }
+    xSemaphoreGive(catalog_mutex);
+
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t err = esp_ota_set_boot_partition(partition);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot boot %s: %s", label, esp_err_to_name(err));
+        return err;
+    }
+
+    xSemaphoreTake(catalog_mutex, portMAX_DELAY);
+    refresh_flags();
+    xSemaphoreGive(catalog_mutex);
+    ESP_LOGI(TAG, "Next boot from %s", label);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Console command: lists the cataloged images.
+ */
+static int images_cmd(int argc, char **argv)
+{
+    image_catalog_entry_t list[IMAGE_CATALOG_MAX_SLOTS];
+    int count = image_catalog_list(list, IMAGE_CATALOG_MAX_SLOTS);
+
+    printf("%-8s %-24s %-12s %-5s %-16s %s\n", "slot", "version", "date", "seq", "elf sha256", "");
+    for (int i = 0; i < count; i++) {
+        char hex[17] = "";
+        if (list[i].valid) {
+            for (int b = 0; b < 8; b++) {
+                snprintf(&hex[b * 2], 3, "%02x", list[i].elf_sha256[b]);
+            }
+        }
+        printf("%-8s %-24s %-12s %-5lu %-16s %s%s\n", list[i].partition->label,
+               list[i].valid ? list[i].version : "(empty)", list[i].date, (unsigned long)list[i].seq, hex,
+               list[i].running ? "running " : "", list[i].boot ? "boot" : "");
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Console command: boots a cataloged image.
+ */
+static int boot_image_cmd(int argc, char **argv)
+{
+    if (argc != 2) {
+        printf("Usage: boot_image <slot>\n");
+        return 1;
+    }
+    if (ota_writer_busy()) {
+        printf("An OTA update is in progress\n");
+        return 1;
+    }
+
+    esp_err_t err = image_catalog_activate(argv[1]);
+    if (err != ESP_OK) {
+        printf("Cannot boot %s: %s\n", argv[1], esp_err_to_name(err));
+        return 1;
+    }
+    printf("Rebooting into %s...\n", argv[1]);
+    request_reboot();
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'images' and 'boot_image' console commands.
+ */
+void register_image_commands(void)
+{
+    const esp_console_cmd_t images = {
+        .command = "images",
+        .help = "List the firmware images held in flash",
+        .hint = NULL,
+        .func = &images_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&images));
+
+    const esp_console_cmd_t boot_image = {
+        .command = "boot_image",
+        .help = "Reboot into the image held in a slot, e.g. 'boot_image ota_1'",
+        .hint = "<slot>",
+        .func = &boot_image_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&boot_image));
+}
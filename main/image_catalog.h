@@ -0,0 +1,56 @@
+/*
+ * image_catalog.h
+ *
+ * Catalog of the firmware images held in the app partitions (factory and
+ * ota_0..ota_2). Each entry records the image version, its ELF and image
+ * SHA-256 and the order in which it was installed, so that any known image
+ * can be booted again by switching the boot partition, without transferring
+ * it a second time.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef IMAGE_CATALOG_H
+#define IMAGE_CATALOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+
+#define IMAGE_CATALOG_MAX_SLOTS     5       // factory + up to four OTA slots
+
+
+// One app partition
+typedef struct {
+    const esp_partition_t   *partition;
+    bool                    valid;              // Holds an image with a valid app descriptor
+    bool                    running;            // Currently executing
+    bool                    boot;               // Selected for the next boot
+    uint32_t                seq;                // Install order, higher is newer, 0 = unknown
+    char                    version[32];
+    char                    date[16];
+    uint8_t                 elf_sha256[32];     // From the app descriptor
+    uint8_t                 image_sha256[32];   // Of the whole image as stored in flash
+} image_catalog_entry_t;
+
+
+// Functions
+void                    image_catalog_init(void);
+int                     image_catalog_list(image_catalog_entry_t *entries, int max_entries);
+const esp_partition_t * image_catalog_next_update_partition(void);
+void                    image_catalog_record_install(const esp_partition_t *partition);
+void                    image_catalog_invalidate(const esp_partition_t *partition);
+esp_err_t               image_catalog_activate(const char *label);
+void                    register_image_commands(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
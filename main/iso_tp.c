@@ -0,0 +1,452 @@
+/*
+ * iso_tp.c
+ *
+ * This file sends transport protocol transfers from the session pool
+ * described in iso_tp.h. Each session is a small state machine with one
+ * deadline: the next packet of a broadcast, the next burst of a
+ * connection, or the time its receiver has to answer. The bursts of all
+ * connections are paced together, from an estimate of when the packets
+ * already queued will have gone out. iso_tp_poll()
+ * runs the sessions that are due and returns the nearest deadline; with a
+ * pool of a few dozen sessions a scan of all of them costs less than one
+ * frame on the bus.
+ *
+ * The standard allows one broadcast at a time from a node and one
+ * connection per node pair, so further broadcasts queue behind the one
+ * being sent and a second transfer to the same node is refused.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "iso_tp.h"
+
+
+// TP.CM control bytes
+#define CM_RTS                  16
+#define CM_CTS                  17
+#define CM_EOMA                 19
+#define CM_BAM                  32
+#define CM_ABORT                255
+
+// Session states
+enum {
+    FREE = 0,
+    BAM_QUEUED,                             // Waits for the broadcast before it
+    BAM_SENDING,                            // Announcement due while next is 0
+    CM_RTS_DUE,
+    CM_WAIT_CTS,
+    CM_SENDING,
+    CM_WAIT_EOMA,
+};
+
+
+static bool before(uint32_t a_us, uint32_t b_us)
+{
+    return (int32_t)(a_us - b_us) < 0;
+}
+
+
+/**
+ * @brief Sends a TP.CM frame.
+ *
+ * @return false if the transmit queue is full.
+ */
+static bool send_cm(iso_tp_t *tp, uint8_t destination, uint8_t control, uint8_t b1, uint8_t b2, uint8_t b3,
+                    uint8_t b4, uint32_t pgn)
+{
+    n2k_frame_t f = { 0 };
+    f.id = n2k_make_id(ISO_TP_PGN_CM, ISO_TP_PRIORITY, tp->address, destination);
+    f.len = 8;
+    f.data[0] = control;
+    f.data[1] = b1;
+    f.data[2] = b2;
+    f.data[3] = b3;
+    f.data[4] = b4;
+    f.data[5] = pgn & 0xFF;
+    f.data[6] = (pgn >> 8) & 0xFF;
+    f.data[7] = (pgn >> 16) & 0xFF;
+    if (tp->sink.send(tp->sink.ctx, &f, 1) != 1) {
+        return false;
+    }
+    tp->stats.frames++;
+    return true;
+}
+
+
+/**
+ * @brief Builds packet seq (from 1) of a session, padded with 0xFF.
+ */
+static void make_dt(const iso_tp_t *tp, const iso_tp_session_t *s, uint8_t seq, n2k_frame_t *f)
+{
+    unsigned offset = (seq - 1) * 7;
+    unsigned n = (s->len - offset < 7) ? s->len - offset : 7;
+
+    f->id = n2k_make_id(ISO_TP_PGN_DT, ISO_TP_PRIORITY, tp->address, s->peer);
+    f->time_ms = 0;
+    f->len = 8;
+    f->data[0] = seq;
+    memcpy(&f->data[1], &s->data[offset], n);
+    memset(&f->data[1 + n], 0xFF, 7 - n);
+}
+
+
+/**
+ * @brief Frees a session and, if it was the broadcast being sent, starts
+ *        the oldest one queued.
+ */
+static void release(iso_tp_t *tp, iso_tp_session_t *s, uint32_t now_us)
+{
+    bool was_bam = (s->state == BAM_SENDING);
+    s->state = FREE;
+    tp->in_use--;
+    if (!was_bam) {
+        return;
+    }
+
+    iso_tp_session_t *next = NULL;
+    for (int i = 0; i < tp->count; i++) {
+        iso_tp_session_t *q = &tp->sessions[i];
+        if (q->state == BAM_QUEUED && (next == NULL || (int32_t)(q->ticket - next->ticket) < 0)) {
+            next = q;
+        }
+    }
+    if (next != NULL) {
+        next->state = BAM_SENDING;
+        next->due_us = now_us;
+    }
+}
+
+
+/**
+ * @brief Tells the receiver a connection is given up, then frees it. The
+ *        Abort is best effort: the receiver times out if it is lost.
+ */
+static void abort_session(iso_tp_t *tp, iso_tp_session_t *s, uint8_t reason, uint32_t now_us)
+{
+    send_cm(tp, s->peer, CM_ABORT, reason, 0xFF, 0xFF, 0xFF, s->pgn);
+    release(tp, s, now_us);
+}
+
+
+static void retry(iso_tp_t *tp, iso_tp_session_t *s, uint32_t now_us)
+{
+    tp->stats.queue_full++;
+    s->due_us = now_us + ISO_TP_RETRY_US;
+}
+
+
+/**
+ * @brief Sends the packets of a connection the last CTS allows, as many as
+ *        fit in the burst.
+ */
+static void send_window(iso_tp_t *tp, iso_tp_session_t *s, uint32_t now_us)
+{
+    n2k_frame_t frames[ISO_TP_BURST];
+    unsigned next = s->next;                // Past 255 after the last packet
+    int32_t queued_us = (int32_t)(tp->drain_us - now_us);
+    int room = ISO_TP_BURST;
+    int n = 0;
+
+    // No more than a burst can be queued; further ahead, drain_us is stale
+    // from before the clock went round and the queue has long emptied
+    if (queued_us > 0 && queued_us <= ISO_TP_BURST * ISO_TP_FRAME_US) {
+        room -= (queued_us + ISO_TP_FRAME_US - 1) / ISO_TP_FRAME_US;
+    } else {
+        tp->drain_us = now_us;
+    }
+    while (n < room && next + n <= s->window_end) {
+        make_dt(tp, s, next + n, &frames[n]);
+        n++;
+    }
+    int sent = (n > 0) ? tp->sink.send(tp->sink.ctx, frames, n) : 0;
+    sent = (sent < 0) ? 0 : sent;
+    tp->stats.frames += sent;
+    tp->drain_us += sent * ISO_TP_FRAME_US;
+    next += sent;
+    s->next = next;
+    if (sent < n) {
+        retry(tp, s, now_us);
+    } else if (next <= s->window_end) {
+        s->due_us = tp->drain_us - ISO_TP_FRAME_US;     // When one packet is left
+    } else {
+        s->state = (s->window_end == s->packets) ? CM_WAIT_EOMA : CM_WAIT_CTS;
+        s->due_us = now_us + ISO_TP_T3_MS * 1000;
+    }
+}
+
+
+/**
+ * @brief Does what is due for a session.
+ */
+static void run(iso_tp_t *tp, iso_tp_session_t *s, uint32_t now_us)
+{
+    switch (s->state) {
+    case BAM_SENDING:
+        if (s->next == 0) {
+            if (!send_cm(tp, N2K_BROADCAST, CM_BAM, s->len & 0xFF, s->len >> 8, s->packets, 0xFF, s->pgn)) {
+                retry(tp, s, now_us);
+                return;
+            }
+        } else {
+            n2k_frame_t f;
+            make_dt(tp, s, s->next, &f);
+            if (tp->sink.send(tp->sink.ctx, &f, 1) != 1) {
+                retry(tp, s, now_us);
+                return;
+            }
+            uint32_t late = now_us - s->due_us;
+            tp->stats.frames++;
+            tp->stats.timed++;
+            tp->stats.late_total_us += late;
+            tp->stats.late_max_us = (late > tp->stats.late_max_us) ? late : tp->stats.late_max_us;
+            if (s->next == s->packets) {
+                tp->stats.completed++;
+                release(tp, s, now_us);
+                return;
+            }
+        }
+        // Spaced from this frame rather than from the schedule, so a late
+        // timer never brings two packets closer than the interval
+        s->next++;
+        s->due_us = now_us + tp->bam_interval_us;
+        break;
+
+    case CM_RTS_DUE:
+        if (!send_cm(tp, s->peer, CM_RTS, s->len & 0xFF, s->len >> 8, s->packets, 0xFF, s->pgn)) {
+            retry(tp, s, now_us);
+            return;
+        }
+        s->state = CM_WAIT_CTS;
+        s->due_us = now_us + ISO_TP_T3_MS * 1000;
+        break;
+
+    case CM_SENDING:
+        send_window(tp, s, now_us);
+        break;
+
+    case CM_WAIT_CTS:
+    case CM_WAIT_EOMA:
+        tp->stats.timeouts++;
+        abort_session(tp, s, ISO_TP_ABORT_TIMEOUT, now_us);
+        break;
+    }
+}
+
+
+/**
+ * @brief Sets up an engine.
+ *
+ * @param tp                The engine.
+ * @param sessions          Storage for the sessions.
+ * @param count             Number of sessions, the transfers that can be
+ *                          in progress or queued at once.
+ * @param address           Address of this node.
+ * @param sink              Where frames are sent.
+ * @param bam_interval_ms   Time between broadcast packets, 50 to 200 ms.
+ */
+void iso_tp_init(iso_tp_t *tp, iso_tp_session_t *sessions, int count, uint8_t address, const n2k_sink_t *sink,
+                 uint32_t bam_interval_ms)
+{
+    memset(tp, 0, sizeof(*tp));
+    memset(sessions, 0, count * sizeof(*sessions));
+    tp->sessions = sessions;
+    tp->count = count;
+    tp->address = address;
+    tp->sink = *sink;
+    tp->bam_interval_us = bam_interval_ms * 1000;
+}
+
+
+/**
+ * @brief Starts a transfer. The data must stay as it is until the session
+ *        ends, see iso_tp_in_use().
+ *
+ * @param tp            The engine.
+ * @param pgn           PGN of the message.
+ * @param destination   Node to send it to, or N2K_BROADCAST.
+ * @param data          The message.
+ * @param len           Its length, 9 to ISO_TP_MAX_LEN bytes.
+ * @param now_us        Current time.
+ *
+ * @return 0 if started or queued, -1 if refused. Call iso_tp_poll() after.
+ */
+int iso_tp_send(iso_tp_t *tp, uint32_t pgn, uint8_t destination, const uint8_t *data, uint16_t len,
+                uint32_t now_us)
+{
+    if (len < 9 || len > ISO_TP_MAX_LEN) {
+        return -1;
+    }
+
+    iso_tp_session_t *s = NULL;
+    bool bam_busy = false;
+    for (int i = 0; i < tp->count; i++) {
+        iso_tp_session_t *t = &tp->sessions[i];
+        if (t->state == FREE) {
+            s = (s == NULL) ? t : s;
+        } else if (destination != N2K_BROADCAST && t->peer == destination) {
+            s = NULL;
+            break;
+        } else if (t->state == BAM_SENDING) {
+            bam_busy = true;
+        }
+    }
+    if (s == NULL) {
+        tp->stats.refused++;
+        return -1;
+    }
+
+    s->data = data;
+    s->pgn = pgn;
+    s->len = len;
+    s->peer = destination;
+    s->packets = (len + 6) / 7;
+    s->next = 0;
+    s->window_end = 0;
+    s->ticket = tp->tickets++;
+    s->due_us = now_us;
+    if (destination == N2K_BROADCAST) {
+        s->state = bam_busy ? BAM_QUEUED : BAM_SENDING;
+    } else {
+        s->state = CM_RTS_DUE;
+    }
+
+    tp->stats.messages++;
+    tp->in_use++;
+    if ((uint32_t)tp->in_use > tp->stats.in_use_max) {
+        tp->stats.in_use_max = tp->in_use;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Handles a TP.CM frame. Others are ignored.
+ */
+void iso_tp_receive(iso_tp_t *tp, const n2k_msg_t *msg, uint32_t now_us)
+{
+    if (msg->pgn != ISO_TP_PGN_CM || msg->len < 8 || msg->destination != tp->address) {
+        return;
+    }
+    const uint8_t *d = msg->data;
+    uint32_t pgn = d[5] | (d[6] << 8) | ((uint32_t)(d[7] & 0x03) << 16);
+
+    if (d[0] == CM_RTS) {
+        tp->stats.rejected++;
+        send_cm(tp, msg->source, CM_ABORT, ISO_TP_ABORT_RESOURCES, 0xFF, 0xFF, 0xFF, pgn);
+        return;
+    }
+
+    iso_tp_session_t *s = NULL;
+    for (int i = 0; i < tp->count && s == NULL; i++) {
+        iso_tp_session_t *t = &tp->sessions[i];
+        if (t->state >= CM_RTS_DUE && t->peer == msg->source && t->pgn == pgn) {
+            s = t;
+        }
+    }
+    if (s == NULL) {
+        return;
+    }
+
+    switch (d[0]) {
+    case CM_CTS:
+        if (s->state != CM_WAIT_CTS && s->state != CM_SENDING) {
+            break;
+        }
+        if (d[1] == 0) {
+            s->state = CM_WAIT_CTS;                     // Receiver holds the connection open
+            s->due_us = now_us + ISO_TP_T4_MS * 1000;
+        } else if (d[2] == 0 || d[2] > s->packets) {
+            abort_session(tp, s, ISO_TP_ABORT_SEQUENCE, now_us);
+        } else {
+            unsigned end = d[2] + d[1] - 1;
+            s->next = d[2];
+            s->window_end = (end > s->packets) ? s->packets : end;
+            s->state = CM_SENDING;
+            s->due_us = now_us;
+        }
+        break;
+
+    case CM_EOMA:
+        tp->stats.completed++;
+        release(tp, s, now_us);
+        break;
+
+    case CM_ABORT:
+        tp->stats.aborted++;
+        release(tp, s, now_us);
+        break;
+    }
+}
+
+
+/**
+ * @brief Runs the sessions that are due.
+ *
+ * @return Microseconds until the next deadline, -1 if there is none.
+ */
+int32_t iso_tp_poll(iso_tp_t *tp, uint32_t now_us)
+{
+    // Starting with each session in turn, so connections share the bursts
+    for (int i = 0; i < tp->count; i++) {
+        iso_tp_session_t *s = &tp->sessions[(tp->rotor + i) % tp->count];
+        if (s->state != FREE && s->state != BAM_QUEUED && !before(now_us, s->due_us)) {
+            run(tp, s, now_us);
+        }
+    }
+    tp->rotor = (tp->rotor + 1) % tp->count;
+
+    // A broadcast ending may have started one already passed
+    int32_t wait = -1;
+    for (int i = 0; i < tp->count; i++) {
+        const iso_tp_session_t *s = &tp->sessions[i];
+        if (s->state != FREE && s->state != BAM_QUEUED) {
+            int32_t d = (int32_t)(s->due_us - now_us);
+            d = (d < 0) ? 0 : d;
+            wait = (wait < 0 || d < wait) ? d : wait;
+        }
+    }
+    return wait;
+}
+
+
+/**
+ * @brief Tells whether a transfer of this data is in progress or queued,
+ *        i.e. whether the caller may change it.
+ */
+bool iso_tp_in_use(const iso_tp_t *tp, const uint8_t *data)
+{
+    for (int i = 0; i < tp->count; i++) {
+        if (tp->sessions[i].state != FREE && tp->sessions[i].data == data) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Changes the source address, after the address claim was lost.
+ *        Transfers in progress are dropped without a word: the address
+ *        they were sent from is no longer this node's, so their receivers
+ *        time out.
+ */
+void iso_tp_set_address(iso_tp_t *tp, uint8_t address)
+{
+    for (int i = 0; i < tp->count; i++) {
+        tp->sessions[i].state = FREE;
+    }
+    tp->in_use = 0;
+    tp->address = address;
+}
+
+
+/**
+ * @brief Clears the counters.
+ */
+void iso_tp_reset_stats(iso_tp_t *tp)
+{
+    memset(&tp->stats, 0, sizeof(tp->stats));
+    tp->stats.in_use_max = tp->in_use;
+}
@@ -0,0 +1,118 @@
+/*
+ * iso_tp.h
+ *
+ * ISO 11783-3 / J1939-21 transport protocol, sending side: messages of 9
+ * to 1785 bytes split into 7-byte TP.DT packets, either broadcast with an
+ * announcement (BAM) at a fixed interval, or sent to one node under its
+ * flow control (TP.CM RTS, CTS, EOMA, Abort).
+ *
+ * Transfers live in a fixed pool of sessions supplied by the caller, and
+ * the data stays with the caller until the session ends, so any number of
+ * requests costs no heap. The engine never waits: iso_tp_poll() does what
+ * is due and returns the time to the next deadline, and the caller arms a
+ * timer for it. Broadcast packets are spaced by the interval from the one
+ * before, as sent, so the spacing varies only by the timer's latency and
+ * never falls below the 50 ms the standard sets. Connection packets are
+ * queued no faster than the bus takes them, a few at a time across all
+ * sessions, so a broadcast packet is never held up behind whole windows
+ * of them.
+ *
+ * Transfers other nodes try to open to this one are refused with an Abort.
+ *
+ * This module has no ESP-IDF dependencies so it can be exercised on a
+ * Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ISO_TP_H
+#define ISO_TP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "n2k_frame.h"
+
+#define ISO_TP_PGN_CM           60416       // TP.CM, connection management
+#define ISO_TP_PGN_DT           60160       // TP.DT, data transfer
+#define ISO_TP_MAX_LEN          1785        // 255 packets
+#define ISO_TP_PRIORITY         7
+#define ISO_TP_T3_MS            1250        // Longest wait for a CTS or EOMA
+#define ISO_TP_T4_MS            1050        // Longest hold after a CTS for 0 packets
+#define ISO_TP_RETRY_US         2000        // Retry when the transmit queue is full
+#define ISO_TP_FRAME_US         540         // 8-byte frame at 250 kbit/s, with typical bit stuffing
+#define ISO_TP_BURST            4           // Connection packets queued at most
+
+// Abort reasons
+#define ISO_TP_ABORT_RESOURCES  2           // Sent to nodes opening a transfer to this one
+#define ISO_TP_ABORT_TIMEOUT    3
+#define ISO_TP_ABORT_SEQUENCE   7           // CTS for a packet that does not exist
+
+
+// A transfer
+typedef struct {
+    const uint8_t   *data;
+    uint32_t        pgn;
+    uint32_t        due_us;                 // Next packet, or when the receiver times out
+    uint32_t        ticket;                 // Order of queued broadcasts
+    uint16_t        len;
+    uint8_t         state;                  // 0 when free
+    uint8_t         peer;                   // N2K_BROADCAST for BAM
+    uint8_t         packets;
+    uint8_t         next;                   // Packet to send next, from 1
+    uint8_t         window_end;             // Last packet the receiver's CTS allows
+} iso_tp_session_t;
+
+
+// Counters
+typedef struct {
+    uint32_t    messages;                   // Transfers started
+    uint32_t    completed;                  // Broadcast, or acknowledged by the receiver
+    uint32_t    refused;                    // No free session, or one already open to the node
+    uint32_t    aborted;                    // By the receiver
+    uint32_t    timeouts;                   // Receiver stopped answering
+    uint32_t    rejected;                   // Transfers from other nodes, refused
+    uint32_t    frames;
+    uint32_t    queue_full;                 // Frames retried, the transmit queue was full
+    uint32_t    timed;                      // BAM packets sent
+    uint32_t    late_total_us;              // Their delay after the due time
+    uint32_t    late_max_us;
+    uint32_t    in_use_max;
+} iso_tp_stats_t;
+
+
+// Transport protocol engine
+typedef struct {
+    iso_tp_session_t    *sessions;
+    int                 count;
+    int                 in_use;
+    uint8_t             address;            // Source of the frames sent
+    n2k_sink_t          sink;
+    uint32_t            bam_interval_us;
+    uint32_t            tickets;
+    int                 rotor;              // Session polled first, in turn
+    uint32_t            drain_us;           // When the connection packets queued will have gone
+    iso_tp_stats_t      stats;
+} iso_tp_t;
+
+
+// Functions
+void        iso_tp_init(iso_tp_t *tp, iso_tp_session_t *sessions, int count, uint8_t address, const n2k_sink_t *sink,
+                        uint32_t bam_interval_ms);
+int         iso_tp_send(iso_tp_t *tp, uint32_t pgn, uint8_t destination, const uint8_t *data, uint16_t len,
+                        uint32_t now_us);
+void        iso_tp_receive(iso_tp_t *tp, const n2k_msg_t *msg, uint32_t now_us);
+int32_t     iso_tp_poll(iso_tp_t *tp, uint32_t now_us);
+bool        iso_tp_in_use(const iso_tp_t *tp, const uint8_t *data);
+void        iso_tp_set_address(iso_tp_t *tp, uint8_t address);
+void        iso_tp_reset_stats(iso_tp_t *tp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
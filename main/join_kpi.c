@@ -0,0 +1,426 @@
+/*
+ * join_kpi.c
+ *
+ * This file implements the join-to-portal tracking. Association and the
+ * DHCP lease come from the Wi-Fi and IP events, which carry the station's
+ * MAC; the lease ties it to the IP address that the DNS server and the web
+ * server see, and they report the later milestones by address. A join
+ * ends when the portal page is served, or when the station leaves first.
+ *
+ * Up to JOIN_MAX_STATIONS joins are followed at a time; if more stations
+ * associate, the oldest join in progress is ended as abandoned.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_console.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+#include "join_kpi.h"
+
+
+#define JOIN_RING_SIZE      CONFIG_JOIN_KPI_RING_SIZE
+#define JOIN_MAX_STATIONS   8               // Joins followed at a time
+
+
+// A join in progress
+typedef struct {
+    bool            used;
+    join_record_t   rec;
+} station_t;
+
+
+// Local variables
+static const char       *TAG = "join_kpi";
+static station_t        stations[JOIN_MAX_STATIONS];
+static int              waiting;            // Stations in use
+static join_record_t    ring[JOIN_RING_SIZE];
+static uint32_t         ring_next;          // Total joins ended
+static join_histogram_t histograms[JOIN_MILESTONE_COUNT];
+static uint32_t         completed;
+static uint32_t         abandoned;
+static portMUX_TYPE     s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Inclusive upper limits of the histogram buckets in ms, the last bucket is unbounded
+static const uint32_t   bucket_limits_ms[JOIN_BUCKETS - 1] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000 };
+
+
+/**
+ * @brief Ends a join, moving it to the ring. Call with s_lock held.
+ */
+static void finish(station_t *s, join_record_t *out)
+{
+    s->rec.left = (s->rec.at_us[JOIN_PORTAL] == JOIN_NOT_REACHED);
+    if (s->rec.left) {
+        abandoned++;
+    } else {
+        completed++;
+    }
+    ring[ring_next++ % JOIN_RING_SIZE] = s->rec;
+    *out = s->rec;
+    s->used = false;
+    waiting--;
+}
+
+
+/**
+ * @brief Logs an ended join.
+ */
+static void log_join(const join_record_t *r)
+{
+    char at[JOIN_MILESTONE_COUNT][12];
+    for (int m = 0; m < JOIN_MILESTONE_COUNT; m++) {
+        if (r->at_us[m] == JOIN_NOT_REACHED) {
+            snprintf(at[m], sizeof(at[m]), "-");
+        } else {
+            snprintf(at[m], sizeof(at[m]), "%lu ms", (unsigned long)(r->at_us[m] / 1000));
+        }
+    }
+    ESP_LOGI(TAG, MACSTR " %s: dhcp %s, dns %s, probe %s, portal %s", MAC2STR(r->mac),
+             r->left ? "left" : "joined", at[JOIN_DHCP], at[JOIN_DNS], at[JOIN_PROBE], at[JOIN_PORTAL]);
+}
+
+
+/**
+ * @brief Returns the join in progress of a station, NULL if none. Call
+ *        with s_lock held.
+ */
+static station_t *find_mac(const uint8_t mac[6])
+{
+    for (int i = 0; i < JOIN_MAX_STATIONS; i++) {
+        if (stations[i].used && memcmp(stations[i].rec.mac, mac, 6) == 0) {
+            return &stations[i];
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Returns a free station slot, or the oldest join in progress if
+ *        none is free. Call with s_lock held.
+ */
+static station_t *free_or_oldest(void)
+{
+    station_t *oldest = &stations[0];
+    for (int i = 0; i < JOIN_MAX_STATIONS; i++) {
+        if (!stations[i].used) {
+            return &stations[i];
+        }
+        if (stations[i].rec.assoc_us < oldest->rec.assoc_us) {
+            oldest = &stations[i];
+        }
+    }
+    return oldest;
+}
+
+
+/**
+ * @brief Records a milestone of a join. Call with s_lock held.
+ *
+ * @return true if it ended the join.
+ */
+static bool reach(station_t *s, join_milestone_t milestone, int64_t at_us, join_record_t *out)
+{
+    if (s->rec.at_us[milestone] != JOIN_NOT_REACHED || at_us < s->rec.assoc_us) {
+        return false;
+    }
+    uint32_t us = at_us - s->rec.assoc_us;
+    s->rec.at_us[milestone] = us;
+
+    int bucket = 0;
+    while (bucket < JOIN_BUCKETS - 1 && us > bucket_limits_ms[bucket] * 1000) {
+        bucket++;
+    }
+    join_histogram_t *h = &histograms[milestone];
+    h->counts[bucket]++;
+    h->count++;
+    h->sum_us += us;
+
+    if (milestone == JOIN_PORTAL) {
+        finish(s, out);
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * @brief Follows stations associating, getting a lease and leaving.
+ */
+static void event_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    int64_t now = esp_timer_get_time();
+    join_record_t done;
+    bool ended = false;
+
+    portENTER_CRITICAL(&s_lock);
+    if (base == WIFI_EVENT && id == WIFI_EVENT_AP_STACONNECTED) {
+        const wifi_event_ap_staconnected_t *e = data;
+
+        // Reconnected without a disconnect event, or out of slots
+        station_t *s = find_mac(e->mac);
+        if (s == NULL) {
+            s = free_or_oldest();
+        }
+        if (s->used) {
+            finish(s, &done);
+            ended = true;
+        }
+
+        memset(s, 0, sizeof(*s));
+        s->used = true;
+        memcpy(s->rec.mac, e->mac, 6);
+        s->rec.assoc_us = now;
+        for (int m = 0; m < JOIN_MILESTONE_COUNT; m++) {
+            s->rec.at_us[m] = JOIN_NOT_REACHED;
+        }
+        waiting++;
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_AP_STADISCONNECTED) {
+        const wifi_event_ap_stadisconnected_t *e = data;
+        station_t *s = find_mac(e->mac);
+        if (s != NULL) {
+            finish(s, &done);
+            ended = true;
+        }
+    } else if (base == IP_EVENT && id == IP_EVENT_AP_STAIPASSIGNED) {
+        const ip_event_ap_staipassigned_t *e = data;
+        station_t *s = find_mac(e->mac);
+        if (s != NULL) {
+            s->rec.ip = e->ip.addr;
+            reach(s, JOIN_DHCP, now, &done);
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (ended) {
+        log_join(&done);
+    }
+}
+
+
+/**
+ * @brief Registers for the station events. Call once the default event
+ *        loop exists, before the softAP is started.
+ */
+void join_kpi_init(void)
+{
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, event_handler, NULL));
+}
+
+
+/**
+ * @brief Returns true while any join is in progress, so callers can skip
+ *        looking up the client address when nobody is joining.
+ */
+bool join_kpi_waiting(void)
+{
+    return waiting > 0;
+}
+
+
+/**
+ * @brief Records a milestone reached by the client at an address. Only the
+ *        first time per join counts; clients that are not joining are
+ *        ignored.
+ *
+ * @param milestone JOIN_DNS, JOIN_PROBE or JOIN_PORTAL.
+ * @param ip        Client address, network order.
+ * @param at_us     esp_timer_get_time() when it was reached.
+ */
+void join_kpi_mark(join_milestone_t milestone, uint32_t ip, int64_t at_us)
+{
+    join_record_t done;
+    bool ended = false;
+
+    if (ip == 0 || milestone >= JOIN_MILESTONE_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < JOIN_MAX_STATIONS; i++) {
+        if (stations[i].used && stations[i].rec.ip == ip) {
+            ended = reach(&stations[i], milestone, at_us, &done);
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (ended) {
+        log_join(&done);
+    }
+}
+
+
+/**
+ * @brief Returns the number of joins ended since start up. The most
+ *        recent CONFIG_JOIN_KPI_RING_SIZE of them can be read back.
+ */
+uint32_t join_kpi_ended(void)
+{
+    return ring_next;
+}
+
+
+/**
+ * @brief Copies an ended join.
+ *
+ * @param seq    Sequence number, 0 for the first join ended since start up.
+ * @param record Receives the join.
+ *
+ * @return false if it has not ended yet or is no longer in the ring.
+ */
+bool join_kpi_get_record(uint32_t seq, join_record_t *record)
+{
+    portENTER_CRITICAL(&s_lock);
+    bool found = (seq < ring_next && ring_next - seq <= JOIN_RING_SIZE);
+    if (found) {
+        *record = ring[seq % JOIN_RING_SIZE];
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return found;
+}
+
+
+/**
+ * @brief Returns the histogram of a milestone's time since association,
+ *        see join_kpi_bucket_limit_ms().
+ */
+void join_kpi_get_histogram(join_milestone_t milestone, join_histogram_t *histogram)
+{
+    portENTER_CRITICAL(&s_lock);
+    *histogram = histograms[milestone];
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Returns the number of joins started, ended at the portal and
+ *        ended before it.
+ */
+void join_kpi_get_counts(uint32_t *joins, uint32_t *done, uint32_t *left)
+{
+    portENTER_CRITICAL(&s_lock);
+    *joins = ring_next + waiting;
+    *done = completed;
+    *left = abandoned;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Returns the inclusive upper limit of a histogram bucket in ms,
+ *        0 for the last bucket, which is unbounded.
+ */
+uint32_t join_kpi_bucket_limit_ms(int bucket)
+{
+    return (bucket < JOIN_BUCKETS - 1) ? bucket_limits_ms[bucket] : 0;
+}
+
+
+/**
+ * @brief Returns the name of a milestone.
+ */
+const char *join_milestone_name(join_milestone_t milestone)
+{
+    switch (milestone) {
+        case JOIN_DHCP:     return "dhcp";
+        case JOIN_DNS:      return "dns";
+        case JOIN_PROBE:    return "probe";
+        case JOIN_PORTAL:   return "portal";
+        default:            return "unknown";
+    }
+}
+
+
+/**
+ * @brief Formats the bucket limit at or below which a share of the
+ *        samples fall.
+ */
+static void format_percentile(char *out, size_t size, const join_histogram_t *h, uint32_t pct)
+{
+    uint32_t target = (h->count * pct + 99) / 100;
+    uint32_t seen = 0;
+    int i = 0;
+    while (i < JOIN_BUCKETS - 1 && (seen += h->counts[i]) < target) {
+        i++;
+    }
+    if (h->count == 0) {
+        snprintf(out, size, "-");
+    } else if (i < JOIN_BUCKETS - 1) {
+        snprintf(out, size, "<=%lu", (unsigned long)bucket_limits_ms[i]);
+    } else {
+        snprintf(out, size, ">%lu", (unsigned long)bucket_limits_ms[JOIN_BUCKETS - 2]);
+    }
+}
+
+
+/**
+ * @brief Handler for the 'joins' console command.
+ */
+static int joins_cmd(int argc, char **argv)
+{
+    uint32_t joins, done, left;
+    join_kpi_get_counts(&joins, &done, &left);
+    printf("%lu joins, %lu reached the portal, %lu left before it\n", (unsigned long)joins,
+           (unsigned long)done, (unsigned long)left);
+
+    printf("\n%-8s %6s %9s %9s %9s\n", "since", "count", "mean ms", "p50 ms", "p90 ms");
+    for (int m = 0; m < JOIN_MILESTONE_COUNT; m++) {
+        join_histogram_t h;
+        join_kpi_get_histogram(m, &h);
+        char p50[12], p90[12];
+        format_percentile(p50, sizeof(p50), &h, 50);
+        format_percentile(p90, sizeof(p90), &h, 90);
+        printf("%-8s %6lu %9lu %9s %9s\n", join_milestone_name(m), (unsigned long)h.count,
+               h.count ? (unsigned long)(h.sum_us / h.count / 1000) : 0UL, p50, p90);
+    }
+
+    uint32_t end = join_kpi_ended();
+    join_record_t rec;
+    printf("\n%-17s %-15s %8s %8s %8s %8s\n", "station", "address", "dhcp", "dns", "probe", "portal");
+    for (uint32_t seq = (end > JOIN_RING_SIZE) ? end - JOIN_RING_SIZE : 0; seq < end; seq++) {
+        if (!join_kpi_get_record(seq, &rec)) {
+            continue;
+        }
+        const join_record_t *r = &rec;
+        esp_ip4_addr_t ip = { .addr = r->ip };
+        char addr[16];
+        snprintf(addr, sizeof(addr), IPSTR, IP2STR(&ip));
+        printf(MACSTR " %-15s", MAC2STR(r->mac), addr);
+        for (int m = 0; m < JOIN_MILESTONE_COUNT; m++) {
+            if (r->at_us[m] == JOIN_NOT_REACHED) {
+                printf(" %8s", "-");
+            } else {
+                printf(" %8lu", (unsigned long)(r->at_us[m] / 1000));
+            }
+        }
+        printf("%s\n", r->left ? "  left" : "");
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'joins' console command.
+ */
+void register_join_kpi(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "joins",
+        .help = "Show join-to-portal latency: per milestone, time since association, and the recent joins in ms",
+        .hint = NULL,
+        .func = &joins_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
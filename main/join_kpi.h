@@ -0,0 +1,74 @@
+/*
+ * join_kpi.h
+ *
+ * Join-to-portal latency: the time from a station associating with the
+ * softAP to the portal page being served to it, the number users feel.
+ * Each join is followed per client through its milestones (DHCP lease,
+ * first DNS query answered, first captive portal probe redirected, first
+ * 200 on /). Finished joins are kept in a ring, and every milestone feeds
+ * a histogram of its time since association, served at /metrics.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef JOIN_KPI_H
+#define JOIN_KPI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define JOIN_NOT_REACHED    UINT32_MAX
+#define JOIN_BUCKETS        10              // Histogram buckets, the last one unbounded
+
+
+// Milestones of a join, in the order they normally happen
+typedef enum {
+    JOIN_DHCP = 0,                          // Lease handed out
+    JOIN_DNS,                               // First DNS query answered
+    JOIN_PROBE,                             // First captive portal probe redirected
+    JOIN_PORTAL,                            // First 200 on /
+    JOIN_MILESTONE_COUNT
+} join_milestone_t;
+
+
+// One join
+typedef struct {
+    uint8_t     mac[6];
+    bool        left;                       // Disconnected (or evicted) before reaching the portal
+    uint32_t    ip;                         // Leased address, network order, 0 if none
+    int64_t     assoc_us;                   // esp_timer_get_time() at association
+    uint32_t    at_us[JOIN_MILESTONE_COUNT];    // Time since association, JOIN_NOT_REACHED if never
+} join_record_t;
+
+
+// Histogram of one milestone's time since association
+typedef struct {
+    uint32_t    counts[JOIN_BUCKETS];       // Not cumulative
+    uint32_t    count;
+    uint64_t    sum_us;
+} join_histogram_t;
+
+
+// Functions
+void        join_kpi_init(void);
+bool        join_kpi_waiting(void);
+void        join_kpi_mark(join_milestone_t milestone, uint32_t ip, int64_t at_us);
+uint32_t    join_kpi_ended(void);
+bool        join_kpi_get_record(uint32_t seq, join_record_t *record);
+void        join_kpi_get_histogram(join_milestone_t milestone, join_histogram_t *histogram);
+void        join_kpi_get_counts(uint32_t *joins, uint32_t *done, uint32_t *left);
+uint32_t    join_kpi_bucket_limit_ms(int bucket);
+const char *join_milestone_name(join_milestone_t milestone);
+void        register_join_kpi(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,472 @@
+/*
+ * kernel_bench.c
+ *
+ * Benchmarks the kernels in kernels.c and the URI decoder in uri_decode.c
+ * against byte-at-a-time reference loops (and the C library or ROM
+ * equivalent where there is one) for a range of buffer sizes, checking that
+ * all variants agree. Builds for the target,
+ * where it is the 'kbench' console command, and for the host
+ * (tools/host/kernel_bench_host.c).
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#define _GNU_SOURCE                         // memmem() on the host
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+#include "uri_decode.h"
+#include "kernel_bench.h"
+#include "alloc_guard.h"
+#include "debug_flags.h"
+#ifdef ESP_PLATFORM
+    #include "esp_console.h"
+    #include "esp_timer.h"
+    #include "esp_rom_crc.h"
+#else
+    #include <time.h>
+#endif
+
+
+#define BENCH_BYTES         (1024 * 1024)   // Processed per measurement
+#define BENCH_BOUNDARY      "\r\n------WebKitFormBoundary7MA4YWxkTrZu0gW"
+#define BENCH_CHUNK         100             // Streamed decode chunk, not a multiple of 3
+
+
+// Buffers shared by all variants of one measurement
+typedef struct {
+    uint8_t     *a;
+    uint8_t     *b;
+    char        *text;                      // URL encoded input
+    char        *out;
+    size_t      size;
+} bench_ctx_t;
+
+typedef uint32_t (*bench_fn_t)(const bench_ctx_t *ctx);
+
+typedef struct {
+    const char  *name;
+    void        (*prepare)(bench_ctx_t *ctx);
+    bench_fn_t  ref;
+    bench_fn_t  kern;
+    bench_fn_t  lib;                        // NULL if there is no library version
+    bool        check_out;                  // ref returns the length of ctx->out, compare it
+} bench_case_t;
+
+
+// Local variables
+static volatile uint32_t    sink;
+
+
+static uint64_t now_ns(void)
+{
+#ifdef ESP_PLATFORM
+    return (uint64_t)esp_timer_get_time() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+
+// Data preparation
+static void fill_random(uint8_t *p, size_t len, uint32_t seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245u + 12345u;
+        p[i] = seed >> 16;
+    }
+}
+
+static void prepare_scan(bench_ctx_t *ctx)
+{
+    fill_random(ctx->a, ctx->size, 1);
+    for (size_t i = 0; i < ctx->size; i++) {
+        if (ctx->a[i] == '\r') {
+            ctx->a[i] = 'r';
+        }
+    }
+    ctx->a[ctx->size - 1] = '\r';
+}
+
+static void prepare_boundary(bench_ctx_t *ctx)
+{
+    size_t n = strlen(BENCH_BOUNDARY);
+    fill_random(ctx->a, ctx->size, 2);
+    for (size_t i = 0; i < ctx->size; i++) {
+        if (ctx->a[i] == '\r') {
+            ctx->a[i] = 'r';
+        }
+    }
+    if (ctx->size >= n) {
+        memcpy(ctx->a + ctx->size - n, BENCH_BOUNDARY, n);
+    }
+}
+
+static void prepare_compare(bench_ctx_t *ctx)
+{
+    fill_random(ctx->a, ctx->size, 3);
+    memcpy(ctx->b, ctx->a, ctx->size);
+}
+
+static void prepare_erased(bench_ctx_t *ctx)
+{
+    memset(ctx->a, 0xFF, ctx->size);
+}
+
+// The settings form with a few escapes, and a non-ASCII SSID where most
+// bytes are escaped
+static void prepare_text(bench_ctx_t *ctx, const char *sample, size_t sample_len)
+{
+    for (size_t i = 0; i < ctx->size; i++) {
+        ctx->text[i] = sample[i % sample_len];
+    }
+    ctx->text[ctx->size] = '\0';
+}
+
+static void prepare_form(bench_ctx_t *ctx)
+{
+    static const char sample[] = "ssid=Boat%20Network+5G&relay=10.0.0.17%3A8080%2C10.0.0.18&serial=12345&name=";
+    prepare_text(ctx, sample, sizeof(sample) - 1);
+}
+
+static void prepare_utf8(bench_ctx_t *ctx)
+{
+    static const char sample[] = "ssid=%D0%9B%D0%BE%D0%B4%D0%BA%D0%B0+%E2%9B%B5&pass=%C3%A4%C3%B6%25%26";
+    prepare_text(ctx, sample, sizeof(sample) - 1);
+}
+
+
+// Byte scan for '\r', e.g. the start of a multipart delimiter
+static uint32_t scan_ref(const bench_ctx_t *ctx)
+{
+    for (size_t i = 0; i < ctx->size; i++) {
+        if (ctx->a[i] == '\r') {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static uint32_t scan_kern(const bench_ctx_t *ctx)
+{
+    const uint8_t *hit = kern_find_byte(ctx->a, ctx->size, '\r');
+    return hit ? hit - ctx->a : 0;
+}
+
+static uint32_t scan_lib(const bench_ctx_t *ctx)
+{
+    const uint8_t *hit = memchr(ctx->a, '\r', ctx->size);
+    return hit ? hit - ctx->a : 0;
+}
+
+
+// Multipart boundary search
+static uint32_t boundary_ref(const bench_ctx_t *ctx)
+{
+    size_t n = strlen(BENCH_BOUNDARY);
+    for (size_t i = 0; i + n <= ctx->size; i++) {
+        size_t k = 0;
+        while (k < n && ctx->a[i + k] == (uint8_t)BENCH_BOUNDARY[k]) {
+            k++;
+        }
+        if (k == n) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static uint32_t boundary_kern(const bench_ctx_t *ctx)
+{
+    const uint8_t *hit = kern_find(ctx->a, ctx->size, (const uint8_t *)BENCH_BOUNDARY, strlen(BENCH_BOUNDARY));
+    return hit ? hit - ctx->a : 0;
+}
+
+static uint32_t boundary_lib(const bench_ctx_t *ctx)
+{
+    const uint8_t *hit = memmem(ctx->a, ctx->size, BENCH_BOUNDARY, strlen(BENCH_BOUNDARY));
+    return hit ? hit - ctx->a : 0;
+}
+
+
+// Sector compare
+static uint32_t compare_ref(const bench_ctx_t *ctx)
+{
+    for (size_t i = 0; i < ctx->size; i++) {
+        if (ctx->a[i] != ctx->b[i]) {
+            return i;
+        }
+    }
+    return ctx->size;
+}
+
+static uint32_t compare_kern(const bench_ctx_t *ctx)
+{
+    return kern_mismatch(ctx->a, ctx->b, ctx->size);
+}
+
+static uint32_t compare_lib(const bench_ctx_t *ctx)
+{
+    return memcmp(ctx->a, ctx->b, ctx->size) == 0 ? ctx->size : 0;
+}
+
+
+// Erased sector check
+static uint32_t erased_ref(const bench_ctx_t *ctx)
+{
+    for (size_t i = 0; i < ctx->size; i++) {
+        if (ctx->a[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint32_t erased_kern(const bench_ctx_t *ctx)
+{
+    return kern_is_filled(ctx->a, ctx->size, 0xFF);
+}
+
+
+// CRC-32, the reference is the single 256 entry table
+static uint32_t crc_ref(const bench_ctx_t *ctx)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < ctx->size; i++) {
+        crc = table[(crc ^ ctx->a[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t crc_kern(const bench_ctx_t *ctx)
+{
+    return kern_crc32(0, ctx->a, ctx->size);
+}
+
+#ifdef ESP_PLATFORM
+static uint32_t crc_rom(const bench_ctx_t *ctx)
+{
+    return esp_rom_crc32_le(0, ctx->a, ctx->size);
+}
+#endif
+
+
+// URL decoding, the reference is the httpd_unescape_uri() this replaced
+static uint32_t uri_ref(const bench_ctx_t *ctx)
+{
+    const char *src = ctx->text;
+    char *dest = ctx->out;
+    size_t si = 0, di = 0;
+    while (src[si]) {
+        if (src[si] == '%' && isxdigit((unsigned char)src[si+1]) && isxdigit((unsigned char)src[si+2])) {
+            char hex[3] = { src[si+1], src[si+2], 0 };
+            dest[di++] = (char) strtol(hex, NULL, 16);
+            si += 3;
+        } else if (src[si] == '+') {
+            dest[di++] = ' ';
+            si++;
+        } else {
+            dest[di++] = src[si++];
+        }
+    }
+    return di;
+}
+
+static uint32_t uri_kern(const bench_ctx_t *ctx)
+{
+    return uri_decode(ctx->out, ctx->size + 1, ctx->text, ctx->size);
+}
+
+static uint32_t uri_stream(const bench_ctx_t *ctx)
+{
+    uri_decoder_t d;
+    uri_decoder_init(&d);
+    size_t n = 0;
+    for (size_t i = 0; i < ctx->size; i += BENCH_CHUNK) {
+        size_t len = (ctx->size - i < BENCH_CHUNK) ? ctx->size - i : BENCH_CHUNK;
+        n += uri_decoder_feed(&d, ctx->out + n, ctx->text + i, len);
+    }
+    return n + uri_decoder_finish(&d, ctx->out + n);
+}
+
+
+// Debug flag test, against the same loop without it. The work is not
+// inlined and may write memory as far as the compiler knows, so the flag
+// is loaded and tested on every iteration as on a real hot path.
+static volatile uint32_t    debug_hits;
+
+static __attribute__((noipa)) uint32_t dbg_work(uint32_t x)
+{
+    return x * 2654435761u;
+}
+
+static uint32_t dbg_plain(const bench_ctx_t *ctx)
+{
+    uint32_t h = 0;
+    for (size_t i = 0; i < ctx->size; i++) {
+        h += dbg_work(ctx->a[i]);
+    }
+    return h;
+}
+
+static uint32_t dbg_checked(const bench_ctx_t *ctx)
+{
+    uint32_t h = 0;
+    for (size_t i = 0; i < ctx->size; i++) {
+        h += dbg_work(ctx->a[i]);
+        if (debug_enabled(DEBUG_LOG_REQUESTS)) {
+            debug_hits++;
+        }
+    }
+    return h;
+}
+
+
+static const bench_case_t cases[] = {
+    { "scan",       prepare_scan,     scan_ref,     scan_kern,     scan_lib,     false },
+    { "boundary",   prepare_boundary, boundary_ref, boundary_kern, boundary_lib, false },
+    { "compare",    prepare_compare,  compare_ref,  compare_kern,  compare_lib,  false },
+    { "erased",     prepare_erased,   erased_ref,   erased_kern,   NULL,         false },
+#ifdef ESP_PLATFORM
+    { "crc32",      prepare_scan,     crc_ref,      crc_kern,      crc_rom,      false },
+#else
+    { "crc32",      prepare_scan,     crc_ref,      crc_kern,      NULL,         false },
+#endif
+    { "uri_form",   prepare_form,     uri_ref,      uri_kern,      NULL,         true },
+    { "uri_utf8",   prepare_utf8,     uri_ref,      uri_kern,      NULL,         true },
+    { "uri_stream", prepare_form,     uri_ref,      uri_stream,    NULL,         true },
+    { "dbg_flag",   prepare_scan,     dbg_plain,    dbg_checked,   NULL,         false },
+};
+
+
+/**
+ * @brief Returns the throughput of fn in MB/s.
+ */
+static double measure(bench_fn_t fn, const bench_ctx_t *ctx)
+{
+    size_t reps = BENCH_BYTES / ctx->size;
+    reps = reps ? reps : 1;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < reps; i++) {
+        sink += fn(ctx);
+    }
+    uint64_t elapsed = now_ns() - start;
+    return (elapsed > 0) ? (double)reps * ctx->size * 1000.0 / elapsed : 0.0;
+}
+
+
+/**
+ * @brief Runs all benchmarks for buffer sizes from 16 bytes up to max_size.
+ *
+ * @param max_size Largest buffer size.
+ *
+ * @return The number of kernels whose result differed from the reference.
+ */
+int kernel_bench_run(size_t max_size)
+{
+    bench_ctx_t ctx = {
+        .a    = malloc(max_size + 4),
+        .b    = malloc(max_size + 4),
+        .text = malloc(max_size + 1),
+        .out  = malloc(max_size + URI_DECODE_MAX_HELD + 1),
+    };
+    if (!ctx.a || !ctx.b || !ctx.text || !ctx.out) {
+        printf("kbench: out of memory\n");
+        free(ctx.a);
+        free(ctx.b);
+        free(ctx.text);
+        free(ctx.out);
+        return -1;
+    }
+
+    int failures = 0;
+    printf("%-11s %7s %10s %10s %10s %8s\n", "kernel", "bytes", "ref MB/s", "kern MB/s", "lib MB/s", "speedup");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const bench_case_t *bc = &cases[c];
+        for (size_t size = 16; size <= max_size; size *= 4) {
+            // Offset by one byte so the unaligned head is exercised too
+            bench_ctx_t run = ctx;
+            run.a += 1;
+            run.b += 1;
+            run.size = size;
+            bc->prepare(&run);
+
+            uint32_t expect = bc->ref(&run);
+            if (bc->check_out) {
+                memcpy(run.b, run.out, expect);
+            }
+            // The kernels run on the DNS, HTTP and OTA paths, which must not allocate
+            alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_KERNELS);
+            bool ok = (bc->kern(&run) == expect);
+            double kern = measure(bc->kern, &run);
+            alloc_guard_exit(guard);
+            ok = ok && (bc->lib == NULL || bc->lib(&run) == expect);
+            if (bc->check_out) {
+                ok = ok && memcmp(run.b, run.out, expect) == 0;
+            }
+            failures += ok ? 0 : 1;
+
+            double ref = measure(bc->ref, &run);
+            char lib[16] = "-";
+            if (bc->lib) {
+                snprintf(lib, sizeof(lib), "%.1f", measure(bc->lib, &run));
+            }
+            printf("%-11s %7u %10.1f %10.1f %10s %7.1fx%s\n", bc->name, (unsigned)size, ref, kern, lib,
+                   (ref > 0) ? kern / ref : 0.0, ok ? "" : "  MISMATCH");
+        }
+    }
+
+    free(ctx.a);
+    free(ctx.b);
+    free(ctx.text);
+    free(ctx.out);
+    return failures;
+}
+
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Handler for the 'kbench' console command.
+ */
+static int kbench_cmd(int argc, char **argv)
+{
+    size_t max_size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 4096;
+    if (max_size < 16) {
+        max_size = 16;
+    }
+    return kernel_bench_run(max_size) == 0 ? 0 : 1;
+}
+
+
+/**
+ * @brief Registers the 'kbench' console command.
+ */
+void register_kernel_bench(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "kbench",
+        .help = "Benchmark the scan/compare/CRC kernels and URI decoder against reference loops",
+        .hint = "[<max_bytes>]",
+        .func = &kbench_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * kernel_bench.h
+ *
+ * Throughput benchmark of the kernels in kernels.h, see kernel_bench.c.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef KERNEL_BENCH_H
+#define KERNEL_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+// Functions
+int  kernel_bench_run(size_t max_size);
+void register_kernel_bench(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
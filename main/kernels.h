@@ -0,0 +1,39 @@
+/*
+ * kernels.h
+ *
+ * Small data-parallel helpers for the byte scanning and comparison loops on
+ * the OTA and web paths: byte and delimiter search, sector compares and
+ * CRC-32. They work on 32-bit words at a time (SWAR) with plain C, and the
+ * sector compares on 128-bit PIE vectors on the ESP32-S3 (kernels_s3.S).
+ * The C code also runs in the host builds under tools/host, where
+ * kernel_bench compares it against byte-at-a-time reference loops.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Functions
+const uint8_t * kern_find_byte(const uint8_t *data, size_t len, uint8_t c);
+const uint8_t * kern_find_byte2(const uint8_t *data, size_t len, uint8_t c1, uint8_t c2);
+const uint8_t * kern_find(const uint8_t *data, size_t len, const uint8_t *needle, size_t needle_len);
+size_t          kern_mismatch(const void *a, const void *b, size_t len);
+bool            kern_is_filled(const void *data, size_t len, uint8_t value);
+uint32_t        kern_crc32(uint32_t crc, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * load_shed.c
+ *
+ * This file implements the load shedding state. An esp_timer samples the
+ * free internal heap and the CPU idle time (the run time of the idle tasks
+ * of both cores) every SAMPLE_PERIOD_MS. Shedding starts on the first
+ * sample below a threshold and ends once both have been clear of it, with
+ * some headroom, for CONFIG_LOAD_SHED_HOLD_MS, so it does not flap while an
+ * upload alternates between receiving and writing flash.
+ *
+ * The callers decide what to shed; load_shed() only answers, counts the
+ * decision and records it in the trace ring. Each episode is traced as a
+ * span of its own, so the decisions line up with it in /debug/trace.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "trace.h"
+#include "load_shed.h"
+
+
+#define SAMPLE_PERIOD_MS    250
+#define HEAP_CLEAR          (CONFIG_LOAD_SHED_HEAP_MIN + CONFIG_LOAD_SHED_HEAP_MIN / 4)
+#ifdef CONFIG_LOAD_SHED_IDLE_MIN
+    #define IDLE_MIN        CONFIG_LOAD_SHED_IDLE_MIN
+#else
+    #define IDLE_MIN        0
+#endif
+#define IDLE_CLEAR          (IDLE_MIN ? IDLE_MIN + 5 : 0)
+
+
+// Local variables
+static const char           *TAG = "load_shed";
+static load_shed_stats_t    st = { .min_free_heap = UINT32_MAX, .min_idle_pct = 100 };
+static load_shed_mode_t     mode = LOAD_SHED_AUTO;
+static int64_t              shed_since;
+static int64_t              clear_since;
+static void                 (*recover_cb)(void);
+static char                 retry_after[12];
+static portMUX_TYPE         s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+/**
+ * @brief Returns the CPU idle time since the previous call in percent,
+ *        over both cores. 100 without run time stats.
+ */
+static uint32_t cpu_idle_pct(int64_t now)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    static int64_t  last_us;
+    static uint32_t last_idle;
+
+    uint32_t idle = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        idle += ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+    }
+    int64_t wall_us = (now - last_us) * portNUM_PROCESSORS;
+    uint32_t pct = (last_us && wall_us > 0) ? (uint32_t)((uint64_t)(uint32_t)(idle - last_idle) * 100 / wall_us) : 100;
+    last_us = now;
+    last_idle = idle;
+    return (pct > 100) ? 100 : pct;
+#else
+    return 100;
+#endif
+}
+
+
+/**
+ * @brief Samples the heap and CPU and starts or ends shedding. Runs from
+ *        the esp_timer task.
+ */
+static void sample(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t heap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    uint32_t idle = cpu_idle_pct(now);
+
+    uint32_t pressure = ((heap < CONFIG_LOAD_SHED_HEAP_MIN) ? LOAD_SHED_HEAP : 0) |
+                        (((int)idle < IDLE_MIN) ? LOAD_SHED_CPU : 0);
+    bool clear = (heap >= HEAP_CLEAR && (int)idle >= IDLE_CLEAR);
+    if (mode == LOAD_SHED_FORCE) {
+        pressure = LOAD_SHED_FORCED;
+        clear = false;
+    } else if (mode == LOAD_SHED_OFF) {
+        pressure = 0;
+        clear = true;
+    }
+
+    bool started = false, ended = false;
+    int64_t since = shed_since;
+    portENTER_CRITICAL(&s_lock);
+    st.free_heap = heap;
+    st.min_free_heap = (heap < st.min_free_heap) ? heap : st.min_free_heap;
+    st.idle_pct = idle;
+    st.min_idle_pct = (idle < st.min_idle_pct) ? idle : st.min_idle_pct;
+    if (!st.active && pressure) {
+        st.active = started = true;
+        st.reasons = pressure;
+        st.episodes++;
+        shed_since = now;
+        clear_since = 0;
+    } else if (st.active) {
+        st.reasons |= pressure;
+        if (!clear) {
+            clear_since = 0;
+        } else if (clear_since == 0 && mode != LOAD_SHED_OFF) {
+            clear_since = now;
+        } else if (mode == LOAD_SHED_OFF || now - clear_since >= CONFIG_LOAD_SHED_HOLD_MS * 1000LL) {
+            st.active = false;
+            ended = true;
+            st.shed_us += now - since;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (started) {
+        ESP_LOGW(TAG, "Shedding load%s: free heap %lu%s, CPU idle %lu%%%s",
+                 (pressure & LOAD_SHED_FORCED) ? " (forced)" : "", (unsigned long)heap,
+                 (pressure & LOAD_SHED_HEAP) ? " (low)" : "", (unsigned long)idle,
+                 (pressure & LOAD_SHED_CPU) ? " (low)" : "");
+    } else if (ended) {
+        trace_span(TRACE_SHED, since, now - since, SHED_COUNT, 0);
+        ESP_LOGI(TAG, "Load shedding ended after %lld ms", (now - since) / 1000);
+        if (recover_cb) {
+            recover_cb();
+        }
+    }
+}
+
+
+/**
+ * @brief Starts sampling. Call once at start up.
+ */
+void load_shed_init(void)
+{
+    snprintf(retry_after, sizeof(retry_after), "%d", CONFIG_LOAD_SHED_RETRY_AFTER_S);
+
+    const esp_timer_create_args_t args = {
+        .callback = sample,
+        .name = "load_shed",
+    };
+    esp_timer_handle_t timer;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, SAMPLE_PERIOD_MS * 1000));
+}
+
+
+/**
+ * @brief Decides whether to shed a piece of work. Counts and traces the
+ *        decision if so.
+ *
+ * @return true if the caller should take its degraded path.
+ */
+bool load_shed(shed_action_t action)
+{
+    if (!st.active) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_lock);
+    st.decisions[action]++;
+    portEXIT_CRITICAL(&s_lock);
+    trace_span(TRACE_SHED, esp_timer_get_time(), 0, action, 0);
+    return true;
+}
+
+
+/**
+ * @brief Returns true while shedding, without counting a decision.
+ */
+bool load_shed_active(void)
+{
+    return st.active;
+}
+
+
+/**
+ * @brief Sets the function called from the esp_timer task when shedding
+ *        ends, e.g. to commit deferred work. It must not block.
+ */
+void load_shed_set_recover_cb(void (*cb)(void))
+{
+    recover_cb = cb;
+}
+
+
+/**
+ * @brief Returns the state and counters. shed_us includes the running
+ *        episode.
+ */
+void load_shed_get_stats(load_shed_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = st;
+    if (st.active) {
+        stats->shed_us += esp_timer_get_time() - shed_since;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Clears the counters and the lowest samples.
+ */
+void load_shed_reset(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    memset(st.decisions, 0, sizeof(st.decisions));
+    st.episodes = st.active ? 1 : 0;
+    st.shed_us = 0;
+    if (st.active) {
+        shed_since = esp_timer_get_time();
+    }
+    st.min_free_heap = UINT32_MAX;
+    st.min_idle_pct = 100;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Selects what decides whether to shed. Takes effect at the next
+ *        sample.
+ */
+void load_shed_set_mode(load_shed_mode_t new_mode)
+{
+    mode = new_mode;
+}
+
+
+/**
+ * @brief Returns what decides whether to shed.
+ */
+load_shed_mode_t load_shed_get_mode(void)
+{
+    return mode;
+}
+
+
+/**
+ * @brief Returns the name of a load shedding mode.
+ */
+const char *load_shed_mode_name(load_shed_mode_t m)
+{
+    switch (m) {
+        case LOAD_SHED_AUTO:    return "auto";
+        case LOAD_SHED_FORCE:   return "force";
+        case LOAD_SHED_OFF:     return "off";
+        default:                return "unknown";
+    }
+}
+
+
+/**
+ * @brief Returns the name of a shed action, "shedding" for the episode.
+ */
+const char *shed_action_name(shed_action_t action)
+{
+    switch (action) {
+        case SHED_PAGE:     return "page";
+        case SHED_PROBE:    return "probe";
+        case SHED_DNS:      return "dns";
+        case SHED_SETTINGS: return "settings";
+        case SHED_UPLOAD:   return "upload";
+        default:            return "shedding";
+    }
+}
+
+
+/**
+ * @brief Returns the Retry-After value sent with refused work, in seconds.
+ */
+const char *load_shed_retry_after(void)
+{
+    return retry_after;
+}
+
+
+/**
+ * @brief Handler for the 'shed' console command.
+ */
+static int shed_cmd(int argc, char **argv)
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "auto") == 0) {
+            load_shed_set_mode(LOAD_SHED_AUTO);
+        } else if (strcmp(argv[1], "force") == 0) {
+            load_shed_set_mode(LOAD_SHED_FORCE);
+        } else if (strcmp(argv[1], "off") == 0) {
+            load_shed_set_mode(LOAD_SHED_OFF);
+        } else if (strcmp(argv[1], "reset") == 0) {
+            load_shed_reset();
+        } else {
+            printf("shed: expected 'auto', 'force', 'off' or 'reset'\n");
+            return 1;
+        }
+    }
+
+    load_shed_stats_t s;
+    load_shed_get_stats(&s);
+    printf("Mode %s, %s\n", load_shed_mode_name(mode), s.active ? "shedding" : "not shedding");
+    if (s.episodes) {
+        printf("Pressure in the %s episode:%s%s%s\n", s.active ? "current" : "last",
+               (s.reasons & LOAD_SHED_HEAP) ? " heap" : "", (s.reasons & LOAD_SHED_CPU) ? " cpu" : "",
+               (s.reasons & LOAD_SHED_FORCED) ? " forced" : "");
+    }
+    printf("Free heap %lu (lowest %lu, threshold %d), CPU idle %u%% (lowest %u%%, threshold %d%%)\n",
+           (unsigned long)s.free_heap, (unsigned long)s.min_free_heap, CONFIG_LOAD_SHED_HEAP_MIN,
+           s.idle_pct, s.min_idle_pct, IDLE_MIN);
+    printf("%lu episodes, %llu ms shedding\n", (unsigned long)s.episodes, (unsigned long long)(s.shed_us / 1000));
+    for (int i = 0; i < SHED_COUNT; i++) {
+        printf("  %-10s %8lu\n", shed_action_name(i), (unsigned long)s.decisions[i]);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'shed' console command.
+ */
+void register_load_shed(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "shed",
+        .help = "Show load shedding state and decisions, optionally switch the mode or clear the counters",
+        .hint = "[auto|force|off|reset]",
+        .func = &shed_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
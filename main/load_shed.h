@@ -0,0 +1,85 @@
+/*
+ * load_shed.h
+ *
+ * Load shedding. When free internal heap or CPU idle time drops below its
+ * threshold (the "Load shedding" menu), e.g. while an OTA update is being
+ * written with several clients connected, the device sheds optional work
+ * instead of failing at random: dynamic pages get a minimal answer,
+ * captive portal probes and DNS queries the cheapest valid one, settings
+ * commits are deferred until the pressure is gone and new uploads are
+ * refused with Retry-After. Every decision is counted and recorded in the
+ * trace ring.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef LOAD_SHED_H
+#define LOAD_SHED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Work that is shed under pressure
+typedef enum {
+    SHED_PAGE = 0,                          // Dynamic page answered with a minimal one
+    SHED_PROBE,                             // Captive portal probe answered with the bare redirect
+    SHED_DNS,                               // DNS query answered without logging
+    SHED_SETTINGS,                          // Settings commit deferred
+    SHED_UPLOAD,                            // New upload refused with Retry-After
+    SHED_COUNT
+} shed_action_t;
+
+
+// What decides whether to shed
+typedef enum {
+    LOAD_SHED_AUTO = 0,                     // Heap and CPU thresholds
+    LOAD_SHED_FORCE,                        // Always, to test the degraded paths
+    LOAD_SHED_OFF,                          // Never
+} load_shed_mode_t;
+
+
+// Pressure that started shedding
+#define LOAD_SHED_HEAP      0x01
+#define LOAD_SHED_CPU       0x02
+#define LOAD_SHED_FORCED    0x04
+
+
+// State and counters
+typedef struct {
+    bool        active;
+    uint32_t    reasons;                    // LOAD_SHED_* bits of the current (or last) episode
+    uint32_t    episodes;                   // Times shedding started
+    uint64_t    shed_us;                    // Total time spent shedding
+    uint32_t    free_heap;                  // Free internal heap at the last sample
+    uint32_t    min_free_heap;              // Lowest sampled free internal heap
+    uint8_t     idle_pct;                   // CPU idle over the last sample period, both cores
+    uint8_t     min_idle_pct;               // Lowest sampled CPU idle
+    uint32_t    decisions[SHED_COUNT];      // Work shed, per action
+} load_shed_stats_t;
+
+
+// Functions
+void                load_shed_init(void);
+bool                load_shed(shed_action_t action);
+bool                load_shed_active(void);
+void                load_shed_set_recover_cb(void (*cb)(void));
+void                load_shed_get_stats(load_shed_stats_t *stats);
+void                load_shed_reset(void);
+void                load_shed_set_mode(load_shed_mode_t mode);
+load_shed_mode_t    load_shed_get_mode(void);
+const char         *load_shed_mode_name(load_shed_mode_t mode);
+const char         *shed_action_name(shed_action_t action);
+const char         *load_shed_retry_after(void);
+void                register_load_shed(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -21,6 +21,14 @@
 #include "console.h"
 #include "settings.h"
 #include "esp_ota_ops.h"
+#include "image_catalog.h"
+#include "netconn_ota.h"
+#include "perf_lock.h"
+#include "ram_budget.h"
+#include "stack_usage.h"
+#include "load_shed.h"
+#include "mdns_responder.h"
+#include "nmea_task.h"
 
 
 // === Logging identifier ===
@@ -68,15 +76,44 @@ void app_main(void)
     // Mark the current app image as valid
     esp_ota_mark_app_valid_cancel_rollback();
 
+    // Heap taken by each subsystem as it starts, see the 'ram' command
+    ram_budget_begin();
+    stack_usage_init();
+
     // Initialize non-volatile storage
     settings_init(false);               // false = don't erase settings
+    ram_budget_mark("settings");
+
+    // Catalog the images held in the app partitions
+    image_catalog_init();
+    ram_budget_mark("image catalog");
+
+    // Idle at a low clock, raised while OTA, HTTP or DNS work is running
+    perf_lock_init();
+    ram_budget_mark("perf locks");
+
+    // Degrade gracefully when heap or CPU run short
+    load_shed_init();
+    ram_budget_mark("load shedding");
 
     // Initialize the WiFi AP and HTTP server
     wifi_init_softap();
+    ram_budget_mark("wifi");
     start_webserver();
+    ram_budget_mark("http + dns");
+    mdns_responder_start();
+    ram_budget_mark("mdns");
+    netconn_ota_start();
+    ram_budget_mark("netconn ota");
+
+    // Listen to the NMEA 2000 bus
+    nmea_task_start();
+    ram_budget_mark("nmea");
 
     // Start the REPL console.
     start_console(NULL);
+    ram_budget_mark("console");
+    ram_budget_log();
 
     // Main loop should never exit - this task is essentially a system monitor
     // that ensures that all critical tasks are running and healthy.
@@ -0,0 +1,367 @@
+/*
+ * mdns_proto.c
+ *
+ * This file builds the mDNS response packets described in mdns_proto.h and
+ * matches queries against them. Names in the packets are compressed, so the
+ * full set of records fits in about 300 bytes.
+ *
+ * There is no probing or conflict resolution: the host name carries the
+ * unit's MAC suffix, so no other unit on the network claims it. Known
+ * answers in a query do not suppress the reply.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include "mdns_proto.h"
+
+
+#define FLAG_QR             0x8000          // Response
+#define FLAG_AA             0x0400          // Authoritative
+#define FLAG_OPCODE         0x7800
+
+#define TYPE_A              1
+#define TYPE_PTR            12
+#define TYPE_TXT            16
+#define TYPE_SRV            33
+#define TYPE_ANY            255
+#define CLASS_IN            1
+#define CLASS_ANY           255
+#define CLASS_FLUSH         0x8000          // Cache-flush bit of a unique record
+#define CLASS_QU            0x8000          // Unicast response bit of a question
+
+#define TTL_HOST            120             // Records naming the host (RFC 6762 section 10)
+#define TTL_OTHER           4500
+
+#define SERVICE             "_http._tcp.local"
+#define SERVICES_ENUM       "_services._dns-sd._udp.local"
+
+
+// Packet being built
+typedef struct {
+    mdns_packet_t   *p;
+    bool            ok;
+} writer_t;
+
+
+// Big-endian helpers
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v >> 16);
+    put_u16(p + 2, v & 0xFFFF);
+}
+
+
+/**
+ * @brief Appends bytes to a packet.
+ *
+ * @return The offset they were written at.
+ */
+static uint16_t put(writer_t *w, const void *data, size_t len)
+{
+    uint16_t ofs = w->p->len;
+    if (!w->ok || w->p->len + len > MDNS_MAX_PACKET) {
+        w->ok = false;
+        return ofs;
+    }
+    memcpy(&w->p->data[ofs], data, len);
+    w->p->len += len;
+    return ofs;
+}
+
+static void put_be16(writer_t *w, uint16_t v)
+{
+    uint8_t b[2];
+    put_u16(b, v);
+    put(w, b, 2);
+}
+
+
+/**
+ * @brief Appends the labels of a dotted name, ending it with a pointer to
+ *        an earlier name, or with the root label if ptr is 0.
+ *
+ * @return The offset of the name.
+ */
+static uint16_t put_name(writer_t *w, const char *dotted, uint16_t ptr)
+{
+    uint16_t ofs = w->p->len;
+    while (*dotted) {
+        const char *dot = strchr(dotted, '.');
+        size_t n = dot ? (size_t)(dot - dotted) : strlen(dotted);
+        uint8_t len = (n > 63) ? 63 : n;
+        put(w, &len, 1);
+        put(w, dotted, len);
+        dotted += n + (dot ? 1 : 0);
+    }
+    if (ptr) {
+        put_be16(w, 0xC000 | ptr);
+    } else {
+        put(w, "", 1);
+    }
+    return ofs;
+}
+
+
+/**
+ * @brief Appends the type, class and TTL of a record, and a placeholder
+ *        for its data length.
+ *
+ * @return The offset of the data length, for end_record().
+ */
+static uint16_t begin_record(writer_t *w, uint16_t type, uint16_t cls, uint32_t ttl)
+{
+    uint8_t b[10];
+    put_u16(b, type);
+    put_u16(b + 2, cls);
+    put_u32(b + 4, ttl);
+    put_u16(b + 8, 0);
+    return put(w, b, sizeof(b)) + 8;
+}
+
+static void end_record(writer_t *w, uint16_t rdlength_ofs)
+{
+    if (w->ok) {
+        put_u16(&w->p->data[rdlength_ofs], w->p->len - rdlength_ofs - 2);
+    }
+}
+
+
+/**
+ * @brief Appends an A record, by name or by a pointer to it.
+ */
+static void put_a(writer_t *w, const char *name, uint16_t ptr, uint32_t ip)
+{
+    if (name) {
+        put_name(w, name, 0);
+    } else {
+        put_be16(w, 0xC000 | ptr);
+    }
+    uint16_t rd = begin_record(w, TYPE_A, CLASS_IN | CLASS_FLUSH, TTL_HOST);
+    uint8_t b[4];
+    put_u32(b, ip);
+    w->p->ip_ofs = put(w, b, 4);
+    end_record(w, rd);
+}
+
+
+/**
+ * @brief Starts a response packet.
+ */
+static void begin_packet(writer_t *w, mdns_packet_t *p, uint16_t answers)
+{
+    uint8_t hdr[12] = { 0 };
+    put_u16(hdr + 2, FLAG_QR | FLAG_AA);
+    put_u16(hdr + 6, answers);
+    memset(p, 0, sizeof(*p));
+    w->p = p;
+    w->ok = true;
+    put(w, hdr, sizeof(hdr));
+}
+
+
+/**
+ * @brief Builds the response packets.
+ *
+ * @param r         Records to build.
+ * @param host      Host name without ".local", also the service instance name.
+ * @param port      HTTP port.
+ * @param txt       TXT strings, "key=value".
+ * @param txt_count Number of TXT strings.
+ * @param ip        Address, host order.
+ *
+ * @return false if the names are too long or the records do not fit.
+ */
+bool mdns_proto_build(mdns_records_t *r, const char *host, uint16_t port, const char *const *txt,
+                      int txt_count, uint32_t ip)
+{
+    if (strlen(host) + sizeof(SERVICE) + 1 > MDNS_MAX_NAME || strlen(host) > 63 || strchr(host, '.')) {
+        return false;
+    }
+    memset(r, 0, sizeof(*r));
+    r->ip = ip;
+    char label[64] = { 0 };
+    for (size_t i = 0; host[i]; i++) {
+        label[i] = tolower((unsigned char)host[i]);
+    }
+    strcpy(r->host, label);
+    strcpy(r->instance, label);
+    strcat(r->host, ".local");
+    strcat(r->instance, "." SERVICE);
+
+    // Host name queries
+    writer_t w;
+    begin_packet(&w, &r->host_packet, 1);
+    put_a(&w, r->host, 0, ip);
+    if (!w.ok) {
+        return false;
+    }
+
+    // Everything, for service queries and announcements
+    begin_packet(&w, &r->all_packet, 5);
+
+    // _services._dns-sd._udp.local PTR _http._tcp.local
+    uint16_t enum_ofs = put_name(&w, SERVICES_ENUM, 0);
+    uint16_t local_ofs = enum_ofs + sizeof(SERVICES_ENUM) - sizeof("local");
+    uint16_t rd = begin_record(&w, TYPE_PTR, CLASS_IN, TTL_OTHER);
+    uint16_t service_ofs = put_name(&w, "_http._tcp", local_ofs);
+    end_record(&w, rd);
+
+    // _http._tcp.local PTR <host>._http._tcp.local
+    put_be16(&w, 0xC000 | service_ofs);
+    rd = begin_record(&w, TYPE_PTR, CLASS_IN, TTL_OTHER);
+    uint16_t instance_ofs = put_name(&w, label, service_ofs);
+    end_record(&w, rd);
+
+    // <host>._http._tcp.local SRV 0 0 <port> <host>.local
+    put_be16(&w, 0xC000 | instance_ofs);
+    rd = begin_record(&w, TYPE_SRV, CLASS_IN | CLASS_FLUSH, TTL_HOST);
+    uint8_t srv[6] = { 0 };
+    put_u16(srv + 4, port);
+    put(&w, srv, sizeof(srv));
+    uint16_t host_ofs = put_name(&w, label, local_ofs);
+    end_record(&w, rd);
+
+    // <host>._http._tcp.local TXT
+    put_be16(&w, 0xC000 | instance_ofs);
+    rd = begin_record(&w, TYPE_TXT, CLASS_IN | CLASS_FLUSH, TTL_OTHER);
+    for (int i = 0; i < txt_count; i++) {
+        size_t n = strlen(txt[i]);
+        uint8_t len = (n > 255) ? 255 : n;
+        put(&w, &len, 1);
+        put(&w, txt[i], len);
+    }
+    end_record(&w, rd);
+
+    // <host>.local A
+    put_a(&w, NULL, host_ofs, ip);
+    return w.ok;
+}
+
+
+/**
+ * @brief Patches a new address into the packets.
+ */
+void mdns_proto_set_ip(mdns_records_t *r, uint32_t ip)
+{
+    r->ip = ip;
+    put_u32(&r->host_packet.data[r->host_packet.ip_ofs], ip);
+    put_u32(&r->all_packet.data[r->all_packet.ip_ofs], ip);
+}
+
+
+/**
+ * @brief Returns the packet of an answer, NULL for MDNS_ANSWER_NONE.
+ */
+const mdns_packet_t *mdns_proto_packet(const mdns_records_t *r, mdns_answer_t answer)
+{
+    switch (answer) {
+        case MDNS_ANSWER_HOST:  return &r->host_packet;
+        case MDNS_ANSWER_ALL:   return &r->all_packet;
+        default:                return NULL;
+    }
+}
+
+
+/**
+ * @brief Reads a name from a message, following compression pointers, as a
+ *        lowercase dotted string.
+ *
+ * @return The offset after the name where it starts, 0 if malformed or
+ *         longer than the names matched.
+ */
+static size_t read_name(const uint8_t *msg, size_t len, size_t ofs, char *out)
+{
+    size_t next = 0, n = 0;
+    int hops = 0;
+
+    while (ofs < len) {
+        uint8_t label = msg[ofs];
+        if (label == 0) {
+            out[n ? n - 1 : 0] = '\0';
+            return next ? next : ofs + 1;
+        }
+        if ((label & 0xC0) == 0xC0) {
+            if (ofs + 1 >= len || ++hops > 8) {
+                return 0;
+            }
+            next = next ? next : ofs + 2;
+            ofs = ((label & 0x3F) << 8) | msg[ofs + 1];
+            continue;
+        }
+        if (label > 63 || ofs + 1 + label > len || n + label + 1 >= MDNS_MAX_NAME) {
+            return 0;
+        }
+        for (int i = 0; i < label; i++) {
+            out[n++] = tolower(msg[ofs + 1 + i]);
+        }
+        out[n++] = '.';
+        ofs += 1 + label;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Matches a query against the records.
+ *
+ * @param r       The records.
+ * @param msg     The message (UDP payload).
+ * @param len     Its length.
+ * @param unicast Set if a matching question asks for a unicast response.
+ *
+ * @return The packet to answer with. Responses, and queries for names or
+ *         types not held, get MDNS_ANSWER_NONE.
+ */
+mdns_answer_t mdns_proto_match(const mdns_records_t *r, const uint8_t *msg, size_t len, bool *unicast)
+{
+    *unicast = false;
+    if (len < 12 || (get_u16(msg + 2) & (FLAG_QR | FLAG_OPCODE)) != 0) {
+        return MDNS_ANSWER_NONE;
+    }
+
+    mdns_answer_t answer = MDNS_ANSWER_NONE;
+    size_t ofs = 12;
+    for (int q = get_u16(msg + 4); q > 0; q--) {
+        char name[MDNS_MAX_NAME];
+        ofs = read_name(msg, len, ofs, name);
+        if (ofs == 0 || ofs + 4 > len) {
+            break;
+        }
+        uint16_t type = get_u16(msg + ofs);
+        uint16_t cls = get_u16(msg + ofs + 2);
+        ofs += 4;
+        if ((cls & ~CLASS_QU) != CLASS_IN && (cls & ~CLASS_QU) != CLASS_ANY) {
+            continue;
+        }
+
+        mdns_answer_t a = MDNS_ANSWER_NONE;
+        if (strcmp(name, r->host) == 0 && (type == TYPE_A || type == TYPE_ANY)) {
+            a = MDNS_ANSWER_HOST;
+        } else if ((strcmp(name, SERVICE) == 0 || strcmp(name, SERVICES_ENUM) == 0) &&
+                   (type == TYPE_PTR || type == TYPE_ANY)) {
+            a = MDNS_ANSWER_ALL;
+        } else if (strcmp(name, r->instance) == 0 &&
+                   (type == TYPE_SRV || type == TYPE_TXT || type == TYPE_ANY)) {
+            a = MDNS_ANSWER_ALL;
+        }
+        if (a != MDNS_ANSWER_NONE) {
+            *unicast |= (cls & CLASS_QU) != 0;
+            answer = (a > answer) ? a : answer;
+        }
+    }
+    return answer;
+}
@@ -0,0 +1,76 @@
+/*
+ * mdns_proto.h
+ *
+ * Multicast DNS / DNS-SD records of one unit (RFC 6762, RFC 6763): the
+ * host name <host>.local, and an _http._tcp service instance of the same
+ * name with TXT records for the version and the OTA capabilities.
+ *
+ * The responses are built once into two packets: one holding only the A
+ * record, for host name queries, and one holding every record, used for
+ * service queries and the announcements. Only the address is patched in
+ * place when it changes. A query is matched by comparing its questions
+ * against the four names answered for, and answered with one of the
+ * packets as it stands, so answering costs a send.
+ *
+ * This module has no ESP-IDF dependencies so it can be exercised on a
+ * Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef MDNS_PROTO_H
+#define MDNS_PROTO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MDNS_PORT               5353
+#define MDNS_GROUP              0xE00000FB                  // 224.0.0.251
+#define MDNS_MAX_PACKET         384                         // The full set takes about 300
+#define MDNS_MAX_NAME           64                          // Longest name matched, dotted
+
+
+// Packet answering a query
+typedef enum {
+    MDNS_ANSWER_NONE = 0,
+    MDNS_ANSWER_HOST,                       // The A record
+    MDNS_ANSWER_ALL,                        // Every record
+} mdns_answer_t;
+
+
+// A built response
+typedef struct {
+    uint8_t     data[MDNS_MAX_PACKET];
+    uint16_t    len;
+    uint16_t    ip_ofs;                     // Offset of the A record's address
+} mdns_packet_t;
+
+
+// Records of the unit
+typedef struct {
+    mdns_packet_t   host_packet;                    // MDNS_ANSWER_HOST
+    mdns_packet_t   all_packet;                     // MDNS_ANSWER_ALL, also the announcement
+    char            host[MDNS_MAX_NAME];            // <host>.local
+    char            instance[MDNS_MAX_NAME];        // <host>._http._tcp.local
+    uint32_t        ip;                             // Host order
+} mdns_records_t;
+
+
+// Functions
+bool                 mdns_proto_build(mdns_records_t *r, const char *host, uint16_t port, const char *const *txt,
+                                      int txt_count, uint32_t ip);
+void                 mdns_proto_set_ip(mdns_records_t *r, uint32_t ip);
+mdns_answer_t        mdns_proto_match(const mdns_records_t *r, const uint8_t *msg, size_t len, bool *unicast);
+const mdns_packet_t *mdns_proto_packet(const mdns_records_t *r, mdns_answer_t answer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
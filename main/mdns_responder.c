@@ -0,0 +1,324 @@
+/*
+ * mdns_responder.c
+ *
+ * This file runs the mDNS responder on the softAP. Like the DHCP server it
+ * is a raw lwIP UDP pcb, so queries are handled in the lwIP task without a
+ * task or socket of its own. Each query is matched against the four names
+ * answered for and anything else (other hosts' responses, queries for
+ * other names) is dropped without further parsing. A match is answered by
+ * sending one of the prebuilt packets by reference, without copying it.
+ *
+ * The same answer is multicast at most once a second (RFC 6762 section 6),
+ * which also bounds the work when many clients ask at once. The records
+ * are announced twice, a second apart, when the AP starts, and once more
+ * when a station gets a lease, so a tool that just joined sees the unit
+ * without asking. The address is checked before each announcement and
+ * patched into the packets if it changed. Legacy unicast queries (from a
+ * port other than 5353) are not answered.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_app_desc.h"
+#include "esp_console.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_netif_net_stack.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "lwip/igmp.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "sdkconfig.h"
+#include "mdns_proto.h"
+#include "mdns_responder.h"
+
+
+#if CONFIG_MDNS_RESPONDER
+
+#define HTTP_PORT           80
+#define ANNOUNCE_COUNT      2
+#define ANNOUNCE_GAP_MS     1000
+#define MIN_INTERVAL_US     1000000         // Between multicasts of the same answer
+
+
+extern const char *get_ssid(void);
+
+
+// Local variables
+static const char               *TAG = "mdns";
+static mdns_records_t           records;
+static char                     txt_project[40];
+static char                     txt_version[40];
+static char                     txt_caps[96];
+static char                     txt_port[16];
+static esp_netif_t              *ap_netif;
+static struct udp_pcb           *pcb;
+static int64_t                  last_multicast_us[2];       // Per answer, HOST and ALL
+static int                      announce_left;
+static esp_timer_handle_t       announce_timer;
+static mdns_responder_stats_t   st;             // Written in the lwIP task only
+
+
+/**
+ * @brief Sends a prebuilt packet without copying it. Runs in the lwIP task,
+ *        as does patching the packets, so the data cannot change while the
+ *        stack still refers to it.
+ */
+static void send_packet(const mdns_packet_t *packet, const ip_addr_t *dest, u16_t port)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, packet->len, PBUF_REF);
+    if (p == NULL) {
+        return;
+    }
+    p->payload = (void *)packet->data;
+    udp_sendto_if(pcb, p, dest, port, esp_netif_get_netif_impl(ap_netif));
+    pbuf_free(p);
+}
+
+
+/**
+ * @brief Multicasts an answer unless it went out within the last second.
+ *
+ * @return false if suppressed.
+ */
+static bool multicast(mdns_answer_t answer)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t *last = &last_multicast_us[answer == MDNS_ANSWER_ALL];
+    if (*last && now - *last < MIN_INTERVAL_US) {
+        return false;
+    }
+    *last = now;
+
+    ip_addr_t group;
+    ip_addr_set_ip4_u32(&group, lwip_htonl(MDNS_GROUP));
+    send_packet(mdns_proto_packet(&records, answer), &group, MDNS_PORT);
+    return true;
+}
+
+
+/**
+ * @brief Handles a message on port 5353. Runs in the lwIP task.
+ */
+static void mdns_recv(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    st.received++;
+    bool unicast = false;
+    mdns_answer_t answer = MDNS_ANSWER_NONE;
+    if (port == MDNS_PORT && p->len == p->tot_len &&
+        ip_current_input_netif() == esp_netif_get_netif_impl(ap_netif)) {
+        answer = mdns_proto_match(&records, p->payload, p->len, &unicast);
+    }
+
+    if (answer == MDNS_ANSWER_NONE) {
+        st.ignored++;
+    } else if (unicast) {
+        send_packet(mdns_proto_packet(&records, answer), addr, port);
+        st.unicast++;
+    } else if (multicast(answer)) {
+        st.multicast++;
+    } else {
+        st.suppressed++;
+    }
+    pbuf_free(p);
+}
+
+
+/**
+ * @brief Patches the packets if the address changed and multicasts the
+ *        full set. Runs in the lwIP task.
+ */
+static esp_err_t announce_in_lwip(void *ctx)
+{
+    esp_netif_ip_info_t ip_info;
+    if (esp_netif_get_ip_info(ap_netif, &ip_info) == ESP_OK && lwip_ntohl(ip_info.ip.addr) != records.ip) {
+        mdns_proto_set_ip(&records, lwip_ntohl(ip_info.ip.addr));
+        memset(last_multicast_us, 0, sizeof(last_multicast_us));
+    }
+    if (multicast(MDNS_ANSWER_ALL)) {
+        st.announcements++;
+    }
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Sends the due announcement. Runs from the esp_timer task.
+ */
+static void announce_cb(void *arg)
+{
+    esp_netif_tcpip_exec(announce_in_lwip, NULL);
+    if (--announce_left > 0) {
+        esp_timer_start_once(announce_timer, ANNOUNCE_GAP_MS * 1000);
+    }
+}
+
+
+/**
+ * @brief Starts a series of announcements, unless one is running.
+ */
+static void announce(int count)
+{
+    if (!esp_timer_is_active(announce_timer)) {
+        announce_left = count;
+        esp_timer_start_once(announce_timer, 0);
+    }
+}
+
+
+/**
+ * @brief Announces when the AP starts and when a station gets a lease.
+ */
+static void event_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    announce((base == WIFI_EVENT) ? ANNOUNCE_COUNT : 1);
+}
+
+
+/**
+ * @brief Creates the pcb and joins the mDNS group. Runs in the lwIP task.
+ */
+static esp_err_t start_in_lwip(void *ctx)
+{
+    pcb = udp_new();
+    if (pcb == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    udp_set_multicast_ttl(pcb, 255);
+    pcb->ttl = 255;
+    ip4_addr_t group;
+    ip4_addr_set_u32(&group, lwip_htonl(MDNS_GROUP));
+    if (igmp_joingroup_netif(esp_netif_get_netif_impl(ap_netif), &group) != ERR_OK ||
+        udp_bind(pcb, IP4_ADDR_ANY, MDNS_PORT) != ERR_OK) {
+        udp_remove(pcb);
+        pcb = NULL;
+        return ESP_FAIL;
+    }
+    udp_recv(pcb, mdns_recv, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Builds the records and starts answering. Call once the softAP has
+ *        been set up.
+ */
+void mdns_responder_start(void)
+{
+    ap_netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    esp_netif_ip_info_t ip_info = { 0 };
+    esp_netif_get_ip_info(ap_netif, &ip_info);
+
+    // ota-demo-xxxxxx from the SSID, OTA-Demo-XXXXXX, lowercased by mdns_proto_build()
+    char host[32];
+    snprintf(host, sizeof(host), "%s", get_ssid());
+    const esp_app_desc_t *app = esp_app_get_description();
+    snprintf(txt_project, sizeof(txt_project), "project=%s", app->project_name);
+    snprintf(txt_version, sizeof(txt_version), "version=%s", app->version);
+    snprintf(txt_caps, sizeof(txt_caps), "caps=upload,put,serial,pull,relay,catalog,pm%s%s",
+#if CONFIG_NETCONN_OTA_ENABLE
+             ",netconn",
+#else
+             "",
+#endif
+#if CONFIG_HTTPD_WS_SUPPORT
+             ",websocket"
+#else
+             ""
+#endif
+             );
+#if CONFIG_NETCONN_OTA_ENABLE
+    snprintf(txt_port, sizeof(txt_port), "ota_port=%d", CONFIG_NETCONN_OTA_PORT);
+#else
+    snprintf(txt_port, sizeof(txt_port), "ota_port=0");
+#endif
+    const char *txt[] = { "path=/", txt_project, txt_version, txt_caps, txt_port };
+
+    if (!mdns_proto_build(&records, host, HTTP_PORT, txt, sizeof(txt) / sizeof(txt[0]),
+                          lwip_ntohl(ip_info.ip.addr))) {
+        ESP_LOGE(TAG, "Records for %s do not fit", host);
+        return;
+    }
+    esp_err_t err = esp_netif_tcpip_exec(start_in_lwip, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start: %s", esp_err_to_name(err));
+        return;
+    }
+
+    const esp_timer_create_args_t args = {
+        .callback = announce_cb,
+        .name = "mdns_announce",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &announce_timer));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_START, event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, event_handler, NULL));
+    announce(ANNOUNCE_COUNT);
+    ESP_LOGI(TAG, "Answering for %s, %u byte announcement", records.host, records.all_packet.len);
+}
+
+
+/**
+ * @brief Returns the counters.
+ */
+void mdns_responder_get_stats(mdns_responder_stats_t *stats)
+{
+    *stats = st;
+}
+
+
+/**
+ * @brief Handler for the 'mdns' console command.
+ */
+static int mdns_cmd(int argc, char **argv)
+{
+    if (pcb == NULL) {
+        printf("Not running\n");
+        return 1;
+    }
+    mdns_responder_stats_t s = st;
+    esp_ip4_addr_t ip = { .addr = lwip_htonl(records.ip) };
+    printf("%s (" IPSTR "), service %s\n", records.host, IP2STR(&ip), records.instance);
+    printf("Packets: host %u bytes, all records %u bytes\n", records.host_packet.len, records.all_packet.len);
+    printf("%lu received, %lu ignored; answered %lu multicast, %lu unicast, %lu suppressed; %lu announcements\n",
+           (unsigned long)s.received, (unsigned long)s.ignored, (unsigned long)s.multicast,
+           (unsigned long)s.unicast, (unsigned long)s.suppressed, (unsigned long)s.announcements);
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'mdns' console command.
+ */
+void register_mdns_responder(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "mdns",
+        .help = "Show the mDNS host name, records and counters",
+        .hint = NULL,
+        .func = &mdns_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+#else
+
+void mdns_responder_start(void)
+{
+}
+
+void mdns_responder_get_stats(mdns_responder_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void register_mdns_responder(void)
+{
+}
+
+#endif
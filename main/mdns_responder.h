@@ -0,0 +1,44 @@
+/*
+ * mdns_responder.h
+ *
+ * mDNS / DNS-SD responder on the softAP, so tools can find a unit as
+ * ota-demo-XXXXXX.local (the MAC suffix of its SSID) or browse for it as
+ * an _http._tcp service. The TXT records carry the project, the version
+ * and the OTA capabilities, named as in /api/info. Responses are built
+ * once, see mdns_proto.h.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef MDNS_RESPONDER_H
+#define MDNS_RESPONDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+// Counters
+typedef struct {
+    uint32_t    received;                   // Messages on port 5353
+    uint32_t    ignored;                    // Responses, other names, legacy queries
+    uint32_t    multicast;                  // Answers sent to the group
+    uint32_t    unicast;                    // Answers sent to the querier
+    uint32_t    suppressed;                 // Not multicast, the same answer went out within a second
+    uint32_t    announcements;
+} mdns_responder_stats_t;
+
+
+// Functions
+void        mdns_responder_start(void);
+void        mdns_responder_get_stats(mdns_responder_stats_t *stats);
+void        register_mdns_responder(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * n2k_frame.h
+ *
+ * NMEA 2000 CAN frames as the receive path sees them, the fields of their
+ * 29-bit identifiers (ISO 11783-3 / J1939), and the frame source the NMEA
+ * task reads from and the sink it transmits to. Each is a pair of a function
+ * and a context so the same engines run on the TWAI driver on the device and
+ * on stand-ins on a Linux host (tools/host/pgn_dispatch_host.cpp,
+ * tools/host/iso_tp_host.c).
+ *
+ * This header has no ESP-IDF dependencies.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef N2K_FRAME_H
+#define N2K_FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define N2K_BROADCAST           255         // Destination of PDU2 PGNs and global requests
+#define N2K_NULL_ADDRESS        254         // Cannot claim an address
+#define N2K_BATCH               16          // Frames read from a source at once
+
+
+// A frame
+typedef struct {
+    uint32_t    id;                         // 29-bit extended identifier
+    uint32_t    time_ms;                    // When it was received, stamped by the source
+    uint8_t     len;
+    uint8_t     data[8];
+} n2k_frame_t;
+
+
+// Identifier fields of a frame
+typedef struct {
+    uint32_t        pgn;
+    uint8_t         priority;
+    uint8_t         source;
+    uint8_t         destination;            // N2K_BROADCAST for PDU2 PGNs
+    uint8_t         len;
+    const uint8_t   *data;
+    uint32_t        time_ms;
+} n2k_msg_t;
+
+
+// Where frames come from
+typedef struct {
+    // Waits up to timeout_ms for frames and returns as many as are ready, up to
+    // max: the count, 0 on timeout, < 0 once the source has ended
+    int         (*receive)(void *ctx, n2k_frame_t *frames, int max, uint32_t timeout_ms);
+    void        *ctx;
+} n2k_source_t;
+
+
+// Where frames go
+typedef struct {
+    // Queues frames for transmission without waiting: the count taken, which
+    // is less than count when the transmit queue is full
+    int         (*send)(void *ctx, const n2k_frame_t *frames, int count);
+    void        *ctx;
+} n2k_sink_t;
+
+
+/**
+ * @brief Splits a frame identifier into PGN, priority and addresses. In PDU1
+ *        format (PF below 240) the PS byte is the destination, otherwise it
+ *        is part of the PGN.
+ */
+static inline void n2k_parse(const n2k_frame_t *frame, n2k_msg_t *msg)
+{
+    uint32_t id = frame->id;
+    uint8_t pf = (id >> 16) & 0xFF;
+    uint8_t ps = (id >> 8) & 0xFF;
+
+    msg->priority = (id >> 26) & 0x07;
+    msg->source = id & 0xFF;
+    if (pf < 240) {
+        msg->pgn = (id >> 8) & 0x3FF00;
+        msg->destination = ps;
+    } else {
+        msg->pgn = (id >> 8) & 0x3FFFF;
+        msg->destination = N2K_BROADCAST;
+    }
+    msg->len = frame->len;
+    msg->data = frame->data;
+    msg->time_ms = frame->time_ms;
+}
+
+
+/**
+ * @brief Builds a frame identifier, the inverse of n2k_parse().
+ */
+static inline uint32_t n2k_make_id(uint32_t pgn, uint8_t priority, uint8_t source, uint8_t destination)
+{
+    uint32_t id = ((uint32_t)(priority & 0x07) << 26) | ((pgn & 0x3FFFF) << 8) | source;
+    if (((pgn >> 8) & 0xFF) < 240) {
+        id = (id & ~0xFF00u) | ((uint32_t)destination << 8);
+    }
+    return id;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
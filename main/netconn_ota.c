@@ -0,0 +1,342 @@
+/*
+ * netconn_ota.c
+ *
+ * This file implements the zero-copy OTA upload listener. Requests are read
+ * with netconn_recv(), which hands over the pbuf chain lwIP received the
+ * data in. The request head is collected in a small buffer; the body is
+ * pushed into an OTA session directly from each pbuf payload, and the
+ * session writes the image from there. The only other consumer of the
+ * payload is the OTA relay, which has to buffer it anyway.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/api.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "ota_relay.h"
+#include "ota_session.h"
+#include "load_shed.h"
+#include "netconn_ota.h"
+
+
+#if CONFIG_NETCONN_OTA_ENABLE
+
+#define NETCONN_OTA_HEAD_MAX    1024        // Request line and headers
+#define NETCONN_OTA_STACK_SIZE  CONFIG_STACK_SIZE_NETCONN_OTA
+
+
+// Parser state of one connection
+typedef enum {
+    NC_REQ_HEAD = 0,                        // Collecting the request head
+    NC_BODY,                                // Body goes to the OTA session
+} nc_state_t;
+
+typedef struct {
+    struct netconn  *conn;
+    nc_state_t      state;
+    uint8_t         matched;                // Progress through "\r\n\r\n"
+    size_t          head_len;
+    const char      *error;                 // Status line to reply with on failure
+    ota_session_t   session;
+    char            head[NETCONN_OTA_HEAD_MAX + 1];
+} nc_client_t;
+
+
+// Local function prototypes
+extern void request_reboot(void);
+
+
+// Local variables
+static const char       *TAG = "netconn_ota";
+static const char       busy_status[] = "503 Service Unavailable";    // Sent with Retry-After
+#if CONFIG_STATIC_ALLOCATION
+static nc_client_t      s_client;
+static StaticTask_t     s_task_tcb;
+static StackType_t      s_task_stack[NETCONN_OTA_STACK_SIZE];
+#endif
+
+
+/**
+ * @brief Scans for the blank line that ends a header block.
+ *
+ * The match state is carried across calls so the terminator may be split
+ * between pbufs.
+ *
+ * @return The offset just past the terminator, or -1 if it is not in data.
+ */
+static int find_head_end(uint8_t *matched, const uint8_t *data, size_t len)
+{
+    static const char terminator[] = "\r\n\r\n";
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == terminator[*matched]) {
+            if (++*matched == 4) {
+                *matched = 0;
+                return i + 1;
+            }
+        } else {
+            *matched = (data[i] == '\r') ? 1 : 0;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Copies the value of a request header.
+ *
+ * @return true if the header is present.
+ */
+static bool header_value(const char *head, const char *name, char *out, size_t size)
+{
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':') {
+            continue;
+        }
+        const char *value = line + name_len + 1;
+        while (*value == ' ') {
+            value++;
+        }
+        size_t len = strcspn(value, "\r");
+        if (len >= size) {
+            len = size - 1;
+        }
+        memcpy(out, value, len);
+        out[len] = '\0';
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * @brief Validates the request head and opens the OTA session.
+ */
+static esp_err_t start_upload(nc_client_t *c)
+{
+    char value[128];
+
+    const char *path = (strncmp(c->head, "POST ", 5) == 0) ? c->head + 5 :
+                       (strncmp(c->head, "PUT ", 4) == 0) ? c->head + 4 : NULL;
+    if (path == NULL || strncmp(path, "/upload", 7) != 0 || (path[7] != ' ' && path[7] != '?')) {
+        c->error = "404 Not Found";
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (!header_value(c->head, "Content-Length", value, sizeof(value)) || atoi(value) <= 0) {
+        c->error = "411 Length Required";
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (load_shed(SHED_UPLOAD)) {
+        c->error = busy_status;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    char content_type[128] = "";
+    char boundary[OTA_SESSION_MAX_BOUNDARY + 1];
+    char hops[8] = "";
+    header_value(c->head, "Content-Type", content_type, sizeof(content_type));
+    header_value(c->head, OTA_RELAY_HOPS_HEADER, hops, sizeof(hops));
+    bool multipart = ota_session_multipart_boundary(content_type, boundary, sizeof(boundary));
+
+    ota_session_config_t config = {
+        .format       = multipart ? OTA_SESSION_MULTIPART : OTA_SESSION_RAW,
+        .boundary     = boundary,
+        .content_len  = atoi(value),
+        .path         = OTA_PATH_NETCONN,
+        .relay        = true,
+        .content_type = content_type,
+        .hops         = atoi(hops),
+    };
+    esp_err_t err = ota_session_open(&c->session, &config);
+    if (err != ESP_OK) {
+        c->error = "500 Internal Server Error";
+        return err;
+    }
+    c->state = NC_BODY;
+
+    // curl waits for this before sending large bodies
+    if (header_value(c->head, "Expect", value, sizeof(value)) && strcasecmp(value, "100-continue") == 0) {
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        netconn_write(c->conn, cont, sizeof(cont) - 1, NETCONN_NOCOPY);
+    }
+
+    ESP_LOGI(TAG, "Receiving %u byte upload", (unsigned)config.content_len);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Feeds one pbuf payload through the request parser.
+ */
+static esp_err_t consume(nc_client_t *c, const uint8_t *data, size_t len)
+{
+    if (c->state == NC_REQ_HEAD) {
+        int end = find_head_end(&c->matched, data, len);
+        size_t take = (end < 0) ? len : (size_t)end;
+        if (c->head_len + take > NETCONN_OTA_HEAD_MAX) {
+            c->error = "431 Request Header Fields Too Large";
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(c->head + c->head_len, data, take);
+        c->head_len += take;
+        if (end < 0) {
+            return ESP_OK;
+        }
+        c->head[c->head_len] = '\0';
+        esp_err_t err = start_upload(c);
+        if (err != ESP_OK) {
+            return err;
+        }
+        data += take;
+        len -= take;
+    }
+
+    if (len > 0 && ota_session_push(&c->session, data, len) == OTA_SESSION_FAILED) {
+        c->error = "500 Internal Server Error";
+        return c->session.error;
+    }
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Sends a plain text response.
+ */
+static void send_response(struct netconn *conn, const char *status, const char *text)
+{
+    char head[192];
+    char retry[32] = "";
+    if (status == busy_status) {
+        snprintf(retry, sizeof(retry), "Retry-After: %s\r\n", load_shed_retry_after());
+    }
+    int len = snprintf(head, sizeof(head),
+                       "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %u\r\n%sConnection: close\r\n\r\n",
+                       status, (unsigned)strlen(text), retry);
+    netconn_write(conn, head, len, NETCONN_COPY);
+    netconn_write(conn, text, strlen(text), NETCONN_COPY);
+}
+
+
+/**
+ * @brief Receives one upload request and replies to it.
+ *
+ * @return true if a new image was installed and the unit should reboot.
+ */
+static bool handle_client(struct netconn *conn, nc_client_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->conn = conn;
+    netconn_set_recvtimeout(conn, CONFIG_NETCONN_OTA_TIMEOUT_MS);
+
+    esp_err_t err = ESP_OK;
+    struct netbuf *buf;
+    while (err == ESP_OK && (c->state == NC_REQ_HEAD || c->session.status == OTA_SESSION_MORE)) {
+        if (netconn_recv(conn, &buf) != ERR_OK) {
+            c->error = "408 Request Timeout";
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        do {
+            void *data;
+            u16_t len;
+            netbuf_data(buf, &data, &len);
+            err = consume(c, data, len);
+        } while (err == ESP_OK && netbuf_next(buf) >= 0);
+        netbuf_delete(buf);
+    }
+
+    if (c->state == NC_BODY) {
+        // Downstream units must have the whole image before we reboot
+        if (err == ESP_OK && ota_session_finish(&c->session) == ESP_OK) {
+            char msg[80];
+            snprintf(msg, sizeof(msg), "Upload successful, relayed to %d of %d units! Rebooting...",
+                     c->session.relayed, c->session.relay_peers);
+            send_response(conn, "200 OK", (c->session.relay_peers > 0) ? msg : "Upload successful! Rebooting...");
+            return true;
+        }
+        ota_session_abort(&c->session);
+        if (err == ESP_OK) {
+            c->error = "500 Internal Server Error";
+        }
+    }
+
+    ESP_LOGW(TAG, "Upload failed: %s", c->error ? c->error : "connection closed");
+    if (c->error != NULL) {
+        send_response(conn, c->error, "Upload failed");
+    }
+    return false;
+}
+
+
+/**
+ * @brief Listener task, serves one upload at a time.
+ */
+static void netconn_ota_task(void *param)
+{
+#if CONFIG_STATIC_ALLOCATION
+    nc_client_t *client = &s_client;
+#else
+    nc_client_t *client = malloc(sizeof(nc_client_t));
+#endif
+    struct netconn *listener = netconn_new(NETCONN_TCP);
+    if (client == NULL || listener == NULL ||
+        netconn_bind(listener, IP_ADDR_ANY, CONFIG_NETCONN_OTA_PORT) != ERR_OK ||
+        netconn_listen(listener) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to listen on port %d", CONFIG_NETCONN_OTA_PORT);
+        if (listener != NULL) {
+            netconn_delete(listener);
+        }
+#if !CONFIG_STATIC_ALLOCATION
+        free(client);
+#endif
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Listening for uploads on port %d", CONFIG_NETCONN_OTA_PORT);
+
+    while (1) {
+        struct netconn *conn;
+        if (netconn_accept(listener, &conn) != ERR_OK) {
+            continue;
+        }
+        bool reboot = handle_client(conn, client);
+        netconn_close(conn);
+        netconn_delete(conn);
+        if (reboot) {
+            ESP_LOGI(TAG, "OTA Update Successful. Rebooting...");
+            request_reboot();
+        }
+    }
+}
+
+
+/**
+ * @brief Starts the zero-copy OTA listener.
+ *
+ * Must be called after the network interface is up.
+ */
+void netconn_ota_start(void)
+{
+#if CONFIG_STATIC_ALLOCATION
+    xTaskCreateStatic(netconn_ota_task, "netconn_ota", NETCONN_OTA_STACK_SIZE, NULL, 5, s_task_stack, &s_task_tcb);
+#else
+    xTaskCreate(netconn_ota_task, "netconn_ota", NETCONN_OTA_STACK_SIZE, NULL, 5, NULL);
+#endif
+}
+
+#else
+
+void netconn_ota_start(void)
+{
+}
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * netconn_ota.h
+ *
+ * Alternate OTA upload listener on the lwIP netconn API. It accepts the same
+ * POST /upload requests as the web server (multipart or raw body) on its own
+ * port, but writes the image to flash straight from the received pbufs
+ * instead of copying it through an httpd receive buffer first.
+ *
+ *     curl -F firmware=@build/ota-demo.bin http://192.168.4.1:8032/upload
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef NETCONN_OTA_H
+#define NETCONN_OTA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Functions
+void netconn_ota_start(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,598 @@
+/*
+ * nmea_task.cpp
+ *
+ * This file runs the NMEA 2000 receive path on the TWAI controller. The
+ * task blocks for the first frame of a batch, then takes whatever else the
+ * driver has queued without waiting, up to N2K_BATCH frames, and hands the
+ * batch to pgn_handlers_dispatch(). A fully loaded bus at 250 kbit/s
+ * carries about 1,800 frames per second; dispatching one takes well under
+ * a microsecond, so the task keeps the driver queue near empty and only a
+ * stall of the task itself (CONFIG_NMEA_RX_QUEUE_LEN frames, about 35 ms
+ * at the default) loses frames. The driver counts those, shown by the
+ * 'n2k' command.
+ *
+ * Fast-packet messages are reassembled in CONFIG_NMEA_FAST_PACKET_CONTEXTS
+ * static contexts, so a busy bus takes no heap from Wi-Fi.
+ *
+ * Requests for product information (126996) and configuration information
+ * (126998, the installation descriptions and the device label) are
+ * answered through the ISO transport protocol: by BAM when the request was
+ * global, under the requester's flow control when it was addressed here.
+ * The engine (iso_tp.h) runs from a one-shot esp_timer armed for its next
+ * deadline rather than from task delays, which at the 10 ms tick would
+ * stretch every 50 ms broadcast gap by up to a tick. A mutex serialises the
+ * timer and the NMEA task, which passes on the CTS, EOMA and Abort frames.
+ *
+ * The PGNs the node sends on its own, the address claim and heartbeat
+ * among them, are on the transmit scheduler in pgn_senders.cpp; requests
+ * for them are passed on to it. Nothing else is sent from the node address
+ * until 250 ms after the claim went out, as ISO 11783-5 requires. Claims
+ * from other nodes go to it as well; when the node loses its address, the
+ * receive and transport engines move with it and the new address is saved
+ * as the one to claim at the next start.
+ *
+ * With CONFIG_NMEA_RX_RING the TWAI driver is left out: the controller's
+ * interrupt decodes frames straight into a ring (twai_ring.h, can_ring.h)
+ * and notifies the task with NOTIFY_BIT_NMEA only when the ring was empty.
+ * The task dispatches the frames where they lie until the ring is empty
+ * again, so no frame is copied through a queue and a burst costs one
+ * wakeup.
+ *
+ * The frame source is the only part tied to the driver; the host benchmark
+ * runs the same handlers on a socket.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/twai.h"
+#include "esp_app_desc.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "settings.h"
+#include "pgn_handlers.h"
+#include "iso_tp.h"
+#include "pgn_senders.h"
+#include "can_ring.h"
+#include "twai_ring.h"
+#include "main.h"
+#include "nmea_task.h"
+
+
+#if CONFIG_NMEA_ENABLE
+
+#define NMEA_STACK_SIZE     CONFIG_STACK_SIZE_NMEA
+#define NMEA_PRIORITY       6               // Above the HTTP server and OTA listeners
+#define IDLE_MS             1000            // Bus state checked when no frame comes in this long
+
+#define PGN_PRODUCT_INFO    126996
+#define PGN_CONFIG_INFO     126998
+#define PRODUCT_INFO_LEN    134
+#define LABEL_MAX           70              // Characters of each configuration information field
+#define CONFIG_INFO_MAX     (3 * (LABEL_MAX + 2))
+#define DATABASE_VERSION    2100            // NMEA 2000 version 2.100
+#define PRODUCT_CODE        1
+#define LOAD_EQUIVALENCY    1               // 50 mA units
+
+
+// Local variables
+static const char       *TAG = "nmea";
+static volatile bool    reset_requested;
+static uint32_t         other_frames;       // Standard-ID and remote frames, not NMEA 2000
+static bool             started;
+static fast_packet_ctx_t fast_packets[CONFIG_NMEA_FAST_PACKET_CONTEXTS];
+static iso_tp_session_t tp_sessions[CONFIG_NMEA_TP_SESSIONS];
+static iso_tp_t         tp;
+static SemaphoreHandle_t tp_mutex;
+static esp_timer_handle_t tp_timer;
+static uint8_t          product_info[PRODUCT_INFO_LEN];
+static uint8_t          config_info[CONFIG_INFO_MAX];
+static uint16_t         config_info_len;
+#if CONFIG_NMEA_RX_RING
+static n2k_frame_t      rx_slots[CONFIG_NMEA_RX_RING_LEN];
+static can_ring_t       rx_ring;
+static_assert((CONFIG_NMEA_RX_RING_LEN & (CONFIG_NMEA_RX_RING_LEN - 1)) == 0, "Ring length not a power of two");
+#endif
+#if CONFIG_STATIC_ALLOCATION
+static StaticTask_t     s_task_tcb;
+static StackType_t      s_task_stack[NMEA_STACK_SIZE];
+static StaticSemaphore_t s_tp_mutex_buf;
+#endif
+
+
+#if !CONFIG_NMEA_RX_RING
+/**
+ * @brief Frame source on the TWAI driver: waits for the first frame, then
+ *        drains what is queued without waiting.
+ */
+static int twai_source_receive(void *ctx, n2k_frame_t *frames, int max, uint32_t timeout_ms)
+{
+    TickType_t wait = pdMS_TO_TICKS(timeout_ms);
+    twai_message_t m;
+    int n = 0;
+
+    while (n < max && twai_receive(&m, wait) == ESP_OK) {
+        wait = 0;
+        if (!m.extd || m.rtr) {
+            other_frames++;
+            continue;
+        }
+        n2k_frame_t *f = &frames[n++];
+        f->id = m.identifier;
+        f->len = (m.data_length_code > 8) ? 8 : m.data_length_code;
+        f->time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        memcpy(f->data, m.data, 8);
+    }
+    return n;
+}
+#endif
+
+
+/**
+ * @brief Frame sink on the TWAI driver: queues frames without waiting.
+ */
+static int twai_sink_send(void *ctx, const n2k_frame_t *frames, int count)
+{
+#if CONFIG_NMEA_RX_RING
+    return twai_ring_transmit(frames, count);
+#else
+    int n;
+    for (n = 0; n < count; n++) {
+        twai_message_t m = {};
+        m.extd = 1;
+        m.identifier = frames[n].id;
+        m.data_length_code = frames[n].len;
+        memcpy(m.data, frames[n].data, frames[n].len);
+        if (twai_transmit(&m, 0) != ESP_OK) {
+            break;
+        }
+    }
+    return n;
+#endif
+}
+
+
+static uint32_t now_us(void)
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+
+/**
+ * @brief Copies a string into a fixed-length field, padded with 0xFF.
+ */
+static void put_fixed(uint8_t *field, const char *text, size_t len)
+{
+    size_t n = strnlen(text, len);
+    memcpy(field, text, n);
+    memset(field + n, 0xFF, len - n);
+}
+
+
+/**
+ * @brief Appends a variable-length string: length including this header,
+ *        encoding (1, ASCII), characters.
+ */
+static uint8_t *put_lau(uint8_t *p, const char *text)
+{
+    size_t n = strnlen(text, LABEL_MAX);
+    p[0] = n + 2;
+    p[1] = 1;
+    memcpy(&p[2], text, n);
+    return p + 2 + n;
+}
+
+
+/**
+ * @brief Fills in 126996 Product Information: database version, product
+ *        code, model ID, software version, model version, serial code,
+ *        certification level and load equivalency.
+ */
+static void build_product_info(void)
+{
+    const esp_app_desc_t *app = esp_app_get_description();
+    char serial[16];
+
+    product_info[0] = DATABASE_VERSION & 0xFF;
+    product_info[1] = DATABASE_VERSION >> 8;
+    product_info[2] = PRODUCT_CODE & 0xFF;
+    product_info[3] = PRODUCT_CODE >> 8;
+    put_fixed(&product_info[4], app->project_name, 32);
+    put_fixed(&product_info[36], app->version, 32);
+    put_fixed(&product_info[68], CONFIG_IDF_TARGET, 32);
+    snprintf(serial, sizeof(serial), "%lu", (unsigned long)get_serial_nbr());
+    put_fixed(&product_info[100], serial, 32);
+    product_info[132] = 0;
+    product_info[133] = LOAD_EQUIVALENCY;
+}
+
+
+/**
+ * @brief Builds 126998 Configuration Information from the settings:
+ *        installation descriptions 1 and 2, then the device label in the
+ *        manufacturer information field.
+ *
+ * @return The length.
+ */
+static uint16_t build_config_info(uint8_t *buf)
+{
+    char label[LABEL_MAX + 1];
+    uint8_t *p = buf;
+    p = put_lau(p, get_installation_1(label, sizeof(label)));
+    p = put_lau(p, get_installation_2(label, sizeof(label)));
+    p = put_lau(p, get_device_label(label, sizeof(label)));
+    return p - buf;
+}
+
+
+/**
+ * @brief Runs the transport sessions that are due and arms the timer for
+ *        the next deadline. Call with tp_mutex held.
+ */
+static void tp_run(void)
+{
+    int32_t wait = iso_tp_poll(&tp, now_us());
+    esp_timer_stop(tp_timer);
+    if (wait >= 0) {
+        esp_timer_start_once(tp_timer, wait);
+    }
+}
+
+
+/**
+ * @brief Timer callback, at the transport engine's deadline. Runs from the
+ *        esp_timer task.
+ */
+static void tp_timer_cb(void *arg)
+{
+    xSemaphoreTake(tp_mutex, portMAX_DELAY);
+    tp_run();
+    xSemaphoreGive(tp_mutex);
+}
+
+
+/**
+ * @brief Contends for the node address with another node's claim, and
+ *        moves the engines to the address the node ends up with.
+ */
+static void address_claim(const n2k_msg_t *msg)
+{
+    uint8_t address = pgn_senders_claim_received(msg->source, msg->data);
+    if (address == tp.address) {
+        return;
+    }
+    xSemaphoreTake(tp_mutex, portMAX_DELAY);
+    iso_tp_set_address(&tp, address);
+    tp_run();
+    xSemaphoreGive(tp_mutex);
+    pgn_handlers_set_address(address);
+    if (address != N2K_NULL_ADDRESS) {
+        set_node_address(address);
+    }
+}
+
+
+/**
+ * @brief Answers ISO requests and passes TP.CM frames to the transport
+ *        engine. Requests for the PGNs on the transmit scheduler go to it;
+ *        nothing else goes out before the address claim has settled.
+ *        Address claims go to address_claim(). Runs in the NMEA task.
+ */
+static void respond(const n2k_msg_t *msg)
+{
+    uint32_t pgn = msg->data[0] | (msg->data[1] << 8) | ((uint32_t)msg->data[2] << 16);
+    uint8_t labels[CONFIG_INFO_MAX];
+    uint16_t labels_len = 0;
+
+    if (msg->pgn == ADDRESS_CLAIM_PGN) {
+        address_claim(msg);
+        return;
+    }
+    bool request = (msg->pgn != ISO_TP_PGN_CM);
+    if (request && pgn != PGN_PRODUCT_INFO && pgn != PGN_CONFIG_INFO) {
+        pgn_senders_request(pgn);
+        return;
+    }
+    if (!pgn_senders_claimed()) {
+        return;
+    }
+    if (request && pgn == PGN_CONFIG_INFO) {
+        labels_len = build_config_info(labels);         // Reads NVS, so outside the mutex
+    }
+
+    xSemaphoreTake(tp_mutex, portMAX_DELAY);
+    if (msg->pgn == ISO_TP_PGN_CM) {
+        iso_tp_receive(&tp, msg, now_us());
+    } else {
+        const uint8_t *data = product_info;
+        uint16_t len = PRODUCT_INFO_LEN;
+        if (pgn == PGN_CONFIG_INFO) {
+            if (!iso_tp_in_use(&tp, config_info)) {
+                memcpy(config_info, labels, labels_len);
+                config_info_len = labels_len;
+            }
+            data = config_info;
+            len = config_info_len;
+        }
+        uint8_t destination = (msg->destination == N2K_BROADCAST) ? N2K_BROADCAST : msg->source;
+        if (len > 8) {
+            iso_tp_send(&tp, pgn, destination, data, len, now_us());
+        } else {
+            n2k_frame_t f = {};
+            f.id = n2k_make_id(pgn, 6, tp.address, destination);
+            f.len = 8;
+            memset(f.data, 0xFF, 8);
+            memcpy(f.data, data, len);
+            twai_sink_send(NULL, &f, 1);
+        }
+    }
+    tp_run();
+    xSemaphoreGive(tp_mutex);
+}
+
+
+/**
+ * @brief Restarts the controller after bus-off, once it has recovered.
+ */
+static void check_bus(void)
+{
+#if CONFIG_NMEA_RX_RING
+    twai_ring_check_bus();
+#else
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK) {
+        return;
+    }
+    if (status.state == TWAI_STATE_BUS_OFF) {
+        ESP_LOGW(TAG, "Bus off, recovering");
+        twai_initiate_recovery();
+    } else if (status.state == TWAI_STATE_STOPPED) {
+        ESP_LOGI(TAG, "Recovered, restarting");
+        twai_start();
+    }
+#endif
+}
+
+
+/**
+ * @brief Receives and dispatches frames.
+ */
+static void nmea_task(void *arg)
+{
+#if CONFIG_NMEA_RX_RING
+    // Frames that arrived before this wait in the ring for the first drain
+    twai_ring_set_consumer(xTaskGetCurrentTaskHandle(), NOTIFY_BIT_NMEA);
+#else
+    const n2k_source_t source = { twai_source_receive, NULL };
+#endif
+
+    pgn_handlers_init(get_node_address(), fast_packets, CONFIG_NMEA_FAST_PACKET_CONTEXTS);
+    while (1) {
+        if (reset_requested) {
+            pgn_handlers_reset_stats();
+            xSemaphoreTake(tp_mutex, portMAX_DELAY);
+            iso_tp_reset_stats(&tp);
+            xSemaphoreGive(tp_mutex);
+            pgn_senders_reset_stats();
+            other_frames = 0;
+            twai_ring_reset_stats();
+            reset_requested = false;
+        }
+#if CONFIG_NMEA_RX_RING
+        // Empty the ring before waiting: the interrupt only notifies when it
+        // puts a frame into an empty ring
+        if (pgn_handlers_drain(&rx_ring) == 0 &&
+            xTaskNotifyWait(0, NOTIFY_BIT_NMEA, NULL, pdMS_TO_TICKS(IDLE_MS)) == pdFALSE) {
+            check_bus();
+        }
+#else
+        if (pgn_handlers_pump(&source, IDLE_MS) == 0) {
+            check_bus();
+        }
+#endif
+    }
+}
+
+
+/**
+ * @brief Starts the TWAI controller at 250 kbit/s, the transport engine,
+ *        the transmit scheduler and the receive task.
+ */
+void nmea_task_start(void)
+{
+#if CONFIG_NMEA_RX_RING
+    can_ring_init(&rx_ring, rx_slots, CONFIG_NMEA_RX_RING_LEN);
+    esp_err_t err = twai_ring_start(CONFIG_NMEA_TX_GPIO, CONFIG_NMEA_RX_GPIO, &rx_ring);
+#else
+    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)CONFIG_NMEA_TX_GPIO,
+                                                                 (gpio_num_t)CONFIG_NMEA_RX_GPIO, TWAI_MODE_NORMAL);
+    g_config.rx_queue_len = CONFIG_NMEA_RX_QUEUE_LEN;
+    g_config.tx_queue_len = N2K_BATCH;                  // A batch of TP.DT packets
+    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_250KBITS();
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+    esp_err_t err = twai_driver_install(&g_config, &t_config, &f_config);
+    if (err == ESP_OK) {
+        err = twai_start();
+    }
+#endif
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start TWAI: %s", esp_err_to_name(err));
+        return;
+    }
+
+#if CONFIG_STATIC_ALLOCATION
+    tp_mutex = xSemaphoreCreateMutexStatic(&s_tp_mutex_buf);
+#else
+    tp_mutex = xSemaphoreCreateMutex();
+#endif
+    esp_timer_create_args_t args = {};
+    args.callback = tp_timer_cb;
+    args.name = "iso_tp";
+    ESP_ERROR_CHECK(esp_timer_create(&args, &tp_timer));
+    const n2k_sink_t sink = { twai_sink_send, NULL };
+    iso_tp_init(&tp, tp_sessions, CONFIG_NMEA_TP_SESSIONS, get_node_address(), &sink,
+                CONFIG_NMEA_TP_BAM_INTERVAL_MS);
+    build_product_info();
+    config_info_len = build_config_info(config_info);
+    pgn_senders_start(&sink);                           // Claims the address before anything answers
+    pgn_handlers_set_responder(respond);
+
+#if CONFIG_STATIC_ALLOCATION
+    xTaskCreateStatic(nmea_task, "nmea", NMEA_STACK_SIZE, NULL, NMEA_PRIORITY, s_task_stack, &s_task_tcb);
+#else
+    xTaskCreate(nmea_task, "nmea", NMEA_STACK_SIZE, NULL, NMEA_PRIORITY, NULL);
+#endif
+    started = true;
+    ESP_LOGI(TAG, "Listening at 250 kbit/s on TX %d, RX %d, address %d", CONFIG_NMEA_TX_GPIO, CONFIG_NMEA_RX_GPIO,
+             get_node_address());
+}
+
+
+/**
+ * @brief Handler for the 'n2k' console command.
+ */
+static int nmea_cmd(int argc, char **argv)
+{
+    if (!started) {
+        printf("Not running\n");
+        return 1;
+    }
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0) {
+            printf("n2k: expected 'reset'\n");
+            return 1;
+        }
+        reset_requested = true;
+        return 0;
+    }
+
+    static const char *states[] = { "stopped", "running", "bus off", "recovering" };
+    address_claim_t claim;
+    pgn_senders_get_claim(&claim);
+#if CONFIG_NMEA_RX_RING
+    twai_ring_status_t status;
+    twai_ring_get_status(&status);
+    other_frames = status.rx_other;
+    printf("Bus %s, address %d; %lu missed (ring full), %lu overrun, %lu bus errors, TEC %lu, REC %lu\n",
+           (status.state < 4) ? states[status.state] : "?", claim.address, (unsigned long)status.rx_missed,
+           (unsigned long)status.rx_overrun, (unsigned long)status.bus_errors, (unsigned long)status.tec,
+           (unsigned long)status.rec);
+    printf("Receive ring: %lu frames, %lu wakeups, %lu of %d slots used at most; %lu frames sent, %lu failed, "
+           "%lu queued\n",
+           (unsigned long)status.rx_frames, (unsigned long)status.notifications, (unsigned long)rx_ring.max_used,
+           CONFIG_NMEA_RX_RING_LEN, (unsigned long)status.tx_frames, (unsigned long)status.tx_failed,
+           (unsigned long)status.tx_queued);
+#else
+    twai_status_info_t status = {};
+    twai_get_status_info(&status);
+    printf("Bus %s, address %d; %lu queued, %lu missed (queue full), %lu overrun, %lu bus errors\n",
+           (status.state < 4) ? states[status.state] : "?", claim.address, (unsigned long)status.msgs_to_rx,
+           (unsigned long)status.rx_missed_count, (unsigned long)status.rx_overrun_count,
+           (unsigned long)status.bus_error_count);
+#endif
+
+    pgn_stats_t s;
+    pgn_handlers_get_stats(&s);
+    printf("%lu frames in %lu batches (max %lu): %lu handled, %lu unknown PGN, %lu for other nodes, %lu too short, "
+           "%lu not NMEA 2000\n",
+           (unsigned long)s.frames, (unsigned long)s.batches, (unsigned long)s.max_batch, (unsigned long)s.handled,
+           (unsigned long)s.unknown, (unsigned long)s.not_for_us, (unsigned long)s.invalid,
+           (unsigned long)other_frames);
+    printf("%lu ISO requests; address %s, %lu claims for it: %lu defended, %lu moved, %lu with this NAME\n",
+           (unsigned long)s.requests, (claim.address == N2K_NULL_ADDRESS) ? "lost" :
+           pgn_senders_claimed() ? "claimed" : "being claimed", (unsigned long)claim.stats.contested,
+           (unsigned long)claim.stats.defended, (unsigned long)claim.stats.moved,
+           (unsigned long)claim.stats.same_name);
+
+    fast_packet_stats_t f;
+    pgn_handlers_get_fast_packet_stats(&f);
+    printf("Fast packets: %lu frames, %lu messages, %lu of %d contexts used at most; dropped %lu timed out, "
+           "%lu evicted, %lu out of order, %lu restarted; %lu orphan frames, %lu bad length\n",
+           (unsigned long)f.frames, (unsigned long)f.completed, (unsigned long)f.in_use_max,
+           CONFIG_NMEA_FAST_PACKET_CONTEXTS, (unsigned long)f.timeouts, (unsigned long)f.evicted,
+           (unsigned long)f.out_of_order, (unsigned long)f.restarted, (unsigned long)f.orphans,
+           (unsigned long)f.bad_length);
+
+    xSemaphoreTake(tp_mutex, portMAX_DELAY);
+    iso_tp_stats_t t = tp.stats;
+    xSemaphoreGive(tp_mutex);
+    printf("Transport: %lu transfers, %lu completed, %lu of %d sessions used at most; %lu refused, %lu aborted "
+           "by the receiver, %lu timed out; %lu incoming refused; %lu frames, %lu retried (queue full); "
+           "BAM packets %lu us late on average, %lu max\n",
+           (unsigned long)t.messages, (unsigned long)t.completed, (unsigned long)t.in_use_max,
+           CONFIG_NMEA_TP_SESSIONS, (unsigned long)t.refused, (unsigned long)t.aborted, (unsigned long)t.timeouts,
+           (unsigned long)t.rejected, (unsigned long)t.frames, (unsigned long)t.queue_full,
+           (unsigned long)(t.timed ? t.late_total_us / t.timed : 0), (unsigned long)t.late_max_us);
+
+    pgn_sched_stats_t x;
+    pgn_senders_get_stats(&x);
+    printf("Transmit: %lu messages, %lu frames in %lu batches (max %lu messages), %lu wakeups; %lu ms late on "
+           "average, %lu max; %lu retried (queue full), %lu periods skipped\n",
+           (unsigned long)x.sent, (unsigned long)x.frames, (unsigned long)x.batches, (unsigned long)x.max_batch,
+           (unsigned long)x.wakeups, (unsigned long)(x.sent ? x.late_total_ms / x.sent : 0),
+           (unsigned long)x.late_max_ms, (unsigned long)x.queue_full, (unsigned long)x.skipped);
+
+    pgn_count_t counts[32];
+    int n = pgn_handlers_get_counts(counts, 32);
+    printf("\n%-8s %-26s %s\n", "PGN", "name", "messages");
+    for (int i = 0; i < n; i++) {
+        printf("%-8lu %-26s %lu\n", (unsigned long)counts[i].pgn, counts[i].name, (unsigned long)counts[i].count);
+    }
+
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    printf("\n%-16s %12s %-4s %4s %4s %s\n", "reading", "value", "unit", "src", "inst", "age");
+    for (int id = 0; id < N2K_READING_COUNT; id++) {
+        n2k_reading_t r;
+        pgn_handlers_get_reading((n2k_reading_id_t)id, &r);
+        if (r.valid) {
+            printf("%-16s %12.3f %-4s %4d %4d %lu ms\n", pgn_reading_name((n2k_reading_id_t)id), r.value,
+                   pgn_reading_unit((n2k_reading_id_t)id), r.source, r.instance,
+                   (unsigned long)(now_ms - r.updated_ms));
+        }
+    }
+    n2k_fix_t fix;
+    pgn_handlers_get_fix(&fix);
+    if (fix.has_position) {
+        printf("%-16s %.7f %.7f, %lu ms\n", "position", fix.latitude * 1e-7, fix.longitude * 1e-7,
+               (unsigned long)(now_ms - fix.position_ms));
+    }
+    if (fix.has_time) {
+        printf("%-16s day %u, %lu.%04lu s, %lu ms\n", "time", fix.date, (unsigned long)(fix.time / 10000),
+               (unsigned long)(fix.time % 10000), (unsigned long)(now_ms - fix.time_ms));
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'n2k' console command.
+ */
+void register_nmea(void)
+{
+    esp_console_cmd_t cmd = {};
+    cmd.command = "n2k";
+    cmd.help = "Show NMEA 2000 bus state, frame counters per PGN and the latest readings, or clear the counters";
+    cmd.hint = "[reset]";
+    cmd.func = &nmea_cmd;
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+#else
+
+void nmea_task_start(void)
+{
+}
+
+void register_nmea(void)
+{
+}
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * nmea_task.h
+ *
+ * NMEA 2000 receive task. It reads frames from the TWAI controller at
+ * 250 kbit/s in batches and dispatches them to the PGN handlers, see
+ * pgn_handlers.h.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef NMEA_TASK_H
+#define NMEA_TASK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Functions
+void        nmea_task_start(void);
+void        register_nmea(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
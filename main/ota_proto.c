@@ -0,0 +1,469 @@
+/*
+ * ota_proto.c
+ *
+ * This file implements the framing (SLIP + CRC-32) and the receiver state
+ * machine of the binary serial OTA protocol described in ota_proto.h. The
+ * receiver is driven purely by the bytes handed to ota_proto_rx_feed() and
+ * reports everything it does through the ota_proto_io_t callbacks, so it is
+ * independent of the serial driver and of the flash writer.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "kernels.h"
+#include "ota_proto.h"
+
+
+#define SLIP_END        0xC0
+#define SLIP_ESC        0xDB
+#define SLIP_ESC_END    0xDC
+#define SLIP_ESC_ESC    0xDD
+
+
+/**
+ * @brief Updates a CRC-32 with a block of data.
+ *
+ * The result is compatible with zlib's crc32(): start with crc = 0 and pass
+ * the previous return value to continue a running checksum.
+ *
+ * @param crc  Running CRC value, 0 for the first block.
+ * @param data Data to checksum.
+ * @param len  Number of bytes.
+ *
+ * @return The updated CRC value.
+ */
+uint32_t ota_proto_crc32(uint32_t crc, const void *data, size_t len)
+{
+    return kern_crc32(crc, data, len);
+}
+
+
+// Little-endian helpers
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+/**
+ * @brief Appends one byte to a SLIP encoded buffer, escaping if required.
+ *
+ * @return The number of bytes written to out (1 or 2), or 0 if out is full.
+ */
+static size_t slip_put(uint8_t byte, uint8_t *out, size_t pos, size_t out_size)
+{
+    if (byte == SLIP_END || byte == SLIP_ESC) {
+        if (pos + 2 > out_size) {
+            return 0;
+        }
+        out[pos] = SLIP_ESC;
+        out[pos + 1] = (byte == SLIP_END) ? SLIP_ESC_END : SLIP_ESC_ESC;
+        return 2;
+    }
+    if (pos + 1 > out_size) {
+        return 0;
+    }
+    out[pos] = byte;
+    return 1;
+}
+
+
+/**
+ * @brief Builds a complete, SLIP encoded frame.
+ *
+ * @param type      Frame type (OTA_FRAME_xxx).
+ * @param seq       Sequence / block number.
+ * @param payload   Payload bytes, may be NULL if len is 0.
+ * @param len       Payload length, at most OTA_PROTO_MAX_BLOCK.
+ * @param out       Output buffer, OTA_PROTO_MAX_ENCODED bytes is always enough.
+ * @param out_size  Size of the output buffer.
+ *
+ * @return Number of encoded bytes, or 0 if the frame did not fit.
+ */
+size_t ota_proto_encode(uint8_t type, uint16_t seq, const void *payload, uint16_t len,
+                        uint8_t *out, size_t out_size)
+{
+    if (len > OTA_PROTO_MAX_BLOCK || out_size < 2) {
+        return 0;
+    }
+
+    uint8_t hdr[OTA_PROTO_HDR_LEN];
+    hdr[0] = type;
+    put_u16(&hdr[1], seq);
+    put_u16(&hdr[3], len);
+
+    uint8_t trailer[OTA_PROTO_CRC_LEN];
+    uint32_t crc = ota_proto_crc32(0, hdr, sizeof(hdr));
+    crc = ota_proto_crc32(crc, payload, len);
+    put_u32(trailer, crc);
+
+    size_t pos = 0;
+    out[pos++] = SLIP_END;
+
+    const uint8_t *parts[3] = { hdr, payload, trailer };
+    const size_t lens[3] = { sizeof(hdr), len, sizeof(trailer) };
+    for (int part = 0; part < 3; part++) {
+        for (size_t i = 0; i < lens[part]; i++) {
+            size_t n = slip_put(parts[part][i], out, pos, out_size);
+            if (n == 0) {
+                return 0;
+            }
+            pos += n;
+        }
+    }
+
+    if (pos + 1 > out_size) {
+        return 0;
+    }
+    out[pos++] = SLIP_END;
+    return pos;
+}
+
+
+/**
+ * @brief Feeds one received byte into the SLIP decoder.
+ *
+ * @return true if a complete frame is now available in dec->frame/dec->len.
+ *         The caller must consume it before feeding the next byte.
+ */
+bool ota_proto_slip_feed(slip_decoder_t *dec, uint8_t byte)
+{
+    if (byte == SLIP_END) {
+        bool complete = (dec->len > 0) && !dec->overflow;
+        if (!complete) {
+            dec->len = 0;
+        }
+        dec->overflow = false;
+        dec->escape = false;
+        return complete;
+    }
+
+    if (byte == SLIP_ESC) {
+        dec->escape = true;
+        return false;
+    }
+
+    if (dec->escape) {
+        dec->escape = false;
+        byte = (byte == SLIP_ESC_END) ? SLIP_END : (byte == SLIP_ESC_ESC) ? SLIP_ESC : byte;
+    }
+
+    if (dec->len >= sizeof(dec->frame)) {
+        dec->overflow = true;
+        return false;
+    }
+    dec->frame[dec->len++] = byte;
+    return false;
+}
+
+
+/**
+ * @brief Validates and splits a decoded frame.
+ *
+ * @param frame Decoded frame bytes.
+ * @param len   Number of decoded bytes.
+ * @param out   Parsed frame, payload points into frame.
+ *
+ * @return true if the frame is well formed and its CRC matches.
+ */
+bool ota_proto_parse(const uint8_t *frame, size_t len, ota_frame_t *out)
+{
+    if (len < OTA_PROTO_HDR_LEN + OTA_PROTO_CRC_LEN) {
+        return false;
+    }
+
+    uint16_t payload_len = get_u16(&frame[3]);
+    if (payload_len > OTA_PROTO_MAX_BLOCK || len != (size_t)OTA_PROTO_HDR_LEN + payload_len + OTA_PROTO_CRC_LEN) {
+        return false;
+    }
+
+    uint32_t crc = ota_proto_crc32(0, frame, OTA_PROTO_HDR_LEN + payload_len);
+    if (crc != get_u32(&frame[OTA_PROTO_HDR_LEN + payload_len])) {
+        return false;
+    }
+
+    out->type = frame[0];
+    out->seq = get_u16(&frame[1]);
+    out->len = payload_len;
+    out->payload = &frame[OTA_PROTO_HDR_LEN];
+    return true;
+}
+
+
+/**
+ * @brief Encodes and sends a frame through the io callbacks.
+ */
+static void rx_send(ota_proto_rx_t *rx, uint8_t type, uint16_t seq, const void *payload, uint16_t len)
+{
+    uint8_t out[32];    // Device to host frames carry at most 8 payload bytes
+    size_t n = ota_proto_encode(type, seq, payload, len, out, sizeof(out));
+    if (n > 0) {
+        rx->io.send(rx->io.ctx, out, n);
+    }
+}
+
+
+/**
+ * @brief Sends a one byte status frame.
+ */
+static void rx_send_status(ota_proto_rx_t *rx, uint8_t type, uint8_t status)
+{
+    rx_send(rx, type, rx->expected, &status, 1);
+}
+
+
+/**
+ * @brief Aborts the transfer and tells the host why.
+ */
+static void rx_fail(ota_proto_rx_t *rx, uint8_t status)
+{
+    if (rx->state == OTA_RX_RECEIVING) {
+        rx->io.abort(rx->io.ctx);
+    }
+    rx->state = OTA_RX_FAILED;
+    rx_send_status(rx, OTA_FRAME_FAIL, status);
+}
+
+
+/**
+ * @brief Handles a HELLO frame: negotiates window, block size and baud rate.
+ */
+static void rx_hello(ota_proto_rx_t *rx, const ota_frame_t *f)
+{
+    if (f->len < 11) {
+        rx_send_status(rx, OTA_FRAME_FAIL, OTA_STATUS_PROTOCOL);
+        return;
+    }
+
+    // A repeated HELLO means the host missed our reply, answer it again
+    if (rx->state == OTA_RX_RECEIVING) {
+        if (rx->expected != 0) {
+            rx_send_status(rx, OTA_FRAME_FAIL, OTA_STATUS_PROTOCOL);
+            return;
+        }
+    } else {
+        rx->image_size = get_u32(&f->payload[0]);
+        int status = rx->io.begin(rx->io.ctx, rx->image_size);
+        if (status != OTA_STATUS_OK) {
+            rx->state = OTA_RX_FAILED;
+            rx_send_status(rx, OTA_FRAME_HELLO_ACK, (uint8_t)status);
+            return;
+        }
+        rx->state = OTA_RX_RECEIVING;
+    }
+
+    uint16_t block = get_u16(&f->payload[4]);
+    uint8_t window = f->payload[6];
+    uint32_t baud = get_u32(&f->payload[7]);
+
+    if (block == 0 || block > OTA_PROTO_MAX_BLOCK) {
+        block = OTA_PROTO_MAX_BLOCK;
+    }
+    if (window == 0 || window > rx->window) {
+        window = rx->window;
+    }
+    if (baud > rx->max_baud || rx->io.set_baud == NULL) {
+        baud = 0;
+    }
+    rx->ack_every = (window > 1) ? window / 2 : 1;
+
+    uint8_t ack[8];
+    ack[0] = OTA_STATUS_OK;
+    ack[1] = window;
+    put_u16(&ack[2], block);
+    put_u32(&ack[4], baud);
+    rx_send(rx, OTA_FRAME_HELLO_ACK, 0, ack, sizeof(ack));
+
+    if (baud != 0) {
+        rx->io.set_baud(rx->io.ctx, baud);
+    }
+}
+
+
+/**
+ * @brief Handles a DATA frame.
+ *
+ * In-order blocks are written straight to the sink. A gap triggers a single
+ * NAK until the expected block arrives; duplicates re-send the current ACK in
+ * case the previous one was lost.
+ */
+static void rx_data(ota_proto_rx_t *rx, const ota_frame_t *f)
+{
+    int16_t delta = (int16_t)(f->seq - rx->expected);
+
+    if (delta < 0) {
+        rx_send(rx, OTA_FRAME_ACK, rx->expected, NULL, 0);
+        return;
+    }
+    if (delta > 0) {
+        if (!rx->nak_sent) {
+            rx->nak_sent = true;
+            rx->resends++;
+            rx_send(rx, OTA_FRAME_NAK, rx->expected, NULL, 0);
+        }
+        return;
+    }
+
+    if (rx->received + f->len > rx->image_size) {
+        rx_fail(rx, OTA_STATUS_SIZE);
+        return;
+    }
+
+    int status = rx->io.write(rx->io.ctx, f->payload, f->len);
+    if (status != OTA_STATUS_OK) {
+        rx->state = OTA_RX_FAILED;          // The sink has already aborted
+        rx_send_status(rx, OTA_FRAME_FAIL, (uint8_t)status);
+        return;
+    }
+
+    rx->image_crc = ota_proto_crc32(rx->image_crc, f->payload, f->len);
+    rx->received += f->len;
+    rx->expected++;
+    rx->nak_sent = false;
+
+    if (++rx->since_ack >= rx->ack_every || rx->received == rx->image_size) {
+        rx->since_ack = 0;
+        rx_send(rx, OTA_FRAME_ACK, rx->expected, NULL, 0);
+    }
+}
+
+
+/**
+ * @brief Handles an END frame: checks size and CRC, then commits the image.
+ */
+static void rx_end(ota_proto_rx_t *rx, const ota_frame_t *f)
+{
+    if (f->len < 8) {
+        rx_fail(rx, OTA_STATUS_PROTOCOL);
+        return;
+    }
+    if (get_u32(&f->payload[0]) != rx->image_size || rx->received != rx->image_size) {
+        rx_fail(rx, OTA_STATUS_SIZE);
+        return;
+    }
+    if (get_u32(&f->payload[4]) != rx->image_crc) {
+        rx_fail(rx, OTA_STATUS_CRC);
+        return;
+    }
+
+    int status = rx->io.finish(rx->io.ctx);
+    rx->state = (status == OTA_STATUS_OK) ? OTA_RX_DONE : OTA_RX_FAILED;
+    rx_send_status(rx, OTA_FRAME_END_ACK, (uint8_t)status);
+}
+
+
+/**
+ * @brief Dispatches one complete, CRC checked frame.
+ */
+static void rx_frame(ota_proto_rx_t *rx, const ota_frame_t *f)
+{
+    switch (f->type) {
+        case OTA_FRAME_HELLO:
+            rx_hello(rx, f);
+            break;
+        case OTA_FRAME_DATA:
+            if (rx->state == OTA_RX_RECEIVING) {
+                rx_data(rx, f);
+            }
+            break;
+        case OTA_FRAME_END:
+            if (rx->state == OTA_RX_RECEIVING) {
+                rx_end(rx, f);
+            }
+            break;
+        case OTA_FRAME_ABORT:
+            if (rx->state == OTA_RX_RECEIVING) {
+                rx->io.abort(rx->io.ctx);
+            }
+            rx->state = OTA_RX_FAILED;
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+ * @brief Initializes a receiver.
+ *
+ * @param rx        Receiver state.
+ * @param io        Sink and serial port callbacks (copied).
+ * @param window    Largest number of unacknowledged blocks the host may send.
+ * @param max_baud  Highest baud rate the host may switch to, 0 to disable.
+ */
+void ota_proto_rx_init(ota_proto_rx_t *rx, const ota_proto_io_t *io, uint8_t window, uint32_t max_baud)
+{
+    memset(rx, 0, sizeof(*rx));
+    rx->io = *io;
+    rx->window = (window == 0 || window > OTA_PROTO_MAX_WINDOW) ? OTA_PROTO_MAX_WINDOW : window;
+    rx->max_baud = max_baud;
+    rx->ack_every = 1;
+    rx->state = OTA_RX_WAIT_HELLO;
+}
+
+
+/**
+ * @brief Feeds received serial bytes into the receiver.
+ *
+ * @param rx   Receiver state.
+ * @param data Raw bytes from the serial port.
+ * @param len  Number of bytes.
+ *
+ * @return The receiver state after processing; OTA_RX_DONE and OTA_RX_FAILED
+ *         are final.
+ */
+ota_rx_state_t ota_proto_rx_feed(ota_proto_rx_t *rx, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len && rx->state < OTA_RX_DONE; i++) {
+        if (!ota_proto_slip_feed(&rx->slip, data[i])) {
+            continue;
+        }
+
+        ota_frame_t frame;
+        if (ota_proto_parse(rx->slip.frame, rx->slip.len, &frame)) {
+            rx_frame(rx, &frame);
+        } else {
+            rx->crc_errors++;
+        }
+        rx->slip.len = 0;
+    }
+    return rx->state;
+}
+
+
+/**
+ * @brief Called when the serial line has been idle for a while.
+ *
+ * Re-sends the current cumulative ACK so the sender can recover from a lost
+ * acknowledgement without waiting for its own retransmit timeout.
+ *
+ * @param rx Receiver state.
+ */
+void ota_proto_rx_idle(ota_proto_rx_t *rx)
+{
+    if (rx->state == OTA_RX_RECEIVING) {
+        rx->since_ack = 0;
+        rx_send(rx, OTA_FRAME_ACK, rx->expected, NULL, 0);
+    }
+}
@@ -0,0 +1,133 @@
+/*
+ * ota_proto.h
+ *
+ * Binary framed OTA transfer protocol used by the serial console update path.
+ *
+ * Frames are SLIP encoded (RFC 1055) and carry a small header, a payload and
+ * a CRC-32 trailer:
+ *
+ *      type (1) | seq (2, LE) | len (2, LE) | payload (len) | crc32 (4, LE)
+ *
+ * The CRC is the standard zlib CRC-32 over header and payload. Image data is
+ * sent in DATA blocks numbered from 0; the receiver acknowledges cumulatively
+ * (ACK carries the next expected block) and asks for a go-back-N resend with
+ * NAK when it sees a gap, so the sender may keep a whole window in flight.
+ *
+ * This module has no ESP-IDF dependencies so the receiver can be exercised on
+ * a Linux host (see tools/host).
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef OTA_PROTO_H
+#define OTA_PROTO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTA_PROTO_MAX_BLOCK     1024                        // Largest DATA payload
+#define OTA_PROTO_HDR_LEN       5                           // type + seq + len
+#define OTA_PROTO_CRC_LEN       4
+#define OTA_PROTO_MAX_FRAME     (OTA_PROTO_HDR_LEN + OTA_PROTO_MAX_BLOCK + OTA_PROTO_CRC_LEN)
+#define OTA_PROTO_MAX_ENCODED   (2 * OTA_PROTO_MAX_FRAME + 2)
+#define OTA_PROTO_MAX_WINDOW    32
+
+// Frame types, host to device
+#define OTA_FRAME_HELLO         0x01    // u32 image size, u16 block size, u8 window, u32 baud
+#define OTA_FRAME_DATA          0x02    // seq = block number, payload = image data
+#define OTA_FRAME_END           0x03    // u32 image size, u32 image crc32
+#define OTA_FRAME_ABORT         0x04    // no payload
+
+// Frame types, device to host
+#define OTA_FRAME_HELLO_ACK     0x81    // u8 status, u8 window, u16 block size, u32 baud
+#define OTA_FRAME_ACK           0x82    // seq = next expected block
+#define OTA_FRAME_NAK           0x83    // seq = next expected block, resend from here
+#define OTA_FRAME_END_ACK       0x84    // u8 status
+#define OTA_FRAME_FAIL          0x85    // u8 status, transfer aborted by device
+
+// Status codes carried in HELLO_ACK, END_ACK and FAIL frames
+#define OTA_STATUS_OK           0x00
+#define OTA_STATUS_BUSY         0x01    // Update already in progress or not ready
+#define OTA_STATUS_WRITE        0x02    // Flash write failed
+#define OTA_STATUS_SIZE         0x03    // Image size mismatch
+#define OTA_STATUS_CRC          0x04    // Image CRC mismatch
+#define OTA_STATUS_VERIFY       0x05    // Image failed validation
+#define OTA_STATUS_PROTOCOL     0x06    // Unexpected frame
+
+
+// Incremental SLIP decoder
+typedef struct {
+    uint8_t     frame[OTA_PROTO_MAX_FRAME];
+    size_t      len;
+    bool        escape;
+    bool        overflow;
+} slip_decoder_t;
+
+// Decoded frame, payload points into the decoder buffer
+typedef struct {
+    uint8_t         type;
+    uint16_t        seq;
+    uint16_t        len;
+    const uint8_t   *payload;
+} ota_frame_t;
+
+// Callbacks connecting the receiver to the OTA writer and the serial port.
+// Sink callbacks return 0 on success or an OTA_STATUS_xxx code.
+typedef struct {
+    int     (*begin)(void *ctx, uint32_t image_size);
+    int     (*write)(void *ctx, const uint8_t *data, size_t len);
+    int     (*finish)(void *ctx);
+    void    (*abort)(void *ctx);
+    void    (*send)(void *ctx, const uint8_t *data, size_t len);
+    void    (*set_baud)(void *ctx, uint32_t baud);      // Optional
+    void    *ctx;
+} ota_proto_io_t;
+
+typedef enum {
+    OTA_RX_WAIT_HELLO = 0,
+    OTA_RX_RECEIVING,
+    OTA_RX_DONE,
+    OTA_RX_FAILED,
+} ota_rx_state_t;
+
+// Receiver state
+typedef struct {
+    ota_proto_io_t  io;
+    slip_decoder_t  slip;
+    ota_rx_state_t  state;
+    uint32_t        max_baud;       // Highest baud rate we agree to switch to, 0 = never
+    uint8_t         window;         // Largest window we allow the sender
+    uint8_t         ack_every;      // Send a cumulative ACK every N in-order blocks
+    uint8_t         since_ack;
+    bool            nak_sent;
+    uint16_t        expected;       // Next expected block number
+    uint32_t        image_size;
+    uint32_t        received;
+    uint32_t        image_crc;
+    uint32_t        crc_errors;
+    uint32_t        resends;
+} ota_proto_rx_t;
+
+
+// Functions
+uint32_t        ota_proto_crc32(uint32_t crc, const void *data, size_t len);
+size_t          ota_proto_encode(uint8_t type, uint16_t seq, const void *payload, uint16_t len,
+                                 uint8_t *out, size_t out_size);
+bool            ota_proto_slip_feed(slip_decoder_t *dec, uint8_t byte);
+bool            ota_proto_parse(const uint8_t *frame, size_t len, ota_frame_t *out);
+
+void            ota_proto_rx_init(ota_proto_rx_t *rx, const ota_proto_io_t *io, uint8_t window, uint32_t max_baud);
+ota_rx_state_t  ota_proto_rx_feed(ota_proto_rx_t *rx, const uint8_t *data, size_t len);
+void            ota_proto_rx_idle(ota_proto_rx_t *rx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
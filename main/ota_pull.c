@@ -0,0 +1,150 @@
+/*
+ * ota_pull.c
+ *
+ * This file implements the 'ota_pull' console command. The image is read
+ * with esp_http_client on the console task and pushed into an OTA session
+ * exactly like an upload, so it is relayed to downstream units as well.
+ * HTTPS servers are verified against the embedded server_certs/ca_cert.pem.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_console.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "ota_session.h"
+#include "ota_pull.h"
+
+
+#define OTA_PULL_CHUNK      1024
+
+
+// Local function prototypes
+extern void request_reboot(void);
+
+
+// Local variables
+static const char       *TAG = "ota_pull";
+extern const uint8_t    server_cert_pem_start[] asm("_binary_ca_cert_pem_start");
+
+
+/**
+ * @brief Downloads an image and installs it.
+ *
+ * @param url Image URL.
+ *
+ * @return ESP_OK if the image was installed and will be booted on restart.
+ */
+static esp_err_t ota_pull(const char *url)
+{
+    esp_http_client_config_t config = {
+        .url = url,
+        .cert_pem = (const char *)server_cert_pem_start,
+        .timeout_ms = CONFIG_EXAMPLE_OTA_RECV_TIMEOUT,
+        .keep_alive_enable = true,
+#ifdef CONFIG_EXAMPLE_SKIP_COMMON_NAME_CHECK
+        .skip_cert_common_name_check = true,
+#endif
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open %s: %s", url, esp_err_to_name(err));
+        esp_http_client_cleanup(client);
+        return err;
+    }
+
+    int64_t content_len = esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    if (status != 200) {
+        ESP_LOGE(TAG, "Server returned HTTP %d", status);
+        esp_http_client_close(client);
+        esp_http_client_cleanup(client);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ota_session_config_t session_config = {
+        .format       = OTA_SESSION_RAW,
+        .content_len  = (content_len > 0) ? content_len : 0,
+        .path         = OTA_PATH_PULL,
+        .relay        = true,
+        .content_type = "application/octet-stream",
+    };
+    ota_session_t *session = malloc(sizeof(ota_session_t));
+    char *buf = malloc(OTA_PULL_CHUNK);
+    err = (session && buf) ? ota_session_open(session, &session_config) : ESP_ERR_NO_MEM;
+
+    ota_session_status_t state = OTA_SESSION_MORE;
+    while (err == ESP_OK && state == OTA_SESSION_MORE) {
+        int n = esp_http_client_read(client, buf, OTA_PULL_CHUNK);
+        if (n < 0 || (n == 0 && !esp_http_client_is_complete_data_received(client))) {
+            ESP_LOGE(TAG, "Download failed after %u bytes", (unsigned)session->received);
+            ota_session_abort(session);
+            err = ESP_FAIL;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        state = ota_session_push(session, buf, n);
+    }
+
+    if (err == ESP_OK) {
+        err = ota_session_finish(session);
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "Installed %u bytes from %s", (unsigned)session->writer.written, url);
+        }
+    }
+
+    free(buf);
+    free(session);
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+
+/**
+ * @brief Handler for the 'ota_pull' console command.
+ */
+static int ota_pull_cmd(int argc, char **argv)
+{
+    const char *url = (argc > 1) ? argv[1] : CONFIG_EXAMPLE_FIRMWARE_UPG_URL;
+
+    printf("ota_pull: downloading %s\n", url);
+    esp_err_t err = ota_pull(url);
+    if (err != ESP_OK) {
+        printf("ota_pull: failed: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("ota_pull: done. Rebooting...\n");
+    request_reboot();
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'ota_pull' console command.
+ */
+void register_ota_pull(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "ota_pull",
+        .help = "Download and install a firmware image, default URL from menuconfig",
+        .hint = "[<url>]",
+        .func = &ota_pull_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,25 @@
+/*
+ * ota_pull.h
+ *
+ * 'ota_pull' console command: downloads a firmware image from an HTTP(S)
+ * server and installs it through the OTA session engine.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef OTA_PULL_H
+#define OTA_PULL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Functions
+void register_ota_pull(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,498 @@
+/*
+ * ota_relay.c
+ *
+ * This file implements chain-forwarding of OTA uploads. Each configured peer
+ * gets a bounded stream buffer and a task that replays the upload request to
+ * it over a plain TCP connection. The upload handler pushes every received
+ * chunk into all peer buffers before writing it locally; when a peer is
+ * slower than the upstream sender its buffer fills and the push blocks, which
+ * throttles the upstream connection instead of growing memory. A peer that
+ * makes no progress for CONFIG_OTA_RELAY_STALL_MS is dropped so it cannot hold
+ * up the local update. The upload starts once every peer has connected and
+ * taken the request headers, or failed to, so a hop adds no fixed delay.
+ *
+ * With CONFIG_STATIC_ALLOCATION every peer slot has a statically allocated
+ * task, stream buffer and chunk buffer. The tasks are created on first use
+ * and then wait for the next upload instead of being deleted.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "sdkconfig.h"
+#include "settings.h"
+#include "ota_relay.h"
+
+
+#define RELAY_DEFAULT_PORT      80
+#define RELAY_POLL_MS           100
+#define RELAY_CHUNK_SIZE        1024
+#define RELAY_STACK_SIZE        CONFIG_STACK_SIZE_OTA_RELAY
+
+
+// One downstream unit
+typedef struct {
+    char                    host[64];
+    char                    port[6];
+    StreamBufferHandle_t    stream;
+    TaskHandle_t            task;
+    volatile bool           failed;
+    volatile bool           done;           // Task finished with the peer
+    size_t                  sent;
+} relay_peer_t;
+
+
+// Local variables
+static const char       *TAG = "relay";
+static relay_peer_t     peers[CONFIG_OTA_RELAY_MAX_PEERS];
+static int              num_peers;
+static size_t           content_len;
+static char             content_type[128];
+static int              next_hops;
+static volatile bool    relay_abort;
+static SemaphoreHandle_t done_sem;
+static SemaphoreHandle_t ready_sem;
+static int              stale_peers;        // Peers of an upload whose tasks were given up on
+static int              stale_pending;      // Of their tasks, those that have not finished
+#if CONFIG_STATIC_ALLOCATION
+static TaskHandle_t         slot_tasks[CONFIG_OTA_RELAY_MAX_PEERS];
+static StreamBufferHandle_t slot_streams[CONFIG_OTA_RELAY_MAX_PEERS];
+static StaticTask_t         slot_tcb[CONFIG_OTA_RELAY_MAX_PEERS];
+static StackType_t          slot_stack[CONFIG_OTA_RELAY_MAX_PEERS][RELAY_STACK_SIZE];
+static StaticStreamBuffer_t slot_stream_buf[CONFIG_OTA_RELAY_MAX_PEERS];
+static uint8_t              slot_stream_mem[CONFIG_OTA_RELAY_MAX_PEERS][CONFIG_OTA_RELAY_BUFFER_SIZE + 1];
+static char                 slot_chunk[CONFIG_OTA_RELAY_MAX_PEERS][RELAY_CHUNK_SIZE];
+static StaticSemaphore_t    done_sem_buf;
+static StaticSemaphore_t    ready_sem_buf;
+#endif
+
+
+/**
+ * @brief Sends a complete buffer on a socket.
+ *
+ * @return true if all bytes were sent, false on error.
+ */
+static bool send_all(int sock, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0) {
+        int n = send(sock, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Opens a TCP connection to a peer. The connect is non-blocking and
+ *        waited for with select(), since lwIP does not bound a blocking
+ *        connect by SO_SNDTIMEO and an unreachable peer would hold the
+ *        task for the whole SYN retry time.
+ *
+ * @return A connected socket, or -1 on failure.
+ */
+static int relay_connect(const relay_peer_t *peer)
+{
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(peer->host, peer->port, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGE(TAG, "Cannot resolve %s", peer->host);
+        return -1;
+    }
+
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    struct timeval tv = { .tv_sec = CONFIG_OTA_RELAY_STALL_MS / 1000,
+                          .tv_usec = (CONFIG_OTA_RELAY_STALL_MS % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int err = 0;
+    if (connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+        err = errno;
+        if (err == EINPROGRESS) {
+            fd_set writable;
+            FD_ZERO(&writable);
+            FD_SET(sock, &writable);
+            socklen_t len = sizeof(err);
+            if (select(sock + 1, NULL, &writable, NULL, &tv) <= 0) {
+                err = ETIMEDOUT;
+            } else if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+                err = errno;
+            }
+        }
+    }
+    freeaddrinfo(res);
+
+    if (err != 0) {
+        ESP_LOGE(TAG, "Cannot connect to %s:%s: errno %d", peer->host, peer->port, err);
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, flags);
+    return sock;
+}
+
+
+/**
+ * @brief Forwards the buffered upload body to one peer.
+ *
+ * @param peer Peer to serve.
+ * @param buf  Chunk buffer of RELAY_CHUNK_SIZE bytes, or NULL if it could
+ *             not be allocated.
+ */
+static void relay_serve(relay_peer_t *peer, char *buf)
+{
+    int sock = (buf != NULL) ? relay_connect(peer) : -1;
+
+    if (sock >= 0) {
+        int len = snprintf(buf, RELAY_CHUNK_SIZE,
+            "POST /upload HTTP/1.1\r\n"
+            "Host: %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %u\r\n"
+            OTA_RELAY_HOPS_HEADER ": %d\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            peer->host, content_type, (unsigned)content_len, next_hops);
+        if (!send_all(sock, buf, len)) {
+            peer->failed = true;
+        }
+    } else {
+        peer->failed = true;
+    }
+    xSemaphoreGive(ready_sem);                  // Connected and headers sent, or failed
+
+    // Forward the body as it arrives
+    int idle_ms = 0;
+    while (!peer->failed && !relay_abort && peer->sent < content_len) {
+        size_t n = xStreamBufferReceive(peer->stream, buf, RELAY_CHUNK_SIZE, pdMS_TO_TICKS(RELAY_POLL_MS));
+        if (n == 0) {
+            idle_ms += RELAY_POLL_MS;
+            if (idle_ms >= CONFIG_OTA_RELAY_STALL_MS) {
+                ESP_LOGE(TAG, "%s: upstream stalled", peer->host);
+                peer->failed = true;
+            }
+            continue;
+        }
+        idle_ms = 0;
+        if (!send_all(sock, buf, n)) {
+            ESP_LOGE(TAG, "%s: send failed: errno %d", peer->host, errno);
+            peer->failed = true;
+        }
+        peer->sent += n;
+    }
+
+    if (relay_abort) {
+        peer->failed = true;
+    }
+
+    // The peer answers once it has written and validated the image
+    if (!peer->failed) {
+        int n = recv(sock, buf, RELAY_CHUNK_SIZE - 1, 0);
+        buf[n > 0 ? n : 0] = '\0';
+        if (strncmp(buf, "HTTP/1.1 200", 12) != 0) {
+            ESP_LOGE(TAG, "%s: update rejected: %.32s", peer->host, buf);
+            peer->failed = true;
+        } else {
+            ESP_LOGI(TAG, "%s: update accepted", peer->host);
+        }
+    }
+
+    if (sock >= 0) {
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+    }
+}
+
+
+#if CONFIG_STATIC_ALLOCATION
+/**
+ * @brief Task of one peer slot, serves that slot for every upload.
+ *
+ * @param param Index of the slot in peers.
+ */
+static void relay_task(void *param)
+{
+    int slot = (intptr_t)param;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        relay_serve(&peers[slot], slot_chunk[slot]);
+        peers[slot].done = true;
+        xSemaphoreGive(done_sem);
+    }
+}
+#else
+/**
+ * @brief Task forwarding the buffered upload body to one peer.
+ *
+ * @param param Pointer to the relay_peer_t to serve.
+ */
+static void relay_task(void *param)
+{
+    relay_peer_t *peer = param;
+    char *buf = malloc(RELAY_CHUNK_SIZE);
+    relay_serve(peer, buf);
+    free(buf);
+    peer->done = true;
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+#endif
+
+
+/**
+ * @brief Parses the relay_peers setting into the peer table.
+ *
+ * @return The number of peers found.
+ */
+static int parse_peers(void)
+{
+    char list[CONFIG_OTA_RELAY_MAX_PEERS * 32];
+    get_relay_peers(list, sizeof(list));
+
+    int count = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ", ", &save); tok && count < CONFIG_OTA_RELAY_MAX_PEERS; tok = strtok_r(NULL, ", ", &save)) {
+        relay_peer_t *peer = &peers[count];
+        memset(peer, 0, sizeof(*peer));
+
+        char *colon = strchr(tok, ':');
+        if (colon) {
+            *colon = '\0';
+            strlcpy(peer->port, colon + 1, sizeof(peer->port));
+        } else {
+            snprintf(peer->port, sizeof(peer->port), "%d", RELAY_DEFAULT_PORT);
+        }
+        strlcpy(peer->host, tok, sizeof(peer->host));
+        count++;
+    }
+    return count;
+}
+
+
+/**
+ * @brief Releases the peers of an earlier upload whose tasks
+ *        ota_relay_end() gave up on, once all those tasks have finished.
+ *        Until then the peer table and the slots are still in use.
+ *
+ * @return true if none are left.
+ */
+static bool release_stale(void)
+{
+    while (stale_pending > 0 && xSemaphoreTake(done_sem, 0) == pdTRUE) {
+        stale_pending--;
+    }
+    if (stale_pending > 0) {
+        return false;
+    }
+#if !CONFIG_STATIC_ALLOCATION
+    for (int i = 0; i < stale_peers; i++) {
+        if (peers[i].stream != NULL) {
+            vStreamBufferDelete(peers[i].stream);
+            peers[i].stream = NULL;
+        }
+    }
+#endif
+    stale_peers = 0;
+    return true;
+}
+
+
+/**
+ * @brief Starts relaying an upload to all configured peers.
+ *
+ * @param len    Content-Length of the incoming upload request.
+ * @param type   Content-Type of the incoming request (multipart boundary
+ *               included), forwarded unchanged.
+ * @param hops   Value of the X-OTA-Hops header of the incoming request,
+ *               0 if it was absent.
+ *
+ * @return The number of peers the upload is being relayed to.
+ */
+int ota_relay_begin(size_t len, const char *type, int hops)
+{
+    num_peers = 0;
+    if (hops >= CONFIG_OTA_RELAY_MAX_HOPS) {
+        ESP_LOGW(TAG, "Hop limit reached, not relaying");
+        return 0;
+    }
+
+    if (done_sem == NULL) {
+#if CONFIG_STATIC_ALLOCATION
+        done_sem = xSemaphoreCreateCountingStatic(CONFIG_OTA_RELAY_MAX_PEERS, 0, &done_sem_buf);
+        ready_sem = xSemaphoreCreateCountingStatic(CONFIG_OTA_RELAY_MAX_PEERS, 0, &ready_sem_buf);
+#else
+        done_sem = xSemaphoreCreateCounting(CONFIG_OTA_RELAY_MAX_PEERS, 0);
+        ready_sem = xSemaphoreCreateCounting(CONFIG_OTA_RELAY_MAX_PEERS, 0);
+#endif
+        if (done_sem == NULL || ready_sem == NULL) {
+            return 0;
+        }
+    }
+    if (!release_stale()) {
+        ESP_LOGW(TAG, "Relay tasks of the last upload still running, not relaying");
+        return 0;
+    }
+    while (xSemaphoreTake(ready_sem, 0) == pdTRUE) {
+        // Left by tasks of an earlier upload that was not waited for
+    }
+    relay_abort = false;
+
+    content_len = len;
+    next_hops = hops + 1;
+    strlcpy(content_type, type ? type : "application/octet-stream", sizeof(content_type));
+
+    int count = parse_peers();
+    for (int i = 0; i < count; i++) {
+        relay_peer_t *peer = &peers[num_peers];
+#if CONFIG_STATIC_ALLOCATION
+        if (slot_tasks[i] == NULL) {
+            slot_streams[i] = xStreamBufferCreateStatic(CONFIG_OTA_RELAY_BUFFER_SIZE, 1, slot_stream_mem[i],
+                                                        &slot_stream_buf[i]);
+            slot_tasks[i] = xTaskCreateStatic(relay_task, "ota_relay", RELAY_STACK_SIZE, (void *)(intptr_t)i, 5,
+                                              slot_stack[i], &slot_tcb[i]);
+        }
+        xStreamBufferReset(slot_streams[i]);
+        peer->stream = slot_streams[i];
+        peer->task = slot_tasks[i];
+        xTaskNotifyGive(peer->task);
+#else
+        peer->stream = xStreamBufferCreate(CONFIG_OTA_RELAY_BUFFER_SIZE, 1);
+        if (peer->stream == NULL) {
+            ESP_LOGE(TAG, "No memory for relay to %s", peer->host);
+            break;
+        }
+        if (xTaskCreate(relay_task, "ota_relay", RELAY_STACK_SIZE, peer, 5, &peer->task) != pdPASS) {
+            vStreamBufferDelete(peer->stream);
+            break;
+        }
+#endif
+        ESP_LOGI(TAG, "Relaying upload to %s:%s", peer->host, peer->port);
+        num_peers++;
+    }
+
+    // Wait for the peers to take the headers, within the connect timeout
+    TickType_t start = xTaskGetTickCount();
+    TickType_t limit = pdMS_TO_TICKS(CONFIG_OTA_RELAY_STALL_MS);
+    for (int ready = 0; ready < num_peers; ready++) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= limit || xSemaphoreTake(ready_sem, limit - waited) != pdTRUE) {
+            ESP_LOGW(TAG, "%d peers not ready, relaying anyway", num_peers - ready);
+            break;
+        }
+    }
+    return num_peers;
+}
+
+
+/**
+ * @brief Tees a chunk of the upload body to every active peer.
+ *
+ * Blocks while a peer's buffer is full, which applies back-pressure to the
+ * upstream connection. Peers that stay full for CONFIG_OTA_RELAY_STALL_MS are
+ * dropped.
+ *
+ * @param data Chunk of the raw request body.
+ * @param len  Number of bytes.
+ */
+void ota_relay_push(const void *data, size_t len)
+{
+    for (int i = 0; i < num_peers; i++) {
+        relay_peer_t *peer = &peers[i];
+        const uint8_t *p = data;
+        size_t remaining = len;
+        int waited_ms = 0;
+
+        while (remaining > 0 && !peer->failed) {
+            size_t n = xStreamBufferSend(peer->stream, p, remaining, pdMS_TO_TICKS(RELAY_POLL_MS));
+            p += n;
+            remaining -= n;
+            waited_ms = n ? 0 : waited_ms + RELAY_POLL_MS;
+            if (waited_ms >= CONFIG_OTA_RELAY_STALL_MS) {
+                ESP_LOGE(TAG, "%s: too slow, dropping peer", peer->host);
+                peer->failed = true;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Finishes relaying and releases all relay resources.
+ *
+ * @param complete true if the whole body was pushed; the function then waits
+ *                 for every peer to accept or reject the image. false aborts
+ *                 all peer connections, which makes the peers discard their
+ *                 partial update.
+ *
+ * @return The number of peers that accepted the image.
+ */
+int ota_relay_end(bool complete)
+{
+    if (!complete) {
+        relay_abort = true;
+    }
+
+    // Peers only answer after validating the image, allow for that. A task
+    // stuck past the deadline keeps its peer, released by the next upload
+    // once it finishes.
+    TickType_t start = xTaskGetTickCount();
+    TickType_t limit = pdMS_TO_TICKS(CONFIG_OTA_RELAY_STALL_MS * 2);
+    int finished = 0;
+    while (finished < num_peers) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= limit || xSemaphoreTake(done_sem, limit - waited) != pdTRUE) {
+            break;
+        }
+        finished++;
+    }
+    if (finished < num_peers) {
+        ESP_LOGE(TAG, "%d relay tasks did not finish, giving up on them", num_peers - finished);
+        relay_abort = true;
+        stale_peers = num_peers;
+        stale_pending = num_peers - finished;
+    }
+
+    int accepted = 0;
+    for (int i = 0; i < num_peers; i++) {
+        if (!peers[i].done) {
+            continue;
+        }
+        if (!peers[i].failed && complete) {
+            accepted++;
+        }
+#if !CONFIG_STATIC_ALLOCATION
+        vStreamBufferDelete(peers[i].stream);
+        peers[i].stream = NULL;
+#endif
+    }
+
+    if (num_peers > 0) {
+        ESP_LOGI(TAG, "Upload relayed to %d of %d peers", accepted, num_peers);
+    }
+    num_peers = 0;
+    return accepted;
+}
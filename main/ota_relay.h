@@ -0,0 +1,39 @@
+/*
+ * ota_relay.h
+ *
+ * Chain-forwarding of OTA uploads. While a unit writes an incoming image to
+ * its own update partition it can tee the raw request body to one or more
+ * downstream units, so a whole string of units is updated with one upload
+ * and each hop only adds pipeline latency.
+ *
+ * Downstream peers are configured through the "relay_peers" setting as a
+ * comma separated list of host[:port] entries.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef OTA_RELAY_H
+#define OTA_RELAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define OTA_RELAY_HOPS_HEADER   "X-OTA-Hops"
+
+
+// Functions
+int  ota_relay_begin(size_t content_len, const char *content_type, int hops);
+void ota_relay_push(const void *data, size_t len);
+int  ota_relay_end(bool complete);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * ota_session.c
+ *
+ * This file implements the OTA session engine. The body parser is written
+ * as a protothread: session_run() is re-entered on every push and resumes
+ * at the step it last waited in, so the transports do not have to know
+ * anything about multipart framing and may deliver data in pieces of any
+ * size.
+ *
+ * Image data is written straight from the caller's buffer. The multipart
+ * closing delimiter is found with a KMP matcher whose state carries across
+ * pushes; bytes held back because they might start the delimiter are known
+ * to equal a prefix of it, so they are written from the delimiter itself
+ * when the match fails and never have to be copied.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "kernels.h"
+#include "ota_relay.h"
+#include "perf_lock.h"
+#include "alloc_guard.h"
+#include "ota_session.h"
+
+
+// Protothread resume points, see session_run()
+#define PT_ENDED                -1
+#define PT_BEGIN(s)             switch ((s)->pt) { case 0:
+#define PT_WAIT_UNTIL(s, cond)  do { (s)->pt = __LINE__; case __LINE__: if (!(cond)) return OTA_SESSION_MORE; } while (0)
+#define PT_END(s)               } (s)->pt = PT_ENDED; return OTA_SESSION_COMPLETE
+
+
+// Local variables
+static const char       *TAG = "ota_session";
+
+
+/**
+ * @brief Writes image data, recording the first error.
+ */
+static bool session_write(ota_session_t *s, const void *data, size_t len)
+{
+    if (len == 0 || s->error != ESP_OK) {
+        return s->error == ESP_OK;
+    }
+    s->error = ota_writer_write(&s->writer, data, len);
+    return s->error == ESP_OK;
+}
+
+
+/**
+ * @brief Drops the session's performance lock, if it still holds it.
+ */
+static void session_unlock(ota_session_t *s)
+{
+    if (s->perf_locked) {
+        s->perf_locked = false;
+        perf_lock_release(PERF_LOCK_OTA);
+    }
+}
+
+
+/**
+ * @brief Raw stream: everything is image data.
+ *
+ * @return true once the whole stream has been written, or on error.
+ */
+static bool write_raw(ota_session_t *s)
+{
+    session_write(s, s->in, s->in_len);
+    s->in_len = 0;
+    return s->error != ESP_OK || (s->content_len != 0 && s->received >= s->content_len);
+}
+
+
+/**
+ * @brief Multipart stream: skips everything up to the end of the part header.
+ *
+ * @return true once the blank line ending the part header has been consumed.
+ */
+static bool skip_part_header(ota_session_t *s)
+{
+    static const char terminator[] = "\r\n\r\n";
+    while (s->in_len > 0) {
+        uint8_t c = *s->in++;
+        s->in_len--;
+        if (c == terminator[s->matched]) {
+            if (++s->matched == 4) {
+                return true;
+            }
+        } else {
+            s->matched = (c == '\r') ? 1 : 0;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Multipart stream: writes image data up to the closing delimiter.
+ *
+ * @return true once the delimiter has been found, or on error.
+ */
+static bool write_until_delimiter(ota_session_t *s)
+{
+    const uint8_t *data = s->in;
+    size_t len = s->in_len;
+    size_t m = s->held;
+    bool found = false;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        // Outside a partial match, skip straight to the next candidate start
+        if (m == 0) {
+            const uint8_t *hit = kern_find_byte(data + i, len - i, s->delim[0]);
+            if (hit == NULL) {
+                i = len;
+                break;
+            }
+            i = hit - data;
+        }
+        while (m > 0 && s->delim[m] != data[i]) {
+            m = s->fail[m - 1];
+        }
+        if (s->delim[m] == data[i]) {
+            m++;
+        }
+        if (m == s->delim_len) {
+            found = true;
+            i++;
+            break;
+        }
+    }
+
+    // Bytes that can no longer be part of the delimiter are image data. The
+    // ones held back from earlier pushes equal the start of the delimiter.
+    size_t window = found ? s->delim_len : m;
+    size_t earlier_kept = (window > i) ? window - i : 0;
+    size_t current = (window < i) ? i - window : 0;
+    session_write(s, s->delim, s->held - earlier_kept);
+    session_write(s, data, current);
+
+    s->held = found ? 0 : m;
+    s->in += i;
+    s->in_len -= i;
+    return found || s->error != ESP_OK;
+}
+
+
+/**
+ * @brief Body parser, resumed with every push.
+ */
+static ota_session_status_t session_run(ota_session_t *s)
+{
+    PT_BEGIN(s);
+    if (s->format == OTA_SESSION_MULTIPART) {
+        PT_WAIT_UNTIL(s, skip_part_header(s));
+        PT_WAIT_UNTIL(s, write_until_delimiter(s));
+    } else {
+        PT_WAIT_UNTIL(s, write_raw(s));
+    }
+    PT_END(s);
+}
+
+
+/**
+ * @brief Extracts the boundary from a multipart Content-Type header.
+ *
+ * @param content_type Value of the Content-Type header.
+ * @param boundary     Receives the boundary without quotes.
+ * @param size         Size of the boundary buffer.
+ *
+ * @return true if content_type is multipart and has a usable boundary.
+ */
+bool ota_session_multipart_boundary(const char *content_type, char *boundary, size_t size)
+{
+    if (content_type == NULL || strncasecmp(content_type, "multipart/", 10) != 0) {
+        return false;
+    }
+    const char *start = strstr(content_type, "boundary=");
+    if (start == NULL) {
+        return false;
+    }
+    start += 9;
+    size_t len = strcspn(start, "\";, ");
+    if (*start == '"') {
+        len = strcspn(++start, "\"");
+    }
+    if (len == 0 || len > OTA_SESSION_MAX_BOUNDARY || len >= size) {
+        return false;
+    }
+    memcpy(boundary, start, len);
+    boundary[len] = '\0';
+    return true;
+}
+
+
+/**
+ * @brief Opens a session and starts the OTA update.
+ *
+ * @param session Session state to initialize.
+ * @param config  Stream parameters.
+ *
+ * @return
+ *     - ESP_OK: Ready for ota_session_push().
+ *     - ESP_ERR_INVALID_ARG: Missing or oversized multipart boundary.
+ *     - Other error codes from ota_writer_begin(), e.g. ESP_ERR_INVALID_STATE
+ *       if another update is in progress.
+ */
+esp_err_t ota_session_open(ota_session_t *session, const ota_session_config_t *config)
+{
+    ota_session_t *s = session;
+    memset(s, 0, sizeof(*s));
+    s->format = config->format;
+    s->content_len = config->content_len;
+
+    if (s->format == OTA_SESSION_MULTIPART) {
+        size_t boundary_len = config->boundary ? strlen(config->boundary) : 0;
+        if (boundary_len == 0 || boundary_len > OTA_SESSION_MAX_BOUNDARY) {
+            ESP_LOGE(TAG, "Invalid multipart boundary");
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(s->delim, "\r\n--", 4);
+        memcpy(s->delim + 4, config->boundary, boundary_len);
+        s->delim_len = boundary_len + 4;
+
+        // KMP failure function of the delimiter
+        for (size_t i = 1, k = 0; i < s->delim_len; i++) {
+            while (k > 0 && s->delim[i] != s->delim[k]) {
+                k = s->fail[k - 1];
+            }
+            if (s->delim[i] == s->delim[k]) {
+                k++;
+            }
+            s->fail[i] = k;
+        }
+    }
+
+    // Full clock from the partition erase to the final image check
+    perf_lock_acquire(PERF_LOCK_OTA);
+    s->perf_locked = true;
+
+    esp_err_t err = ota_writer_begin(&s->writer, (s->format == OTA_SESSION_RAW) ? s->content_len : 0);
+    if (err != ESP_OK) {
+        session_unlock(s);
+        s->status = OTA_SESSION_FAILED;
+        s->error = err;
+        return err;
+    }
+
+    if (config->relay && s->content_len > 0) {
+        s->relay_peers = ota_relay_begin(s->content_len, config->content_type, config->hops);
+        s->relaying = true;
+    }
+    ota_stats_begin(&s->stats, config->path);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Feeds received stream data into the session.
+ *
+ * Data beyond the declared content length is ignored. On failure the
+ * session is aborted before returning.
+ *
+ * @param session Open session.
+ * @param data    Received bytes.
+ * @param len     Number of bytes.
+ *
+ * @return The session status after consuming the data.
+ */
+ota_session_status_t ota_session_push(ota_session_t *session, const void *data, size_t len)
+{
+    ota_session_t *s = session;
+    if (s->status != OTA_SESSION_MORE) {
+        return s->status;
+    }
+
+    if (s->content_len != 0 && len > s->content_len - s->received) {
+        len = s->content_len - s->received;
+    }
+    // The write loop runs per packet and must not allocate
+    alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_OTA_WRITE);
+    if (s->relay_peers > 0) {
+        ota_relay_push(data, len);
+    }
+    s->received += len;
+    s->in = data;
+    s->in_len = len;
+
+    ota_session_status_t parsed = OTA_SESSION_COMPLETE;
+    if (s->pt != PT_ENDED) {
+        parsed = session_run(s);
+    }
+    alloc_guard_exit(guard);
+
+    // Outside the guard: the abort rewrites the image catalog in NVS
+    if (s->error != ESP_OK) {
+        ESP_LOGE(TAG, "Session failed after %u bytes: %s", (unsigned)s->received, esp_err_to_name(s->error));
+        ota_session_abort(s);
+    } else if (parsed == OTA_SESSION_COMPLETE && (s->content_len == 0 || s->received >= s->content_len)) {
+        s->status = OTA_SESSION_COMPLETE;
+    }
+    return s->status;
+}
+
+
+/**
+ * @brief Completes the session once the stream has ended.
+ *
+ * A raw stream of unknown length is complete when this is called; all other
+ * streams must have reached OTA_SESSION_COMPLETE. Relay peers are waited for
+ * before the new image is selected for boot. The caller is responsible for
+ * rebooting.
+ *
+ * @param session Open session.
+ *
+ * @return
+ *     - ESP_OK: The new image will be booted on the next restart.
+ *     - ESP_ERR_INVALID_SIZE: The stream ended early.
+ *     - Other error codes from ota_writer_finish() or the failed push.
+ */
+esp_err_t ota_session_finish(ota_session_t *session)
+{
+    ota_session_t *s = session;
+    if (s->status == OTA_SESSION_FAILED) {
+        return s->error;
+    }
+    if (s->status != OTA_SESSION_COMPLETE && !(s->format == OTA_SESSION_RAW && s->content_len == 0)) {
+        ESP_LOGE(TAG, "Stream ended after %u of %u bytes", (unsigned)s->received, (unsigned)s->content_len);
+        s->error = ESP_ERR_INVALID_SIZE;
+        ota_session_abort(s);
+        return s->error;
+    }
+
+    if (s->relaying) {
+        s->relaying = false;
+        s->relayed = ota_relay_end(true);
+    }
+    s->error = ota_writer_finish(&s->writer);
+    session_unlock(s);
+    if (s->error != ESP_OK) {
+        s->status = OTA_SESSION_FAILED;
+        return s->error;
+    }
+    ota_stats_end(&s->stats, &s->writer);
+    s->status = OTA_SESSION_COMPLETE;
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Aborts the session, discarding the partial image.
+ *
+ * Safe to call more than once and on a session that failed to open.
+ *
+ * @param session Session to abort.
+ */
+void ota_session_abort(ota_session_t *session)
+{
+    ota_session_t *s = session;
+    if (s->relaying) {
+        s->relaying = false;
+        ota_relay_end(false);
+    }
+    ota_writer_abort(&s->writer);
+    session_unlock(s);
+    s->status = OTA_SESSION_FAILED;
+    if (s->error == ESP_OK) {
+        s->error = ESP_FAIL;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * ota_session.h
+ *
+ * Transport independent OTA session. A transport opens a session, pushes the
+ * bytes it receives in whatever pieces they arrive and finally calls
+ * ota_session_finish(). The session unwraps multipart bodies, tees the stream
+ * to the OTA relay, writes the image through ota_writer and records the
+ * transfer cost in ota_stats.
+ *
+ * ota_session_push() never waits for input, so one task can service several
+ * sources (httpd does this for websocket uploads). It only blocks while flash
+ * is being written or a relay peer applies back-pressure.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef OTA_SESSION_H
+#define OTA_SESSION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "ota_writer.h"
+#include "ota_stats.h"
+
+#define OTA_SESSION_MAX_BOUNDARY    70      // RFC 2046
+#define OTA_SESSION_MAX_DELIM       (OTA_SESSION_MAX_BOUNDARY + 4)
+
+
+// How the pushed stream wraps the image
+typedef enum {
+    OTA_SESSION_RAW = 0,                    // The stream is the image
+    OTA_SESSION_MULTIPART,                  // multipart/form-data with the image as the first part
+} ota_session_format_t;
+
+
+// Parameters of a new session
+typedef struct {
+    ota_session_format_t    format;
+    const char              *boundary;      // Multipart boundary, without the leading "--"
+    size_t                  content_len;    // Stream length if known, 0 = until ota_session_finish()
+    ota_path_t              path;           // Transport, for ota_stats
+    bool                    relay;          // Forward the stream to the relay peers (needs content_len)
+    const char              *content_type;  // Content-Type to relay the stream with
+    int                     hops;           // Number of times the stream has been relayed already
+} ota_session_config_t;
+
+
+// Result of ota_session_push()
+typedef enum {
+    OTA_SESSION_MORE = 0,                   // Waiting for more data
+    OTA_SESSION_COMPLETE,                   // Whole image received, call ota_session_finish()
+    OTA_SESSION_FAILED,                     // Session aborted, see ota_session_t.error
+} ota_session_status_t;
+
+
+// State of one session
+typedef struct {
+    ota_writer_t            writer;
+    ota_stats_run_t         stats;
+    ota_session_format_t    format;
+    ota_session_status_t    status;
+    esp_err_t               error;
+    int                     pt;             // Resume point of the parser
+    size_t                  content_len;
+    size_t                  received;       // Stream bytes consumed
+    bool                    relaying;       // ota_relay_begin() called, ota_relay_end() pending
+    bool                    perf_locked;    // Holds PERF_LOCK_OTA
+    int                     relay_peers;    // Peers the stream is relayed to
+    int                     relayed;        // Peers that received the whole stream
+    const uint8_t           *in;            // Unparsed part of the current push
+    size_t                  in_len;
+    uint8_t                 matched;        // Progress through the end of the part header
+    uint8_t                 held;           // Delimiter prefix held back at the end of the last push
+    uint8_t                 delim_len;
+    uint8_t                 delim[OTA_SESSION_MAX_DELIM];
+    uint8_t                 fail[OTA_SESSION_MAX_DELIM];
+} ota_session_t;
+
+
+// Functions
+esp_err_t            ota_session_open(ota_session_t *session, const ota_session_config_t *config);
+ota_session_status_t ota_session_push(ota_session_t *session, const void *data, size_t len);
+esp_err_t            ota_session_finish(ota_session_t *session);
+void                 ota_session_abort(ota_session_t *session);
+bool                 ota_session_multipart_boundary(const char *content_type, char *boundary, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
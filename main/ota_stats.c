@@ -0,0 +1,129 @@
+/*
+ * ota_stats.c
+ *
+ * This file implements the OTA cost accounting. CPU time is taken from the
+ * FreeRTOS run time counter of the receiving task, so time the task spends
+ * blocked waiting for the network or the UART is not counted. Flash writes
+ * busy-wait on the calling task and are therefore included; ota_writer
+ * measures them separately so the receive overhead can be reported on its
+ * own.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "ota_stats.h"
+
+
+// Local variables
+static const char       *TAG = "ota_stats";
+static ota_stats_t      results[OTA_PATH_COUNT];
+static portMUX_TYPE     s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+/**
+ * @brief Returns the run time of the calling task in microseconds.
+ *
+ * The counter is only brought up to date when the task is switched out,
+ * so yield first. Without run time stats the wall clock is used instead.
+ */
+static uint32_t task_cpu_us(void)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    vTaskDelay(1);
+    return (uint32_t)ulTaskGetRunTimeCounter(xTaskGetCurrentTaskHandle());
+#else
+    return (uint32_t)esp_timer_get_time();
+#endif
+}
+
+
+/**
+ * @brief Starts measuring a transfer. Call before the first byte is received.
+ *
+ * @param run  Measurement state.
+ * @param path Receive path being measured.
+ */
+void ota_stats_begin(ota_stats_run_t *run, ota_path_t path)
+{
+    run->path = path;
+    run->start_cpu = task_cpu_us();
+    run->start_us = esp_timer_get_time();
+}
+
+
+/**
+ * @brief Completes a measurement and stores it as the latest result for its path.
+ *
+ * @param run    Measurement state passed to ota_stats_begin().
+ * @param writer The writer that received the image.
+ */
+void ota_stats_end(ota_stats_run_t *run, const ota_writer_t *writer)
+{
+    ota_stats_t stats = {
+        .valid    = true,
+        .bytes    = writer->written,
+        .wall_ms  = (esp_timer_get_time() - run->start_us) / 1000,
+        .cpu_us   = task_cpu_us() - run->start_cpu,
+        .write_us = writer->write_us,
+    };
+    if (run->path >= OTA_PATH_COUNT || stats.bytes == 0) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    results[run->path] = stats;
+    portEXIT_CRITICAL(&s_lock);
+
+    uint32_t mb_x100 = (uint32_t)(((uint64_t)stats.bytes * 100) >> 20);
+    if (mb_x100 == 0) {
+        mb_x100 = 1;
+    }
+    ESP_LOGI(TAG, "%s: %lu bytes in %lu ms, CPU %lu us/MB (flash %lu, receive %lu)",
+             ota_stats_path_name(run->path), (unsigned long)stats.bytes, (unsigned long)stats.wall_ms,
+             (unsigned long)((uint64_t)stats.cpu_us * 100 / mb_x100),
+             (unsigned long)((uint64_t)stats.write_us * 100 / mb_x100),
+             (unsigned long)((uint64_t)(stats.cpu_us > stats.write_us ? stats.cpu_us - stats.write_us : 0) * 100 / mb_x100));
+}
+
+
+/**
+ * @brief Returns the latest result for a path.
+ *
+ * @param path  Receive path.
+ * @param stats Receives the result.
+ *
+ * @return true if a transfer has completed on this path since boot.
+ */
+bool ota_stats_get(ota_path_t path, ota_stats_t *stats)
+{
+    if (path >= OTA_PATH_COUNT) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_lock);
+    *stats = results[path];
+    portEXIT_CRITICAL(&s_lock);
+    return stats->valid;
+}
+
+
+/**
+ * @brief Returns the name of a receive path as used in logs and /api/ota_stats.
+ */
+const char *ota_stats_path_name(ota_path_t path)
+{
+    switch (path) {
+        case OTA_PATH_HTTPD:      return "httpd";
+        case OTA_PATH_NETCONN:    return "netconn";
+        case OTA_PATH_SERIAL:     return "serial";
+        case OTA_PATH_WEBSOCKET:  return "websocket";
+        case OTA_PATH_PULL:       return "pull";
+        default:                  return "unknown";
+    }
+}
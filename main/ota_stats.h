@@ -0,0 +1,64 @@
+/*
+ * ota_stats.h
+ *
+ * Cost accounting for OTA transfers. Each transport records how much CPU
+ * time its receiving task used per megabyte of image, split into the time
+ * spent writing flash and the time spent getting the data off the wire, so
+ * the different receive paths can be compared on the same hardware.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef OTA_STATS_H
+#define OTA_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ota_writer.h"
+
+
+// Receive paths that are measured
+typedef enum {
+    OTA_PATH_HTTPD = 0,                     // esp_http_server /upload handler
+    OTA_PATH_NETCONN,                       // Zero-copy netconn listener
+    OTA_PATH_SERIAL,                        // serial_ota console command
+    OTA_PATH_WEBSOCKET,                     // /ws/upload
+    OTA_PATH_PULL,                          // ota_pull console command
+    OTA_PATH_COUNT
+} ota_path_t;
+
+
+// Result of the last completed transfer on one path
+typedef struct {
+    bool        valid;
+    uint32_t    bytes;                      // Image bytes written
+    uint32_t    wall_ms;                    // First to last byte
+    uint32_t    cpu_us;                     // Run time of the receiving task
+    uint32_t    write_us;                   // Part of cpu_us spent in esp_ota_write()
+} ota_stats_t;
+
+
+// One measurement in progress
+typedef struct {
+    ota_path_t  path;
+    int64_t     start_us;
+    uint32_t    start_cpu;
+} ota_stats_run_t;
+
+
+// Functions
+void        ota_stats_begin(ota_stats_run_t *run, ota_path_t path);
+void        ota_stats_end(ota_stats_run_t *run, const ota_writer_t *writer);
+bool        ota_stats_get(ota_path_t path, ota_stats_t *stats);
+const char *ota_stats_path_name(ota_path_t path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
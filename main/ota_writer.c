@@ -0,0 +1,305 @@
+/*
+ * ota_writer.c
+ *
+ * This file implements the OTA image writer shared by all update transports.
+ * It selects the next update partition, streams image data into it and, once
+ * the image has been validated, marks it as the boot partition. Only one
+ * update may be in progress at any time.
+ *
+ * Each block written is read back and compared with kern_mismatch(), into
+ * a buffer at the same 16 byte alignment as the data so the compare runs
+ * on the vector path. Blocks are only buffered by esp_ota_write() with
+ * flash encryption, which is then left to the image check in esp_ota_end().
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_app_desc.h"
+#include "esp_flash_encrypt.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "flash_stall.h"
+#include "image_catalog.h"
+#include "kernels.h"
+#include "ota_writer.h"
+
+
+#define VERIFY_CHUNK        1024            // Read back at a time
+
+
+// Local variables
+static const char       *TAG = "ota";
+static portMUX_TYPE     s_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool             s_busy = false;
+static uint8_t          s_verify_buf[VERIFY_CHUNK + 16] __attribute__((aligned(16)));
+
+
+/**
+ * @brief Claims the single OTA slot.
+ *
+ * @return true if the caller now owns the OTA slot, false if another
+ *         update is already in progress.
+ */
+static bool ota_claim(void)
+{
+    bool claimed = false;
+    portENTER_CRITICAL(&s_lock);
+    if (!s_busy) {
+        s_busy = true;
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return claimed;
+}
+
+
+/**
+ * @brief Releases the OTA slot claimed by ota_claim().
+ */
+static void ota_release(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_busy = false;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Reads back a block just written and compares it with the data.
+ *        The buffer is only used by the owner of the OTA slot.
+ *
+ * @return ESP_OK if the flash holds the data, ESP_FAIL if it differs.
+ */
+static esp_err_t verify(const ota_writer_t *writer, const uint8_t *data, size_t len)
+{
+    uint8_t *buf = s_verify_buf + ((uintptr_t)data & 15);
+    for (size_t off = 0; off < len; off += VERIFY_CHUNK) {
+        size_t n = (len - off < VERIFY_CHUNK) ? len - off : VERIFY_CHUNK;
+        esp_err_t err = esp_partition_read(writer->partition, writer->written + off, buf, n);
+        if (err != ESP_OK) {
+            return err;
+        }
+        size_t at = kern_mismatch(buf, data + off, n);
+        if (at < n) {
+            ESP_LOGE(TAG, "Flash differs from the image at offset %u%s", (unsigned)(writer->written + off + at),
+                     kern_is_filled(buf + at, n - at, 0xFF) ? ", not programmed" : "");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Reports whether an OTA update is currently in progress.
+ *
+ * @return true if an update is in progress, false otherwise.
+ */
+bool ota_writer_busy(void)
+{
+    return s_busy;
+}
+
+
+/**
+ * @brief Starts a new OTA update.
+ *
+ * Selects the update partition (the OTA slot holding the oldest image, see
+ * image_catalog.c) and prepares it to receive a new image.
+ *
+ * @param[out] writer     Writer state to initialize.
+ * @param[in]  image_size Size of the image in bytes if known, or 0 if the size
+ *                        is unknown (the whole partition is then erased).
+ *
+ * @return
+ *     - ESP_OK: The writer is ready to accept image data.
+ *     - ESP_ERR_INVALID_STATE: Another update is already in progress.
+ *     - ESP_ERR_NOT_FOUND: No suitable update partition was found.
+ *     - Other error codes from esp_ota_begin().
+ */
+esp_err_t ota_writer_begin(ota_writer_t *writer, size_t image_size)
+{
+    if (writer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(writer, 0, sizeof(*writer));
+
+    if (!ota_claim()) {
+        ESP_LOGE(TAG, "An OTA update is already in progress");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const esp_partition_t *running_partition = esp_ota_get_running_partition();
+    const esp_partition_t *update_partition = image_catalog_next_update_partition();
+    if (running_partition == NULL || update_partition == NULL) {
+        ESP_LOGE(TAG, "Failed to get running or update partition");
+        ota_release();
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_app_desc_t new_app_info;
+    if (esp_ota_get_partition_description(update_partition, &new_app_info) == ESP_OK) {
+        const esp_app_desc_t *running_app_info = esp_app_get_description();
+        if (running_app_info && new_app_info.version[0] != 0) {
+            ESP_LOGI(TAG, "Running Version: %s", running_app_info->version);
+            ESP_LOGI(TAG, "Version currently in update partition: %s", new_app_info.version);
+        } else {
+            ESP_LOGW(TAG, "Firmware descriptor invalid or missing");
+        }
+    } else {
+        ESP_LOGW(TAG, "Could not get firmware description");
+    }
+
+    ESP_LOGI(TAG, "Current running partition: %s", running_partition->label);
+    ESP_LOGI(TAG, "Writing to partition: %s", update_partition->label);
+
+    image_catalog_invalidate(update_partition);
+    flash_op_t prev_op = flash_stall_op_begin(FLASH_OP_OTA_ERASE);
+    esp_err_t err = esp_ota_begin(update_partition, image_size ? image_size : OTA_SIZE_UNKNOWN, &writer->handle);
+    flash_stall_op_end(prev_op);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        ota_release();
+        return err;
+    }
+
+    writer->partition = update_partition;
+    writer->active = true;
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Writes a block of image data to the update partition.
+ *
+ * On failure the writer stays active; the caller aborts it with
+ * ota_writer_abort(). This runs inside the OTA write allocation guard
+ * (ota_session_push()), the abort does not: it rewrites the image catalog
+ * in NVS, which allocates.
+ *
+ * @param writer Writer state returned by ota_writer_begin().
+ * @param data   Image data to write.
+ * @param len    Number of bytes to write.
+ *
+ * @return
+ *     - ESP_OK: Data written.
+ *     - ESP_ERR_INVALID_STATE: The writer is not active.
+ *     - ESP_FAIL: The flash does not hold the data after writing it.
+ *     - Other error codes from esp_ota_write() or esp_partition_read().
+ */
+esp_err_t ota_writer_write(ota_writer_t *writer, const void *data, size_t len)
+{
+    if (writer == NULL || !writer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len == 0) {
+        return ESP_OK;
+    }
+
+    flash_op_t prev_op = flash_stall_op_begin(FLASH_OP_OTA_WRITE);
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_ota_write(writer->handle, data, len);
+    writer->write_us += esp_timer_get_time() - start;
+    flash_stall_op_end(prev_op);
+    if (err == ESP_OK && !esp_flash_encryption_enabled()) {
+        err = verify(writer, data, len);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error writing OTA data: %s", esp_err_to_name(err));
+        return err;
+    }
+    writer->written += len;
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Completes the OTA update.
+ *
+ * Validates the written image and selects the update partition as the
+ * next boot partition. The caller is responsible for rebooting.
+ *
+ * @param writer Writer state returned by ota_writer_begin().
+ *
+ * @return
+ *     - ESP_OK: The new image will be booted on the next restart.
+ *     - ESP_ERR_INVALID_STATE: The writer is not active.
+ *     - Other error codes from esp_ota_end() or esp_ota_set_boot_partition().
+ */
+esp_err_t ota_writer_finish(ota_writer_t *writer)
+{
+    if (writer == NULL || !writer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    writer->active = false;
+    flash_op_t prev_op = flash_stall_op_begin(FLASH_OP_OTA_FINISH);
+    esp_err_t err = esp_ota_end(writer->handle);
+    flash_stall_op_end(prev_op);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_end failed: %s", esp_err_to_name(err));
+        ota_release();
+        return err;
+    }
+
+    esp_app_desc_t new_app_info;
+    if (esp_ota_get_partition_description(writer->partition, &new_app_info) == ESP_OK) {
+        const esp_app_desc_t *running_app_info = esp_app_get_description();
+        ESP_LOGI(TAG, "Running Version: %s", running_app_info->version);
+        ESP_LOGI(TAG, "Uploaded Version: %s", new_app_info.version);
+
+#if 0
+        if (strcmp(new_app_info.version, running_app_info->version) == 0) {
+            ESP_LOGW(TAG, "Same firmware version uploaded. Skipping update.");
+            ota_release();
+            return ESP_ERR_INVALID_VERSION;
+        }
+#endif
+#if 0
+        if (strcmp(new_app_info.version, running_app_info->version) < 0) {
+            ESP_LOGE(TAG, "Firmware downgrade detected! Update rejected.");
+            ota_release();
+            return ESP_ERR_INVALID_VERSION;
+        }
+#endif
+    } else {
+        ESP_LOGW(TAG, "Could not read new firmware description. Proceeding blindly.");
+    }
+
+    prev_op = flash_stall_op_begin(FLASH_OP_OTA_FINISH);
+    err = esp_ota_set_boot_partition(writer->partition);
+    flash_stall_op_end(prev_op);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(err));
+        ota_release();
+        return err;
+    }
+
+    image_catalog_record_install(writer->partition);
+    ESP_LOGI(TAG, "OTA update of %u bytes to %s complete", (unsigned)writer->written, writer->partition->label);
+    ota_release();
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Aborts an in-progress OTA update and releases the writer.
+ *
+ * Safe to call on a writer that is not active.
+ *
+ * @param writer Writer state returned by ota_writer_begin().
+ */
+void ota_writer_abort(ota_writer_t *writer)
+{
+    if (writer == NULL || !writer->active) {
+        return;
+    }
+    writer->active = false;
+    esp_ota_abort(writer->handle);
+    image_catalog_invalidate(writer->partition);
+    ota_release();
+    ESP_LOGW(TAG, "OTA update aborted after %u bytes", (unsigned)writer->written);
+}
@@ -0,0 +1,48 @@
+/*
+ * ota_writer.h
+ *
+ * Transport independent OTA image writer. Every update path (HTTP upload,
+ * serial console, ...) streams the image through these functions so that
+ * partition selection, version logging and boot partition switching are
+ * handled in exactly one place.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef OTA_WRITER_H
+#define OTA_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+
+
+// State of one in-progress OTA update
+typedef struct {
+    esp_ota_handle_t        handle;         // Handle returned by esp_ota_begin()
+    const esp_partition_t   *partition;     // Partition being written
+    size_t                  written;        // Number of image bytes written so far
+    int64_t                 write_us;       // Time spent in esp_ota_write(), see ota_stats.c
+    bool                    active;         // True between begin and finish/abort
+} ota_writer_t;
+
+
+// Functions
+esp_err_t ota_writer_begin(ota_writer_t *writer, size_t image_size);
+esp_err_t ota_writer_write(ota_writer_t *writer, const void *data, size_t len);
+esp_err_t ota_writer_finish(ota_writer_t *writer);
+void      ota_writer_abort(ota_writer_t *writer);
+bool      ota_writer_busy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
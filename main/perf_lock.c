@@ -0,0 +1,287 @@
+/*
+ * perf_lock.c
+ *
+ * This file implements the performance locks on top of esp_pm. Each reason
+ * has its own CPU and APB max frequency locks, so esp_pm_dump_locks() shows
+ * which one keeps the clock up. esp_pm_lock_acquire() switches the clock
+ * synchronously, so the time it takes is the cost of leaving the idle
+ * frequency and is recorded as the acquisition time.
+ *
+ * Without CONFIG_PM_ENABLE the clock stays fixed and only the counters are
+ * kept.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "perf_lock.h"
+
+
+#define PERF_MAX_FREQ_MHZ   CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#ifdef CONFIG_PERF_MIN_FREQ_MHZ
+    #define PERF_MIN_FREQ_MHZ   CONFIG_PERF_MIN_FREQ_MHZ
+#else
+    #define PERF_MIN_FREQ_MHZ   PERF_MAX_FREQ_MHZ
+#endif
+
+
+// Local variables
+static const char           *TAG = "perf_lock";
+static perf_lock_stats_t    stats[PERF_LOCK_COUNT];
+static int64_t              held_since[PERF_LOCK_COUNT];
+static perf_mode_t          mode = PERF_MODE_FIXED;
+static portMUX_TYPE         s_lock = portMUX_INITIALIZER_UNLOCKED;
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpu_locks[PERF_LOCK_COUNT];
+static esp_pm_lock_handle_t apb_locks[PERF_LOCK_COUNT];
+#endif
+
+
+/**
+ * @brief Creates the locks and applies the configured clock policy.
+ *        Call once at start up, before the locks are used.
+ */
+void perf_lock_init(void)
+{
+#if CONFIG_PM_ENABLE
+    static const char *cpu_names[PERF_LOCK_COUNT] = { "ota_cpu", "http_cpu", "dns_cpu" };
+    static const char *apb_names[PERF_LOCK_COUNT] = { "ota_apb", "http_apb", "dns_apb" };
+    for (int i = 0; i < PERF_LOCK_COUNT; i++) {
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, cpu_names[i], &cpu_locks[i]));
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, apb_names[i], &apb_locks[i]));
+    }
+#endif
+
+#if CONFIG_PERF_DYNAMIC_FREQ
+    esp_err_t err = perf_set_mode(PERF_MODE_DYNAMIC);
+#else
+    esp_err_t err = perf_set_mode(PERF_MODE_FIXED);
+#endif
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to configure power management: %s", esp_err_to_name(err));
+    }
+}
+
+
+/**
+ * @brief Raises the clock to the maximum until the matching perf_lock_release().
+ *        Calls nest, also across tasks.
+ */
+void perf_lock_acquire(perf_lock_reason_t reason)
+{
+    if (reason >= PERF_LOCK_COUNT) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(cpu_locks[reason]);
+    esp_pm_lock_acquire(apb_locks[reason]);
+#endif
+    int64_t now = esp_timer_get_time();
+    uint32_t took = now - start;
+
+    portENTER_CRITICAL(&s_lock);
+    perf_lock_stats_t *st = &stats[reason];
+    st->acquired++;
+    st->acquire_us += took;
+    if (took > st->max_acquire_us) {
+        st->max_acquire_us = took;
+    }
+    if (st->active++ == 0) {
+        held_since[reason] = now;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Releases a lock taken with perf_lock_acquire().
+ */
+void perf_lock_release(perf_lock_reason_t reason)
+{
+    if (reason >= PERF_LOCK_COUNT) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    perf_lock_stats_t *st = &stats[reason];
+    if (st->active > 0 && --st->active == 0) {
+        uint32_t held = now - held_since[reason];
+        st->held_us += held;
+        if (held > st->max_held_us) {
+            st->max_held_us = held;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(apb_locks[reason]);
+    esp_pm_lock_release(cpu_locks[reason]);
+#endif
+}
+
+
+/**
+ * @brief Returns the counters for a reason. held_us includes a hold that is
+ *        still in progress.
+ */
+void perf_lock_get_stats(perf_lock_reason_t reason, perf_lock_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (reason >= PERF_LOCK_COUNT) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    *out = stats[reason];
+    if (out->active > 0) {
+        out->held_us += now - held_since[reason];
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Returns the name of a reason as used in /api/pm and the 'pm' command.
+ */
+const char *perf_lock_name(perf_lock_reason_t reason)
+{
+    switch (reason) {
+        case PERF_LOCK_OTA:     return "ota";
+        case PERF_LOCK_HTTP:    return "http";
+        case PERF_LOCK_DNS:     return "dns";
+        default:                return "unknown";
+    }
+}
+
+
+/**
+ * @brief Selects the clock policy.
+ *
+ * @return
+ *     - ESP_OK: The policy is in effect.
+ *     - ESP_ERR_NOT_SUPPORTED: Dynamic mode without CONFIG_PM_ENABLE.
+ *     - Other error codes from esp_pm_configure().
+ */
+esp_err_t perf_set_mode(perf_mode_t new_mode)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t config = {
+        .max_freq_mhz       = PERF_MAX_FREQ_MHZ,
+        .min_freq_mhz       = (new_mode == PERF_MODE_DYNAMIC) ? PERF_MIN_FREQ_MHZ : PERF_MAX_FREQ_MHZ,
+        .light_sleep_enable = false,        // The softAP has to keep listening
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        return err;
+    }
+#else
+    if (new_mode == PERF_MODE_DYNAMIC) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+
+    mode = new_mode;
+    ESP_LOGI(TAG, "Clock %s: %d-%d MHz", perf_mode_name(mode),
+             (mode == PERF_MODE_DYNAMIC) ? PERF_MIN_FREQ_MHZ : PERF_MAX_FREQ_MHZ, PERF_MAX_FREQ_MHZ);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Returns the current clock policy.
+ */
+perf_mode_t perf_get_mode(void)
+{
+    return mode;
+}
+
+
+/**
+ * @brief Returns the name of a clock policy.
+ */
+const char *perf_mode_name(perf_mode_t m)
+{
+    return (m == PERF_MODE_DYNAMIC) ? "dynamic" : "fixed";
+}
+
+
+/**
+ * @brief Returns the idle, maximum and current CPU clock in MHz.
+ */
+void perf_get_freq(int *min_mhz, int *max_mhz, int *cur_mhz)
+{
+    *min_mhz = (mode == PERF_MODE_DYNAMIC) ? PERF_MIN_FREQ_MHZ : PERF_MAX_FREQ_MHZ;
+    *max_mhz = PERF_MAX_FREQ_MHZ;
+    *cur_mhz = esp_rom_get_cpu_ticks_per_us();
+}
+
+
+/**
+ * @brief Handler for the 'pm' console command.
+ */
+static int pm_cmd(int argc, char **argv)
+{
+    if (argc > 1) {
+        perf_mode_t new_mode;
+        if (strcmp(argv[1], "fixed") == 0) {
+            new_mode = PERF_MODE_FIXED;
+        } else if (strcmp(argv[1], "dynamic") == 0) {
+            new_mode = PERF_MODE_DYNAMIC;
+        } else {
+            printf("pm: expected 'fixed' or 'dynamic'\n");
+            return 1;
+        }
+        esp_err_t err = perf_set_mode(new_mode);
+        if (err != ESP_OK) {
+            printf("pm: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+    }
+
+    int min_mhz, max_mhz, cur_mhz;
+    perf_get_freq(&min_mhz, &max_mhz, &cur_mhz);
+    uint64_t uptime_us = esp_timer_get_time();
+    printf("Mode %s, %d-%d MHz, now %d MHz\n", perf_mode_name(mode), min_mhz, max_mhz, cur_mhz);
+    printf("%-6s %9s %7s %12s %6s %12s %12s\n", "lock", "acquired", "active", "held ms", "held%",
+           "max held us", "max acq us");
+    for (int i = 0; i < PERF_LOCK_COUNT; i++) {
+        perf_lock_stats_t st;
+        perf_lock_get_stats(i, &st);
+        printf("%-6s %9lu %7lu %12llu %5.1f%% %12lu %12lu\n", perf_lock_name(i), (unsigned long)st.acquired,
+               (unsigned long)st.active, (unsigned long long)(st.held_us / 1000),
+               uptime_us ? 100.0 * st.held_us / uptime_us : 0.0,
+               (unsigned long)st.max_held_us, (unsigned long)st.max_acquire_us);
+    }
+#if CONFIG_PM_PROFILING
+    esp_pm_dump_locks(stdout);
+#endif
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'pm' console command.
+ */
+void register_perf_commands(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "pm",
+        .help = "Show performance lock statistics, optionally switch the clock policy",
+        .hint = "[fixed|dynamic]",
+        .func = &pm_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,68 @@
+/*
+ * perf_lock.h
+ *
+ * Dynamic frequency scaling. The CPU runs at the configured minimum clock
+ * and is raised to the maximum only while something holds a performance
+ * lock: an OTA session, an HTTP request or a burst of DNS queries. Every
+ * acquisition is counted and timed per reason.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef PERF_LOCK_H
+#define PERF_LOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+
+// Reasons for holding the clock at the maximum
+typedef enum {
+    PERF_LOCK_OTA = 0,                      // OTA session open
+    PERF_LOCK_HTTP,                         // Web server handler running
+    PERF_LOCK_DNS,                          // Captive portal DNS burst
+    PERF_LOCK_COUNT
+} perf_lock_reason_t;
+
+
+// Clock policy
+typedef enum {
+    PERF_MODE_FIXED = 0,                    // Always at the maximum clock
+    PERF_MODE_DYNAMIC,                      // Minimum clock unless a lock is held
+} perf_mode_t;
+
+
+// Counters for one reason
+typedef struct {
+    uint32_t    acquired;                   // Number of acquisitions
+    uint32_t    active;                     // Current holders
+    uint64_t    held_us;                    // Time with at least one holder
+    uint32_t    max_held_us;                // Longest single hold
+    uint32_t    max_acquire_us;             // Slowest acquisition, includes the clock switch
+    uint64_t    acquire_us;                 // Total time spent acquiring
+} perf_lock_stats_t;
+
+
+// Functions
+void        perf_lock_init(void);
+void        perf_lock_acquire(perf_lock_reason_t reason);
+void        perf_lock_release(perf_lock_reason_t reason);
+void        perf_lock_get_stats(perf_lock_reason_t reason, perf_lock_stats_t *stats);
+const char *perf_lock_name(perf_lock_reason_t reason);
+esp_err_t   perf_set_mode(perf_mode_t mode);
+perf_mode_t perf_get_mode(void);
+const char *perf_mode_name(perf_mode_t mode);
+void        perf_get_freq(int *min_mhz, int *max_mhz, int *cur_mhz);
+void        register_perf_commands(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
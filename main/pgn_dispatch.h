@@ -0,0 +1,179 @@
+/*
+ * pgn_dispatch.h
+ *
+ * Building blocks of the NMEA 2000 receive path, all resolved at compile
+ * time:
+ *
+ * - pgn_field<T, Offset, Bits, Shift> reads one field of a PGN straight
+ *   from the frame data, or from the reassembled message of a fast-packet
+ *   PGN. The byte offsets, shifts and masks are constants, so each read
+ *   compiles to a few loads and shifts.
+ *
+ * - pgn_table<N> maps a PGN to its handler through a perfect hash found by
+ *   the compiler: one multiply, one table load and one compare per frame,
+ *   whether the PGN is handled or not. The build fails if the PGNs repeat
+ *   or no collision-free hash is found.
+ *
+ * C++ only, and without ESP-IDF dependencies so it builds on a Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef PGN_DISPATCH_H
+#define PGN_DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include "n2k_frame.h"
+#include "fast_packet.h"
+
+
+/**
+ * @brief A field of a PGN: Bits bits at bit Shift of byte Offset, little
+ *        endian, read as T (sign extended if T is signed).
+ */
+template <typename T, unsigned Offset, unsigned Bits = sizeof(T) * 8, unsigned Shift = 0>
+struct pgn_field {
+    static_assert(std::is_integral<T>::value, "fields are read as integers");
+    static_assert(Bits > 0 && Bits <= sizeof(T) * 8 && Shift < 8, "field does not fit its type");
+
+    static constexpr unsigned BYTES = (Shift + Bits + 7) / 8;
+    static constexpr unsigned END = Offset + BYTES;             // Message length needed
+    static constexpr uint64_t MASK = (Bits == 64) ? ~0ull : ((1ull << Bits) - 1);
+    static_assert(END <= FAST_PACKET_MAX_LEN, "field runs past the longest message");
+
+    static T get(const uint8_t *data)
+    {
+        uint64_t raw = 0;
+        for (unsigned i = 0; i < BYTES; i++) {
+            raw |= (uint64_t)data[Offset + i] << (8 * i);
+        }
+        raw = (raw >> Shift) & MASK;
+        if (std::is_signed<T>::value && Bits < 64 && ((raw >> (Bits - 1)) & 1)) {
+            raw |= ~MASK;
+        }
+        return (T)raw;
+    }
+
+    // NMEA 2000 reserves the top codes of a field: no data, out of range and
+    // reserved for fields of a byte or more, no data for smaller ones
+    static bool valid(T value)
+    {
+        constexpr uint64_t top = std::is_signed<T>::value ? (MASK >> 1) : MASK;
+        constexpr uint64_t reserved = (Bits >= 8) ? 3 : 1;
+        return std::is_signed<T>::value ? (int64_t)value <= (int64_t)(top - reserved)
+                                        : (uint64_t)value <= top - reserved;
+    }
+};
+
+
+// Handler of one PGN
+typedef void (*pgn_handler_t)(const n2k_msg_t &msg);
+
+
+// Entry flags
+#define PGN_FAST        0x01                // Fast packet, reassembled before the handler runs
+
+
+// Table entry
+struct pgn_entry_t {
+    uint32_t        pgn;
+    uint8_t         min_len;                // Shorter messages are counted as invalid
+    uint8_t         flags;                  // PGN_*
+    pgn_handler_t   handler;
+    const char      *name;
+};
+
+
+/**
+ * @brief PGN lookup through a perfect hash, built at compile time.
+ */
+template <size_t N>
+class pgn_table {
+public:
+    static_assert(N > 0 && N < 255, "table size");
+
+    static constexpr unsigned BITS = (N <= 4) ? 4 : (N <= 8) ? 5 : (N <= 16) ? 6 : (N <= 32) ? 7 : 8;
+    static constexpr unsigned SLOTS = 1u << BITS;               // At least 4 per entry
+
+    constexpr explicit pgn_table(const pgn_entry_t (&list)[N]) : entries(), slots(), mult(0)
+    {
+        for (size_t i = 0; i < N; i++) {
+            entries[i] = list[i];
+        }
+        // Odd multipliers from the golden ratio up, until no two PGNs share a slot
+        for (uint32_t m = 0x9E3779B1u; m != 0x9E3779B1u + 2 * MAX_TRIES; m += 2) {
+            if (fill(m)) {
+                mult = m;
+                return;
+            }
+        }
+    }
+
+    constexpr bool ok() const
+    {
+        return mult != 0;
+    }
+
+    constexpr bool unique() const
+    {
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = i + 1; j < N; j++) {
+                if (entries[i].pgn == entries[j].pgn) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @return The index of the PGN's entry, -1 if it is not in the table.
+     */
+    int find(uint32_t pgn) const
+    {
+        int i = slots[slot(pgn, mult)] - 1;
+        return (i >= 0 && entries[i].pgn == pgn) ? i : -1;
+    }
+
+    const pgn_entry_t &operator[](size_t i) const
+    {
+        return entries[i];
+    }
+
+    static constexpr size_t size()
+    {
+        return N;
+    }
+
+private:
+    static constexpr uint32_t MAX_TRIES = 4096;
+
+    static constexpr unsigned slot(uint32_t pgn, uint32_t m)
+    {
+        return (uint32_t)(pgn * m) >> (32 - BITS);
+    }
+
+    constexpr bool fill(uint32_t m)
+    {
+        for (unsigned s = 0; s < SLOTS; s++) {
+            slots[s] = 0;
+        }
+        for (size_t i = 0; i < N; i++) {
+            unsigned s = slot(entries[i].pgn, m);
+            if (slots[s] != 0) {
+                return false;
+            }
+            slots[s] = (uint8_t)(i + 1);
+        }
+        return true;
+    }
+
+    pgn_entry_t     entries[N];
+    uint8_t         slots[SLOTS];           // Entry index + 1, 0 if empty
+    uint32_t        mult;
+};
+
+#endif
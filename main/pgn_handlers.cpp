@@ -0,0 +1,467 @@
+/*
+ * pgn_handlers.cpp
+ *
+ * This file holds the handlers of the PGNs this unit listens to and the
+ * dispatch loop that feeds them. Each handler reads its fields with
+ * pgn_field<> and stores the scaled values; values the sender marks as not
+ * available are skipped. Field layouts follow the NMEA 2000 appendix B
+ * definitions. Frames of fast-packet PGNs go through the reassembly pool
+ * and their handler sees the whole message.
+ *
+ * Everything here runs in the NMEA task (or the host benchmark), so the
+ * readings and counters have a single writer. Readers in other tasks may
+ * see a reading half updated, which is harmless for display.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "pgn_dispatch.h"
+#include "pgn_handlers.h"
+
+
+// Local variables
+static uint8_t          own_address = N2K_NULL_ADDRESS;
+static n2k_reading_t    readings[N2K_READING_COUNT];
+static n2k_fix_t        fix;
+static pgn_stats_t      st;
+static fast_packet_pool_t pool;
+static pgn_responder_t  responder;
+
+static const struct {
+    const char  *name;
+    const char  *unit;
+} reading_names[N2K_READING_COUNT] = {                     // In n2k_reading_id_t order
+    { "heading",          "rad" },
+    { "cog",              "rad" },
+    { "sog",              "m/s" },
+    { "depth",            "m" },
+    { "water_temp",       "K" },
+    { "air_temp",         "K" },
+    { "pressure",         "Pa" },
+    { "temperature",      "K" },
+    { "engine_speed",     "rpm" },
+    { "engine_temp",      "K" },
+    { "engine_hours",     "h" },
+    { "battery_voltage",  "V" },
+    { "battery_current",  "A" },
+    { "tank_level",       "%" },
+    { "log",              "m" },
+};
+
+
+/**
+ * @brief Stores a field as a reading, scaled, unless it is marked as not
+ *        available.
+ */
+template <typename F>
+static void store(n2k_reading_id_t id, const n2k_msg_t &msg, float scale, uint8_t instance = 0)
+{
+    auto raw = F::get(msg.data);
+    if (!F::valid(raw)) {
+        return;
+    }
+    n2k_reading_t &r = readings[id];
+    r.value = raw * scale;
+    r.updated_ms = msg.time_ms;
+    r.source = msg.source;
+    r.instance = instance;
+    r.valid = true;
+}
+
+
+// 59904 ISO Request: PGN requested. Answered by the responder.
+static void iso_request(const n2k_msg_t &msg)
+{
+    st.requests++;
+    if (responder != NULL) {
+        responder(&msg);
+    }
+}
+
+
+// 60416 ISO Transport Protocol, Connection Management: flow control of the
+// transfers the responder sends
+static void iso_tp_cm(const n2k_msg_t &msg)
+{
+    if (responder != NULL) {
+        responder(&msg);
+    }
+}
+
+
+// 60928 ISO Address Claim: NAME. Passed to the responder, which contends
+// for this node's address.
+static void iso_address_claim(const n2k_msg_t &msg)
+{
+    if (msg.source == own_address) {
+        st.address_conflicts++;
+    }
+    if (responder != NULL) {
+        responder(&msg);
+    }
+}
+
+
+// 126992 System Time: SID, source:4, reserved:4, date, time
+static void system_time(const n2k_msg_t &msg)
+{
+    using date = pgn_field<uint16_t, 2>;
+    using time = pgn_field<uint32_t, 4>;
+    uint16_t d = date::get(msg.data);
+    uint32_t t = time::get(msg.data);
+    if (date::valid(d) && time::valid(t)) {
+        fix.date = d;
+        fix.time = t;
+        fix.time_ms = msg.time_ms;
+        fix.has_time = true;
+    }
+}
+
+
+// 127250 Vessel Heading: SID, heading, deviation, variation, reference:2
+static void vessel_heading(const n2k_msg_t &msg)
+{
+    store<pgn_field<uint16_t, 1>>(N2K_HEADING, msg, 1e-4f);
+}
+
+
+// 127488 Engine Parameters, Rapid Update: instance, speed, boost, tilt
+static void engine_rapid(const n2k_msg_t &msg)
+{
+    store<pgn_field<uint16_t, 1>>(N2K_ENGINE_SPEED, msg, 0.25f, pgn_field<uint8_t, 0>::get(msg.data));
+}
+
+
+// 127489 Engine Parameters, Dynamic (fast packet): instance, oil pressure, oil
+// temperature, temperature, alternator, fuel rate, total hours, ...
+static void engine_dynamic(const n2k_msg_t &msg)
+{
+    uint8_t instance = pgn_field<uint8_t, 0>::get(msg.data);
+    store<pgn_field<uint16_t, 5>>(N2K_ENGINE_TEMP, msg, 0.01f, instance);
+    store<pgn_field<uint32_t, 11>>(N2K_ENGINE_HOURS, msg, 1.0f / 3600, instance);
+}
+
+
+// 127505 Fluid Level: instance:4, type:4, level, capacity
+static void fluid_level(const n2k_msg_t &msg)
+{
+    store<pgn_field<int16_t, 1>>(N2K_TANK_LEVEL, msg, 0.004f, pgn_field<uint8_t, 0, 4>::get(msg.data));
+}
+
+
+// 127508 Battery Status: instance, voltage, current, temperature, SID
+static void battery_status(const n2k_msg_t &msg)
+{
+    uint8_t instance = pgn_field<uint8_t, 0>::get(msg.data);
+    store<pgn_field<int16_t, 1>>(N2K_BATTERY_VOLTAGE, msg, 0.01f, instance);
+    store<pgn_field<int16_t, 3>>(N2K_BATTERY_CURRENT, msg, 0.1f, instance);
+}
+
+
+// 128267 Water Depth: SID, depth, offset, range
+static void water_depth(const n2k_msg_t &msg)
+{
+    store<pgn_field<uint32_t, 1>>(N2K_DEPTH, msg, 0.01f);
+}
+
+
+// 128275 Distance Log (fast packet): date, time, log, trip log
+static void distance_log(const n2k_msg_t &msg)
+{
+    store<pgn_field<uint32_t, 6>>(N2K_LOG, msg, 1.0f);
+}
+
+
+// 129025 Position, Rapid Update: latitude, longitude
+static void position_rapid(const n2k_msg_t &msg)
+{
+    using lat = pgn_field<int32_t, 0>;
+    using lon = pgn_field<int32_t, 4>;
+    int32_t la = lat::get(msg.data);
+    int32_t lo = lon::get(msg.data);
+    if (lat::valid(la) && lon::valid(lo)) {
+        fix.latitude = la;
+        fix.longitude = lo;
+        fix.position_ms = msg.time_ms;
+        fix.has_position = true;
+    }
+}
+
+
+// 129026 COG & SOG, Rapid Update: SID, reference:2, reserved:6, COG, SOG
+static void cog_sog_rapid(const n2k_msg_t &msg)
+{
+    store<pgn_field<uint16_t, 2>>(N2K_COG, msg, 1e-4f);
+    store<pgn_field<uint16_t, 4>>(N2K_SOG, msg, 0.01f);
+}
+
+
+// 129029 GNSS Position Data (fast packet): SID, date, time, latitude and
+// longitude in 1e-16 degrees, altitude, ...
+static void gnss_position(const n2k_msg_t &msg)
+{
+    using date = pgn_field<uint16_t, 1>;
+    using time = pgn_field<uint32_t, 3>;
+    using lat = pgn_field<int64_t, 7>;
+    using lon = pgn_field<int64_t, 15>;
+    int64_t la = lat::get(msg.data);
+    int64_t lo = lon::get(msg.data);
+    if (lat::valid(la) && lon::valid(lo)) {
+        fix.latitude = (int32_t)(la / 1000000000);
+        fix.longitude = (int32_t)(lo / 1000000000);
+        fix.position_ms = msg.time_ms;
+        fix.has_position = true;
+    }
+    uint16_t d = date::get(msg.data);
+    uint32_t t = time::get(msg.data);
+    if (date::valid(d) && time::valid(t)) {
+        fix.date = d;
+        fix.time = t;
+        fix.time_ms = msg.time_ms;
+        fix.has_time = true;
+    }
+}
+
+
+// 130310 Environmental Parameters: SID, water temperature, air temperature, pressure
+static void environmental(const n2k_msg_t &msg)
+{
+    store<pgn_field<uint16_t, 1>>(N2K_WATER_TEMP, msg, 0.01f);
+    store<pgn_field<uint16_t, 3>>(N2K_AIR_TEMP, msg, 0.01f);
+    store<pgn_field<uint16_t, 5>>(N2K_PRESSURE, msg, 100.0f);
+}
+
+
+// 130312 Temperature: SID, instance, source, actual, set
+static void temperature(const n2k_msg_t &msg)
+{
+    store<pgn_field<uint16_t, 3>>(N2K_TEMPERATURE, msg, 0.01f, pgn_field<uint8_t, 1>::get(msg.data));
+}
+
+
+// PGNs handled, in any order
+static constexpr pgn_entry_t entries[] = {
+    { 59904,    3,  0,          iso_request,        "ISO Request" },
+    { 60416,    8,  0,          iso_tp_cm,          "ISO TP Connection Mgmt" },
+    { 60928,    8,  0,          iso_address_claim,  "ISO Address Claim" },
+    { 126992,   8,  0,          system_time,        "System Time" },
+    { 127250,   8,  0,          vessel_heading,     "Vessel Heading" },
+    { 127488,   8,  0,          engine_rapid,       "Engine Parameters, Rapid" },
+    { 127489,   26, PGN_FAST,   engine_dynamic,     "Engine Parameters, Dynamic" },
+    { 127505,   8,  0,          fluid_level,        "Fluid Level" },
+    { 127508,   8,  0,          battery_status,     "Battery Status" },
+    { 128267,   8,  0,          water_depth,        "Water Depth" },
+    { 128275,   14, PGN_FAST,   distance_log,       "Distance Log" },
+    { 129025,   8,  0,          position_rapid,     "Position, Rapid" },
+    { 129026,   8,  0,          cog_sog_rapid,      "COG & SOG, Rapid" },
+    { 129029,   43, PGN_FAST,   gnss_position,      "GNSS Position Data" },
+    { 130310,   8,  0,          environmental,      "Environmental Parameters" },
+    { 130312,   8,  0,          temperature,        "Temperature" },
+};
+
+static constexpr pgn_table<sizeof(entries) / sizeof(entries[0])> table(entries);
+static_assert(table.unique(), "a PGN is listed twice");
+static_assert(table.ok(), "no perfect hash for the PGN table, raise pgn_table::MAX_TRIES");
+
+static uint32_t counts[table.size()];
+
+
+/**
+ * @brief Sets up the receive engine. Call before dispatching.
+ *
+ * @param address   Address this node answers to.
+ * @param contexts  Storage for the fast-packet messages in progress.
+ * @param count     Number of contexts.
+ */
+void pgn_handlers_init(uint8_t address, fast_packet_ctx_t *contexts, int count)
+{
+    own_address = address;
+    fast_packet_init(&pool, contexts, count);
+}
+
+
+/**
+ * @brief Changes the address this node answers to, after it lost its
+ *        address claim. Call from the dispatching task.
+ */
+void pgn_handlers_set_address(uint8_t address)
+{
+    own_address = address;
+}
+
+
+/**
+ * @brief Sets the function that answers ISO requests and transport protocol
+ *        connection management addressed to this node or to all, and takes
+ *        in address claims. It runs in the dispatching task.
+ */
+void pgn_handlers_set_responder(pgn_responder_t fn)
+{
+    responder = fn;
+}
+
+
+/**
+ * @brief Hands each frame of a batch to the handler of its PGN.
+ */
+void pgn_handlers_dispatch(const n2k_frame_t *frames, int count)
+{
+    if (count > 0) {
+        st.batches++;
+        st.max_batch = ((uint32_t)count > st.max_batch) ? count : st.max_batch;
+    }
+    for (int i = 0; i < count; i++) {
+        n2k_msg_t msg;
+        n2k_parse(&frames[i], &msg);
+        st.frames++;
+
+        int e = table.find(msg.pgn);
+        if (e < 0) {
+            st.unknown++;
+            continue;
+        }
+        if (msg.destination != N2K_BROADCAST && msg.destination != own_address) {
+            st.not_for_us++;
+            continue;
+        }
+        if (table[e].flags & PGN_FAST) {
+            msg.data = fast_packet_add(&pool, &msg, &msg.len);
+            if (msg.data == NULL) {
+                continue;
+            }
+        }
+        if (msg.len < table[e].min_len) {
+            st.invalid++;
+            continue;
+        }
+        st.handled++;
+        counts[e]++;
+        table[e].handler(msg);
+    }
+    if (count > 0) {
+        fast_packet_expire(&pool, frames[count - 1].time_ms);
+    }
+}
+
+
+/**
+ * @brief Reads a batch of frames from a source and dispatches them.
+ *
+ * @return The frames read, 0 on timeout, < 0 once the source has ended.
+ */
+int pgn_handlers_pump(const n2k_source_t *source, uint32_t timeout_ms)
+{
+    n2k_frame_t frames[N2K_BATCH];
+    int n = source->receive(source->ctx, frames, N2K_BATCH, timeout_ms);
+    if (n > 0) {
+        pgn_handlers_dispatch(frames, n);
+    }
+    return n;
+}
+
+
+/**
+ * @brief Dispatches the frames waiting in a receive ring where they lie,
+ *        N2K_BATCH at most at a time so the producer gets slots back as it
+ *        goes, until the ring is empty.
+ *
+ * @return The frames dispatched, 0 if the ring was empty.
+ */
+int pgn_handlers_drain(can_ring_t *ring)
+{
+    const n2k_frame_t *frames;
+    int total = 0;
+    int n;
+
+    while ((n = can_ring_peek(ring, &frames, N2K_BATCH)) > 0) {
+        pgn_handlers_dispatch(frames, n);
+        can_ring_pop(ring, n);
+        total += n;
+    }
+    return total;
+}
+
+
+/**
+ * @brief Returns the counters.
+ */
+void pgn_handlers_get_stats(pgn_stats_t *stats)
+{
+    *stats = st;
+}
+
+
+/**
+ * @brief Returns the fast-packet reassembly counters.
+ */
+void pgn_handlers_get_fast_packet_stats(fast_packet_stats_t *stats)
+{
+    *stats = pool.stats;
+}
+
+
+/**
+ * @brief Clears the counters, including those of each PGN and of the
+ *        reassembly.
+ */
+void pgn_handlers_reset_stats(void)
+{
+    memset(&st, 0, sizeof(st));
+    memset(counts, 0, sizeof(counts));
+    fast_packet_reset_stats(&pool);
+}
+
+
+/**
+ * @brief Returns the messages handled of each PGN in the table.
+ *
+ * @return The number of entries written.
+ */
+int pgn_handlers_get_counts(pgn_count_t *out, int max)
+{
+    int n = 0;
+    for (size_t i = 0; i < table.size() && n < max; i++, n++) {
+        out[n].pgn = table[i].pgn;
+        out[n].name = table[i].name;
+        out[n].count = counts[i];
+    }
+    return n;
+}
+
+
+/**
+ * @brief Returns the latest value of a reading.
+ */
+void pgn_handlers_get_reading(n2k_reading_id_t id, n2k_reading_t *reading)
+{
+    *reading = readings[id];
+}
+
+
+/**
+ * @brief Returns the latest position and time.
+ */
+void pgn_handlers_get_fix(n2k_fix_t *out)
+{
+    *out = fix;
+}
+
+
+/**
+ * @brief Returns the name of a reading, as used in the console and logs.
+ */
+const char *pgn_reading_name(n2k_reading_id_t id)
+{
+    return (id < N2K_READING_COUNT) ? reading_names[id].name : "?";
+}
+
+
+/**
+ * @brief Returns the unit of a reading.
+ */
+const char *pgn_reading_unit(n2k_reading_id_t id)
+{
+    return (id < N2K_READING_COUNT) ? reading_names[id].unit : "";
+}
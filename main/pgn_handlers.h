@@ -0,0 +1,127 @@
+/*
+ * pgn_handlers.h
+ *
+ * NMEA 2000 receive engine: dispatches frames to the handlers of the PGNs
+ * this unit listens to and keeps the latest value of each reading they
+ * carry. The table of handlers is fixed at compile time, see
+ * pgn_dispatch.h. Frames of other PGNs, and PDU1 frames addressed to other
+ * nodes, are counted and dropped after the lookup. Fast-packet PGNs are
+ * reassembled first, in a pool of contexts the caller supplies, see
+ * fast_packet.h. Frames are read from a source a batch at a time, or
+ * dispatched where they lie in a receive ring (can_ring.h). ISO requests,
+ * transport protocol connection management and address claims are passed
+ * on to a responder, which sends the answers.
+ *
+ * This module has no ESP-IDF dependencies so it can be exercised on a
+ * Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef PGN_HANDLERS_H
+#define PGN_HANDLERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "n2k_frame.h"
+#include "fast_packet.h"
+#include "can_ring.h"
+
+
+// Readings kept from the bus
+typedef enum {
+    N2K_HEADING = 0,                        // rad, 127250
+    N2K_COG,                                // rad, 129026
+    N2K_SOG,                                // m/s, 129026
+    N2K_DEPTH,                              // m below the transducer, 128267
+    N2K_WATER_TEMP,                         // K, 130310
+    N2K_AIR_TEMP,                           // K, 130310
+    N2K_PRESSURE,                           // Pa, 130310
+    N2K_TEMPERATURE,                        // K, 130312, any source
+    N2K_ENGINE_SPEED,                       // rpm, 127488
+    N2K_ENGINE_TEMP,                        // K, 127489
+    N2K_ENGINE_HOURS,                       // h, 127489
+    N2K_BATTERY_VOLTAGE,                    // V, 127508
+    N2K_BATTERY_CURRENT,                    // A, 127508
+    N2K_TANK_LEVEL,                         // %, 127505
+    N2K_LOG,                                // m, total distance, 128275
+    N2K_READING_COUNT
+} n2k_reading_id_t;
+
+
+// Latest value of a reading
+typedef struct {
+    float       value;
+    uint32_t    updated_ms;                 // Time of the frame it came in
+    bool        valid;                      // Received at least once
+    uint8_t     source;                     // Address it came from
+    uint8_t     instance;                   // Of the engine, battery, tank or sensor, else 0
+} n2k_reading_t;
+
+
+// Readings that do not fit a float
+typedef struct {
+    int32_t     latitude;                   // 1e-7 degrees, 129025 or 129029
+    int32_t     longitude;
+    uint32_t    position_ms;
+    uint32_t    time;                       // 1e-4 s since midnight, 126992 or 129029
+    uint32_t    time_ms;
+    uint16_t    date;                       // Days since 1970-01-01
+    bool        has_position;
+    bool        has_time;
+} n2k_fix_t;
+
+
+// Counters
+typedef struct {
+    uint32_t    frames;
+    uint32_t    handled;                    // Messages, a fast packet counts once
+    uint32_t    unknown;                    // PGN not in the table
+    uint32_t    not_for_us;                 // PDU1 addressed to another node
+    uint32_t    invalid;                    // Message too short for the PGN
+    uint32_t    batches;                    // Batches dispatched, from a source read or the ring
+    uint32_t    max_batch;
+    uint32_t    requests;                   // ISO requests to this node or to all
+    uint32_t    address_conflicts;          // Claims for this node's address
+} pgn_stats_t;
+
+
+// Messages handled of one PGN in the table
+typedef struct {
+    uint32_t    pgn;
+    const char  *name;
+    uint32_t    count;
+} pgn_count_t;
+
+
+// Answers ISO requests and transport protocol connection management, and
+// takes in address claims
+typedef void (*pgn_responder_t)(const n2k_msg_t *msg);
+
+
+// Functions
+void        pgn_handlers_init(uint8_t own_address, fast_packet_ctx_t *contexts, int count);
+void        pgn_handlers_set_address(uint8_t address);
+void        pgn_handlers_set_responder(pgn_responder_t responder);
+void        pgn_handlers_dispatch(const n2k_frame_t *frames, int count);
+int         pgn_handlers_pump(const n2k_source_t *source, uint32_t timeout_ms);
+int         pgn_handlers_drain(can_ring_t *ring);
+void        pgn_handlers_get_stats(pgn_stats_t *stats);
+void        pgn_handlers_get_fast_packet_stats(fast_packet_stats_t *stats);
+void        pgn_handlers_reset_stats(void);
+int         pgn_handlers_get_counts(pgn_count_t *counts, int max);
+void        pgn_handlers_get_reading(n2k_reading_id_t id, n2k_reading_t *reading);
+void        pgn_handlers_get_fix(n2k_fix_t *fix);
+const char *pgn_reading_name(n2k_reading_id_t id);
+const char *pgn_reading_unit(n2k_reading_id_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * pgn_scheduler.c
+ *
+ * This file implements the transmit scheduler described in
+ * pgn_scheduler.h. The wheel hands back the PGNs due, earliest first; they
+ * are taken PGN_SCHED_BATCH at a time, sorted by deadline then priority,
+ * and their frames built into one array that goes to the sink in a single
+ * call, or in more than one when a batch's frames do not fit.
+ *
+ * If the sink takes fewer frames than it was given, the messages it did
+ * not take in full are put back on the wheel PGN_SCHED_RETRY_MS out with
+ * their deadlines kept, and so are the rest of the PGNs due. A fast packet
+ * cut short is sent again whole under a new sequence ID, so receivers drop
+ * the part they had.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "pgn_scheduler.h"
+
+
+/**
+ * @brief Converts a timer to its entry; the timer is the first member.
+ */
+static inline pgn_sched_entry_t *entry_of(wheel_timer_t *t)
+{
+    return (pgn_sched_entry_t *)t;
+}
+
+
+/**
+ * @brief Orders entries by deadline, then priority. Batches are small and
+ *        come from the wheel nearly sorted, so insertion sort.
+ */
+static void sort_due(pgn_sched_entry_t **due, int count)
+{
+    for (int i = 1; i < count; i++) {
+        pgn_sched_entry_t *e = due[i];
+        int j = i - 1;
+        while (j >= 0) {
+            int32_t d = (int32_t)(due[j]->deadline - e->deadline);
+            if (d < 0 || (d == 0 && due[j]->priority <= e->priority)) {
+                break;
+            }
+            due[j + 1] = due[j];
+            j--;
+        }
+        due[j + 1] = e;
+    }
+}
+
+
+/**
+ * @brief Builds the frames of a message: one frame up to 8 bytes, a fast
+ *        packet above.
+ *
+ * @return Frames written.
+ */
+static int make_frames(pgn_scheduler_t *s, pgn_sched_entry_t *e, int len, n2k_frame_t *f, uint32_t now_ms)
+{
+    uint32_t id = n2k_make_id(e->pgn, e->priority, s->address, N2K_BROADCAST);
+
+    if (len <= 8) {
+        f->id = id;
+        f->time_ms = now_ms;
+        f->len = len;
+        memcpy(f->data, s->data, len);
+        return 1;
+    }
+
+    uint8_t seq = (e->fast_seq++ & 0x07) << 5;
+    int count = 0;
+    int offset = 0;
+    while (offset < len) {
+        n2k_frame_t *frame = &f[count];
+        int at = 1;
+        frame->id = id;
+        frame->time_ms = now_ms;
+        frame->len = 8;
+        frame->data[0] = seq | count;
+        if (count == 0) {
+            frame->data[at++] = len;
+        }
+        int n = len - offset;
+        if (n > 8 - at) {
+            n = 8 - at;
+        }
+        memcpy(&frame->data[at], &s->data[offset], n);
+        memset(&frame->data[at + n], 0xFF, 8 - at - n);
+        offset += n;
+        count++;
+    }
+    return count;
+}
+
+
+/**
+ * @brief Sets the next deadline of an entry that was sent, or had nothing
+ *        to send. Periodic PGNs keep to their schedule and drop the periods
+ *        they missed; on-change PGNs wait for the next change.
+ */
+static void reschedule(pgn_scheduler_t *s, pgn_sched_entry_t *e, uint32_t now_ms)
+{
+    if (e->period_ms == 0) {
+        return;
+    }
+    uint32_t next = e->deadline + e->period_ms;
+    if ((int32_t)(next - now_ms) <= 0) {
+        uint32_t missed = (now_ms - e->deadline) / e->period_ms;
+        s->stats.skipped += missed;
+        next = e->deadline + (missed + 1) * e->period_ms;
+    }
+    e->deadline = next;
+    timer_wheel_add(&s->wheel, &e->timer, next);
+}
+
+
+/**
+ * @brief Hands the frames built so far to the sink and completes the
+ *        messages it took.
+ *
+ * @param s         The scheduler.
+ * @param msgs      Entries whose frames are in the batch, in order.
+ * @param ends      Frame count in the batch after each of them.
+ * @param count     Number of entries.
+ * @param now_ms    Current time.
+ *
+ * @return Whether the sink took everything.
+ */
+static bool flush(pgn_scheduler_t *s, pgn_sched_entry_t **msgs, const uint8_t *ends, int count, uint32_t now_ms)
+{
+    int frames = ends[count - 1];
+    int taken = s->sink.send(s->sink.ctx, s->frames, frames);
+    if (taken < 0) {
+        taken = 0;
+    }
+    s->stats.batches++;
+
+    for (int i = 0; i < count; i++) {
+        pgn_sched_entry_t *e = msgs[i];
+        if (ends[i] > taken) {
+            // Not taken in full: again shortly, deadline kept
+            s->stats.queue_full++;
+            timer_wheel_add(&s->wheel, &e->timer, now_ms + PGN_SCHED_RETRY_MS);
+            continue;
+        }
+        uint32_t late = now_ms - e->deadline;
+        s->stats.sent++;
+        s->stats.late_total_ms += late;
+        if (late > s->stats.late_max_ms) {
+            s->stats.late_max_ms = late;
+        }
+        e->sent++;
+        e->last_sent = now_ms;
+        e->ever_sent = true;
+        reschedule(s, e, now_ms);
+    }
+    s->stats.frames += taken;
+    if ((uint32_t)count > s->stats.max_batch) {
+        s->stats.max_batch = count;
+    }
+    return taken == frames;
+}
+
+
+/**
+ * @brief Sets up a scheduler with no PGNs.
+ *
+ * @param s         The scheduler.
+ * @param address   Source address of the frames sent.
+ * @param sink      Where the frames go.
+ * @param now_ms    Current time.
+ */
+void pgn_scheduler_init(pgn_scheduler_t *s, uint8_t address, const n2k_sink_t *sink, uint32_t now_ms)
+{
+    memset(s, 0, sizeof(*s));
+    timer_wheel_init(&s->wheel, now_ms);
+    s->sink = *sink;
+    s->address = address;
+}
+
+
+/**
+ * @brief Adds a PGN. A periodic PGN is first due offset_ms from now; an
+ *        on-change PGN waits for pgn_scheduler_changed(). Offsets spread
+ *        PGNs of the same period apart on the bus.
+ */
+void pgn_scheduler_add(pgn_scheduler_t *s, pgn_sched_entry_t *e, uint32_t now_ms)
+{
+    e->timer.next = NULL;
+    e->timer.pprev = NULL;
+    e->sent = 0;
+    e->fast_seq = 0;
+    e->ever_sent = false;
+    if (e->period_ms != 0) {
+        e->deadline = now_ms + e->offset_ms;
+        timer_wheel_add(&s->wheel, &e->timer, e->deadline);
+    }
+}
+
+
+/**
+ * @brief Sends a PGN as soon as its minimum gap allows, because its data
+ *        changed or it was requested. A periodic PGN then continues its
+ *        period from this transmission.
+ */
+void pgn_scheduler_changed(pgn_scheduler_t *s, pgn_sched_entry_t *e, uint32_t now_ms)
+{
+    uint32_t due = now_ms;
+    if (e->ever_sent && (int32_t)(e->last_sent + e->min_gap_ms - now_ms) > 0) {
+        due = e->last_sent + e->min_gap_ms;
+    }
+    if (timer_wheel_pending(&e->timer) && (int32_t)(e->deadline - due) <= 0) {
+        return;                             // Already due as soon
+    }
+    e->deadline = due;
+    timer_wheel_add(&s->wheel, &e->timer, due);
+}
+
+
+/**
+ * @brief Sends the PGNs that are due.
+ *
+ * @param s         The scheduler.
+ * @param now_ms    Current time.
+ *
+ * @return Milliseconds until it next needs to run, -1 if no PGN is due at
+ *         any time.
+ */
+int32_t pgn_scheduler_run(pgn_scheduler_t *s, uint32_t now_ms)
+{
+    wheel_timer_t *list = timer_wheel_advance(&s->wheel, now_ms);
+    if (list != NULL) {
+        s->stats.wakeups++;
+    }
+
+    bool full = false;
+    while (list != NULL) {
+        int count = 0;
+        while (list != NULL && count < PGN_SCHED_BATCH) {
+            s->due[count++] = entry_of(list);
+            list = list->next;
+        }
+        sort_due(s->due, count);
+
+        pgn_sched_entry_t *msgs[PGN_SCHED_BATCH];
+        uint8_t ends[PGN_SCHED_BATCH];
+        int n = 0;
+        int frames = 0;
+        for (int i = 0; i < count; i++) {
+            pgn_sched_entry_t *e = s->due[i];
+            if (full) {
+                s->stats.queue_full++;
+                timer_wheel_add(&s->wheel, &e->timer, now_ms + PGN_SCHED_RETRY_MS);
+                continue;
+            }
+            int len = e->build(e->ctx, s->data);
+            if (len <= 0 || len > FAST_PACKET_MAX_LEN) {
+                reschedule(s, e, now_ms);
+                continue;
+            }
+            int needed = (len <= 8) ? 1 : 1 + (len - 6 + 7 - 1) / 7;     // 6 bytes in the first frame, 7 after
+            if (frames + needed > PGN_SCHED_BATCH) {
+                full = !flush(s, msgs, ends, n, now_ms);
+                n = 0;
+                frames = 0;
+                if (full) {
+                    i--;                    // Put back with the rest
+                    continue;
+                }
+            }
+            frames += make_frames(s, e, len, &s->frames[frames], now_ms);
+            msgs[n] = e;
+            ends[n++] = frames;
+        }
+        if (n > 0) {
+            full = !flush(s, msgs, ends, n, now_ms);
+        }
+    }
+    return timer_wheel_next(&s->wheel, now_ms);
+}
+
+
+/**
+ * @brief Changes the source address of the frames sent, after the address
+ *        claim was lost.
+ */
+void pgn_scheduler_set_address(pgn_scheduler_t *s, uint8_t address)
+{
+    s->address = address;
+}
+
+
+/**
+ * @brief Clears the counters.
+ */
+void pgn_scheduler_reset_stats(pgn_scheduler_t *s)
+{
+    memset(&s->stats, 0, sizeof(s->stats));
+}
@@ -0,0 +1,103 @@
+/*
+ * pgn_scheduler.h
+ *
+ * NMEA 2000 transmit scheduler: every PGN this node sends, periodic or on
+ * change, has one timer on a single timing wheel (timer_wheel.h) ticking
+ * in milliseconds. pgn_scheduler_run() takes the PGNs that are due, sorts
+ * them by deadline and priority, builds their frames into one batch and
+ * hands it to the CAN driver in a single call, then returns the time to
+ * the next deadline. One timer wakes it, however many PGNs there are.
+ *
+ * Periodic PGNs keep to their schedule: the next deadline is the last one
+ * plus the period, not the time sent plus the period, so a late wakeup
+ * shifts no later transmission. On-change PGNs are sent at once, but no
+ * more often than their minimum gap. Messages over 8 bytes are sent as
+ * fast packets.
+ *
+ * This module has no ESP-IDF dependencies so it can be exercised on a
+ * Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef PGN_SCHEDULER_H
+#define PGN_SCHEDULER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "n2k_frame.h"
+#include "fast_packet.h"
+#include "timer_wheel.h"
+
+#define PGN_SCHED_BATCH         32          // Frames handed to the driver at once
+#define PGN_SCHED_RETRY_MS      2           // Retry when the transmit queue is full
+
+
+// Builds the message of a PGN: returns its length, up to FAST_PACKET_MAX_LEN,
+// or 0 to skip this transmission
+typedef int (*pgn_build_t)(void *ctx, uint8_t *data);
+
+
+// A PGN this node sends. Fill in the fields up to ctx, then add it.
+typedef struct {
+    wheel_timer_t   timer;                  // First, see pgn_scheduler.c
+    uint32_t        pgn;
+    uint16_t        period_ms;              // 0 if sent on change only
+    uint16_t        min_gap_ms;             // On change, not sent more often than this
+    uint16_t        offset_ms;              // First transmission after being added
+    uint8_t         priority;
+    pgn_build_t     build;
+    void            *ctx;
+
+    uint32_t        deadline;               // Of the transmission due, in ms
+    uint32_t        last_sent;
+    uint32_t        sent;
+    uint8_t         fast_seq;               // Sequence ID of the next fast packet
+    bool            ever_sent;
+} pgn_sched_entry_t;
+
+
+// Counters
+typedef struct {
+    uint32_t    wakeups;                    // Runs that had a PGN due
+    uint32_t    sent;                       // Messages
+    uint32_t    frames;
+    uint32_t    batches;                    // Calls to the driver
+    uint32_t    max_batch;                  // Most messages in a batch
+    uint32_t    queue_full;                 // Messages put back, the transmit queue was full
+    uint32_t    skipped;                    // Periods missed, more than a period late
+    uint32_t    late_total_ms;              // Transmissions after their deadline
+    uint32_t    late_max_ms;
+} pgn_sched_stats_t;
+
+
+// The scheduler
+typedef struct {
+    timer_wheel_t       wheel;
+    n2k_sink_t          sink;
+    uint8_t             address;
+    pgn_sched_stats_t   stats;
+    pgn_sched_entry_t   *due[PGN_SCHED_BATCH];
+    uint8_t             data[FAST_PACKET_MAX_LEN];
+    n2k_frame_t         frames[PGN_SCHED_BATCH];
+} pgn_scheduler_t;
+
+
+// Functions
+void        pgn_scheduler_init(pgn_scheduler_t *s, uint8_t address, const n2k_sink_t *sink, uint32_t now_ms);
+void        pgn_scheduler_add(pgn_scheduler_t *s, pgn_sched_entry_t *e, uint32_t now_ms);
+void        pgn_scheduler_changed(pgn_scheduler_t *s, pgn_sched_entry_t *e, uint32_t now_ms);
+int32_t     pgn_scheduler_run(pgn_scheduler_t *s, uint32_t now_ms);
+void        pgn_scheduler_set_address(pgn_scheduler_t *s, uint8_t address);
+void        pgn_scheduler_reset_stats(pgn_scheduler_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
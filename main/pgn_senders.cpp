@@ -0,0 +1,376 @@
+/*
+ * pgn_senders.cpp
+ *
+ * This file holds the PGNs this node sends of its own accord and runs
+ * them on the transmit scheduler:
+ *
+ *   60928  ISO Address Claim       at start, when requested and when contested
+ *   126993 Heartbeat               every 60 s
+ *   126464 PGN List (transmit)     when requested, a fast packet
+ *
+ * Product and configuration information go out through the transport
+ * protocol instead, see nmea_task.cpp.
+ *
+ * Nothing but the claim is sent until 250 ms after the claim first went
+ * out, as ISO 11783-5 requires. The node contends for its address by NAME
+ * (address_claim.h): it sends the claim again if its NAME is the lower,
+ * otherwise moves to a free address in 128-247 and claims that, or sends
+ * the cannot-claim and nothing else once none is left. The identity number
+ * in the NAME is the serial number, or without one the low bits of the
+ * MAC, so that two units left at their defaults do not tie.
+ *
+ * The scheduler runs from one one-shot esp_timer armed for its next
+ * deadline, on the millisecond boundary, however many PGNs are added
+ * here; each new one is a table entry, not another timer or task. A mutex
+ * serialises the timer and the NMEA task, which passes on requests.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "settings.h"
+#include "iso_tp.h"
+#include "pgn_senders.h"
+
+
+#if CONFIG_NMEA_ENABLE
+
+#define PGN_ADDRESS_CLAIM   ADDRESS_CLAIM_PGN
+#define PGN_HEARTBEAT       126993
+#define PGN_PGN_LIST        126464
+#define HEARTBEAT_MS        60000
+
+// NAME fields of the address claim
+#define MANUFACTURER_CODE   2046            // Not registered with NMEA
+#define DEVICE_FUNCTION     140             // Load controller
+#define DEVICE_CLASS        30              // Electrical distribution
+#define INDUSTRY_GROUP      4               // Marine
+
+// The PGNs sent
+enum { ADDRESS_CLAIM, HEARTBEAT, PGN_LIST, SENDER_COUNT };
+
+
+// Local variables
+static const char       *TAG = "n2k_tx";
+static pgn_scheduler_t  sched;
+static pgn_sched_entry_t entries[SENDER_COUNT];
+static SemaphoreHandle_t sched_mutex;
+static esp_timer_handle_t sched_timer;
+static uint8_t          heartbeat_seq;
+static address_claim_t  claim;
+static uint32_t         claims_sent;        // Of the claim entry, last seen
+#if CONFIG_STATIC_ALLOCATION
+static StaticSemaphore_t s_sched_mutex_buf;
+#endif
+
+
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+
+/**
+ * @brief The 64-bit NAME, from the serial number, or the MAC without one,
+ *        and the device instance.
+ */
+static uint64_t make_name(void)
+{
+    uint32_t identity = get_serial_nbr();
+    if (identity == 0) {
+        uint8_t mac[6];
+        esp_efuse_mac_get_default(mac);
+        identity = ((uint32_t)mac[3] << 16) | (mac[4] << 8) | mac[5];
+    }
+    return (uint64_t)(identity & 0x1FFFFF)
+         | ((uint64_t)MANUFACTURER_CODE << 21)
+         | ((uint64_t)get_instance() << 32)
+         | ((uint64_t)DEVICE_FUNCTION << 40)
+         | ((uint64_t)DEVICE_CLASS << 49)
+         | ((uint64_t)INDUSTRY_GROUP << 60)
+         | ADDRESS_CLAIM_ARBITRARY;
+}
+
+
+/**
+ * @brief 60928 ISO Address Claim: the NAME.
+ */
+static int build_address_claim(void *ctx, uint8_t *data)
+{
+    address_claim_put_name(claim.name, data);
+    return 8;
+}
+
+
+/**
+ * @brief 126993 Heartbeat: interval in 0.01 s, sequence counter, both
+ *        controllers error active.
+ */
+static int build_heartbeat(void *ctx, uint8_t *data)
+{
+    if (!address_claim_ready(&claim, now_ms())) {
+        return 0;
+    }
+    uint16_t interval = HEARTBEAT_MS / 10;
+    data[0] = interval & 0xFF;
+    data[1] = interval >> 8;
+    data[2] = heartbeat_seq++;
+    data[3] = 0xF0;
+    memset(&data[4], 0xFF, 4);
+    return 8;
+}
+
+
+/**
+ * @brief 126464 PGN List: function code 0 (transmit), then the PGNs sent
+ *        here and by the transport protocol.
+ */
+static int build_pgn_list(void *ctx, uint8_t *data)
+{
+    static const uint32_t tp_pgns[] = { 126996, 126998, ISO_TP_PGN_CM, ISO_TP_PGN_DT };
+    int len = 0;
+
+    data[len++] = 0;
+    for (const pgn_sched_entry_t &e : entries) {
+        data[len++] = e.pgn & 0xFF;
+        data[len++] = (e.pgn >> 8) & 0xFF;
+        data[len++] = e.pgn >> 16;
+    }
+    for (uint32_t pgn : tp_pgns) {
+        data[len++] = pgn & 0xFF;
+        data[len++] = (pgn >> 8) & 0xFF;
+        data[len++] = pgn >> 16;
+    }
+    return len;
+}
+
+
+/**
+ * @brief Sends what is due and arms the timer for the next deadline, on
+ *        its millisecond boundary. Call with sched_mutex held.
+ */
+static void sched_run(void)
+{
+    int64_t now = esp_timer_get_time();
+    int32_t wait = pgn_scheduler_run(&sched, (uint32_t)(now / 1000));
+    if (entries[ADDRESS_CLAIM].sent != claims_sent) {
+        claims_sent = entries[ADDRESS_CLAIM].sent;
+        address_claim_sent(&claim, entries[ADDRESS_CLAIM].last_sent);
+    }
+    esp_timer_stop(sched_timer);
+    if (wait >= 0) {
+        int64_t delay = (int64_t)wait * 1000 - now % 1000;
+        esp_timer_start_once(sched_timer, (delay > 0) ? delay : 0);
+    }
+}
+
+
+/**
+ * @brief Timer callback, at the scheduler's deadline. Runs from the
+ *        esp_timer task.
+ */
+static void sched_timer_cb(void *arg)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    sched_run();
+    xSemaphoreGive(sched_mutex);
+}
+
+
+/**
+ * @brief Fills in an entry and adds it to the scheduler.
+ */
+static void add(int index, uint32_t pgn, uint16_t period_ms, uint16_t min_gap_ms, uint16_t offset_ms,
+                uint8_t priority, pgn_build_t build, uint32_t now)
+{
+    pgn_sched_entry_t *e = &entries[index];
+    memset(e, 0, sizeof(*e));
+    e->pgn = pgn;
+    e->period_ms = period_ms;
+    e->min_gap_ms = min_gap_ms;
+    e->offset_ms = offset_ms;
+    e->priority = priority;
+    e->build = build;
+    pgn_scheduler_add(&sched, e, now);
+}
+
+
+/**
+ * @brief Adds the PGNs to the scheduler, claims the address and starts the
+ *        timer.
+ *
+ * @param sink  Where frames go.
+ */
+void pgn_senders_start(const n2k_sink_t *sink)
+{
+#if CONFIG_STATIC_ALLOCATION
+    sched_mutex = xSemaphoreCreateMutexStatic(&s_sched_mutex_buf);
+#else
+    sched_mutex = xSemaphoreCreateMutex();
+#endif
+    esp_timer_create_args_t args = {};
+    args.callback = sched_timer_cb;
+    args.name = "n2k_tx";
+    ESP_ERROR_CHECK(esp_timer_create(&args, &sched_timer));
+
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    uint32_t now = now_ms();
+    address_claim_init(&claim, make_name(), get_node_address());
+    claims_sent = 0;
+    pgn_scheduler_init(&sched, claim.address, sink, now);
+    add(ADDRESS_CLAIM, PGN_ADDRESS_CLAIM, 0, 250, 0, 6, build_address_claim, now);
+    add(HEARTBEAT, PGN_HEARTBEAT, HEARTBEAT_MS, 0, 1000, 7, build_heartbeat, now);
+    add(PGN_LIST, PGN_PGN_LIST, 0, 250, 0, 6, build_pgn_list, now);
+    pgn_scheduler_changed(&sched, &entries[ADDRESS_CLAIM], now);
+    sched_run();
+    xSemaphoreGive(sched_mutex);
+    ESP_LOGI(TAG, "%d PGNs scheduled", SENDER_COUNT);
+}
+
+
+/**
+ * @brief Sends a PGN in answer to an ISO request, subject to its minimum
+ *        gap.
+ *
+ * @return Whether the PGN is one sent here.
+ */
+bool pgn_senders_request(uint32_t pgn)
+{
+    for (pgn_sched_entry_t &e : entries) {
+        if (e.pgn == pgn) {
+            xSemaphoreTake(sched_mutex, portMAX_DELAY);
+            uint32_t now = now_ms();
+            if (e.pgn == PGN_ADDRESS_CLAIM || address_claim_ready(&claim, now)) {
+                pgn_scheduler_changed(&sched, &e, now);
+                sched_run();
+            }
+            xSemaphoreGive(sched_mutex);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Takes in an address claim heard on the bus and sends this node's
+ *        claim again if its address was contested: from the same address
+ *        if its NAME won, from a new one if not, or the cannot-claim.
+ *
+ * @param source    Address the claim came from.
+ * @param data      The 8 bytes of the claim.
+ *
+ * @return The node address now, N2K_NULL_ADDRESS if it has none.
+ */
+uint8_t pgn_senders_claim_received(uint8_t source, const uint8_t *data)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    uint8_t previous = claim.address;
+    address_claim_action_t action = address_claim_received(&claim, source, data);
+    if (action != ADDRESS_CLAIM_IGNORE) {
+        uint32_t now = now_ms();
+        pgn_scheduler_set_address(&sched, claim.address);
+        pgn_scheduler_changed(&sched, &entries[ADDRESS_CLAIM], now);
+        sched_run();
+    }
+    uint8_t address = claim.address;
+    xSemaphoreGive(sched_mutex);
+
+    if (action == ADDRESS_CLAIM_MOVED) {
+        ESP_LOGW(TAG, "Lost address %d to a lower NAME, claiming %d", previous, address);
+    } else if (action == ADDRESS_CLAIM_LOST) {
+        ESP_LOGE(TAG, "Lost address %d and no address is free, sending nothing", previous);
+    }
+    return address;
+}
+
+
+/**
+ * @brief Whether the address claim has settled, so that other PGNs may be
+ *        sent from the node address.
+ */
+bool pgn_senders_claimed(void)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    bool result = address_claim_ready(&claim, now_ms());
+    xSemaphoreGive(sched_mutex);
+    return result;
+}
+
+
+/**
+ * @brief Copies the state of the address claim.
+ */
+void pgn_senders_get_claim(address_claim_t *state)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    *state = claim;
+    xSemaphoreGive(sched_mutex);
+}
+
+
+/**
+ * @brief Copies the scheduler's counters.
+ */
+void pgn_senders_get_stats(pgn_sched_stats_t *stats)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    *stats = sched.stats;
+    xSemaphoreGive(sched_mutex);
+}
+
+
+/**
+ * @brief Clears the scheduler's counters.
+ */
+void pgn_senders_reset_stats(void)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    pgn_scheduler_reset_stats(&sched);
+    xSemaphoreGive(sched_mutex);
+}
+
+#else
+
+void pgn_senders_start(const n2k_sink_t *sink)
+{
+}
+
+bool pgn_senders_request(uint32_t pgn)
+{
+    return false;
+}
+
+uint8_t pgn_senders_claim_received(uint8_t source, const uint8_t *data)
+{
+    return N2K_NULL_ADDRESS;
+}
+
+bool pgn_senders_claimed(void)
+{
+    return false;
+}
+
+void pgn_senders_get_claim(address_claim_t *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->address = N2K_NULL_ADDRESS;
+}
+
+void pgn_senders_get_stats(pgn_sched_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void pgn_senders_reset_stats(void)
+{
+}
+
+#endif
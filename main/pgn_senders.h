@@ -0,0 +1,38 @@
+/*
+ * pgn_senders.h
+ *
+ * NMEA 2000 transmit side: the PGNs this node sends on its own, on a
+ * period or when asked, all on one transmit scheduler (pgn_scheduler.h)
+ * run from a single one-shot timer.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef PGN_SENDERS_H
+#define PGN_SENDERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "n2k_frame.h"
+#include "address_claim.h"
+#include "pgn_scheduler.h"
+
+// Functions
+void        pgn_senders_start(const n2k_sink_t *sink);
+bool        pgn_senders_request(uint32_t pgn);
+uint8_t     pgn_senders_claim_received(uint8_t source, const uint8_t *data);
+bool        pgn_senders_claimed(void);
+void        pgn_senders_get_claim(address_claim_t *state);
+void        pgn_senders_get_stats(pgn_sched_stats_t *stats);
+void        pgn_senders_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
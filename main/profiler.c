@@ -0,0 +1,492 @@
+/*
+ * profiler.c
+ *
+ * This file implements the sampling profiler. Each core runs its own
+ * general purpose timer, created from that core through esp_ipc so its
+ * interrupt is allocated there. On every alarm the interrupt handler takes
+ * the stack pointer that the port saved in the interrupted task's TCB
+ * (pxTopOfStack points at the exception frame pushed on interrupt entry)
+ * and walks the Xtensa windowed call frames from it, the same way the
+ * panic handler prints a backtrace.
+ *
+ * Stacks are merged in an open addressing hash table as they are sampled,
+ * so memory is bounded by the number of unique stacks, not by the length
+ * of the run. Samples that interrupt another interrupt handler are counted
+ * as "(isr)". The timer interrupt is not IRAM safe, so no samples are taken
+ * while the flash cache is disabled; flash_stall.c accounts for that time.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gptimer.h"
+#include "esp_console.h"
+#include "esp_debug_helpers.h"
+#include "esp_cpu_utils.h"
+#include "esp_ipc.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "profiler.h"
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+    #include "freertos/xtensa_context.h"
+
+// Interrupt nesting per core, kept by the port's interrupt entry and exit
+extern volatile unsigned port_interruptNesting[portNUM_PROCESSORS];
+#endif
+
+
+#define PROFILER_DEPTH      CONFIG_PROFILER_DEPTH
+#define PROFILER_STACKS     CONFIG_PROFILER_STACKS     // Power of two
+#define PROFILER_TASKS      32
+#define MAX_PROBES          16                          // Bounds the time spent in the interrupt
+#define ISR_TASK            0xFF                        // Sample interrupted an interrupt handler
+#define OTHER_TASK          0xFE                        // Task table full
+#define FOLD_LINE_MAX       (configMAX_TASK_NAME_LEN + PROFILER_DEPTH * 11 + 16)
+
+_Static_assert((PROFILER_STACKS & (PROFILER_STACKS - 1)) == 0, "PROFILER_STACKS must be a power of two");
+
+
+// One unique stack, leaf first
+typedef struct {
+    uint32_t    count;
+    uint32_t    hash;
+    uint32_t    pc[PROFILER_DEPTH];
+    uint8_t     depth;
+    uint8_t     task;                       // Index into tasks, ISR_TASK or OTHER_TASK
+} profile_stack_t;
+
+
+// Task seen while sampling
+typedef struct {
+    TaskHandle_t    handle;
+    char            name[configMAX_TASK_NAME_LEN];
+} profile_task_t;
+
+
+// Start and stop are serialized through this state, as ota_claim() does
+typedef enum {
+    STATE_IDLE = 0,
+    STATE_CHANGING,
+    STATE_RUNNING,
+} profiler_state_t;
+
+
+// esp_ipc argument for the per core timer set up
+typedef struct {
+    uint32_t    rate_hz;
+    esp_err_t   err;
+} timer_arg_t;
+
+
+// Local variables
+static const char           *TAG = "profiler";
+static profile_stack_t      *stacks;        // Kept after a run until the next one starts
+#if CONFIG_STATIC_ALLOCATION
+static profile_stack_t      stacks_mem[PROFILER_STACKS];
+#endif
+static profile_task_t       tasks[PROFILER_TASKS];
+static int                  task_count;
+static gptimer_handle_t     timers[portNUM_PROCESSORS];
+static esp_timer_handle_t   stop_timer;
+static profiler_stats_t     stats;
+static int64_t              started_us;
+static profiler_state_t     state = STATE_IDLE;
+static portMUX_TYPE         s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+/**
+ * @brief Returns the tasks index of a task, adding it if it is new.
+ *        Called with s_lock held.
+ */
+static uint8_t task_index(TaskHandle_t handle)
+{
+    for (int i = 0; i < task_count; i++) {
+        if (tasks[i].handle == handle) {
+            return i;
+        }
+    }
+    if (task_count == PROFILER_TASKS) {
+        return OTHER_TASK;
+    }
+    tasks[task_count].handle = handle;
+    strlcpy(tasks[task_count].name, pcTaskGetName(handle), sizeof(tasks[task_count].name));
+    return task_count++;
+}
+
+
+/**
+ * @brief Captures the backtrace of the task interrupted on this core.
+ *
+ * @return Number of frames written to pc, 0 if an interrupt handler was
+ *         interrupted.
+ */
+static int capture(int core, TaskHandle_t *task, uint32_t pc[PROFILER_DEPTH])
+{
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+    // This handler is one level of nesting itself; a second means it
+    // interrupted another handler, and the TCB does not hold the stack
+    if (port_interruptNesting[core] > 1) {
+        return 0;
+    }
+    *task = xTaskGetCurrentTaskHandleForCore(core);
+    const XtExcFrame *frame = *(XtExcFrame * const *)*task;
+    if (!esp_stack_ptr_is_sane((uint32_t)frame)) {
+        return 0;
+    }
+
+    esp_backtrace_frame_t bt = {
+        .pc = frame->pc,
+        .sp = frame->a1,
+        .next_pc = frame->a0,
+        .exc_frame = frame,
+    };
+    int depth = 0;
+    pc[depth++] = esp_cpu_process_stack_pc(bt.pc);
+    while (depth < PROFILER_DEPTH && esp_cpu_process_stack_pc(bt.next_pc) != 0 && esp_stack_ptr_is_sane(bt.sp)) {
+        if (!esp_backtrace_get_next_frame(&bt)) {
+            break;
+        }
+        pc[depth++] = esp_cpu_process_stack_pc(bt.pc);
+    }
+    return depth;
+#else
+    return 0;
+#endif
+}
+
+
+/**
+ * @brief Timer alarm: records one sample of this core.
+ */
+static bool on_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+    uint32_t pc[PROFILER_DEPTH];
+    TaskHandle_t task = NULL;
+    int depth = capture(xPortGetCoreID(), &task, pc);
+
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ pc[i]) * 16777619u;
+    }
+
+    portENTER_CRITICAL_ISR(&s_lock);
+    if (state == STATE_RUNNING) {
+        uint8_t t = depth ? task_index(task) : ISR_TASK;
+        hash = (hash ^ t) * 16777619u;
+        stats.samples++;
+
+        uint32_t slot = hash & (PROFILER_STACKS - 1);
+        int probe;
+        for (probe = 0; probe < MAX_PROBES; probe++, slot = (slot + 1) & (PROFILER_STACKS - 1)) {
+            profile_stack_t *s = &stacks[slot];
+            if (s->count == 0) {
+                s->hash = hash;
+                s->task = t;
+                s->depth = depth;
+                memcpy(s->pc, pc, depth * sizeof(pc[0]));
+                s->count = 1;
+                stats.stacks++;
+                break;
+            }
+            if (s->hash == hash && s->task == t && s->depth == depth &&
+                memcmp(s->pc, pc, depth * sizeof(pc[0])) == 0) {
+                s->count++;
+                break;
+            }
+        }
+        if (probe == MAX_PROBES) {
+            stats.dropped++;
+        }
+    }
+    portEXIT_CRITICAL_ISR(&s_lock);
+    return false;
+}
+
+
+/**
+ * @brief Creates and starts the sampling timer of the calling core (esp_ipc).
+ */
+static void timer_start_on_core(void *arg)
+{
+    timer_arg_t *a = arg;
+    int core = xPortGetCoreID();
+    gptimer_config_t config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,
+    };
+    gptimer_alarm_config_t alarm = {
+        .alarm_count = 1000000 / a->rate_hz,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    gptimer_event_callbacks_t cbs = {
+        .on_alarm = on_alarm,
+    };
+
+    a->err = gptimer_new_timer(&config, &timers[core]);
+    if (a->err != ESP_OK) {
+        return;
+    }
+    if ((a->err = gptimer_register_event_callbacks(timers[core], &cbs, NULL)) != ESP_OK ||
+        (a->err = gptimer_set_alarm_action(timers[core], &alarm)) != ESP_OK ||
+        (a->err = gptimer_enable(timers[core])) != ESP_OK) {
+        gptimer_del_timer(timers[core]);
+        timers[core] = NULL;
+        return;
+    }
+    a->err = gptimer_start(timers[core]);
+}
+
+
+/**
+ * @brief Stops and deletes the sampling timer of the calling core (esp_ipc).
+ */
+static void timer_stop_on_core(void *arg)
+{
+    int core = xPortGetCoreID();
+    if (timers[core] != NULL) {
+        gptimer_stop(timers[core]);
+        gptimer_disable(timers[core]);
+        gptimer_del_timer(timers[core]);
+        timers[core] = NULL;
+    }
+}
+
+
+/**
+ * @brief Ends a timed run, see profiler_start().
+ */
+static void stop_timer_cb(void *arg)
+{
+    profiler_stop();
+}
+
+
+/**
+ * @brief Moves between the start/stop states.
+ *
+ * @return true if the profiler was in state from and is now in state to.
+ */
+static bool change_state(profiler_state_t from, profiler_state_t to)
+{
+    bool changed = false;
+    portENTER_CRITICAL(&s_lock);
+    if (state == from) {
+        state = to;
+        changed = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return changed;
+}
+
+
+/**
+ * @brief Starts a new profile, discarding the previous one.
+ *
+ * The sampling timers hold the APB clock while they run, so a profile
+ * taken with the dynamic clock policy (see perf_lock.h) sees a fixed clock.
+ *
+ * @param rate_hz     Samples per second and core, 1 to PROFILER_MAX_HZ.
+ * @param duration_ms Stop automatically after this long, 0 to run until
+ *                    profiler_stop().
+ *
+ * @return
+ *     - ESP_OK: Sampling.
+ *     - ESP_ERR_INVALID_ARG: Rate out of range.
+ *     - ESP_ERR_INVALID_STATE: A profile is already running.
+ *     - ESP_ERR_NO_MEM: The stack table could not be allocated.
+ *     - Other error codes from the timer driver.
+ */
+esp_err_t profiler_start(uint32_t rate_hz, uint32_t duration_ms)
+{
+    if (rate_hz == 0 || rate_hz > PROFILER_MAX_HZ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!change_state(STATE_IDLE, STATE_CHANGING)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#if CONFIG_STATIC_ALLOCATION
+    stacks = stacks_mem;
+    memset(stacks, 0, sizeof(stacks_mem));
+#else
+    free(stacks);
+    stacks = calloc(PROFILER_STACKS, sizeof(profile_stack_t));
+    if (stacks == NULL) {
+        change_state(STATE_CHANGING, STATE_IDLE);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    memset(&stats, 0, sizeof(stats));
+    memset(tasks, 0, sizeof(tasks));
+    task_count = 0;
+    stats.rate_hz = rate_hz;
+    started_us = esp_timer_get_time();
+
+    // Samples are only recorded once the state is STATE_RUNNING
+    timer_arg_t arg = { .rate_hz = rate_hz, .err = ESP_OK };
+    for (int core = 0; core < portNUM_PROCESSORS && arg.err == ESP_OK; core++) {
+        esp_err_t err = esp_ipc_call_blocking(core, timer_start_on_core, &arg);
+        arg.err = (err != ESP_OK) ? err : arg.err;
+    }
+    if (arg.err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot start the sampling timers: %s", esp_err_to_name(arg.err));
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            esp_ipc_call_blocking(core, timer_stop_on_core, NULL);
+        }
+        change_state(STATE_CHANGING, STATE_IDLE);
+        return arg.err;
+    }
+
+    if (duration_ms > 0) {
+        if (stop_timer == NULL) {
+            const esp_timer_create_args_t args = {
+                .callback = stop_timer_cb,
+                .name = "profiler_stop",
+            };
+            ESP_ERROR_CHECK(esp_timer_create(&args, &stop_timer));
+        }
+        esp_timer_start_once(stop_timer, (uint64_t)duration_ms * 1000);
+    }
+    stats.running = true;
+    change_state(STATE_CHANGING, STATE_RUNNING);
+    ESP_LOGI(TAG, "Sampling at %lu Hz per core", (unsigned long)rate_hz);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Stops the running profile. The folded profile stays available
+ *        until the next profiler_start().
+ *
+ * @return
+ *     - ESP_OK: Stopped.
+ *     - ESP_ERR_INVALID_STATE: No profile is running.
+ */
+esp_err_t profiler_stop(void)
+{
+    if (!change_state(STATE_RUNNING, STATE_CHANGING)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (stop_timer != NULL) {
+        esp_timer_stop(stop_timer);
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_ipc_call_blocking(core, timer_stop_on_core, NULL);
+    }
+    stats.duration_ms = (esp_timer_get_time() - started_us) / 1000;
+    stats.running = false;
+    change_state(STATE_CHANGING, STATE_IDLE);
+    ESP_LOGI(TAG, "%lu samples, %lu stacks, %lu dropped", (unsigned long)stats.samples,
+             (unsigned long)stats.stacks, (unsigned long)stats.dropped);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Returns the counters of the running or last profile.
+ */
+void profiler_get_stats(profiler_stats_t *out)
+{
+    portENTER_CRITICAL(&s_lock);
+    *out = stats;
+    if (stats.running) {
+        out->duration_ms = (esp_timer_get_time() - started_us) / 1000;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Emits the last profile in folded stack format, one line per
+ *        unique stack: "task;0xroot;...;0xleaf count". Empty while a
+ *        profile is running.
+ *
+ * @param cb  Called for each line, without a line terminator.
+ * @param ctx Passed to cb.
+ */
+void profiler_fold(profiler_line_cb_t cb, void *ctx)
+{
+    if (state != STATE_IDLE || stacks == NULL) {
+        return;
+    }
+    char line[FOLD_LINE_MAX];
+    for (int i = 0; i < PROFILER_STACKS; i++) {
+        const profile_stack_t *s = &stacks[i];
+        if (s->count == 0) {
+            continue;
+        }
+        const char *task = (s->task == ISR_TASK) ? "(isr)" : (s->task == OTHER_TASK) ? "(other)" : tasks[s->task].name;
+        int len = snprintf(line, sizeof(line), "%s", task);
+        for (int d = s->depth; d-- > 0; ) {
+            len += snprintf(line + len, sizeof(line) - len, ";0x%08lx", (unsigned long)s->pc[d]);
+        }
+        snprintf(line + len, sizeof(line) - len, " %lu", (unsigned long)s->count);
+        cb(line, ctx);
+    }
+}
+
+
+/**
+ * @brief Prints a folded stack line to the console.
+ */
+static void print_line(const char *line, void *ctx)
+{
+    printf("%s\n", line);
+}
+
+
+/**
+ * @brief Handler for the 'profile' console command.
+ */
+static int profile_cmd(int argc, char **argv)
+{
+    esp_err_t err = ESP_OK;
+    if (argc > 1 && strcmp(argv[1], "start") == 0) {
+        uint32_t rate_hz = (argc > 2) ? strtoul(argv[2], NULL, 10) : CONFIG_PROFILER_DEFAULT_HZ;
+        uint32_t seconds = (argc > 3) ? strtoul(argv[3], NULL, 10) : 0;
+        err = profiler_start(rate_hz, seconds * 1000);
+    } else if (argc > 1 && strcmp(argv[1], "stop") == 0) {
+        err = profiler_stop();
+    } else if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        profiler_fold(print_line, NULL);
+        return 0;
+    } else if (argc > 1) {
+        printf("profile: expected start, stop or dump\n");
+        return 1;
+    }
+    if (err != ESP_OK) {
+        printf("profile: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    profiler_stats_t st;
+    profiler_get_stats(&st);
+    printf("%s, %lu Hz, %lu ms, %lu samples, %lu stacks, %lu dropped\n", st.running ? "Running" : "Stopped",
+           (unsigned long)st.rate_hz, (unsigned long)st.duration_ms, (unsigned long)st.samples,
+           (unsigned long)st.stacks, (unsigned long)st.dropped);
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'profile' console command.
+ */
+void register_profiler(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "profile",
+        .help = "Sample the call stacks of both cores; 'dump' prints the folded profile",
+        .hint = "[start [hz] [seconds]|stop|dump]",
+        .func = &profile_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,57 @@
+/*
+ * profiler.h
+ *
+ * Sampling profiler. A hardware timer on each core interrupts at the
+ * sampling rate and records the backtrace of the task it interrupted.
+ * Identical stacks are merged as they are sampled, so the profile is
+ * already folded (one line per unique stack with its sample count) when
+ * it is read from /debug/profile or the 'profile' console command.
+ * Addresses are symbolized on the host, see tools/profile_symbolize.py.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+
+#define PROFILER_MAX_HZ     10000
+
+
+// Counters of the current or last profile
+typedef struct {
+    uint32_t    rate_hz;
+    uint32_t    samples;                    // Samples recorded
+    uint32_t    dropped;                    // Samples lost because the stack table was full
+    uint32_t    stacks;                     // Unique stacks
+    uint32_t    duration_ms;                // Time sampled so far
+    bool        running;
+} profiler_stats_t;
+
+
+// Receives the folded profile one line at a time
+typedef void (*profiler_line_cb_t)(const char *line, void *ctx);
+
+
+// Functions
+esp_err_t   profiler_start(uint32_t rate_hz, uint32_t duration_ms);
+esp_err_t   profiler_stop(void);
+void        profiler_get_stats(profiler_stats_t *stats);
+void        profiler_fold(profiler_line_cb_t cb, void *ctx);
+void        register_profiler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
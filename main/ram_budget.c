@@ -0,0 +1,147 @@
+/*
+ * ram_budget.c
+ *
+ * This file implements the RAM budget report. app_main() calls
+ * ram_budget_mark() after starting each subsystem; the drop in free
+ * internal heap since the previous mark is what that subsystem allocated,
+ * including the tasks and buffers ESP-IDF creates for it. Static RAM comes
+ * from the section symbols of the ESP-IDF linker script.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "ram_budget.h"
+
+
+#define MAX_MARKS   12
+
+
+// Heap taken by one start up step
+typedef struct {
+    const char  *subsystem;
+    int32_t     bytes;
+} ram_mark_t;
+
+
+// Section bounds from the linker script
+extern int _data_start, _data_end;
+extern int _bss_start, _bss_end;
+extern int _iram_start, _iram_end;
+
+
+// Local variables
+static const char   *TAG = "ram";
+static ram_mark_t   marks[MAX_MARKS];
+static int          num_marks;
+static size_t       last_free;
+static size_t       start_free;
+
+
+/**
+ * @brief Starts the budget. Call at the top of app_main().
+ */
+void ram_budget_begin(void)
+{
+    start_free = last_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    num_marks = 0;
+}
+
+
+/**
+ * @brief Charges the internal heap allocated since the previous mark to a
+ *        subsystem.
+ *
+ * @param subsystem Name, a string literal.
+ */
+void ram_budget_mark(const char *subsystem)
+{
+    size_t free_now = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    if (num_marks < MAX_MARKS) {
+        marks[num_marks].subsystem = subsystem;
+        marks[num_marks].bytes = (int32_t)last_free - (int32_t)free_now;
+        num_marks++;
+    }
+    last_free = free_now;
+}
+
+
+/**
+ * @brief Prints the budget to stdout.
+ */
+static void print_budget(void)
+{
+    size_t data = (uintptr_t)&_data_end - (uintptr_t)&_data_start;
+    size_t bss = (uintptr_t)&_bss_end - (uintptr_t)&_bss_start;
+    size_t iram = (uintptr_t)&_iram_end - (uintptr_t)&_iram_start;
+
+#if CONFIG_STATIC_ALLOCATION
+    printf("Static RAM (static allocation build)\n");
+#else
+    printf("Static RAM\n");
+#endif
+    printf("  %-16s %8u\n", ".data", (unsigned)data);
+    printf("  %-16s %8u\n", ".bss", (unsigned)bss);
+    printf("  %-16s %8u\n", "IRAM", (unsigned)iram);
+
+    printf("Heap taken at start up\n");
+    int32_t total = 0;
+    for (int i = 0; i < num_marks; i++) {
+        printf("  %-16s %8ld\n", marks[i].subsystem, (long)marks[i].bytes);
+        total += marks[i].bytes;
+    }
+    printf("  %-16s %8ld\n", "total", (long)total);
+
+    printf("Internal heap now\n");
+    printf("  %-16s %8u\n", "free", (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    printf("  %-16s %8u\n", "minimum free", (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    printf("  %-16s %8u\n", "largest block", (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+    printf("  %-16s %8ld\n", "after start up", (long)((int32_t)start_free -
+                                                       (int32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL) - total));
+}
+
+
+/**
+ * @brief Logs the heap taken at start up, once all subsystems are running.
+ */
+void ram_budget_log(void)
+{
+    int32_t total = 0;
+    for (int i = 0; i < num_marks; i++) {
+        ESP_LOGI(TAG, "%-16s %6ld bytes", marks[i].subsystem, (long)marks[i].bytes);
+        total += marks[i].bytes;
+    }
+    ESP_LOGI(TAG, "Start up took %ld bytes of heap, %u free", (long)total,
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+}
+
+
+/**
+ * @brief Handler for the 'ram' console command.
+ */
+static int ram_cmd(int argc, char **argv)
+{
+    print_budget();
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'ram' console command.
+ */
+void register_ram_budget(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "ram",
+        .help = "Show static RAM, the heap each subsystem took at start up and the free heap",
+        .hint = NULL,
+        .func = &ram_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,31 @@
+/*
+ * ram_budget.h
+ *
+ * RAM budget of the firmware: the static sections from the linker and the
+ * internal heap each subsystem takes while it starts up. Printed by the
+ * 'ram' console command; tools/ram_budget.py breaks the static part down
+ * by subsystem from the link map.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef RAM_BUDGET_H
+#define RAM_BUDGET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Functions
+void ram_budget_begin(void);
+void ram_budget_mark(const char *subsystem);
+void ram_budget_log(void);
+void register_ram_budget(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * serial_ota.c
+ *
+ * This file implements the 'serial_ota' console command. It takes over the
+ * console port, silences logging, and runs the ota_proto receiver until the
+ * host has delivered a complete image or the transfer fails. Image data goes
+ * through an OTA session, exactly like an upload through the web server.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#if defined(CONFIG_ESP_CONSOLE_UART_DEFAULT) || defined(CONFIG_ESP_CONSOLE_UART_CUSTOM)
+    #include "driver/uart.h"
+#elif defined(CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG)
+    #include "driver/usb_serial_jtag.h"
+#endif
+#include "ota_proto.h"
+#include "ota_session.h"
+#include "serial_ota.h"
+
+
+#define SERIAL_OTA_READ_CHUNK   512
+#define SERIAL_OTA_POLL_MS      100
+#define SERIAL_OTA_IDLE_ACK_MS  500
+
+
+// Local function prototypes
+extern void request_reboot(void);
+
+
+#if defined(CONFIG_ESP_CONSOLE_UART_DEFAULT) || defined(CONFIG_ESP_CONSOLE_UART_CUSTOM)
+
+#define SERIAL_OTA_PORT         CONFIG_ESP_CONSOLE_UART_NUM
+#define CONSOLE_RX_BUFFER_SIZE  256         // What esp_console_new_repl_uart() installs
+
+/**
+ * @brief Re-installs the console UART driver with a receive buffer large
+ *        enough to hold a full window of frames while flash is being erased.
+ */
+static void port_open(void)
+{
+    uart_wait_tx_done(SERIAL_OTA_PORT, pdMS_TO_TICKS(100));
+    uart_driver_delete(SERIAL_OTA_PORT);
+    ESP_ERROR_CHECK(uart_driver_install(SERIAL_OTA_PORT, CONFIG_SERIAL_OTA_RX_BUFFER_SIZE, 0, 0, NULL, 0));
+}
+
+static void port_close(void)
+{
+    uart_wait_tx_done(SERIAL_OTA_PORT, pdMS_TO_TICKS(100));
+    uart_set_baudrate(SERIAL_OTA_PORT, CONFIG_ESP_CONSOLE_UART_BAUDRATE);
+    uart_driver_delete(SERIAL_OTA_PORT);
+    ESP_ERROR_CHECK(uart_driver_install(SERIAL_OTA_PORT, CONSOLE_RX_BUFFER_SIZE, 0, 0, NULL, 0));
+}
+
+static int port_read(uint8_t *buf, size_t len, TickType_t timeout)
+{
+    return uart_read_bytes(SERIAL_OTA_PORT, buf, len, timeout);
+}
+
+static void port_write(void *ctx, const uint8_t *data, size_t len)
+{
+    uart_write_bytes(SERIAL_OTA_PORT, data, len);
+}
+
+static void port_set_baud(void *ctx, uint32_t baud)
+{
+    uart_wait_tx_done(SERIAL_OTA_PORT, pdMS_TO_TICKS(100));
+    uart_set_baudrate(SERIAL_OTA_PORT, baud);
+}
+
+#define SERIAL_OTA_SET_BAUD     port_set_baud
+#define SERIAL_OTA_MAX_BAUD     CONFIG_SERIAL_OTA_MAX_BAUD
+#define SERIAL_OTA_RX_BUFFER    CONFIG_SERIAL_OTA_RX_BUFFER_SIZE
+
+#elif defined(CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG)
+
+// USB is flow controlled end to end, so the console driver can be used as is
+static void port_open(void)
+{
+}
+
+static void port_close(void)
+{
+}
+
+static int port_read(uint8_t *buf, size_t len, TickType_t timeout)
+{
+    return usb_serial_jtag_read_bytes(buf, len, timeout);
+}
+
+static void port_write(void *ctx, const uint8_t *data, size_t len)
+{
+    usb_serial_jtag_write_bytes(data, len, portMAX_DELAY);
+}
+
+#define SERIAL_OTA_SET_BAUD     NULL
+#define SERIAL_OTA_MAX_BAUD     0
+#define SERIAL_OTA_RX_BUFFER    (OTA_PROTO_MAX_WINDOW * OTA_PROTO_MAX_ENCODED)
+
+#else
+#define SERIAL_OTA_UNSUPPORTED
+#endif
+
+
+#ifndef SERIAL_OTA_UNSUPPORTED
+
+/**
+ * @brief Log sink used while the console port carries binary frames.
+ */
+static int null_vprintf(const char *fmt, va_list args)
+{
+    return 0;
+}
+
+
+// OTA session adapters for the protocol receiver
+static int sink_begin(void *ctx, uint32_t image_size)
+{
+    ota_session_config_t config = {
+        .format      = OTA_SESSION_RAW,
+        .content_len = image_size,
+        .path        = OTA_PATH_SERIAL,
+    };
+    esp_err_t err = ota_session_open((ota_session_t *)ctx, &config);
+    if (err == ESP_ERR_INVALID_STATE) {
+        return OTA_STATUS_BUSY;
+    }
+    return (err == ESP_OK) ? OTA_STATUS_OK : OTA_STATUS_WRITE;
+}
+
+static int sink_write(void *ctx, const uint8_t *data, size_t len)
+{
+    return (ota_session_push((ota_session_t *)ctx, data, len) != OTA_SESSION_FAILED) ? OTA_STATUS_OK : OTA_STATUS_WRITE;
+}
+
+static int sink_finish(void *ctx)
+{
+    esp_err_t err = ota_session_finish((ota_session_t *)ctx);
+    if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+        return OTA_STATUS_VERIFY;
+    }
+    return (err == ESP_OK) ? OTA_STATUS_OK : OTA_STATUS_WRITE;
+}
+
+static void sink_abort(void *ctx)
+{
+    ota_session_abort((ota_session_t *)ctx);
+}
+
+
+/**
+ * @brief Handler for the 'serial_ota' console command.
+ *
+ * Runs the transfer to completion on the console task. On success the
+ * device reboots into the new image; on failure the console is restored
+ * and the reason is printed.
+ */
+static int serial_ota_cmd(int argc, char **argv)
+{
+    static ota_session_t session;
+
+    uint8_t *buf = malloc(SERIAL_OTA_READ_CHUNK);
+    ota_proto_rx_t *rx = calloc(1, sizeof(ota_proto_rx_t));
+    if (buf == NULL || rx == NULL) {
+        printf("serial_ota: out of memory\n");
+        free(buf);
+        free(rx);
+        return 1;
+    }
+
+    ota_proto_io_t io = {
+        .begin    = sink_begin,
+        .write    = sink_write,
+        .finish   = sink_finish,
+        .abort    = sink_abort,
+        .send     = port_write,
+        .set_baud = SERIAL_OTA_SET_BAUD,
+        .ctx      = &session,
+    };
+
+    // Never offer more in-flight data than the receive buffer can hold
+    int window = SERIAL_OTA_RX_BUFFER / OTA_PROTO_MAX_ENCODED;
+    if (window > CONFIG_SERIAL_OTA_WINDOW) {
+        window = CONFIG_SERIAL_OTA_WINDOW;
+    }
+    if (window < 1) {
+        window = 1;
+    }
+    ota_proto_rx_init(rx, &io, window, SERIAL_OTA_MAX_BAUD);
+
+    printf("serial_ota: ready (window %d, max baud %d)\n", window, SERIAL_OTA_MAX_BAUD);
+    fflush(stdout);
+
+    vprintf_like_t old_vprintf = esp_log_set_vprintf(null_vprintf);
+    port_open();
+
+    int idle_ms = 0;
+    int idle_ack_ms = 0;
+    ota_rx_state_t state = OTA_RX_WAIT_HELLO;
+    while (state != OTA_RX_DONE && state != OTA_RX_FAILED) {
+        int n = port_read(buf, SERIAL_OTA_READ_CHUNK, pdMS_TO_TICKS(SERIAL_OTA_POLL_MS));
+        if (n > 0) {
+            idle_ms = 0;
+            idle_ack_ms = 0;
+            state = ota_proto_rx_feed(rx, buf, n);
+            continue;
+        }
+
+        idle_ms += SERIAL_OTA_POLL_MS;
+        idle_ack_ms += SERIAL_OTA_POLL_MS;
+        if (idle_ms >= CONFIG_SERIAL_OTA_TIMEOUT_MS) {
+            break;
+        }
+        if (idle_ack_ms >= SERIAL_OTA_IDLE_ACK_MS) {
+            idle_ack_ms = 0;
+            ota_proto_rx_idle(rx);
+        }
+    }
+
+    if (state == OTA_RX_RECEIVING) {
+        ota_session_abort(&session);
+    }
+
+    port_close();
+    esp_log_set_vprintf(old_vprintf);
+
+    int ret = 0;
+    if (state == OTA_RX_DONE) {
+        printf("serial_ota: received %lu bytes, %lu CRC errors, %lu resends. Rebooting...\n",
+               (unsigned long)rx->received, (unsigned long)rx->crc_errors, (unsigned long)rx->resends);
+        request_reboot();
+    } else {
+        printf("serial_ota: %s after %lu of %lu bytes\n",
+               (state == OTA_RX_FAILED) ? "transfer failed" : "timed out",
+               (unsigned long)rx->received, (unsigned long)rx->image_size);
+        ret = 1;
+    }
+
+    free(buf);
+    free(rx);
+    return ret;
+}
+
+
+/**
+ * @brief Registers the 'serial_ota' console command.
+ */
+void register_serial_ota(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "serial_ota",
+        .help = "Receive a firmware image over this console port (use tools/serial_ota.py)",
+        .hint = NULL,
+        .func = &serial_ota_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+#else
+
+void register_serial_ota(void)
+{
+}
+
+#endif
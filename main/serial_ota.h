@@ -0,0 +1,29 @@
+/**
+ * @file    serial_ota.h
+ * @brief   Console command for high-speed OTA over the serial console
+ *
+ * @author  David Hoy
+ * @date    10/18/2026
+ *
+ * @note    The protocol itself lives in ota_proto.h, tools/serial_ota.py is
+ *          the matching host side sender.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief Registers the 'serial_ota' console command.
+ *
+ * The command switches the console port into binary mode and receives a
+ * firmware image using the framed protocol from ota_proto.h. The image is
+ * written through the same OTA writer as the web upload path and the device
+ * reboots into it on success. Normal console operation resumes on failure.
+ */
+void register_serial_ota(void);
+
+#ifdef __cplusplus
+}
+#endif
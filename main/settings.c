@@ -10,6 +10,7 @@
  * Date:    Feb 2025
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
@@ -19,6 +20,7 @@
 
 #include "esp_log.h"
 #include "esp_err.h"
+#include "flash_stall.h"
 #include "settings.h"
 //#include "event_manager.h"
 //#include "demo_mode.h"
@@ -47,6 +49,7 @@
 #define DEFAULT_DEBUG_FLAGS     0x0000
 #define DEFAULT_SERIAL_NUMBER   0
 #define DEFAULT_PRESSURE_CHECK_INTERVAL     150  // 2.5 minutes 
+#define DEFAULT_RELAY_PEERS     ""
 
 
 // Generalized get function
@@ -116,6 +119,7 @@ esp_err_t set_setting(const char *key, const void *value, size_t size, bool is_s
         return err;
     }
 
+    flash_op_t prev_op = flash_stall_op_begin(FLASH_OP_NVS);
     if (is_string) {
         err = nvs_set_str(handle, key, (const char *)value);
     } else {
@@ -126,6 +130,7 @@ esp_err_t set_setting(const char *key, const void *value, size_t size, bool is_s
         err = nvs_commit(handle);
         //trigger_events(EVENT_SETTINGS);     // Notify tasks that settings have changed.
     }
+    flash_stall_op_end(prev_op);
 
     nvs_close(handle);
     return err;
@@ -153,6 +158,157 @@ void settings_init(bool reset_defaults)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+
+    // Hot paths test the flags through the cache, see debug_flags.h
+    debug_flags_update(get_debug_flags());
+}
+
+
+/**
+ * @brief Retrieves the NMEA 2000 node address.
+ *
+ * @return The address this node claims on the bus.
+ */
+unsigned char get_node_address(void)
+{
+    unsigned char address = DEFAULT_NODE_ADDRESS;
+    size_t size = sizeof(address);
+    get_setting("node_address", &address, &size, false);
+    return address;
+}
+
+
+/**
+ * @brief Sets the NMEA 2000 node address.
+ *
+ * @param value The address to claim, 0 to 253.
+ */
+void set_node_address(unsigned char value)
+{
+    if (set_setting("node_address", &value, sizeof(value), false) != ESP_OK) {
+        printf("Failed to save node address\n");
+    }
+}
+
+
+/**
+ * @brief Retrieves the NMEA 2000 device instance.
+ *
+ * @return The instance number.
+ */
+unsigned char get_instance(void)
+{
+    unsigned char instance = DEFAULT_INSTANCE;
+    size_t size = sizeof(instance);
+    get_setting("instance", &instance, &size, false);
+    return instance;
+}
+
+
+/**
+ * @brief Sets the NMEA 2000 device instance.
+ *
+ * @param value The instance number.
+ */
+void set_instance(unsigned char value)
+{
+    if (set_setting("instance", &value, sizeof(value), false) != ESP_OK) {
+        printf("Failed to save instance\n");
+    }
+}
+
+
+/**
+ * @brief Retrieves the device label, sent in the NMEA 2000 configuration
+ *        information.
+ *
+ * @param label      Buffer for the label.
+ * @param max_length Size of the buffer.
+ *
+ * @return The buffer.
+ */
+char *get_device_label(char *label, size_t max_length)
+{
+    size_t size = max_length;
+    if (get_setting("device_label", label, &size, true) != ESP_OK) {
+        strlcpy(label, DEFAULT_DEVICE_LABEL, max_length);
+    }
+    return label;
+}
+
+
+/**
+ * @brief Sets the device label.
+ *
+ * @param label Up to 70 characters.
+ */
+void set_device_label(const char *label)
+{
+    if (set_setting("device_label", label, strlen(label) + 1, true) != ESP_OK) {
+        printf("Failed to save device label\n");
+    }
+}
+
+
+/**
+ * @brief Retrieves the first installation description.
+ *
+ * @param label      Buffer for the description.
+ * @param max_length Size of the buffer.
+ *
+ * @return The buffer.
+ */
+char *get_installation_1(char *label, size_t max_length)
+{
+    size_t size = max_length;
+    if (get_setting("install_1", label, &size, true) != ESP_OK) {
+        strlcpy(label, DEFAULT_INSTALLATION_1, max_length);
+    }
+    return label;
+}
+
+
+/**
+ * @brief Sets the first installation description.
+ *
+ * @param label Up to 70 characters.
+ */
+void set_installation_1(const char *label)
+{
+    if (set_setting("install_1", label, strlen(label) + 1, true) != ESP_OK) {
+        printf("Failed to save installation description 1\n");
+    }
+}
+
+
+/**
+ * @brief Retrieves the second installation description.
+ *
+ * @param label      Buffer for the description.
+ * @param max_length Size of the buffer.
+ *
+ * @return The buffer.
+ */
+char *get_installation_2(char *label, size_t max_length)
+{
+    size_t size = max_length;
+    if (get_setting("install_2", label, &size, true) != ESP_OK) {
+        strlcpy(label, DEFAULT_INSTALLATION_2, max_length);
+    }
+    return label;
+}
+
+
+/**
+ * @brief Sets the second installation description.
+ *
+ * @param label Up to 70 characters.
+ */
+void set_installation_2(const char *label)
+{
+    if (set_setting("install_2", label, strlen(label) + 1, true) != ESP_OK) {
+        printf("Failed to save installation description 2\n");
+    }
 }
 
 
@@ -188,3 +344,91 @@ void set_serial_nbr(uint32_t serial_nbr)
     }
 }
 
+
+/**
+ * @brief Checks that a relay peers list holds only the characters of
+ *        host names, IPv4 addresses, ports and separators. The list is
+ *        printed into the settings page, its script and /api/info, so
+ *        anything else, quotes above all, is refused.
+ *
+ * @param peers The list.
+ *
+ * @return true if it may be stored.
+ */
+bool relay_peers_valid(const char *peers)
+{
+    for (const char *p = peers; *p != '\0'; p++) {
+        if (!isalnum((unsigned char)*p) && strchr(".-:, ", *p) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Retrieves the list of downstream OTA relay peers.
+ *
+ * @param peers Buffer receiving the comma separated host[:port] list.
+ * @param max_length Size of the buffer.
+ *
+ * @return Pointer to the peers buffer.
+ */
+char *get_relay_peers(char *peers, size_t max_length)
+{
+    size_t size = max_length;
+    if (get_setting("relay_peers", peers, &size, true) != ESP_OK || !relay_peers_valid(peers)) {
+        strlcpy(peers, DEFAULT_RELAY_PEERS, max_length);
+    }
+    return peers;
+}
+
+
+/**
+ * @brief Sets the list of downstream OTA relay peers. A list that fails
+ *        relay_peers_valid() is not saved.
+ *
+ * @param peers Comma separated host[:port] list, empty to disable relaying.
+ */
+void set_relay_peers(const char *peers)
+{
+    if (!relay_peers_valid(peers)) {
+        printf("Invalid relay peers, expected host[:port] list\n");
+        return;
+    }
+    if (set_setting("relay_peers", peers, strlen(peers) + 1, true) != ESP_OK) {
+        printf("Failed to save relay peers\n");
+    }
+}
+
+
+/**
+ * @brief Retrieves the debug flags from NVS.
+ *
+ * Hot paths should test a flag with debug_enabled() instead, which reads
+ * the cached copy.
+ *
+ * @return The DEBUG_* flags that are set.
+ */
+unsigned short get_debug_flags(void)
+{
+    unsigned short flags = DEFAULT_DEBUG_FLAGS;
+    size_t size = sizeof(flags);
+    get_setting("debug_flags", &flags, &size, false);
+    return flags;
+}
+
+
+/**
+ * @brief Sets the debug flags, in NVS and in the cache read by
+ *        debug_enabled().
+ *
+ * @param value The DEBUG_* flags to set.
+ */
+void set_debug_flags(unsigned short value)
+{
+    if (set_setting("debug_flags", &value, sizeof(value), false) != ESP_OK) {
+        printf("Failed to save debug flags\n");
+    }
+    debug_flags_update(value);
+}
@@ -17,8 +17,7 @@ extern "C" {
 #endif
 
 #include <nvs_flash.h>
-
-#define DEBUG_SHOW_TASK_STATS   0x0001
+#include "debug_flags.h"
 
 
 // Functions
@@ -77,6 +76,11 @@ void            set_high_current_threshold(unsigned short value);
 unsigned short  get_flush_timeout(void);
 void            set_flush_timeout(unsigned short value);
 
+// Getter/setter for downstream OTA relay peers, comma separated host[:port]
+char *          get_relay_peers(char *peers, size_t max_length);
+void            set_relay_peers(const char *peers);
+bool            relay_peers_valid(const char *peers);
+
 // Getter/setter for debug flags
 unsigned short  get_debug_flags(void); 
 void            set_debug_flags(unsigned short value); 
@@ -0,0 +1,196 @@
+/*
+ * stack_usage.c
+ *
+ * This file implements the stack usage report. The high-water mark of each
+ * task comes from uxTaskGetSystemState(); on ESP-IDF stacks are counted in
+ * bytes. reboot_task() calls stack_usage_save() just before restarting,
+ * which copies the marks to RTC memory that survives a software reset;
+ * stack_usage_init() takes them over on the next boot.
+ *
+ * Tasks that have ended (the per-transfer relay workers of the dynamic
+ * build) are not listed, their marks are lost with them.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+#include "stack_usage.h"
+
+
+#define SAVED_MAGIC     0x53544B31          // "STK1"
+
+
+// Marks saved across a software reset
+typedef struct {
+    uint32_t        magic;
+    uint32_t        count;
+    stack_usage_t   tasks[STACK_USAGE_MAX_TASKS];
+} saved_stacks_t;
+
+
+// Local variables
+static const char           *TAG = "stacks";
+static RTC_NOINIT_ATTR saved_stacks_t saved;
+static stack_usage_t        previous[STACK_USAGE_MAX_TASKS];
+static int                  previous_count;
+
+// Stacks set by this firmware, by task name
+static const struct {
+    const char  *task;
+    uint32_t    size;
+} configured[] = {
+    { "httpd",          CONFIG_STACK_SIZE_HTTPD },
+    { "dns_server",     CONFIG_STACK_SIZE_DNS_SERVER },
+    { "console_repl",   CONFIG_STACK_SIZE_CONSOLE },
+    { "netconn_ota",    CONFIG_STACK_SIZE_NETCONN_OTA },
+    { "ota_relay",      CONFIG_STACK_SIZE_OTA_RELAY },
+    { "reboot_task",    CONFIG_STACK_SIZE_REBOOT },
+    { "nmea",           CONFIG_STACK_SIZE_NMEA },
+};
+
+
+/**
+ * @brief Takes over the marks saved by the previous boot, if it ended in a
+ *        software reboot. Call once at start up.
+ */
+void stack_usage_init(void)
+{
+    if (saved.magic == SAVED_MAGIC && esp_reset_reason() == ESP_RST_SW && saved.count <= STACK_USAGE_MAX_TASKS) {
+        previous_count = saved.count;
+        memcpy(previous, saved.tasks, previous_count * sizeof(stack_usage_t));
+        ESP_LOGI(TAG, "Stack marks of %d tasks kept from the previous boot", previous_count);
+    }
+    saved.magic = 0;
+}
+
+
+/**
+ * @brief Returns the configured stack size of one of this firmware's tasks.
+ *
+ * @return The size in bytes, 0 for tasks created by ESP-IDF with its own
+ *         settings.
+ */
+uint32_t stack_usage_configured(const char *task)
+{
+    for (size_t i = 0; i < sizeof(configured) / sizeof(configured[0]); i++) {
+        if (strcmp(configured[i].task, task) == 0) {
+            return configured[i].size;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Returns the stack high-water mark of every running task.
+ *
+ * @param tasks Receives up to max entries.
+ * @param max   Size of tasks.
+ *
+ * @return The number of entries written.
+ */
+int stack_usage_get(stack_usage_t *tasks, int max)
+{
+    UBaseType_t n = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *status = malloc(n * sizeof(TaskStatus_t));
+    if (status == NULL) {
+        return 0;
+    }
+    n = uxTaskGetSystemState(status, n, NULL);
+
+    int count = 0;
+    for (UBaseType_t i = 0; i < n && count < max; i++) {
+        stack_usage_t *t = &tasks[count++];
+        strlcpy(t->name, status[i].pcTaskName, sizeof(t->name));
+        t->size = stack_usage_configured(t->name);
+        t->min_free = status[i].usStackHighWaterMark;
+    }
+    free(status);
+    return count;
+}
+
+
+/**
+ * @brief Returns the marks saved before the last software reboot.
+ *
+ * @return The number of entries written, 0 if the previous boot did not
+ *         save any.
+ */
+int stack_usage_get_previous(stack_usage_t *tasks, int max)
+{
+    int count = (previous_count < max) ? previous_count : max;
+    memcpy(tasks, previous, count * sizeof(stack_usage_t));
+    return count;
+}
+
+
+/**
+ * @brief Saves the current marks for the next boot. Call just before a
+ *        software reboot.
+ */
+void stack_usage_save(void)
+{
+    saved.count = stack_usage_get(saved.tasks, STACK_USAGE_MAX_TASKS);
+    saved.magic = SAVED_MAGIC;
+}
+
+
+/**
+ * @brief Prints one set of marks to stdout.
+ */
+static void print_usage(const stack_usage_t *tasks, int count)
+{
+    printf("  %-16s %8s %8s %8s\n", "task", "size", "min free", "used");
+    for (int i = 0; i < count; i++) {
+        const stack_usage_t *t = &tasks[i];
+        if (t->size) {
+            printf("  %-16s %8lu %8lu %8lu\n", t->name, (unsigned long)t->size, (unsigned long)t->min_free,
+                   (unsigned long)(t->size - t->min_free));
+        } else {
+            printf("  %-16s %8s %8lu %8s\n", t->name, "-", (unsigned long)t->min_free, "-");
+        }
+    }
+}
+
+
+/**
+ * @brief Handler for the 'stacks' console command.
+ */
+static int stacks_cmd(int argc, char **argv)
+{
+    stack_usage_t tasks[STACK_USAGE_MAX_TASKS];
+
+    printf("This boot\n");
+    print_usage(tasks, stack_usage_get(tasks, STACK_USAGE_MAX_TASKS));
+    int count = stack_usage_get_previous(tasks, STACK_USAGE_MAX_TASKS);
+    if (count > 0) {
+        printf("Previous boot, saved at reboot\n");
+        print_usage(tasks, count);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Registers the 'stacks' console command.
+ */
+void register_stack_usage(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "stacks",
+        .help = "Show the stack size and high-water mark of each task, this boot and the previous one",
+        .hint = NULL,
+        .func = &stacks_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,46 @@
+/*
+ * stack_usage.h
+ *
+ * Stack high-water marks of all tasks, next to the sizes this firmware
+ * gives its own tasks (the "Task stacks" menu). The marks of a boot are
+ * saved across the software reboot that ends an OTA update, so one run of
+ * tools/stack_sizes.py covers both the request load and the upload.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef STACK_USAGE_H
+#define STACK_USAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+#define STACK_USAGE_MAX_TASKS   24
+
+
+// Stack of one task
+typedef struct {
+    char        name[16];
+    uint32_t    size;                       // Configured size in bytes, 0 if not set by this firmware
+    uint32_t    min_free;                   // Least free stack since the task started, in bytes
+} stack_usage_t;
+
+
+// Functions
+void        stack_usage_init(void);
+int         stack_usage_get(stack_usage_t *tasks, int max);
+int         stack_usage_get_previous(stack_usage_t *tasks, int max);
+void        stack_usage_save(void);
+uint32_t    stack_usage_configured(const char *task);
+void        register_stack_usage(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * timer_wheel.c
+ *
+ * This file implements the timing wheel described in timer_wheel.h. A
+ * timer's slot depends on how far out it is when placed: within 64 ticks
+ * it goes in level 0 at its own tick, otherwise in the level whose slots
+ * are wide enough, at the slot covering its tick. Each time level 0 comes
+ * round to slot 0, the level 1 slot for the next 64 ticks is emptied and
+ * its timers placed again, and every 64 of those the level 2 slot the
+ * same way.
+ *
+ * Slots are singly linked lists with a back link, so a timer is unlinked
+ * without knowing its slot. Timers in a slot are in no particular order.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "timer_wheel.h"
+
+
+#define SLOT_MASK       (TIMER_WHEEL_SLOTS - 1)
+#define SPAN            (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+
+static void link(timer_wheel_t *w, wheel_timer_t *t, int level, unsigned slot)
+{
+    wheel_timer_t **head = &w->slots[level][slot];
+    t->next = *head;
+    if (t->next != NULL) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+    w->occupied[level] |= 1ull << slot;
+}
+
+
+/**
+ * @brief Puts a timer in the slot for how far out it is.
+ */
+static void place(timer_wheel_t *w, wheel_timer_t *t)
+{
+    int32_t delta = (int32_t)(t->expires - w->current);
+    uint32_t at = t->expires;
+
+    if (delta < 0) {
+        at = w->current;                    // Already due: the next tick processed
+        delta = 0;
+    } else if ((uint32_t)delta >= SPAN) {
+        at = w->current + SPAN - 1;         // Placed again as its slot comes round
+        delta = SPAN - 1;
+    }
+    int level = 0;
+    while ((uint32_t)delta >= (1u << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    link(w, t, level, (at >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+}
+
+
+/**
+ * @brief Takes all timers out of a slot.
+ *
+ * @return Them, linked through next.
+ */
+static wheel_timer_t *take(timer_wheel_t *w, int level, unsigned slot)
+{
+    wheel_timer_t *list = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->occupied[level] &= ~(1ull << slot);
+    return list;
+}
+
+
+/**
+ * @brief Moves the timers of the next 64 ticks down from the upper levels.
+ *        Called when level 0 is at slot 0.
+ */
+static void cascade(timer_wheel_t *w)
+{
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        if ((w->current & ((1u << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+            continue;                       // Levels below have not come round
+        }
+        unsigned slot = (w->current >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+        wheel_timer_t *t = take(w, level, slot);
+        while (t != NULL) {
+            wheel_timer_t *next = t->next;
+            place(w, t);
+            t = next;
+        }
+    }
+}
+
+
+/**
+ * @brief Sets up an empty wheel.
+ *
+ * @param w     The wheel.
+ * @param now   Current tick.
+ */
+void timer_wheel_init(timer_wheel_t *w, uint32_t now)
+{
+    memset(w, 0, sizeof(*w));
+    w->current = now;
+}
+
+
+/**
+ * @brief Adds a timer, or moves it if it is pending.
+ *
+ * @param w         The wheel.
+ * @param t         The timer.
+ * @param expires   Tick it is due at; a past tick is due at the next
+ *                  advance.
+ */
+void timer_wheel_add(timer_wheel_t *w, wheel_timer_t *t, uint32_t expires)
+{
+    timer_wheel_del(w, t);
+    t->expires = expires;
+    place(w, t);
+    w->count++;
+}
+
+
+/**
+ * @brief Removes a timer if it is pending.
+ */
+void timer_wheel_del(timer_wheel_t *w, wheel_timer_t *t)
+{
+    if (t->pprev == NULL) {
+        return;
+    }
+    *t->pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    // Last out of its slot: clear the slot's bit
+    wheel_timer_t **heads = &w->slots[0][0];
+    if (*t->pprev == NULL && t->pprev >= heads && t->pprev < heads + TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS) {
+        unsigned i = t->pprev - heads;
+        w->occupied[i / TIMER_WHEEL_SLOTS] &= ~(1ull << (i % TIMER_WHEEL_SLOTS));
+    }
+    t->pprev = NULL;
+    w->count--;
+}
+
+
+/**
+ * @brief Moves the wheel up to a tick.
+ *
+ * @param w     The wheel.
+ * @param now   Current tick.
+ *
+ * @return The timers due by now, linked through next, earliest tick first.
+ *         They are no longer pending.
+ */
+wheel_timer_t *timer_wheel_advance(timer_wheel_t *w, uint32_t now)
+{
+    wheel_timer_t *due = NULL;
+    wheel_timer_t **tail = &due;
+
+    while ((int32_t)(now - w->current) >= 0) {
+        unsigned slot = w->current & SLOT_MASK;
+        if (slot == 0) {
+            cascade(w);
+        }
+
+        wheel_timer_t *t = take(w, 0, slot);
+        while (t != NULL) {
+            t->pprev = NULL;
+            w->count--;
+            *tail = t;
+            tail = &t->next;
+            t = t->next;
+        }
+
+        // On to the next slot holding timers, or to slot 0 to cascade
+        uint64_t ahead = (slot == SLOT_MASK) ? 0 : w->occupied[0] & (~0ull << (slot + 1));
+        uint32_t step = (ahead ? __builtin_ctzll(ahead) : TIMER_WHEEL_SLOTS) - slot;
+        if ((int32_t)(now - w->current) < (int32_t)step) {
+            w->current = now + 1;
+            break;
+        }
+        w->current += step;
+    }
+    *tail = NULL;
+    return due;
+}
+
+
+/**
+ * @brief Returns the ticks until the next timer is due. That is the level 0
+ *        slot next holding timers or, if it comes first, the earliest timer
+ *        in the upper slots next cascaded; advancing cascades every slot it
+ *        passes, so the wheel need not be woken for cascades as such.
+ *
+ * @return Ticks from now, 0 if due, -1 if no timer is pending.
+ */
+int32_t timer_wheel_next(const timer_wheel_t *w, uint32_t now)
+{
+    if (w->count == 0) {
+        return -1;
+    }
+    uint32_t ahead = SPAN;                  // Ticks from current
+    unsigned slot = w->current & SLOT_MASK;
+    uint64_t occupied = w->occupied[0];
+    if (occupied != 0) {
+        uint64_t rotated = (slot == 0) ? occupied : (occupied >> slot) | (occupied << (TIMER_WHEEL_SLOTS - slot));
+        ahead = __builtin_ctzll(rotated);
+    }
+
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = TIMER_WHEEL_BITS * level;
+        // Slots in the order they are cascaded: the current one first only
+        // if the wheel is at its start, else last, when it comes round
+        uint32_t first = (w->current >> shift) + ((w->current & ((1u << shift) - 1)) != 0);
+        slot = first & SLOT_MASK;
+        occupied = w->occupied[level];
+        uint64_t rotated = (slot == 0) ? occupied : (occupied >> slot) | (occupied << (TIMER_WHEEL_SLOTS - slot));
+        while (rotated != 0) {
+            int k = __builtin_ctzll(rotated);
+            rotated &= rotated - 1;
+            uint32_t start = ((first + k) << shift) - w->current;
+            if (start >= ahead) {
+                break;                      // Nothing in this level due sooner
+            }
+            // The earliest timer of the slot; if all were held back from
+            // beyond the wheel's span, the next slot may have an earlier one
+            bool in_slot = false;
+            for (const wheel_timer_t *t = w->slots[level][(first + k) & SLOT_MASK]; t != NULL; t = t->next) {
+                uint32_t d = t->expires - w->current;
+                ahead = (d < ahead) ? d : ahead;
+                in_slot |= d < start + (1u << shift);
+            }
+            if (in_slot) {
+                break;
+            }
+        }
+    }
+    int32_t d = (int32_t)(w->current + ahead - now);
+    return (d < 0) ? 0 : d;
+}
@@ -0,0 +1,73 @@
+/*
+ * timer_wheel.h
+ *
+ * Hierarchical timing wheel: three levels of 64 slots, 1, 64 and 4096
+ * ticks wide, so timers up to 2^18 ticks out (about 4.4 minutes at 1 ms)
+ * are held without sorting. Adding and removing a timer are O(1); moving
+ * the wheel forward visits only the slots that hold timers, found from a
+ * bitmap per level, and a timer is moved down a level at most twice on its
+ * way to expiry. Timers further out wait in the last slot and are placed
+ * again each time it comes round.
+ *
+ * Timers are embedded in their owners and never allocated here.
+ *
+ * This module has no ESP-IDF dependencies so it can be exercised on a
+ * Linux host.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS        6           // Slots per level, as a power of two
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS      3
+
+
+// A timer, embedded in its owner
+typedef struct wheel_timer {
+    struct wheel_timer  *next;
+    struct wheel_timer  **pprev;            // Link pointing here, NULL when not pending
+    uint32_t            expires;            // Tick
+} wheel_timer_t;
+
+
+// The wheel
+typedef struct {
+    wheel_timer_t   *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t        occupied[TIMER_WHEEL_LEVELS];   // Bit per slot that holds timers
+    uint32_t        current;                // Next tick to process
+    int             count;                  // Timers pending
+} timer_wheel_t;
+
+
+// Functions
+void            timer_wheel_init(timer_wheel_t *w, uint32_t now);
+void            timer_wheel_add(timer_wheel_t *w, wheel_timer_t *t, uint32_t expires);
+void            timer_wheel_del(timer_wheel_t *w, wheel_timer_t *t);
+wheel_timer_t  *timer_wheel_advance(timer_wheel_t *w, uint32_t now);
+int32_t         timer_wheel_next(const timer_wheel_t *w, uint32_t now);
+
+
+/**
+ * @brief Tells whether a timer is on the wheel.
+ */
+static inline bool timer_wheel_pending(const wheel_timer_t *t)
+{
+    return t->pprev != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
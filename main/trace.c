@@ -0,0 +1,88 @@
+/*
+ * trace.c
+ *
+ * This file implements the trace ring. Recording is a few stores under a
+ * spinlock and runs from IRAM, so the flash stall hooks can record a window
+ * without waiting on a cache refill. When the ring is full the oldest spans
+ * are overwritten.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include "trace.h"
+
+
+#define TRACE_RING_SIZE     CONFIG_TRACE_RING_SIZE
+
+
+// Local variables
+static DRAM_ATTR trace_event_t  ring[TRACE_RING_SIZE];
+static DRAM_ATTR uint32_t       ring_next;      // Total spans recorded
+static portMUX_TYPE             s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+/**
+ * @brief Records a completed span.
+ *
+ * @param kind     Track of the span.
+ * @param start_us esp_timer_get_time() when it started.
+ * @param dur_us   Duration.
+ * @param detail   Kind specific detail, see trace_kind_t.
+ * @param stall_us Flash cache-disabled time that overlapped the span.
+ */
+void IRAM_ATTR trace_span(trace_kind_t kind, int64_t start_us, uint32_t dur_us, uint16_t detail, uint32_t stall_us)
+{
+    portENTER_CRITICAL_SAFE(&s_lock);
+    trace_event_t *e = &ring[ring_next++ % TRACE_RING_SIZE];
+    e->start_us = start_us;
+    e->dur_us = dur_us;
+    e->stall_us = stall_us;
+    e->detail = detail;
+    e->kind = kind;
+    portEXIT_CRITICAL_SAFE(&s_lock);
+}
+
+
+/**
+ * @brief Copies the recorded spans, oldest first.
+ *
+ * @param events Receives the spans.
+ * @param max    Capacity of events.
+ *
+ * @return Number of spans copied.
+ */
+size_t trace_snapshot(trace_event_t *events, size_t max)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint32_t total = ring_next;
+    size_t count = (total < TRACE_RING_SIZE) ? total : TRACE_RING_SIZE;
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        events[i] = ring[(total - count + i) % TRACE_RING_SIZE];
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return count;
+}
+
+
+/**
+ * @brief Returns the track name of a kind as used in /debug/trace.
+ */
+const char *trace_kind_name(trace_kind_t kind)
+{
+    switch (kind) {
+        case TRACE_HTTP:    return "httpd";
+        case TRACE_DNS:     return "dns";
+        case TRACE_FLASH:   return "flash";
+        case TRACE_SHED:    return "shed";
+        case TRACE_DHCP:    return "dhcp";
+        default:            return "unknown";
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * trace.h
+ *
+ * Trace recorder: a ring of the most recent timed spans (HTTP requests, DNS
+ * replies, DHCP exchanges, flash cache-disabled windows, load shedding) on
+ * one time base, so latency spikes can be lined up with what the device was
+ * doing at the time.
+ * Served as Chrome trace JSON at /debug/trace.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// What a span measures, one track per kind
+typedef enum {
+    TRACE_HTTP = 0,                         // URI handler, detail = handler index
+    TRACE_DNS,                              // Query answered, detail = 0
+    TRACE_FLASH,                            // Cache disabled, detail = flash_op_t
+    TRACE_SHED,                             // Load shedding, detail = shed_action_t, SHED_COUNT for the episode
+    TRACE_DHCP,                             // DHCP reply, detail = message type, ACKs span their exchange
+    TRACE_KIND_COUNT
+} trace_kind_t;
+
+
+// One span
+typedef struct {
+    int64_t     start_us;                   // esp_timer_get_time() at the start
+    uint32_t    dur_us;
+    uint32_t    stall_us;                   // Flash cache-disabled time within the span
+    uint16_t    detail;
+    uint8_t     kind;
+} trace_event_t;
+
+
+// Functions
+void        trace_span(trace_kind_t kind, int64_t start_us, uint32_t dur_us, uint16_t detail, uint32_t stall_us);
+size_t      trace_snapshot(trace_event_t *events, size_t max);
+const char *trace_kind_name(trace_kind_t kind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
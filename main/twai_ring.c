@@ -0,0 +1,344 @@
+/*
+ * twai_ring.c
+ *
+ * This file runs the TWAI controller for the receive ring described in
+ * twai_ring.h. The TWAI driver of ESP-IDF 5.3 has no receive callback: its
+ * interrupt copies every frame into a FreeRTOS queue, and the reader copies
+ * it out again, waking for each frame that arrives while it waits. Here the
+ * interrupt, set up as the driver sets up its own, reads the controller's
+ * FIFO through the HAL and decodes each NMEA 2000 frame into its ring slot;
+ * the NMEA task dispatches it from there.
+ *
+ * Transmission keeps the driver's scheme: a frame goes straight into the
+ * controller if it is idle, otherwise into a queue the interrupt loads
+ * from as each frame completes. The queue is shared by the NMEA task and
+ * the esp_timer task, so it is under a spinlock, as are the HAL calls.
+ *
+ * Bus-off is recovered the driver's way too: twai_ring_check_bus(), called
+ * when the bus has been quiet, starts the recovery and restarts the
+ * controller once it is done.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_clk_tree.h"
+#include "esp_intr_alloc.h"
+#include "esp_log.h"
+#include "esp_rom_gpio.h"
+#include "esp_timer.h"
+#include "esp_private/periph_ctrl.h"
+#include "hal/twai_hal.h"
+#include "soc/gpio_sig_map.h"
+#include "sdkconfig.h"
+#include "twai_ring.h"
+
+
+#if CONFIG_NMEA_RX_RING
+
+#define INTERRUPTS      0xE7                // All but data overrun and BRP divide, as the driver
+
+
+// Local variables
+static const char           *TAG = "twai_ring";
+static twai_hal_context_t   hal;
+static intr_handle_t        intr;
+static portMUX_TYPE         s_lock = portMUX_INITIALIZER_UNLOCKED;
+static can_ring_t           *rx_ring;
+static TaskHandle_t         consumer;
+static uint32_t             consumer_bits;
+static n2k_frame_t          tx_queue[TWAI_RING_TX_LEN];
+static uint32_t             tx_head;
+static twai_ring_status_t   st;
+
+
+/**
+ * @brief Loads the next queued frame into the controller and starts it.
+ *        Call with s_lock held and the transmit buffer free.
+ */
+static void load_tx(void)
+{
+    const n2k_frame_t *f = &tx_queue[tx_head];
+    twai_message_t m = { 0 };
+    m.extd = 1;
+    m.identifier = f->id;
+    m.data_length_code = f->len;
+    memcpy(m.data, f->data, f->len);
+
+    twai_hal_frame_t raw;
+    twai_hal_format_frame(&m, &raw);
+    twai_hal_set_tx_buffer_and_transmit(&hal, &raw);
+    tx_head = (tx_head + 1) % TWAI_RING_TX_LEN;
+    st.tx_queued--;
+}
+
+
+/**
+ * @brief Reads the frames in the controller's FIFO into the ring. Call
+ *        with s_lock held.
+ *
+ * @return Whether the ring was empty before them.
+ */
+static bool receive_frames(void)
+{
+    bool was_empty = false;
+    uint32_t count = twai_hal_get_rx_msg_count(&hal);
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    for (uint32_t i = 0; i < count; i++) {
+        twai_hal_frame_t raw;
+        if (!twai_hal_read_rx_buffer_and_clear(&hal, &raw)) {
+            st.rx_overrun++;
+            continue;
+        }
+        twai_message_t m;
+        twai_hal_parse_frame(&raw, &m);
+        if (!m.extd || m.rtr) {
+            st.rx_other++;
+            continue;
+        }
+        n2k_frame_t *f = can_ring_slot(rx_ring);
+        if (f == NULL) {
+            continue;                       // Counted by the ring
+        }
+        f->id = m.identifier;
+        f->len = (m.data_length_code > 8) ? 8 : m.data_length_code;
+        f->time_ms = now_ms;
+        memcpy(f->data, m.data, 8);
+        was_empty |= can_ring_push(rx_ring);
+        st.rx_frames++;
+    }
+    return was_empty;
+}
+
+
+/**
+ * @brief Controller interrupt: frames received, frame sent, errors and
+ *        state changes.
+ */
+static void twai_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    TaskHandle_t task = NULL;
+
+    portENTER_CRITICAL_ISR(&s_lock);
+    uint32_t events = twai_hal_get_events(&hal);
+
+    if ((events & TWAI_HAL_EVENT_RX_BUFF_FRAME) && receive_frames() && consumer != NULL) {
+        task = consumer;
+        st.notifications++;
+    }
+    if (events & TWAI_HAL_EVENT_TX_BUFF_FREE) {
+        if (twai_hal_check_last_tx_successful(&hal)) {
+            st.tx_frames++;
+        } else {
+            st.tx_failed++;
+        }
+        if (st.tx_queued > 0 && st.state == TWAI_RING_RUNNING) {
+            load_tx();
+        }
+    }
+    if (events & TWAI_HAL_EVENT_BUS_ERR) {
+        st.bus_errors++;
+    }
+    if (events & TWAI_HAL_EVENT_ARB_LOST) {
+        st.arb_lost++;
+    }
+    if (events & TWAI_HAL_EVENT_BUS_OFF) {
+        st.state = TWAI_RING_BUS_OFF;
+        st.tx_queued = 0;                   // Dropped, as the driver does
+    }
+    if (events & TWAI_HAL_EVENT_BUS_RECOV_CPLT) {
+        st.state = TWAI_RING_STOPPED;
+    }
+    portEXIT_CRITICAL_ISR(&s_lock);
+
+    if (task != NULL) {
+        xTaskNotifyFromISR(task, consumer_bits, eSetBits, &woken);
+    }
+    if (woken == pdTRUE) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+
+/**
+ * @brief Starts the controller at 250 kbit/s, accepting all frames.
+ *
+ * @param tx_gpio   TX pin.
+ * @param rx_gpio   RX pin.
+ * @param ring      Where received frames go, initialised.
+ *
+ * @return ESP_OK, or the error.
+ */
+esp_err_t twai_ring_start(int tx_gpio, int rx_gpio, can_ring_t *ring)
+{
+    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_250KBITS();
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    uint32_t clock_hz = 0;
+
+    esp_err_t err = esp_clk_tree_src_get_freq_hz((soc_module_clk_t)t_config.clk_src,
+                                                 ESP_CLK_TREE_SRC_FREQ_PRECISION_CACHED, &clock_hz);
+    if (err != ESP_OK) {
+        return err;
+    }
+    rx_ring = ring;
+    periph_module_reset(PERIPH_TWAI_MODULE);
+    periph_module_enable(PERIPH_TWAI_MODULE);
+
+    twai_hal_config_t hal_config = { 0 };
+    hal_config.controller_id = 0;
+    hal_config.clock_source_hz = clock_hz;
+    if (!twai_hal_init(&hal, &hal_config)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    twai_hal_configure(&hal, &t_config, &f_config, INTERRUPTS, 0);
+
+    esp_rom_gpio_pad_select_gpio(tx_gpio);
+    gpio_set_direction((gpio_num_t)tx_gpio, GPIO_MODE_OUTPUT);
+    esp_rom_gpio_connect_out_signal(tx_gpio, TWAI_TX_IDX, false, false);
+    esp_rom_gpio_pad_select_gpio(rx_gpio);
+    gpio_set_direction((gpio_num_t)rx_gpio, GPIO_MODE_INPUT);
+    esp_rom_gpio_connect_in_signal(rx_gpio, TWAI_RX_IDX, false);
+
+    err = esp_intr_alloc(ETS_TWAI_INTR_SOURCE, 0, twai_isr, NULL, &intr);
+    if (err != ESP_OK) {
+        return err;
+    }
+    portENTER_CRITICAL(&s_lock);
+    twai_hal_start(&hal, TWAI_MODE_NORMAL);
+    st.state = TWAI_RING_RUNNING;
+    portEXIT_CRITICAL(&s_lock);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Sets the task notified when frames arrive in an empty ring. Frames
+ *        that arrive before it is set wait in the ring.
+ */
+void twai_ring_set_consumer(TaskHandle_t task, uint32_t notify_bits)
+{
+    portENTER_CRITICAL(&s_lock);
+    consumer = task;
+    consumer_bits = notify_bits;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Queues frames for transmission without waiting.
+ *
+ * @return The count taken, less than count when the queue is full, 0 when
+ *         the controller is not running.
+ */
+int twai_ring_transmit(const n2k_frame_t *frames, int count)
+{
+    int n = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    if (st.state == TWAI_RING_RUNNING) {
+        for (; n < count && st.tx_queued < TWAI_RING_TX_LEN; n++) {
+            tx_queue[(tx_head + st.tx_queued) % TWAI_RING_TX_LEN] = frames[n];
+            st.tx_queued++;
+        }
+        if (st.tx_queued > 0 && !twai_hal_check_state_flags(&hal, TWAI_HAL_STATE_FLAG_TX_BUFF_OCCUPIED)) {
+            load_tx();
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return n;
+}
+
+
+/**
+ * @brief Starts recovery after bus-off, and restarts the controller once
+ *        it has recovered.
+ */
+void twai_ring_check_bus(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    twai_ring_state_t state = st.state;
+    if (state == TWAI_RING_BUS_OFF) {
+        twai_hal_start_bus_recovery(&hal);
+        st.state = TWAI_RING_RECOVERING;
+    } else if (state == TWAI_RING_STOPPED) {
+        twai_hal_start(&hal, TWAI_MODE_NORMAL);
+        st.state = TWAI_RING_RUNNING;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (state == TWAI_RING_BUS_OFF) {
+        ESP_LOGW(TAG, "Bus off, recovering");
+    } else if (state == TWAI_RING_STOPPED) {
+        ESP_LOGI(TAG, "Recovered, restarting");
+    }
+}
+
+
+/**
+ * @brief Returns the state and counters.
+ */
+void twai_ring_get_status(twai_ring_status_t *status)
+{
+    portENTER_CRITICAL(&s_lock);
+    *status = st;
+    status->rx_missed = (rx_ring != NULL) ? rx_ring->dropped : 0;
+    status->tec = twai_hal_get_tec(&hal);
+    status->rec = twai_hal_get_rec(&hal);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+/**
+ * @brief Clears the counters, and those of the ring.
+ */
+void twai_ring_reset_stats(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    twai_ring_state_t state = st.state;
+    uint32_t queued = st.tx_queued;
+    memset(&st, 0, sizeof(st));
+    st.state = state;
+    st.tx_queued = queued;
+    if (rx_ring != NULL) {
+        rx_ring->dropped = 0;
+        rx_ring->max_used = 0;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+#else
+
+esp_err_t twai_ring_start(int tx_gpio, int rx_gpio, can_ring_t *ring)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void twai_ring_set_consumer(TaskHandle_t task, uint32_t notify_bits)
+{
+}
+
+int twai_ring_transmit(const n2k_frame_t *frames, int count)
+{
+    return 0;
+}
+
+void twai_ring_check_bus(void)
+{
+}
+
+void twai_ring_get_status(twai_ring_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+}
+
+void twai_ring_reset_stats(void)
+{
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * twai_ring.h
+ *
+ * TWAI controller run through the HAL instead of the TWAI driver, for the
+ * NMEA 2000 receive ring (CONFIG_NMEA_RX_RING). Its interrupt decodes
+ * received frames straight into a can_ring_t (can_ring.h) and notifies the
+ * consumer task only when the ring goes from empty to non-empty. Frames
+ * sent wait in a short queue that the interrupt loads into the controller
+ * one at a time.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef TWAI_RING_H
+#define TWAI_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "n2k_frame.h"
+#include "can_ring.h"
+
+#define TWAI_RING_TX_LEN        32          // Frames waiting to be sent
+
+
+// Controller state
+typedef enum {
+    TWAI_RING_STOPPED = 0,
+    TWAI_RING_RUNNING,
+    TWAI_RING_BUS_OFF,
+    TWAI_RING_RECOVERING,
+} twai_ring_state_t;
+
+
+// State and counters
+typedef struct {
+    twai_ring_state_t   state;
+    uint32_t            tec;                // Transmit error counter
+    uint32_t            rec;                // Receive error counter
+    uint32_t            rx_frames;          // Put in the ring
+    uint32_t            rx_missed;          // Ring full
+    uint32_t            rx_overrun;         // Lost in the controller's FIFO
+    uint32_t            rx_other;           // Standard-ID and remote frames, not NMEA 2000
+    uint32_t            notifications;      // Consumer woken, the ring having been empty
+    uint32_t            tx_frames;
+    uint32_t            tx_failed;
+    uint32_t            tx_queued;          // Waiting now
+    uint32_t            bus_errors;
+    uint32_t            arb_lost;
+} twai_ring_status_t;
+
+
+// Functions
+esp_err_t   twai_ring_start(int tx_gpio, int rx_gpio, can_ring_t *ring);
+void        twai_ring_set_consumer(TaskHandle_t task, uint32_t notify_bits);
+int         twai_ring_transmit(const n2k_frame_t *frames, int count);
+void        twai_ring_check_bus(void);
+void        twai_ring_get_status(twai_ring_status_t *status);
+void        twai_ring_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
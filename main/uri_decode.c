@@ -0,0 +1,225 @@
+/*
+ * uri_decode.c
+ *
+ * This file implements URL decoding: '+' becomes a space, %XX the byte it
+ * encodes, and malformed escapes are copied literally. Runs without escapes
+ * are found with kern_find_byte2() and copied as a block, escapes are
+ * decoded with a 256 entry table instead of isxdigit()/strtol().
+ *
+ * The streaming decoder keeps an escape split across chunks ("%" or "%X")
+ * in its state, so a body can be decoded as it arrives with results
+ * identical to decoding it in one piece.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <string.h>
+#include "kernels.h"
+#include "uri_decode.h"
+
+
+// Table entries are HEX_VALID | value for hex digits, 0 otherwise
+#define HEX_VALID       0x10
+#define HEX_VALUE(t)    ((t) & 0x0F)
+
+
+// Local variables
+static const uint8_t hex_table[256] = {
+    ['0'] = HEX_VALID | 0x0, ['1'] = HEX_VALID | 0x1, ['2'] = HEX_VALID | 0x2, ['3'] = HEX_VALID | 0x3,
+    ['4'] = HEX_VALID | 0x4, ['5'] = HEX_VALID | 0x5, ['6'] = HEX_VALID | 0x6, ['7'] = HEX_VALID | 0x7,
+    ['8'] = HEX_VALID | 0x8, ['9'] = HEX_VALID | 0x9,
+    ['A'] = HEX_VALID | 0xA, ['B'] = HEX_VALID | 0xB, ['C'] = HEX_VALID | 0xC,
+    ['D'] = HEX_VALID | 0xD, ['E'] = HEX_VALID | 0xE, ['F'] = HEX_VALID | 0xF,
+    ['a'] = HEX_VALID | 0xA, ['b'] = HEX_VALID | 0xB, ['c'] = HEX_VALID | 0xC,
+    ['d'] = HEX_VALID | 0xD, ['e'] = HEX_VALID | 0xE, ['f'] = HEX_VALID | 0xF,
+};
+
+
+/**
+ * @brief Resets a streaming decoder.
+ */
+void uri_decoder_init(uri_decoder_t *d)
+{
+    d->held_len = 0;
+}
+
+
+/**
+ * @brief Decodes the next chunk of a URL encoded stream.
+ *
+ * An escape at the end of the chunk is held back until the next call or
+ * uri_decoder_finish(). dst may equal src when nothing is held from an
+ * earlier chunk.
+ *
+ * @param d   Decoder state.
+ * @param dst Output, at least len + URI_DECODE_MAX_HELD bytes. Not NUL terminated.
+ * @param src Encoded input.
+ * @param len Length of the input.
+ *
+ * @return Number of bytes written to dst.
+ */
+size_t uri_decoder_feed(uri_decoder_t *d, char *dst, const char *src, size_t len)
+{
+    const char *end = src + len;
+    size_t out = 0;
+
+    // Complete an escape held back from the previous chunk
+    while (d->held_len > 0 && src < end) {
+        uint8_t t = hex_table[(uint8_t)*src];
+        if (!(t & HEX_VALID)) {
+            // Not an escape after all, *src is decoded normally below
+            memcpy(dst + out, d->held, d->held_len);
+            out += d->held_len;
+            d->held_len = 0;
+        } else if (d->held_len == 1) {
+            d->held[d->held_len++] = *src++;
+        } else {
+            dst[out++] = (char)((HEX_VALUE(hex_table[(uint8_t)d->held[1]]) << 4) | HEX_VALUE(t));
+            d->held_len = 0;
+            src++;
+        }
+    }
+
+    while (src < end) {
+        const char *hit = (const char *)kern_find_byte2((const uint8_t *)src, end - src, '%', '+');
+        size_t run = (hit ? hit : end) - src;
+        if (dst + out != src) {
+            memmove(dst + out, src, run);
+        }
+        out += run;
+        src += run;
+        if (hit == NULL) {
+            break;
+        }
+
+        if (*src == '+') {
+            dst[out++] = ' ';
+            src++;
+            continue;
+        }
+
+        if (end - src < 3) {
+            // An escape may continue in the next chunk
+            if (end - src == 1 || (hex_table[(uint8_t)src[1]] & HEX_VALID)) {
+                d->held_len = end - src;
+                memcpy(d->held, src, d->held_len);
+                break;
+            }
+            dst[out++] = *src++;
+            continue;
+        }
+
+        uint8_t hi = hex_table[(uint8_t)src[1]];
+        uint8_t lo = hex_table[(uint8_t)src[2]];
+        if (hi & lo & HEX_VALID) {
+            dst[out++] = (char)((HEX_VALUE(hi) << 4) | HEX_VALUE(lo));
+            src += 3;
+        } else {
+            dst[out++] = *src++;
+        }
+    }
+    return out;
+}
+
+
+/**
+ * @brief Ends a stream, copying an incomplete escape literally.
+ *
+ * @param d   Decoder state.
+ * @param dst Output, at least URI_DECODE_MAX_HELD bytes.
+ *
+ * @return Number of bytes written to dst.
+ */
+size_t uri_decoder_finish(uri_decoder_t *d, char *dst)
+{
+    size_t n = d->held_len;
+    memcpy(dst, d->held, n);
+    d->held_len = 0;
+    return n;
+}
+
+
+/**
+ * @brief Returns the exact length of the decoded form of src.
+ */
+size_t uri_decoded_len(const char *src, size_t len)
+{
+    const char *end = src + len;
+    size_t out = len;
+
+    while (src < end) {
+        src = (const char *)kern_find_byte((const uint8_t *)src, end - src, '%');
+        if (src == NULL) {
+            break;
+        }
+        if (end - src >= 3 && (hex_table[(uint8_t)src[1]] & hex_table[(uint8_t)src[2]] & HEX_VALID)) {
+            out -= 2;
+            src += 3;
+        } else {
+            src++;
+        }
+    }
+    return out;
+}
+
+
+/**
+ * @brief Decodes a complete URL encoded string. dst may equal src.
+ *
+ * @param dst      Output buffer, NUL terminated on success.
+ * @param dst_size Size of the output buffer.
+ * @param src      Encoded input, need not be NUL terminated.
+ * @param len      Length of the input.
+ *
+ * @return Length of the decoded string, or -1 if it does not fit in dst.
+ */
+ssize_t uri_decode(char *dst, size_t dst_size, const char *src, size_t len)
+{
+    // Decoding never lengthens the input, so only count when it might not fit
+    if (len >= dst_size && uri_decoded_len(src, len) >= dst_size) {
+        return -1;
+    }
+
+    uri_decoder_t d;
+    uri_decoder_init(&d);
+    size_t n = uri_decoder_feed(&d, dst, src, len);
+    n += uri_decoder_finish(&d, dst + n);
+    dst[n] = '\0';
+    return n;
+}
+
+
+/**
+ * @brief Finds a field in a URL encoded form body and decodes its value.
+ *
+ * @param body  Form body, need not be NUL terminated.
+ * @param len   Length of the body.
+ * @param key   Field name, compared without decoding.
+ * @param value Receives the decoded, NUL terminated value.
+ * @param size  Size of the value buffer.
+ *
+ * @return Length of the value, or -1 if the field is missing or too long.
+ */
+ssize_t form_value(const char *body, size_t len, const char *key, char *value, size_t size)
+{
+    const char *end = body + len;
+    size_t key_len = strlen(key);
+
+    while (body < end) {
+        const char *amp = (const char *)kern_find_byte((const uint8_t *)body, end - body, '&');
+        const char *field_end = amp ? amp : end;
+        size_t field_len = field_end - body;
+
+        if (field_len >= key_len && memcmp(body, key, key_len) == 0) {
+            if (field_len == key_len) {
+                return uri_decode(value, size, field_end, 0);
+            }
+            if (body[key_len] == '=') {
+                return uri_decode(value, size, body + key_len + 1, field_len - key_len - 1);
+            }
+        }
+        body = field_end + 1;
+    }
+    return -1;
+}
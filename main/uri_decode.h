@@ -0,0 +1,46 @@
+/*
+ * uri_decode.h
+ *
+ * Decoding of URL encoded (application/x-www-form-urlencoded) text, either
+ * in one call or streamed in arbitrary chunks, and lookup of form fields.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef URI_DECODE_H
+#define URI_DECODE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+// An escape split across chunks is held back, at most "%X"
+#define URI_DECODE_MAX_HELD     2
+
+
+// Streaming decoder state
+typedef struct {
+    uint8_t     held_len;
+    char        held[URI_DECODE_MAX_HELD];
+} uri_decoder_t;
+
+
+// Functions
+void    uri_decoder_init(uri_decoder_t *d);
+size_t  uri_decoder_feed(uri_decoder_t *d, char *dst, const char *src, size_t len);
+size_t  uri_decoder_finish(uri_decoder_t *d, char *dst);
+size_t  uri_decoded_len(const char *src, size_t len);
+ssize_t uri_decode(char *dst, size_t dst_size, const char *src, size_t len);
+ssize_t form_value(const char *body, size_t len, const char *key, char *value, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
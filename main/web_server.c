@@ -14,67 +14,72 @@
 #include "esp_app_desc.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
 #include "esp_private/system_internal.h"
 #include "dns_server.h"
 #include "settings.h"
-#include <ctype.h>
+#include "debug_flags.h"
+#include "ota_writer.h"
+#include "ota_relay.h"
+#include "image_catalog.h"
+#include "ota_stats.h"
+#include "ota_session.h"
+#include "uri_decode.h"
+#include "perf_lock.h"
+#include "flash_stall.h"
+#include "trace.h"
+#include "profiler.h"
+#include "alloc_guard.h"
+#include "stack_usage.h"
+#include "load_shed.h"
+#include "join_kpi.h"
+#include "dhcp_server.h"
+#include "lwip/sockets.h"
+#include <string.h>
+
+
+#define API_INFO_MAX_LEN    2048
+#define ROOT_PAGE_MAX_LEN   1024
+#define FW_PAGE_MAX_LEN     2048
+#define MAX_URI_HANDLERS    32
+#define REBOOT_STACK_SIZE   CONFIG_STACK_SIZE_REBOOT
+#define TRACE_404           0xFFFF          // Trace detail of the captive portal redirect
+
+
+// URI handler run with the clock held at the maximum and traced
+typedef struct {
+    esp_err_t   (*handler)(httpd_req_t *req);
+    void        *user_ctx;
+    const char  *uri;
+    int         method;
+} locked_handler_t;
 
 
 // Local variables
 static const char       *TAG = "web";
 static httpd_handle_t   server;             // <-- Your HTTP server handle
+static locked_handler_t locked_handlers[MAX_URI_HANDLERS];
+static int              locked_handler_count;
+static char             root_page[ROOT_PAGE_MAX_LEN];
+static size_t           root_page_len;
+static char             firmware_page[FW_PAGE_MAX_LEN];
+static size_t           firmware_page_len;
+
+// Settings posted while shedding load, committed when it ends
+static struct {
+    bool            serial_set;
+    unsigned long   serial;
+    bool            relay_set;
+    char            relay[128];
+} deferred_settings;
 
 
 // Local function prototypes
 extern const char *get_ssid(void);
 
 
-/**
- * @brief Decodes a percent-encoded URI into its original form.
- *
- * This function takes a percent-encoded URI string (e.g., "%20" for a space)
- * and decodes it into its original form, storing the result in the provided
- * destination buffer. It ensures that the decoded string fits within the
- * specified destination buffer size.
- *
- * @param[out] dest       Pointer to the destination buffer where the decoded
- *                        URI will be stored.
- * @param[in]  src        Pointer to the source string containing the
- *                        percent-encoded URI.
- * @param[in]  dest_size  Size of the destination buffer in bytes.
- *
- * @return The number of bytes written to the destination buffer (excluding
- *         the null terminator) on success, or a negative value if an error
- *         occurs (e.g., if the destination buffer is too small or the input
- *         URI is invalid).
- *
- * @note The destination buffer must be large enough to hold the decoded URI
- *       and a null terminator. If the buffer is too small, the function will
- *       return an error.
- *
- * @note This function is commonly used in HTTP servers to decode URIs
- *       received in HTTP requests.
- */
-ssize_t httpd_unescape_uri(char *dest, const char *src, size_t dest_size)
-{
-    size_t si = 0, di = 0;
-    while (src[si] && di < dest_size - 1) {
-        if (src[si] == '%' && isxdigit((unsigned char)src[si+1]) && isxdigit((unsigned char)src[si+2])) {
-            char hex[3] = { src[si+1], src[si+2], 0 };
-            dest[di++] = (char) strtol(hex, NULL, 16);
-            si += 3;
-        } else if (src[si] == '+') {
-            dest[di++] = ' ';
-            si++;
-        } else {
-            dest[di++] = src[si++];
-        }
-    }
-    dest[di] = '\0';
-    return di;
-}
-
-
 /**
  * @brief Task function to handle system reboot operations.
  *
@@ -85,7 +90,7 @@ ssize_t httpd_unescape_uri(char *dest, const char *src, size_t dest_size)
  * @param param A pointer to a parameter passed to the task. The type and purpose
  *              of this parameter depend on the specific use case.
  */
-void reboot_task(void *param)
+static void reboot_task(void *param)
 {
     vTaskDelay(pdMS_TO_TICKS(500));  // Let HTTP finish
 
@@ -97,6 +102,9 @@ void reboot_task(void *param)
     esp_wifi_stop();
     vTaskDelay(pdMS_TO_TICKS(500));
 
+    // Keep the stack marks of this boot for /debug/stacks after the restart
+    stack_usage_save();
+
 #if 1
     // Most direct software reboot possible
     esp_restart_noos();
@@ -112,23 +120,42 @@ void reboot_task(void *param)
 
 
 /**
- * @brief Handles HTTP GET requests for the root URI.
- *
- * This function serves as the handler for the root URI ("/") of the web server.
- * It provides a simple HTML page displaying basic information and links to
- * the /firmware and /settings pages.
- *
- * @param req Pointer to the HTTP request structure containing details about the request.
- *
- * @return
- *     - ESP_OK: If the request was successfully handled.
- *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ * @brief Starts reboot_task. Only the first request of a boot has an
+ *        effect, so it is safe to call from any transport.
  */
-static esp_err_t root_get_handler(httpd_req_t *req)
+void request_reboot(void)
+{
+    static portMUX_TYPE requested_lock = portMUX_INITIALIZER_UNLOCKED;
+    static bool requested;
+
+    portENTER_CRITICAL(&requested_lock);
+    bool first = !requested;
+    requested = true;
+    portEXIT_CRITICAL(&requested_lock);
+    if (!first) {
+        return;
+    }
+
+#if CONFIG_STATIC_ALLOCATION
+    static StaticTask_t reboot_tcb;
+    static StackType_t  reboot_stack[REBOOT_STACK_SIZE];
+    xTaskCreateStatic(reboot_task, "reboot_task", REBOOT_STACK_SIZE, NULL, configMAX_PRIORITIES-1, reboot_stack, &reboot_tcb);
+#else
+    xTaskCreate(reboot_task, "reboot_task", REBOOT_STACK_SIZE, NULL, configMAX_PRIORITIES-1, NULL);
+#endif
+}
+
+
+/**
+ * @brief Renders the root and /firmware pages. Their content only depends
+ *        on the running image, so they are built once at start up and the
+ *        GET handlers send them without allocating.
+ */
+static void render_pages(void)
 {
-    char html_response[1024];
-    const esp_app_desc_t *running_app_info = esp_app_get_description();
-    snprintf(html_response, sizeof(html_response),  
+    const esp_app_desc_t *app_info = esp_app_get_description();
+
+    root_page_len = snprintf(root_page, sizeof(root_page),
         "<html>"
         "<head>"
         "<title>Demo Web Server</title>"
@@ -149,35 +176,9 @@ static esp_err_t root_get_handler(httpd_req_t *req)
         "<button onclick=\"location.href='/reboot'\">Reboot Device</button>"
         "</body>"
         "</html>",
-        running_app_info->version, running_app_info->date, running_app_info->time);
-
-    httpd_resp_send(req, html_response, HTTPD_RESP_USE_STRLEN);
-    return ESP_OK;
-}
+        app_info->version, app_info->date, app_info->time);
 
-
-/**
- * @brief Handles HTTP GET requests for the /firmware URI.
- *
- * This function is a callback for processing HTTP GET requests directed to the root
- * endpoint of the web server. It is responsible for generating and sending the appropriate
- * response to the client.
- *
- * @param req Pointer to the HTTP request structure containing details about the request.
- * 
- * @return 
- *     - ESP_OK: If the request was successfully handled.
- *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
- */
-static esp_err_t firmware_get_handler(httpd_req_t *req)
-{
-    const esp_app_desc_t *app_info = esp_app_get_description();
-    char *resp = malloc(2048);
-    if (resp == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for response");
-        return ESP_FAIL;
-    }
-    snprintf(resp, 2048,
+    firmware_page_len = snprintf(firmware_page, sizeof(firmware_page),
         "<html><head>"
         "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">"
         "<style>"
@@ -230,163 +231,1112 @@ static esp_err_t firmware_get_handler(httpd_req_t *req)
         "</body></html>",
         app_info->version, app_info->project_name, app_info->date, app_info->time);
 
-    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
-    free(resp);
+    if (root_page_len >= sizeof(root_page) || firmware_page_len >= sizeof(firmware_page)) {
+        ESP_LOGE(TAG, "Page truncated");
+        root_page_len = strnlen(root_page, sizeof(root_page) - 1);
+        firmware_page_len = strnlen(firmware_page, sizeof(firmware_page) - 1);
+    }
+}
+
+
+/**
+ * @brief Sends a page rendered by render_pages(), under the allocation guard.
+ */
+static esp_err_t send_cached_page(httpd_req_t *req, const char *page, size_t len)
+{
+    alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_HTTP_GET);
+    httpd_resp_send(req, page, len);
+    alloc_guard_exit(guard);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Answers a request shed under load with 503 and Retry-After.
+ */
+static esp_err_t send_shed(httpd_req_t *req, const char *text)
+{
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", load_shed_retry_after());
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr(req, text);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Returns the IPv4 address of the client in network order, 0 if
+ *        unknown. The server socket is IPv6, so IPv4 clients show up as
+ *        mapped addresses.
+ */
+static uint32_t client_ip(httpd_req_t *req)
+{
+    struct sockaddr_in6 addr;
+    socklen_t len = sizeof(addr);
+    uint32_t ip = 0;
+    if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &len) != 0) {
+        return 0;
+    }
+    if (addr.sin6_family == AF_INET) {
+        ip = ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+    } else if (addr.sin6_family == AF_INET6 && addr.sin6_addr.un.u32_addr[0] == 0 &&
+               addr.sin6_addr.un.u32_addr[1] == 0 && addr.sin6_addr.un.u32_addr[2] == htonl(0xFFFF)) {
+        ip = addr.sin6_addr.un.u32_addr[3];
+    }
+    return ip;
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the root URI.
+ *
+ * This function serves as the handler for the root URI ("/") of the web server.
+ * It provides a simple HTML page displaying basic information and links to
+ * the /firmware and /settings pages.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t root_get_handler(httpd_req_t *req)
+{
+    send_cached_page(req, root_page, root_page_len);
+
+    // The portal page has rendered, the last milestone of a join
+    if (join_kpi_waiting()) {
+        join_kpi_mark(JOIN_PORTAL, client_ip(req), esp_timer_get_time());
+    }
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the /firmware URI.
+ *
+ * This function is a callback for processing HTTP GET requests directed to the root
+ * endpoint of the web server. It is responsible for generating and sending the appropriate
+ * response to the client.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ * 
+ * @return 
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t firmware_get_handler(httpd_req_t *req)
+{
+    return send_cached_page(req, firmware_page, firmware_page_len);
+}
+
+
+/**
+ * @brief Handles HTTP POST and PUT requests for file uploads.
+ *
+ * This function processes incoming upload requests. A multipart/form-data
+ * body (as sent by the /firmware page) is unwrapped by the OTA session, any
+ * other content type is taken to be the raw image.
+ *
+ * @param req Pointer to the HTTP request structure containing details
+ *            about the incoming request.
+ *
+ * @return
+ *         - ESP_OK on successful handling of the request.
+ *         - Appropriate error code (esp_err_t) on failure.
+ */
+static esp_err_t upload_post_handler(httpd_req_t *req)
+{
+    if (req == NULL) {
+        ESP_LOGE(TAG, "Request is NULL");
+        return ESP_FAIL;
+    }
+
+    // Refused before any of the body is read; failing closes the connection
+    if (load_shed(SHED_UPLOAD)) {
+        httpd_resp_set_hdr(req, "Connection", "close");
+        send_shed(req, "Busy, retry later");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Received firmware upload request");
+    ESP_LOGI(TAG, "Content Length: %d", req->content_len);
+    ESP_LOGI(TAG, "URI: %s", req->uri);
+    ESP_LOGI(TAG, "Method: %d", req->method);
+    ESP_LOGI(TAG, "User Context: %p", req->user_ctx);
+
+    char content_type[128] = "";
+    char boundary[OTA_SESSION_MAX_BOUNDARY + 1];
+    char hops_str[8] = "";
+    httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type));
+    httpd_req_get_hdr_value_str(req, OTA_RELAY_HOPS_HEADER, hops_str, sizeof(hops_str));
+
+    // Forward the raw request body to any downstream units while we flash
+    bool multipart = ota_session_multipart_boundary(content_type, boundary, sizeof(boundary));
+    ota_session_config_t config = {
+        .format       = multipart ? OTA_SESSION_MULTIPART : OTA_SESSION_RAW,
+        .boundary     = boundary,
+        .content_len  = req->content_len,
+        .path         = OTA_PATH_HTTPD,
+        .relay        = true,
+        .content_type = content_type,
+        .hops         = atoi(hops_str),
+    };
+    ota_session_t *session = malloc(sizeof(ota_session_t));
+    if (session == NULL || ota_session_open(session, &config) != ESP_OK) {
+        free(session);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot start OTA update");
+        return ESP_FAIL;
+    }
+
+    char buf[1024];
+    ota_session_status_t status = OTA_SESSION_MORE;
+    while (status == OTA_SESSION_MORE) {
+        int bytes_read = httpd_req_recv(req, buf, sizeof(buf));
+        if (bytes_read <= 0) {
+            ESP_LOGE(TAG, "Error receiving file");
+            break;
+        }
+        status = ota_session_push(session, buf, bytes_read);
+    }
+
+    // Downstream units must have the whole image before we reboot
+    esp_err_t err = ota_session_finish(session);
+    int relay_peers = session->relay_peers;
+    int relayed = session->relayed;
+    free(session);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload failed");
+        return ESP_FAIL;
+    }
+
+    if (relay_peers > 0) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "Upload successful, relayed to %d of %d units! Rebooting...", relayed, relay_peers);
+        httpd_resp_sendstr(req, msg);
+    } else {
+        httpd_resp_sendstr(req, "Upload successful! Rebooting...");
+    }
+
+    // Schedule a task to reboot the system
+    ESP_LOGI(TAG, "OTA Update Successful. Shutting down HTTP server...");
+    request_reboot();
+
+    return ESP_OK;
+}
+
+
+#if CONFIG_HTTPD_WS_SUPPORT
+
+#define WS_UPLOAD_MAX_FRAME     8192
+
+
+// Upload state of one websocket connection
+typedef struct {
+    ota_session_t   session;
+    bool            open;
+} ws_upload_t;
+
+
+/**
+ * @brief Frees the upload state when the websocket connection closes.
+ */
+static void ws_upload_free(void *ctx)
+{
+    ws_upload_t *upload = ctx;
+    if (upload->open) {
+        ota_session_abort(&upload->session);
+    }
+    free(upload);
+}
+
+
+/**
+ * @brief Sends a text frame on the websocket.
+ */
+static esp_err_t ws_reply(httpd_req_t *req, const char *text)
+{
+    httpd_ws_frame_t frame = {
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)text,
+        .len = strlen(text),
+    };
+    return httpd_ws_send_frame(req, &frame);
+}
+
+
+/**
+ * @brief Handles the /ws/upload websocket.
+ *
+ * The client sends a text frame "begin <size>" (size may be 0 if unknown),
+ * then the image in binary frames, then "end". The device answers "ready",
+ * and "done" or "error <reason>". Every frame is handled as it arrives, so
+ * the server task is never held by a slow upload and several connections
+ * are serviced by the same task.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the frame was successfully handled.
+ *     - Appropriate error code (esp_err_t): If the connection should be closed.
+ */
+static esp_err_t ws_upload_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET) {
+        return ESP_OK;                  // Handshake done
+    }
+
+    httpd_ws_frame_t frame = { 0 };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame.len > WS_UPLOAD_MAX_FRAME) {
+        ws_reply(req, "error frame too large");
+        return ESP_FAIL;
+    }
+
+    uint8_t *buf = malloc(frame.len + 1);
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    frame.payload = buf;
+    err = httpd_ws_recv_frame(req, &frame, frame.len);
+    if (err != ESP_OK) {
+        free(buf);
+        return err;
+    }
+    buf[frame.len] = '\0';
+
+    ws_upload_t *upload = req->sess_ctx;
+    if (upload == NULL) {
+        upload = calloc(1, sizeof(ws_upload_t));
+        if (upload == NULL) {
+            free(buf);
+            return ESP_ERR_NO_MEM;
+        }
+        req->sess_ctx = upload;
+        req->free_ctx = ws_upload_free;
+    }
+
+    if (frame.type == HTTPD_WS_TYPE_BINARY) {
+        if (!upload->open) {
+            err = ws_reply(req, "error no upload in progress");
+        } else if (ota_session_push(&upload->session, buf, frame.len) == OTA_SESSION_FAILED) {
+            upload->open = false;
+            err = ws_reply(req, "error write failed");
+        }
+    } else if (frame.type == HTTPD_WS_TYPE_TEXT && strncmp((char *)buf, "begin", 5) == 0) {
+        if (upload->open) {
+            ota_session_abort(&upload->session);
+            upload->open = false;
+        }
+        if (load_shed(SHED_UPLOAD)) {
+            char msg[40];
+            snprintf(msg, sizeof(msg), "error busy, retry after %s s", load_shed_retry_after());
+            free(buf);
+            return ws_reply(req, msg);
+        }
+        ota_session_config_t config = {
+            .format       = OTA_SESSION_RAW,
+            .content_len  = strtoul((char *)buf + 5, NULL, 10),
+            .path         = OTA_PATH_WEBSOCKET,
+            .relay        = true,
+            .content_type = "application/octet-stream",
+        };
+        upload->open = (ota_session_open(&upload->session, &config) == ESP_OK);
+        err = ws_reply(req, upload->open ? "ready" : "error busy");
+    } else if (frame.type == HTTPD_WS_TYPE_TEXT && strcmp((char *)buf, "end") == 0) {
+        bool ok = upload->open && ota_session_finish(&upload->session) == ESP_OK;
+        upload->open = false;
+        err = ws_reply(req, ok ? "done" : "error upload failed");
+        if (ok) {
+            ESP_LOGI(TAG, "OTA Update Successful. Rebooting...");
+            request_reboot();
+        }
+    }
+
+    free(buf);
+    return err;
+}
+
+#endif
+
+
+/**
+ * @brief Handles HTTP GET requests for the /api/info URI.
+ *
+ * Returns a small JSON document describing the running firmware and the
+ * state of the unit. Host side tools (tools/fleet_update.py) use it to build
+ * a device inventory and to skip units that already run a given image.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t api_info_get_handler(httpd_req_t *req)
+{
+    const esp_app_desc_t *app_info = esp_app_get_description();
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+
+    char sha256[65];
+    for (int i = 0; i < 32; i++) {
+        snprintf(&sha256[i * 2], 3, "%02x", app_info->app_elf_sha256[i]);
+    }
+
+    // Shedding load: what the fleet tools poll for, without the heap buffer
+    if (load_shed(SHED_PAGE)) {
+        char json[320];
+        snprintf(json, sizeof(json),
+                 "{\"project\":\"%s\",\"version\":\"%s\",\"sha256\":\"%s\",\"free_heap\":%lu,"
+                 "\"uptime_ms\":%lld,\"ota_busy\":%s,\"shed\":true}",
+                 app_info->project_name, app_info->version, sha256, (unsigned long)esp_get_free_heap_size(),
+                 esp_timer_get_time() / 1000, ota_writer_busy() ? "true" : "false");
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+        httpd_resp_sendstr(req, json);
+        return ESP_OK;
+    }
+
+    uint8_t mac[6];
+    esp_efuse_mac_get_default(mac);
+
+    uint8_t channel = 0;
+    wifi_second_chan_t second;
+    esp_wifi_get_channel(&channel, &second);
+
+    char relay[128];
+    get_relay_peers(relay, sizeof(relay));
+
+    char *json = malloc(API_INFO_MAX_LEN);
+    if (json == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for response");
+        return ESP_FAIL;
+    }
+
+    int len = snprintf(json, API_INFO_MAX_LEN,
+        "{"
+        "\"project\":\"%s\","
+        "\"version\":\"%s\","
+        "\"idf\":\"%s\","
+        "\"date\":\"%s\","
+        "\"time\":\"%s\","
+        "\"sha256\":\"%s\","
+        "\"running\":\"%s\","
+        "\"next\":\"%s\","
+        "\"ssid\":\"%s\","
+        "\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\","
+        "\"channel\":%u,"
+        "\"serial\":%lu,"
+        "\"free_heap\":%lu,"
+        "\"uptime_ms\":%lld,"
+        "\"ota_busy\":%s,"
+        "\"relay_peers\":\"%s\","
+        "\"ota_port\":%d,"
+        "\"caps\":[\"upload\",\"put\",\"serial\",\"pull\",\"relay\",\"catalog\",\"pm\"%s%s],"
+        "\"images\":[",
+        app_info->project_name, app_info->version, app_info->idf_ver, app_info->date, app_info->time, sha256,
+        running ? running->label : "", next ? next->label : "", get_ssid(),
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], channel,
+        (unsigned long)get_serial_nbr(), (unsigned long)esp_get_free_heap_size(),
+        esp_timer_get_time() / 1000, ota_writer_busy() ? "true" : "false", relay,
+#if CONFIG_NETCONN_OTA_ENABLE
+        CONFIG_NETCONN_OTA_PORT, ",\"netconn\"",
+#else
+        0, "",
+#endif
+#if CONFIG_HTTPD_WS_SUPPORT
+        ",\"websocket\""
+#else
+        ""
+#endif
+        );
+
+    // Images that can be booted without a transfer
+    image_catalog_entry_t images[IMAGE_CATALOG_MAX_SLOTS];
+    int count = image_catalog_list(images, IMAGE_CATALOG_MAX_SLOTS);
+    for (int i = 0; i < count && len < API_INFO_MAX_LEN; i++) {
+        if (!images[i].valid) {
+            continue;
+        }
+        for (int b = 0; b < 32; b++) {
+            snprintf(&sha256[b * 2], 3, "%02x", images[i].elf_sha256[b]);
+        }
+        len += snprintf(json + len, API_INFO_MAX_LEN - len, "%s{\"slot\":\"%s\",\"version\":\"%s\",\"sha256\":\"%s\"}",
+                        (json[len - 1] == '[') ? "" : ",", images[i].partition->label, images[i].version, sha256);
+    }
+    if (len < API_INFO_MAX_LEN) {
+        snprintf(json + len, API_INFO_MAX_LEN - len, "]}");
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr(req, json);
+    free(json);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the /api/ota_stats URI.
+ *
+ * Returns the cost of the last completed transfer on each OTA receive path:
+ * wall time, and CPU time of the receiving task per megabyte, split into
+ * flash writes and everything else (network stack, copies, parsing).
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t api_ota_stats_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, "{");
+    for (ota_path_t path = 0; path < OTA_PATH_COUNT; path++) {
+        char entry[224];
+        ota_stats_t stats;
+        if (!ota_stats_get(path, &stats)) {
+            snprintf(entry, sizeof(entry), "%s\"%s\":null", path ? "," : "", ota_stats_path_name(path));
+        } else {
+            uint64_t mb_x100 = ((uint64_t)stats.bytes * 100) >> 20;
+            mb_x100 = mb_x100 ? mb_x100 : 1;
+            uint32_t recv_us = (stats.cpu_us > stats.write_us) ? stats.cpu_us - stats.write_us : 0;
+            snprintf(entry, sizeof(entry),
+                "%s\"%s\":{\"bytes\":%lu,\"wall_ms\":%lu,\"cpu_us_per_mb\":%lu,"
+                "\"flash_us_per_mb\":%lu,\"recv_us_per_mb\":%lu}",
+                path ? "," : "", ota_stats_path_name(path), (unsigned long)stats.bytes, (unsigned long)stats.wall_ms,
+                (unsigned long)(stats.cpu_us * 100ULL / mb_x100), (unsigned long)(stats.write_us * 100ULL / mb_x100),
+                (unsigned long)(recv_us * 100ULL / mb_x100));
+        }
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+    httpd_resp_sendstr_chunk(req, "}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the /api/pm URI.
+ *
+ * Returns the clock policy and, per performance lock, how often it was
+ * taken, how long the clock was held at the maximum and the slowest
+ * acquisition (the clock switch).
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t api_pm_get_handler(httpd_req_t *req)
+{
+    int min_mhz, max_mhz, cur_mhz;
+    perf_get_freq(&min_mhz, &max_mhz, &cur_mhz);
+
+    char entry[224];
+    snprintf(entry, sizeof(entry), "{\"mode\":\"%s\",\"min_mhz\":%d,\"max_mhz\":%d,\"cur_mhz\":%d,\"uptime_ms\":%lld,\"locks\":{",
+             perf_mode_name(perf_get_mode()), min_mhz, max_mhz, cur_mhz, esp_timer_get_time() / 1000);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, entry);
+    for (perf_lock_reason_t reason = 0; reason < PERF_LOCK_COUNT; reason++) {
+        perf_lock_stats_t st;
+        perf_lock_get_stats(reason, &st);
+        snprintf(entry, sizeof(entry),
+            "%s\"%s\":{\"acquired\":%lu,\"active\":%lu,\"held_us\":%llu,\"max_held_us\":%lu,"
+            "\"acquire_us\":%llu,\"max_acquire_us\":%lu}",
+            reason ? "," : "", perf_lock_name(reason), (unsigned long)st.acquired, (unsigned long)st.active,
+            (unsigned long long)st.held_us, (unsigned long)st.max_held_us,
+            (unsigned long long)st.acquire_us, (unsigned long)st.max_acquire_us);
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+    httpd_resp_sendstr_chunk(req, "}}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP POST requests for the /api/pm URI.
+ *
+ * Switches the clock policy, e.g. POST /api/pm?mode=fixed, so response
+ * latency can be compared between a fixed and a dynamic clock.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t api_pm_post_handler(httpd_req_t *req)
+{
+    char query[64] = "";
+    char mode[16] = "";
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        int ret = httpd_req_recv(req, query, sizeof(query) - 1);
+        query[ret > 0 ? ret : 0] = '\0';
+    }
+    if (httpd_query_key_value(query, "mode", mode, sizeof(mode)) != ESP_OK ||
+        (strcmp(mode, "fixed") != 0 && strcmp(mode, "dynamic") != 0)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected mode=fixed or mode=dynamic");
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = perf_set_mode(strcmp(mode, "dynamic") == 0 ? PERF_MODE_DYNAMIC : PERF_MODE_FIXED);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    httpd_resp_sendstr(req, perf_mode_name(perf_get_mode()));
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the /debug/flash_stalls URI.
+ *
+ * Returns, per flash operation, how many cache-disabled windows it caused,
+ * their total and longest duration, and the duration histogram of all
+ * windows.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t debug_flash_stalls_get_handler(httpd_req_t *req)
+{
+    char entry[160];
+    snprintf(entry, sizeof(entry), "{\"uptime_ms\":%lld,\"total_us\":%llu,\"ops\":{",
+             esp_timer_get_time() / 1000, (unsigned long long)flash_stall_total_us());
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, entry);
+    for (flash_op_t op = 0; op < FLASH_OP_COUNT; op++) {
+        flash_stall_stats_t st;
+        flash_stall_get_stats(op, &st);
+        snprintf(entry, sizeof(entry), "%s\"%s\":{\"count\":%lu,\"total_us\":%llu,\"max_us\":%lu}",
+                 op ? "," : "", flash_op_name(op), (unsigned long)st.count, (unsigned long long)st.total_us,
+                 (unsigned long)st.max_us);
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+
+    uint32_t histogram[FLASH_STALL_BUCKETS];
+    flash_stall_get_histogram(histogram);
+    httpd_resp_sendstr_chunk(req, "},\"histogram\":[");
+    for (int i = 0; i < FLASH_STALL_BUCKETS; i++) {
+        uint32_t limit = flash_stall_bucket_limit_us(i);
+        if (limit) {
+            snprintf(entry, sizeof(entry), "%s{\"lt_us\":%lu,\"count\":%lu}", i ? "," : "",
+                     (unsigned long)limit, (unsigned long)histogram[i]);
+        } else {
+            snprintf(entry, sizeof(entry), ",{\"lt_us\":null,\"count\":%lu}", (unsigned long)histogram[i]);
+        }
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Sends a JSON array of stack marks.
+ */
+static void send_stack_usage(httpd_req_t *req, const stack_usage_t *tasks, int count)
+{
+    char entry[96];
+    httpd_resp_sendstr_chunk(req, "[");
+    for (int i = 0; i < count; i++) {
+        snprintf(entry, sizeof(entry), "%s{\"name\":\"%s\",\"size\":%lu,\"min_free\":%lu}", i ? "," : "",
+                 tasks[i].name, (unsigned long)tasks[i].size, (unsigned long)tasks[i].min_free);
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+    httpd_resp_sendstr_chunk(req, "]");
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the /debug/stacks URI.
+ *
+ * Returns the stack high-water mark of every task with the configured size
+ * of this firmware's own tasks (0 for ESP-IDF tasks), for this boot and as
+ * saved before the last software reboot. tools/stack_sizes.py sizes the
+ * stacks from it.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t debug_stacks_get_handler(httpd_req_t *req)
+{
+    stack_usage_t tasks[STACK_USAGE_MAX_TASKS];
+    char entry[48];
+
+    snprintf(entry, sizeof(entry), "{\"uptime_ms\":%lld,\"tasks\":", esp_timer_get_time() / 1000);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, entry);
+    send_stack_usage(req, tasks, stack_usage_get(tasks, STACK_USAGE_MAX_TASKS));
+    httpd_resp_sendstr_chunk(req, ",\"previous\":");
+    send_stack_usage(req, tasks, stack_usage_get_previous(tasks, STACK_USAGE_MAX_TASKS));
+    httpd_resp_sendstr_chunk(req, "}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the /debug/shed URI.
+ *
+ * Returns the load shedding state: the mode, whether it is shedding and
+ * why, the last and lowest sampled free heap and CPU idle time, and how
+ * much work was shed per action since boot (or the last 'shed reset').
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t debug_shed_get_handler(httpd_req_t *req)
+{
+    load_shed_stats_t st;
+    load_shed_get_stats(&st);
+
+    char entry[320];
+    snprintf(entry, sizeof(entry),
+        "{\"uptime_ms\":%lld,\"mode\":\"%s\",\"active\":%s,\"heap\":%s,\"cpu\":%s,\"forced\":%s,"
+        "\"episodes\":%lu,\"shed_ms\":%llu,\"free_heap\":%lu,\"min_free_heap\":%lu,"
+        "\"idle_pct\":%u,\"min_idle_pct\":%u,\"decisions\":{",
+        esp_timer_get_time() / 1000, load_shed_mode_name(load_shed_get_mode()), st.active ? "true" : "false",
+        (st.reasons & LOAD_SHED_HEAP) ? "true" : "false", (st.reasons & LOAD_SHED_CPU) ? "true" : "false",
+        (st.reasons & LOAD_SHED_FORCED) ? "true" : "false", (unsigned long)st.episodes,
+        (unsigned long long)(st.shed_us / 1000), (unsigned long)st.free_heap, (unsigned long)st.min_free_heap,
+        st.idle_pct, st.min_idle_pct);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, entry);
+    for (shed_action_t action = 0; action < SHED_COUNT; action++) {
+        snprintf(entry, sizeof(entry), "%s\"%s\":%lu", action ? "," : "", shed_action_name(action),
+                 (unsigned long)st.decisions[action]);
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+    httpd_resp_sendstr_chunk(req, "}}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP GET requests for the /metrics URI.
+ *
+ * Returns the join-to-portal latency in the Prometheus text format: join
+ * counters, per milestone a histogram of its time since association, and
+ * the DHCP server's counters and exchange time.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    uint32_t joins, done, left;
+    join_kpi_get_counts(&joins, &done, &left);
+
+    char entry[384];
+    snprintf(entry, sizeof(entry),
+        "# TYPE portal_joins_total counter\nportal_joins_total %lu\n"
+        "# TYPE portal_joins_completed_total counter\nportal_joins_completed_total %lu\n"
+        "# TYPE portal_joins_abandoned_total counter\nportal_joins_abandoned_total %lu\n",
+        (unsigned long)joins, (unsigned long)done, (unsigned long)left);
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, entry);
+    httpd_resp_sendstr_chunk(req, "# HELP portal_join_seconds Time from association to each milestone of a join\n"
+                                  "# TYPE portal_join_seconds histogram\n");
+    for (join_milestone_t m = 0; m < JOIN_MILESTONE_COUNT; m++) {
+        join_histogram_t h;
+        join_kpi_get_histogram(m, &h);
+        uint32_t cumulative = 0;
+        for (int i = 0; i < JOIN_BUCKETS; i++) {
+            uint32_t limit = join_kpi_bucket_limit_ms(i);
+            cumulative += h.counts[i];
+            if (limit) {
+                snprintf(entry, sizeof(entry), "portal_join_seconds_bucket{milestone=\"%s\",le=\"%lu.%03lu\"} %lu\n",
+                         join_milestone_name(m), (unsigned long)(limit / 1000), (unsigned long)(limit % 1000),
+                         (unsigned long)cumulative);
+            } else {
+                snprintf(entry, sizeof(entry), "portal_join_seconds_bucket{milestone=\"%s\",le=\"+Inf\"} %lu\n",
+                         join_milestone_name(m), (unsigned long)cumulative);
+            }
+            httpd_resp_sendstr_chunk(req, entry);
+        }
+        snprintf(entry, sizeof(entry),
+                 "portal_join_seconds_sum{milestone=\"%s\"} %llu.%06llu\nportal_join_seconds_count{milestone=\"%s\"} %lu\n",
+                 join_milestone_name(m), (unsigned long long)(h.sum_us / 1000000),
+                 (unsigned long long)(h.sum_us % 1000000), join_milestone_name(m), (unsigned long)h.count);
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+
+    // Only the fast DHCP server counts
+    dhcp_proto_stats_t d;
+    if (dhcp_server_get_stats(&d)) {
+        snprintf(entry, sizeof(entry),
+            "# TYPE portal_dhcp_acks_total counter\nportal_dhcp_acks_total %lu\n"
+            "# TYPE portal_dhcp_naks_total counter\nportal_dhcp_naks_total %lu\n"
+            "# TYPE portal_dhcp_rapid_commits_total counter\nportal_dhcp_rapid_commits_total %lu\n"
+            "# TYPE portal_dhcp_returning_total counter\nportal_dhcp_returning_total %lu\n",
+            (unsigned long)d.acks, (unsigned long)d.naks, (unsigned long)d.rapid_commits, (unsigned long)d.returning);
+        httpd_resp_sendstr_chunk(req, entry);
+        snprintf(entry, sizeof(entry),
+            "# HELP portal_dhcp_exchange_seconds Time from DISCOVER (or REQUEST) to ACK\n"
+            "# TYPE portal_dhcp_exchange_seconds summary\n"
+            "portal_dhcp_exchange_seconds_sum %llu.%06llu\nportal_dhcp_exchange_seconds_count %lu\n",
+            (unsigned long long)(d.exchange_us / 1000000), (unsigned long long)(d.exchange_us % 1000000),
+            (unsigned long)d.exchanges);
+        httpd_resp_sendstr_chunk(req, entry);
+    }
+    httpd_resp_sendstr_chunk(req, NULL);
     return ESP_OK;
 }
 
 
 /**
- * @brief Handles HTTP POST requests for file uploads.
+ * @brief Handles HTTP GET requests for the /debug/joins URI.
  *
- * This function processes incoming POST requests to handle file uploads
- * in the web server. It is registered as a handler for the specific
- * endpoint that supports file uploads.
+ * Returns the most recent joins, oldest first, with the time from
+ * association to each milestone in microseconds (null if not reached).
  *
- * @param req Pointer to the HTTP request structure containing details
- *            about the incoming request.
+ * @param req Pointer to the HTTP request structure containing details about the request.
  *
  * @return
- *         - ESP_OK on successful handling of the request.
- *         - Appropriate error code (esp_err_t) on failure.
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
  */
-static esp_err_t upload_post_handler(httpd_req_t *req)
+static esp_err_t debug_joins_get_handler(httpd_req_t *req)
 {
-    if (req == NULL) {
-        ESP_LOGE(TAG, "Request is NULL");
-        return ESP_FAIL;
+    uint32_t end = join_kpi_ended();
+    join_record_t rec;
+    bool first = true;
+
+    char entry[224];
+    snprintf(entry, sizeof(entry), "{\"uptime_ms\":%lld,\"joins\":[", esp_timer_get_time() / 1000);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, entry);
+    for (uint32_t seq = (end > CONFIG_JOIN_KPI_RING_SIZE) ? end - CONFIG_JOIN_KPI_RING_SIZE : 0; seq < end; seq++) {
+        if (!join_kpi_get_record(seq, &rec)) {
+            continue;
+        }
+        const join_record_t *r = &rec;
+        esp_ip4_addr_t ip = { .addr = r->ip };
+        int len = snprintf(entry, sizeof(entry), "%s{\"mac\":\"" MACSTR "\",\"ip\":\"" IPSTR "\",\"assoc_ms\":%lld,"
+                           "\"left\":%s", first ? "" : ",", MAC2STR(r->mac), IP2STR(&ip), r->assoc_us / 1000,
+                           r->left ? "true" : "false");
+        first = false;
+        for (join_milestone_t m = 0; m < JOIN_MILESTONE_COUNT; m++) {
+            if (r->at_us[m] == JOIN_NOT_REACHED) {
+                len += snprintf(entry + len, sizeof(entry) - len, ",\"%s_us\":null", join_milestone_name(m));
+            } else {
+                len += snprintf(entry + len, sizeof(entry) - len, ",\"%s_us\":%lu", join_milestone_name(m),
+                                (unsigned long)r->at_us[m]);
+            }
+        }
+        snprintf(entry + len, sizeof(entry) - len, "}");
+        httpd_resp_sendstr_chunk(req, entry);
     }
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "Received firmware upload request");
-    ESP_LOGI(TAG, "Content Length: %d", req->content_len);
-    ESP_LOGI(TAG, "URI: %s", req->uri);
-    ESP_LOGI(TAG, "Method: %d", req->method);
-    ESP_LOGI(TAG, "User Context: %p", req->user_ctx);
 
-    vTaskDelay(pdMS_TO_TICKS(1000)); // Allow time for the request to settle
+/**
+ * @brief Returns the flash cache-disabled time that overlapped a span,
+ *        from the flash windows still in the trace snapshot.
+ */
+static uint32_t trace_overlap_us(const trace_event_t *span, const trace_event_t *events, size_t count)
+{
+    int64_t start = span->start_us;
+    int64_t end = start + span->dur_us;
+    uint32_t overlap = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].kind != TRACE_FLASH) {
+            continue;
+        }
+        int64_t from = (events[i].start_us > start) ? events[i].start_us : start;
+        int64_t to = events[i].start_us + events[i].dur_us;
+        to = (to < end) ? to : end;
+        if (to > from) {
+            overlap += to - from;
+        }
+    }
+    return overlap;
+}
+
 
-    const esp_partition_t *running_partition = esp_ota_get_running_partition();
-    const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);   
-    if (running_partition == NULL || update_partition == NULL) {
-        ESP_LOGE(TAG, "Failed to get running or update partition");
+/**
+ * @brief Handles HTTP GET requests for the /debug/trace URI.
+ *
+ * Returns the trace ring in Chrome trace event format, one track each for
+ * HTTP handlers, DNS replies and flash cache-disabled windows, so it can be
+ * opened in Perfetto or chrome://tracing. Request spans carry the flash
+ * stall time they saw in args.stall_us.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t debug_trace_get_handler(httpd_req_t *req)
+{
+    if (load_shed(SHED_PAGE)) {
+        return send_shed(req, "Busy, retry later");
+    }
+    trace_event_t *events = malloc(CONFIG_TRACE_RING_SIZE * sizeof(trace_event_t));
+    if (events == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_FAIL;
     }
+    size_t count = trace_snapshot(events, CONFIG_TRACE_RING_SIZE);
+
+    char entry[224];
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (trace_kind_t kind = 0; kind < TRACE_KIND_COUNT; kind++) {
+        snprintf(entry, sizeof(entry), "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,"
+                 "\"args\":{\"name\":\"%s\"}}", kind ? "," : "", kind, trace_kind_name(kind));
+        httpd_resp_sendstr_chunk(req, entry);
+    }
 
-    esp_app_desc_t new_app_info;
-    if (esp_ota_get_partition_description(update_partition, &new_app_info) == ESP_OK) {
-        const esp_app_desc_t *running_app_info = esp_app_get_description();
-        if (running_app_info && new_app_info.version[0] != 0) {
-            ESP_LOGI(TAG, "Running Version: %s", running_app_info->version);
-            ESP_LOGI(TAG, "Uploaded Version: %s", new_app_info.version);
-        } else {
-            ESP_LOGW(TAG, "Firmware descriptor invalid or missing");
+    for (size_t i = 0; i < count; i++) {
+        const trace_event_t *e = &events[i];
+        char name[48];
+        uint32_t stall_us = e->stall_us;
+        switch (e->kind) {
+            case TRACE_HTTP:
+                if (e->detail < locked_handler_count) {
+                    const locked_handler_t *h = &locked_handlers[e->detail];
+                    snprintf(name, sizeof(name), "%s %s", http_method_str(h->method), h->uri);
+                } else {
+                    snprintf(name, sizeof(name), "redirect");
+                }
+                break;
+            case TRACE_DNS:
+                snprintf(name, sizeof(name), "query");
+                stall_us = trace_overlap_us(e, events, count);
+                break;
+            case TRACE_SHED:
+                snprintf(name, sizeof(name), "%s", shed_action_name(e->detail));
+                break;
+            case TRACE_DHCP:
+                snprintf(name, sizeof(name), "%s", dhcp_msg_name(e->detail));
+                break;
+            default:
+                snprintf(name, sizeof(name), "%s", flash_op_name(e->detail));
+                break;
         }
-    } else {
-        ESP_LOGW(TAG, "Could not get firmware description");
+        snprintf(entry, sizeof(entry), ",{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lu,"
+                 "\"args\":{\"stall_us\":%lu}}", name, e->kind, e->start_us, (unsigned long)e->dur_us,
+                 (unsigned long)stall_us);
+        httpd_resp_sendstr_chunk(req, entry);
     }
+    free(events);
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "Current running partition: %s", running_partition->label ? running_partition->label : "Unknown");
-    ESP_LOGI(TAG, "Writing to partition: %s", update_partition->label ? update_partition->label : "Unknown");
 
-    esp_ota_handle_t ota_handle;
-    esp_err_t err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &ota_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
-        return ESP_FAIL;
-    }
+/**
+ * @brief Sends one folded stack line of the profile.
+ */
+static void send_profile_line(const char *line, void *ctx)
+{
+    httpd_req_t *req = ctx;
+    httpd_resp_sendstr_chunk(req, line);
+    httpd_resp_sendstr_chunk(req, "\n");
+}
 
-    char buf[1024];
-    int total_len = req->content_len;
-    int received = 0;
-    int first_chunk = 1;
 
-    while (received < total_len) {
-        int bytes_read = httpd_req_recv(req, buf, sizeof(buf));
-        if (bytes_read <= 0) {
-            ESP_LOGE(TAG, "Error receiving file");
-            esp_ota_abort(ota_handle);
-            return ESP_FAIL;
-        }
+/**
+ * @brief Handles HTTP GET requests for the /debug/profile URI.
+ *
+ * Stops the running profile, if any, and returns it as folded stacks with
+ * raw addresses; tools/profile_symbolize.py resolves them against the ELF.
+ * The sampling rate and the sample counts are sent as X-Profile-* headers.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t debug_profile_get_handler(httpd_req_t *req)
+{
+    profiler_stop();
+
+    profiler_stats_t st;
+    profiler_get_stats(&st);
+    char rate[12], samples[12], dropped[12], duration[12];
+    snprintf(rate, sizeof(rate), "%lu", (unsigned long)st.rate_hz);
+    snprintf(samples, sizeof(samples), "%lu", (unsigned long)st.samples);
+    snprintf(dropped, sizeof(dropped), "%lu", (unsigned long)st.dropped);
+    snprintf(duration, sizeof(duration), "%lu", (unsigned long)st.duration_ms);
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_hdr(req, "X-Profile-Rate", rate);
+    httpd_resp_set_hdr(req, "X-Profile-Samples", samples);
+    httpd_resp_set_hdr(req, "X-Profile-Dropped", dropped);
+    httpd_resp_set_hdr(req, "X-Profile-Duration-Ms", duration);
+    profiler_fold(send_profile_line, req);
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
 
-        if (first_chunk) {
-            first_chunk = 0;
-            char *firmware_start = strstr(buf, "\r\n\r\n");
-            if (firmware_start == NULL) {
-                ESP_LOGE(TAG, "Multipart header not found!");
-                esp_ota_abort(ota_handle);
-                return ESP_FAIL;
-            }
-            firmware_start += 4;
-            int firmware_data_len = bytes_read - (firmware_start - buf);
-            if (firmware_data_len > 0) {
-                ESP_LOGI(TAG, "Writing %d bytes to OTA", firmware_data_len);
-                if (esp_ota_write(ota_handle, firmware_start, firmware_data_len) != ESP_OK) {
-                    ESP_LOGE(TAG, "Error writing OTA data");
-                    esp_ota_abort(ota_handle);
-                    return ESP_FAIL;
-                }
-            }
-        } else {
-            if (bytes_read == 0) {
-            if (esp_ota_write(ota_handle, buf, bytes_read) != ESP_OK) {
-                ESP_LOGE(TAG, "Error writing OTA data");
-                esp_ota_abort(ota_handle);
-                return ESP_FAIL;
-            }
-                esp_ota_abort(ota_handle);
-                return ESP_FAIL;
-            }
-            esp_ota_write(ota_handle, buf, bytes_read);
-        }
 
-        received += bytes_read;
+/**
+ * @brief Handles HTTP POST requests for the /debug/profile URI.
+ *
+ * Starts a profile, e.g. POST /debug/profile?hz=1000&seconds=30. Without
+ * seconds it runs until the next GET /debug/profile, so an OTA upload or a
+ * DNS flood can be profiled from start to end.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t debug_profile_post_handler(httpd_req_t *req)
+{
+    char query[64] = "";
+    char value[12];
+    uint32_t rate_hz = CONFIG_PROFILER_DEFAULT_HZ;
+    uint32_t seconds = 0;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        int ret = httpd_req_recv(req, query, sizeof(query) - 1);
+        query[ret > 0 ? ret : 0] = '\0';
     }
-
-    if (received != req->content_len) {
-        ESP_LOGE(TAG, "Upload size mismatch! Expected %d bytes, got %d bytes", req->content_len, received);
-        esp_ota_abort(ota_handle);
-        return ESP_FAIL;
+    if (httpd_query_key_value(query, "hz", value, sizeof(value)) == ESP_OK) {
+        rate_hz = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "seconds", value, sizeof(value)) == ESP_OK) {
+        seconds = strtoul(value, NULL, 10);
     }
 
-    if ((err = esp_ota_end(ota_handle)) != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_end failed: %s", esp_err_to_name(err));
+    esp_err_t err = profiler_start(rate_hz, seconds * 1000);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected hz=1..10000");
+        return ESP_FAIL;
+    } else if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
         return ESP_FAIL;
     }
+    httpd_resp_sendstr(req, "Profiling");
+    return ESP_OK;
+}
 
-    if (esp_ota_get_partition_description(update_partition, &new_app_info) == ESP_OK) {
-        const esp_app_desc_t *running_app_info = esp_app_get_description();
-        ESP_LOGI(TAG, "Running Version: %s", running_app_info->version);
-        ESP_LOGI(TAG, "Uploaded Version: %s", new_app_info.version);
 
-#if 0
-        if (strcmp(new_app_info.version, running_app_info->version) == 0) {
-            ESP_LOGW(TAG, "Same firmware version uploaded. Skipping update.");
-            httpd_resp_sendstr(req, "Firmware version is identical. Update canceled.");
-            return ESP_FAIL;
-        }
-#endif
-#if 0
-        if (strcmp(new_app_info.version, running_app_info->version) < 0) {
-            ESP_LOGE(TAG, "Firmware downgrade detected! Update rejected.");
-            httpd_resp_sendstr(req, "Firmware version is older. Update rejected.");
-            return ESP_FAIL;
+/**
+ * @brief Handles HTTP GET requests for the /api/images URI.
+ *
+ * Returns the image catalog as JSON: one entry per app partition with its
+ * version, hashes, install sequence number and running/boot flags.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t api_images_get_handler(httpd_req_t *req)
+{
+    image_catalog_entry_t images[IMAGE_CATALOG_MAX_SLOTS];
+    int count = image_catalog_list(images, IMAGE_CATALOG_MAX_SLOTS);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, "[");
+    for (int i = 0; i < count; i++) {
+        char elf[65], image[65], entry[320];
+        for (int b = 0; b < 32; b++) {
+            snprintf(&elf[b * 2], 3, "%02x", images[i].elf_sha256[b]);
+            snprintf(&image[b * 2], 3, "%02x", images[i].image_sha256[b]);
         }
-#endif
-    } else {
-        ESP_LOGW(TAG, "Could not read new firmware description. Proceeding blindly.");
+        snprintf(entry, sizeof(entry),
+            "%s{\"slot\":\"%s\",\"valid\":%s,\"version\":\"%s\",\"date\":\"%s\","
+            "\"sha256\":\"%s\",\"image_sha256\":\"%s\",\"seq\":%lu,\"running\":%s,\"boot\":%s}",
+            i ? "," : "", images[i].partition->label, images[i].valid ? "true" : "false",
+            images[i].version, images[i].date, images[i].valid ? elf : "", images[i].valid ? image : "",
+            (unsigned long)images[i].seq, images[i].running ? "true" : "false", images[i].boot ? "true" : "false");
+        httpd_resp_sendstr_chunk(req, entry);
     }
+    httpd_resp_sendstr_chunk(req, "]");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Handles HTTP POST requests for the /api/boot URI.
+ *
+ * Switches the boot partition to a cataloged image and reboots, e.g.
+ * POST /api/boot?slot=ota_1. This rolls back (or forward) to any image
+ * still held in flash without transferring it again.
+ *
+ * @param req Pointer to the HTTP request structure containing details about the request.
+ *
+ * @return
+ *     - ESP_OK: If the request was successfully handled.
+ *     - Appropriate error code (esp_err_t): If an error occurred during request handling.
+ */
+static esp_err_t api_boot_post_handler(httpd_req_t *req)
+{
+    char query[64] = "";
+    char slot[17] = "";
 
-    if ((err = esp_ota_set_boot_partition(update_partition)) != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(err));
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        int ret = httpd_req_recv(req, query, sizeof(query) - 1);
+        query[ret > 0 ? ret : 0] = '\0';
+    }
+    if (httpd_query_key_value(query, "slot", slot, sizeof(slot)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing slot");
+        return ESP_FAIL;
+    }
+    if (ota_writer_busy()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA update in progress");
         return ESP_FAIL;
     }
 
-    httpd_resp_sendstr(req, "Upload successful! Rebooting...");
-
-    // Schedule a task to reboot the system
-    ESP_LOGI(TAG, "OTA Update Successful. Shutting down HTTP server...");
-    xTaskCreate(reboot_task, "reboot_task", 4096, NULL, configMAX_PRIORITIES-1, NULL);
+    esp_err_t err = image_catalog_activate(slot);
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No valid image in that slot");
+        return ESP_FAIL;
+    } else if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Image verification failed");
+        return ESP_FAIL;
+    }
 
+    httpd_resp_sendstr(req, "Boot partition switched! Rebooting...");
+    request_reboot();
     return ESP_OK;
 }
 
@@ -412,6 +1362,8 @@ esp_err_t settings_get_handler(httpd_req_t *req)
     //uint8_t instance = get_instance();
     
     uint32_t serial = get_serial_nbr();
+    char relay[128];
+    get_relay_peers(relay, sizeof(relay));
 
     //unsigned short sf = get_short_flush_time();
     //unsigned short lf = get_long_flush_time();
@@ -424,6 +1376,13 @@ esp_err_t settings_get_handler(httpd_req_t *req)
     //unsigned short lc = get_low_current_threshold();
     //unsigned short hc = get_high_current_threshold();
 
+    if (load_shed(SHED_PAGE)) {
+        return send_shed(req,
+            "<html><head><meta name='viewport' content='width=device-width, initial-scale=1.0'></head><body>"
+            "<h1>Device busy</h1><p>An update is in progress. Please try again in a moment.</p>"
+            "</body></html>");
+    }
+
     char *html = malloc(4096);
     if (html == NULL) {
         httpd_resp_sendstr(req, "<html><body><h1>Error</h1><p>Not enough memory to process the request.</p></body></html>");
@@ -446,6 +1405,7 @@ esp_err_t settings_get_handler(httpd_req_t *req)
         "<h1>OTA Demo System Settings</h1>"
         "<form method='POST' action='/settings' id='settings_form'>"
         "<label for='serial'>Serial Number:</label> <input id='serial' type='number' name='serial' value='%ld' oninput='checkChanges()'><br><br>"
+        "<label for='relay'>Relay Updates To (host[:port], comma separated):</label> <input id='relay' type='text' name='relay' value='%s' oninput='checkChanges()'><br><br>"
         "Some settings require a reboot to take effect.<br>"
         "Please save your changes before rebooting.<br><br>"
         "<input type='submit' value='Save' id='save_button' disabled>"
@@ -454,7 +1414,8 @@ esp_err_t settings_get_handler(httpd_req_t *req)
         "</form>"
         "<script>"
         "const originalValues = {"
-        "  serial: '%ld'"
+        "  serial: '%ld',"
+        "  relay: '%s'"
         "};"
         "function checkChanges() {"
         "  const form = document.getElementById('settings_form');"
@@ -471,7 +1432,7 @@ esp_err_t settings_get_handler(httpd_req_t *req)
         "}"
         "</script>"
         "</body></html>",
-        serial, serial);
+        serial, relay, serial, relay);
 
     httpd_resp_sendstr(req, html);
     free(html);
@@ -497,7 +1458,7 @@ esp_err_t settings_get_handler(httpd_req_t *req)
 esp_err_t settings_reboot_handler(httpd_req_t *req)
 {
     ESP_LOGI(TAG, "Rebooting system...");
-    xTaskCreate(reboot_task, "reboot_task", 4096, NULL, configMAX_PRIORITIES-1, NULL);
+    request_reboot();
     httpd_resp_sendstr(req, "Rebooting...");
     return ESP_OK;
 }
@@ -525,12 +1486,47 @@ esp_err_t settings_post_handler(httpd_req_t *req)
     if (ret <= 0) return ESP_FAIL;
     buf[ret] = '\0';
 
-    char value[64];
+    char value[128];
+    bool defer = load_shed(SHED_SETTINGS);
+
+    // Refuse the form before saving anything if the relay list is not one
+    if (form_value(buf, ret, "relay", value, sizeof(value)) >= 0 && !relay_peers_valid(value)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Relay peers must be a comma separated host[:port] list");
+        return ESP_FAIL;
+    }
 
     // Serial number
-    if (httpd_query_key_value(buf, "serial", value, sizeof(value)) == ESP_OK) {
+    if (form_value(buf, ret, "serial", value, sizeof(value)) >= 0) {
         unsigned long serial = atol(value);
-        set_serial_nbr(serial);
+        if (defer) {
+            deferred_settings.serial = serial;
+            deferred_settings.serial_set = true;
+        } else {
+            set_serial_nbr(serial);
+            deferred_settings.serial_set = false;
+        }
+    }
+
+    // Downstream OTA relay peers
+    if (form_value(buf, ret, "relay", value, sizeof(value)) >= 0) {
+        if (defer) {
+            strlcpy(deferred_settings.relay, value, sizeof(deferred_settings.relay));
+            deferred_settings.relay_set = true;
+        } else {
+            set_relay_peers(value);
+            deferred_settings.relay_set = false;
+        }
+    }
+
+    // An NVS commit stalls the flash cache, it waits until the load is gone
+    if (defer) {
+        httpd_resp_set_status(req, "202 Accepted");
+        httpd_resp_sendstr(req,
+            "<html><head><meta name='viewport' content='width=device-width, initial-scale=1.0'></head><body>"
+            "<h1>Settings Accepted</h1><p>The device is busy, they will be saved once it is done.</p>"
+            "<a href='/'>Return</a>"
+            "</body></html>");
+        return ESP_OK;
     }
 
     httpd_resp_sendstr(req, 
@@ -553,6 +1549,38 @@ esp_err_t settings_post_handler(httpd_req_t *req)
 }
 
 
+/**
+ * @brief Commits the settings deferred while shedding load. Runs on the
+ *        server task, like the handler that deferred them.
+ */
+static void commit_deferred_settings(void *arg)
+{
+    if (deferred_settings.serial_set) {
+        set_serial_nbr(deferred_settings.serial);
+    }
+    if (deferred_settings.relay_set) {
+        set_relay_peers(deferred_settings.relay);
+    }
+    if (deferred_settings.serial_set || deferred_settings.relay_set) {
+        ESP_LOGI(TAG, "Deferred settings saved");
+    }
+    memset(&deferred_settings, 0, sizeof(deferred_settings));
+}
+
+
+/**
+ * @brief Called when load shedding ends, hands the deferred settings
+ *        commit to the server task. The handler may be deferring a value
+ *        right now, so the check is left to the server task too.
+ */
+static void settings_recovered(void)
+{
+    if (server) {
+        httpd_queue_work(server, commit_deferred_settings, NULL);
+    }
+}
+
+
 /**
  * @brief Custom HTTP 404 error handler for the web server.
  *
@@ -571,6 +1599,10 @@ esp_err_t settings_post_handler(httpd_req_t *req)
  */
 esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err)
 {
+    perf_lock_acquire(PERF_LOCK_HTTP);
+    int64_t start = esp_timer_get_time();
+    uint64_t stall_start = flash_stall_total_us();
+
     // Set status
     httpd_resp_set_status(req, "302 Temporary Redirect");
     // Redirect to the "/" root directory
@@ -578,11 +1610,106 @@ esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err)
     // iOS requires content in the response to detect a captive portal, simply redirecting is not sufficient.
     httpd_resp_send(req, "Redirect to the captive portal", HTTPD_RESP_USE_STRLEN);
 
-    ESP_LOGI(TAG, "Redirecting to root");
+    // Shedding load: the redirect alone, the log line costs more than the answer
+    if (!load_shed(SHED_PROBE)) {
+        ESP_LOGI(TAG, "Redirecting to root");
+    }
+    if (join_kpi_waiting()) {
+        join_kpi_mark(JOIN_PROBE, client_ip(req), esp_timer_get_time());
+    }
+    alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_METRICS);
+    trace_span(TRACE_HTTP, start, esp_timer_get_time() - start, TRACE_404, flash_stall_total_us() - stall_start);
+    alloc_guard_exit(guard);
+    perf_lock_release(PERF_LOCK_HTTP);
     return ESP_OK;
 }
 
 
+/**
+ * @brief Holds PERF_LOCK_DNS for the duration of each burst of DNS queries.
+ */
+static void dns_busy(bool busy)
+{
+    if (busy) {
+        perf_lock_acquire(PERF_LOCK_DNS);
+    } else {
+        perf_lock_release(PERF_LOCK_DNS);
+    }
+}
+
+
+/**
+ * @brief Tells the DNS server to answer quietly while shedding load.
+ */
+static bool dns_shed(void)
+{
+    return load_shed(SHED_DNS);
+}
+
+
+/**
+ * @brief Records each DNS reply in the trace ring, and the first one a
+ *        joining client gets.
+ */
+static void dns_reply(int64_t received_us, uint32_t reply_us, uint32_t client_ip)
+{
+    alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_METRICS);
+    trace_span(TRACE_DNS, received_us, reply_us, 0, 0);
+    if (join_kpi_waiting()) {
+        join_kpi_mark(JOIN_DNS, client_ip, received_us + reply_us);
+    }
+    alloc_guard_exit(guard);
+}
+
+
+/**
+ * @brief Runs a URI handler with PERF_LOCK_HTTP held and records it in the
+ *        trace ring, with the flash stall time it saw.
+ */
+static esp_err_t locked_handler(httpd_req_t *req)
+{
+    const locked_handler_t *h = req->user_ctx;
+    req->user_ctx = h->user_ctx;
+
+    perf_lock_acquire(PERF_LOCK_HTTP);
+    int64_t start = esp_timer_get_time();
+    uint64_t stall_start = flash_stall_total_us();
+    esp_err_t err = h->handler(req);
+    uint32_t dur_us = esp_timer_get_time() - start;
+    alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_METRICS);
+    trace_span(TRACE_HTTP, start, dur_us, h - locked_handlers, flash_stall_total_us() - stall_start);
+    alloc_guard_exit(guard);
+    if (debug_enabled(DEBUG_LOG_REQUESTS)) {
+        ESP_LOGI(TAG, "%s %s: %s in %lu us", http_method_str(h->method), h->uri, esp_err_to_name(err),
+                 (unsigned long)dur_us);
+    }
+    perf_lock_release(PERF_LOCK_HTTP);
+    return err;
+}
+
+
+/**
+ * @brief Registers a URI handler, wrapped so the clock is at the maximum
+ *        while it runs.
+ */
+static esp_err_t register_handler(const httpd_uri_t *uri)
+{
+    if (locked_handler_count >= MAX_URI_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    locked_handler_t *h = &locked_handlers[locked_handler_count++];
+    h->handler = uri->handler;
+    h->user_ctx = uri->user_ctx;
+    h->uri = uri->uri;
+    h->method = uri->method;
+
+    httpd_uri_t wrapped = *uri;
+    wrapped.handler = locked_handler;
+    wrapped.user_ctx = h;
+    return httpd_register_uri_handler(server, &wrapped);
+}
+
+
 /**
  * @brief Starts the web server.
  *
@@ -599,71 +1726,179 @@ void start_webserver(void)
     // Start the DNS server that will redirect all queries to the softAP IP
     //const char *softap_ip = get_ssid();
     dns_server_config_t dns_config = DNS_SERVER_CONFIG_SINGLE("*" /* all A queries */, "WIFI_AP_DEF" /* softAP netif ID */);
+    dns_config.busy_cb = dns_busy;
+    dns_config.burst_ms = CONFIG_PERF_DNS_BURST_MS;
+    dns_config.reply_cb = dns_reply;
+    dns_config.shed_cb = dns_shed;
     start_dns_server(&dns_config);
 
     // Start the HTTP server
+    render_pages();
     httpd_config_t http_config = HTTPD_DEFAULT_CONFIG();
     http_config.uri_match_fn     = NULL; // Use default URI matching function
     http_config.max_open_sockets = 7;    // Set maximum open sockets (adjust as needed)
-    http_config.max_uri_handlers = 32;   // Increase maximum URI handlers (adjust as needed)
+    http_config.max_uri_handlers = MAX_URI_HANDLERS; // Increase maximum URI handlers (adjust as needed)
     http_config.max_resp_headers = 2048; // Increase maximum response headers size
-    http_config.stack_size       = 8192; // Increase stack size for the server task
+    http_config.stack_size       = CONFIG_STACK_SIZE_HTTPD;
     httpd_start(&server, &http_config);
 
     // Register URI handlers
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
         .uri      = "/",
         .method   = HTTP_GET,
         .handler  = root_get_handler,
         .user_ctx = NULL
     });
 
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
         .uri      = "/index.html",
         .method   = HTTP_GET,
         .handler  = root_get_handler,
         .user_ctx = NULL
     });
 
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
         .uri      = "/index.htm",
         .method   = HTTP_GET,
         .handler  = root_get_handler,
         .user_ctx = NULL
     });
 
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
         .uri      = "/firmware",
         .method   = HTTP_GET,
         .handler  = firmware_get_handler,
         .user_ctx = NULL
     });
 
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
         .uri      = "/upload",
         .method   = HTTP_POST,
         .handler  = upload_post_handler,
         .user_ctx = NULL
     });
 
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
+        .uri      = "/upload",
+        .method   = HTTP_PUT,
+        .handler  = upload_post_handler,
+        .user_ctx = NULL
+    });
+
+#if CONFIG_HTTPD_WS_SUPPORT
+    register_handler(&(httpd_uri_t){
+        .uri          = "/ws/upload",
+        .method       = HTTP_GET,
+        .handler      = ws_upload_handler,
+        .is_websocket = true
+    });
+#endif
+
+    register_handler(&(httpd_uri_t){
         .uri = "/settings",
         .method = HTTP_GET,
         .handler = settings_get_handler
     });
 
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
         .uri = "/settings",
         .method = HTTP_POST,
         .handler = settings_post_handler
     });
 
-    httpd_register_uri_handler(server, &(httpd_uri_t){
+    register_handler(&(httpd_uri_t){
+        .uri = "/api/info",
+        .method = HTTP_GET,
+        .handler = api_info_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/api/ota_stats",
+        .method = HTTP_GET,
+        .handler = api_ota_stats_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/api/pm",
+        .method = HTTP_GET,
+        .handler = api_pm_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/api/pm",
+        .method = HTTP_POST,
+        .handler = api_pm_post_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/debug/flash_stalls",
+        .method = HTTP_GET,
+        .handler = debug_flash_stalls_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/debug/trace",
+        .method = HTTP_GET,
+        .handler = debug_trace_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/debug/stacks",
+        .method = HTTP_GET,
+        .handler = debug_stacks_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/debug/profile",
+        .method = HTTP_GET,
+        .handler = debug_profile_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/debug/profile",
+        .method = HTTP_POST,
+        .handler = debug_profile_post_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/api/images",
+        .method = HTTP_GET,
+        .handler = api_images_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/api/boot",
+        .method = HTTP_POST,
+        .handler = api_boot_post_handler
+    });
+
+    register_handler(&(httpd_uri_t){
         .uri = "/reboot",
         .method = HTTP_GET,
         .handler = settings_reboot_handler
     });
 
+    register_handler(&(httpd_uri_t){
+        .uri = "/debug/shed",
+        .method = HTTP_GET,
+        .handler = debug_shed_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get_handler
+    });
+
+    register_handler(&(httpd_uri_t){
+        .uri = "/debug/joins",
+        .method = HTTP_GET,
+        .handler = debug_joins_get_handler
+    });
+
     // Register 404 error handler
     httpd_register_err_handler(server, HTTPD_404_NOT_FOUND, http_404_error_handler);
+
+    // Settings posted while shedding are committed once it ends
+    load_shed_set_recover_cb(settings_recovered);
 }
@@ -16,6 +16,8 @@
 #include "esp_event.h"
 #include "esp_mac.h"            // Needed for esp_efuse_mac_get_default()
 #include "esp_system.h"         // Needed for esp_sha256_hash()
+#include "join_kpi.h"
+#include "dhcp_server.h"
 //#include "esp_sha.h"            // Needed for esp_sha256_hash
 
 
@@ -54,7 +56,12 @@ void wifi_init_softap(void)
 {
     esp_netif_init();
     esp_event_loop_create_default();
-    esp_netif_create_default_wifi_ap();
+
+    // softAP netif, leases handed out by the server chosen in the "DHCP server" menu
+    dhcp_server_create_netif();
+
+    // Follow each station from association to the portal page
+    join_kpi_init();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     esp_wifi_init(&cfg);
@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Update a fleet of ota-demo units from the host.
+
+The tool reads /api/info from every device, plans the update order and then
+uploads the image to several devices in parallel:
+
+  * devices already running the image (same ELF SHA-256) are skipped,
+  * devices that still hold the image in another app slot (the "images"
+    list of /api/info) are switched to that slot with POST /api/boot,
+  * devices that will receive the image through another unit's OTA relay
+    (the relay_peers setting) are not uploaded to directly,
+  * concurrent uploads are limited per Wi-Fi channel so that their combined
+    estimated airtime stays within --airtime-budget,
+  * the longest transfers are started first, alternating between channels.
+
+    python tools/fleet_update.py build/ota-demo.bin --devices 192.168.4.1 10.0.0.17:8080
+    python tools/fleet_update.py build/ota-demo.bin --inventory units.txt --verify
+
+Run with --bench N to start N mock devices (tools/mock_device.py) locally and
+benchmark the scheduler against them.
+"""
+import argparse
+import http.client
+import json
+import math
+import os
+import struct
+import sys
+import threading
+import time
+import uuid
+from concurrent.futures import ThreadPoolExecutor
+from typing import Dict
+from typing import Iterator
+from typing import List
+from typing import Optional
+from typing import Tuple
+from urllib.parse import urlsplit
+
+APP_DESC_OFFSET = 32            # esp_image_header_t + first esp_image_segment_header_t
+APP_DESC_MAGIC = 0xABCD5432
+UPLOAD_CHUNK = 4096
+
+
+def read_app_desc(image: bytes) -> Tuple[str, str, str]:
+    """Return (project, version, elf sha256) from the esp_app_desc_t of an image."""
+    desc = image[APP_DESC_OFFSET:APP_DESC_OFFSET + 256]
+    if len(desc) < 176 or struct.unpack_from('<I', desc)[0] != APP_DESC_MAGIC:
+        raise ValueError('not an ESP-IDF application image')
+
+    def text(offset: int, size: int) -> str:
+        return desc[offset:offset + size].split(b'\0')[0].decode('ascii', 'replace')
+
+    version = text(16, 32)
+    project = text(48, 32)
+    sha256 = desc[144:176].hex()
+    return project, version, sha256
+
+
+class Device:
+    def __init__(self, address: str) -> None:
+        if '://' not in address:
+            address = 'http://' + address
+        parts = urlsplit(address)
+        self.host = parts.hostname or ''
+        self.port = parts.port or 80
+        self.name = '{}:{}'.format(self.host, self.port) if self.port != 80 else self.host
+        self.info: Dict = {}
+        self.status = 'unknown'
+        self.bytes = 0
+        self.seconds = 0.0
+        self.covered_by: Optional['Device'] = None
+
+    @property
+    def channel(self) -> int:
+        return int(self.info.get('channel', 0))
+
+    def relay_peers(self) -> List[str]:
+        return [p.strip() for p in self.info.get('relay_peers', '').replace(',', ' ').split() if p.strip()]
+
+    def connection(self, timeout: float, port: Optional[int] = None) -> http.client.HTTPConnection:
+        return http.client.HTTPConnection(self.host, port or self.port, timeout=timeout)
+
+    def fetch_info(self, timeout: float = 5.0) -> bool:
+        try:
+            conn = self.connection(timeout)
+            conn.request('GET', '/api/info')
+            resp = conn.getresponse()
+            body = resp.read()
+            conn.close()
+            if resp.status != 200:
+                self.status = 'error: /api/info returned {}'.format(resp.status)
+                return False
+            self.info = json.loads(body)
+            return True
+        except (OSError, ValueError, http.client.HTTPException) as e:
+            self.status = 'unreachable: {}'.format(e)
+            return False
+
+    def cached_slot(self, sha256: str) -> Optional[str]:
+        """Return the app slot already holding the image, if any."""
+        for entry in self.info.get('images', []):
+            if entry.get('sha256') == sha256 and entry.get('slot') != self.info.get('running'):
+                return str(entry.get('slot'))
+        return None
+
+    def boot_slot(self, slot: str, timeout: float) -> None:
+        conn = self.connection(timeout)
+        conn.request('POST', '/api/boot?slot=' + slot)
+        resp = conn.getresponse()
+        reply = resp.read().decode('utf-8', 'replace')
+        conn.close()
+        if resp.status != 200:
+            raise RuntimeError('HTTP {}: {}'.format(resp.status, reply.strip()[:80]))
+
+    def upload(self, image: bytes, timeout: float, netconn: bool = False) -> None:
+        boundary = uuid.uuid4().hex
+        head = ('--{}\r\nContent-Disposition: form-data; name="firmware"; filename="firmware.bin"\r\n'
+                'Content-Type: application/octet-stream\r\n\r\n').format(boundary).encode()
+        tail = '\r\n--{}--\r\n'.format(boundary).encode()
+
+        def body() -> Iterator[bytes]:
+            yield head
+            for i in range(0, len(image), UPLOAD_CHUNK):
+                yield image[i:i + UPLOAD_CHUNK]
+            yield tail
+
+        # The zero-copy listener (main/netconn_ota.c) takes the same request on its own port
+        port = self.info.get('ota_port') if netconn and 'netconn' in self.info.get('caps', []) else None
+        start = time.monotonic()
+        conn = self.connection(timeout, port)
+        conn.putrequest('POST', '/upload')
+        conn.putheader('Content-Type', 'multipart/form-data; boundary=' + boundary)
+        conn.putheader('Content-Length', str(len(head) + len(image) + len(tail)))
+        conn.endheaders()
+        for chunk in body():
+            conn.send(chunk)
+        resp = conn.getresponse()
+        reply = resp.read().decode('utf-8', 'replace')
+        conn.close()
+        self.seconds = time.monotonic() - start
+        self.bytes = len(image)
+        if resp.status != 200:
+            raise RuntimeError('HTTP {}: {}'.format(resp.status, reply.strip()[:80]))
+
+    def wait_for(self, sha256: str, timeout: float) -> bool:
+        deadline = time.monotonic() + timeout
+        time.sleep(1.0)
+        while time.monotonic() < deadline:
+            if self.fetch_info(timeout=2.0) and self.info.get('sha256') == sha256:
+                return True
+            time.sleep(1.0)
+        return False
+
+
+def plan(devices: List[Device], sha256: str, force: bool) -> List[Device]:
+    """Classify devices and return the ones that need a direct upload, in start order.
+
+    Devices that can boot the image from another slot are marked 'slot flip'.
+    """
+    by_name = {d.name: d for d in devices}
+    by_name.update({d.host: d for d in devices})
+    candidates = []
+    for d in devices:
+        if not d.info:
+            continue
+        if not force and d.info.get('sha256') == sha256:
+            d.status = 'identical'
+        elif d.info.get('ota_busy'):
+            d.status = 'busy'
+        elif not force and d.cached_slot(sha256):
+            d.status = 'slot flip'
+        else:
+            d.status = 'pending'
+            candidates.append(d)
+
+    # Units that relay to others go first; everything reachable through their
+    # relay chain gets the image without a separate upload.
+    candidates.sort(key=lambda d: len(d.relay_peers()), reverse=True)
+    direct = []
+    for d in candidates:
+        if d.covered_by is not None:
+            continue
+        direct.append(d)
+        queue = [d]
+        while queue:
+            for peer in queue.pop(0).relay_peers():
+                target = by_name.get(peer)
+                if target and target is not d and target.status == 'pending' and target.covered_by is None \
+                        and target not in direct:
+                    target.covered_by = d
+                    target.status = 'relayed'
+                    queue.append(target)
+
+    # Longest jobs first (relay roots carry the longest chains), interleaving channels
+    by_channel: Dict[int, List[Device]] = {}
+    for d in direct:
+        by_channel.setdefault(d.channel, []).append(d)
+    ordered = []
+    while any(by_channel.values()):
+        for channel in sorted(by_channel):
+            if by_channel[channel]:
+                ordered.append(by_channel[channel].pop(0))
+    return ordered
+
+
+def run(devices: List[Device], image: bytes, args: argparse.Namespace) -> float:
+    """Upload to all planned devices, returns the elapsed wall time."""
+    _, version, sha256 = read_app_desc(image)
+    ordered = plan(devices, sha256, args.force)
+
+    slots = max(1, int(math.floor(args.airtime_budget / args.upload_rate)))
+    channels = {d.channel for d in ordered}
+    channel_sem = {c: threading.BoundedSemaphore(slots) for c in channels}
+    global_sem = threading.BoundedSemaphore(args.max_parallel)
+    lock = threading.Lock()
+
+    print('Image {} ({} bytes, sha256 {}...)'.format(version, len(image), sha256[:16]))
+    flips = [d for d in devices if d.status == 'slot flip']
+    print('{} devices, {} direct uploads on {} channel(s), {} per channel, {} slot flips'.format(
+        len(devices), len(ordered), len(channels), slots, len(flips)))
+    if args.dry_run:
+        for d in ordered:
+            print('  {:24} channel {:2}'.format(d.name, d.channel))
+        for d in flips:
+            print('  {:24} boot {}'.format(d.name, d.cached_slot(sha256)))
+        return 0.0
+
+    def flip(d: Device) -> None:
+        slot = d.cached_slot(sha256) or ''
+        try:
+            d.boot_slot(slot, args.timeout)
+            d.status = 'slot flip to {}'.format(slot)
+        except (OSError, RuntimeError, http.client.HTTPException) as e:
+            d.status = 'failed: {}'.format(e)
+            return
+        if args.verify:
+            d.status += ', verified' if d.wait_for(sha256, args.timeout) else ', not verified'
+
+    def job(d: Device) -> None:
+        with global_sem, channel_sem[d.channel]:
+            with lock:
+                print('  -> {} (channel {})'.format(d.name, d.channel))
+            try:
+                d.upload(image, args.timeout, args.netconn)
+                d.status = 'updated'
+            except (OSError, RuntimeError, http.client.HTTPException) as e:
+                d.status = 'failed: {}'.format(e)
+                return
+        if args.verify:
+            targets = [d] + [r for r in devices if r.covered_by is d]
+            for t in targets:
+                if not t.wait_for(sha256, args.timeout):
+                    t.status = 'not verified'
+                elif t.status == 'relayed':
+                    t.status = 'relayed, verified'
+                else:
+                    t.status = 'updated, verified'
+
+    start = time.monotonic()
+    with ThreadPoolExecutor(max_workers=16) as flip_pool:
+        pending_flips = [flip_pool.submit(flip, d) for d in flips]
+        with ThreadPoolExecutor(max_workers=max(1, min(len(ordered), slots * len(channels), args.max_parallel))) as pool:
+            list(pool.map(job, ordered))
+        for f in pending_flips:
+            f.result()
+    return time.monotonic() - start
+
+
+def report(devices: List[Device], image_size: int, elapsed: float) -> int:
+    print('\n{:24} {:>4} {:>9} {:>9}  {}'.format('device', 'ch', 'seconds', 'KB/s', 'status'))
+    uploaded = 0
+    delivered = 0
+    failed = 0
+    for d in devices:
+        rate = '{:9.1f}'.format(d.bytes / d.seconds / 1024) if d.seconds else '{:>9}'.format('-')
+        secs = '{:9.2f}'.format(d.seconds) if d.seconds else '{:>9}'.format('-')
+        status = d.status + (' via {}'.format(d.covered_by.name) if d.covered_by else '')
+        print('{:24} {:>4} {} {}  {}'.format(d.name, d.channel or '-', secs, rate, status))
+        uploaded += d.bytes
+        if d.status.startswith(('updated', 'relayed', 'identical', 'slot flip')):
+            delivered += image_size
+        if d.status.startswith(('failed', 'unreachable', 'error', 'not verified')) or d.status.endswith('not verified'):
+            failed += 1
+
+    if elapsed > 0:
+        print('\nUploaded {:.1f} KB in {:.2f} s: {:.1f} KB/s aggregate, {:.1f} KB/s effective (incl. relays and skips)'.format(
+            uploaded / 1024, elapsed, uploaded / elapsed / 1024, delivered / elapsed / 1024))
+    return 1 if failed else 0
+
+
+def bench(args: argparse.Namespace) -> int:
+    import mock_device
+
+    image = mock_device.make_image('bench-2', size=args.bench_image_kb * 1024)
+    old_image = mock_device.make_image('bench-1', size=args.bench_image_kb * 1024)
+    mocks = mock_device.start_fleet(args.bench, old_image, current=image, relay_every=4, cached=image,
+                                    channel_capacity=args.bench_channel_mbps)
+    devices = [Device('127.0.0.1:{}'.format(m.port)) for m in mocks]
+    try:
+        with ThreadPoolExecutor(max_workers=16) as pool:
+            list(pool.map(lambda d: d.fetch_info(), devices))
+        elapsed = run(devices, image, args)
+        return report(devices, len(image), elapsed)
+    finally:
+        mock_device.stop_fleet(mocks)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('image', nargs='?', help='application image (.bin)')
+    parser.add_argument('--devices', nargs='*', default=[], help='device addresses, host[:port]')
+    parser.add_argument('--inventory', help='file with one device address per line')
+    parser.add_argument('--airtime-budget', type=float, default=6.0,
+                        help='usable airtime per Wi-Fi channel in Mbit/s (default 6)')
+    parser.add_argument('--upload-rate', type=float, default=2.0,
+                        help='estimated airtime of one upload in Mbit/s (default 2)')
+    parser.add_argument('--max-parallel', type=int, default=8, help='overall concurrent uploads (default 8)')
+    parser.add_argument('--timeout', type=float, default=120.0, help='per-device timeout in seconds')
+    parser.add_argument('--force', action='store_true', help='upload even if the device runs the same image')
+    parser.add_argument('--verify', action='store_true', help='wait for every device to boot the new image')
+    parser.add_argument('--netconn', action='store_true',
+                        help='upload to the zero-copy listener where the device offers one')
+    parser.add_argument('--dry-run', action='store_true', help='print the plan without uploading')
+    parser.add_argument('--bench', type=int, metavar='N', help='benchmark against N local mock devices')
+    parser.add_argument('--bench-image-kb', type=int, default=512, help='mock image size for --bench')
+    parser.add_argument('--bench-channel-mbps', type=float, default=8.0, help='mock channel capacity for --bench')
+    args = parser.parse_args()
+
+    if args.bench:
+        sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+        return bench(args)
+    if not args.image:
+        parser.error('an image is required')
+
+    addresses = list(args.devices)
+    if args.inventory:
+        with open(args.inventory) as f:
+            addresses += [line.split('#')[0].strip() for line in f if line.split('#')[0].strip()]
+    if not addresses:
+        parser.error('no devices given')
+
+    image = open(args.image, 'rb').read()
+    devices = [Device(a) for a in addresses]
+    with ThreadPoolExecutor(max_workers=16) as pool:
+        list(pool.map(lambda d: d.fetch_info(), devices))
+
+    elapsed = run(devices, image, args)
+    return report(devices, len(image), elapsed)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
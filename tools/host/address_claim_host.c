@@ -0,0 +1,280 @@
+/*
+ * address_claim_host.c
+ *
+ * Runs the address arbitration of main/address_claim.c for several nodes
+ * on a simulated bus, a millisecond at a time:
+ *
+ *     ./build-host/address_claim
+ *
+ * Each node sends its claim at its start and again when the arbitration
+ * says so, no more often than every 250 ms, as the claim entry on the
+ * device's transmit scheduler does; every other node hears it a
+ * millisecond later. The scenarios are units left at their default
+ * address, a node joining a settled bus with a lower NAME, a bus with no
+ * address left to move to, and two units with the same NAME.
+ *
+ * The exit status is non-zero if two nodes are ever free to send from the
+ * same address, a node is free to send within 250 ms of claiming, or a
+ * scenario ends with other addresses than expected.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "address_claim.h"
+
+
+#define MAX_NODES       160
+#define RUN_MS          5000
+#define CLAIM_GAP_MS    250                 // Minimum gap of the claim entry, see pgn_senders.cpp
+#define NAME_BASE       ((uint64_t)4 << 60 | (uint64_t)30 << 49 | (uint64_t)140 << 40 | (uint64_t)2046 << 21)
+
+
+// A node on the bus
+typedef struct {
+    address_claim_t ac;
+    uint32_t        start_ms;
+    bool            due;                    // Claim to send
+    bool            ever_sent;
+    uint32_t        last_sent;
+    uint32_t        cannot_claims;          // Claims sent from N2K_NULL_ADDRESS
+} node_t;
+
+
+// A claim on the bus
+typedef struct {
+    int         from;
+    uint8_t     source;
+    uint8_t     data[8];
+} claim_frame_t;
+
+
+// Local variables
+static node_t           nodes[MAX_NODES];
+static int              node_count;
+static claim_frame_t    bus[MAX_NODES];
+static int              on_bus;
+
+
+static void add_node(uint64_t name, uint8_t address, uint32_t start_ms)
+{
+    node_t *n = &nodes[node_count++];
+    memset(n, 0, sizeof(*n));
+    address_claim_init(&n->ac, name, address);
+    n->start_ms = start_ms;
+}
+
+
+/**
+ * @brief Runs the bus until every claim has settled.
+ *
+ * @return The number of times the invariants were broken.
+ */
+static int run_bus(void)
+{
+    int errors = 0;
+    for (uint32_t now = 0; now < RUN_MS; now++) {
+        // Deliver what was sent last millisecond
+        claim_frame_t heard[MAX_NODES];
+        int count = on_bus;
+        memcpy(heard, bus, count * sizeof(bus[0]));
+        on_bus = 0;
+        for (int i = 0; i < count; i++) {
+            for (int j = 0; j < node_count; j++) {
+                node_t *n = &nodes[j];
+                if (j == heard[i].from || now < n->start_ms) {
+                    continue;
+                }
+                if (address_claim_received(&n->ac, heard[i].source, heard[i].data) != ADDRESS_CLAIM_IGNORE) {
+                    n->due = true;
+                }
+            }
+        }
+
+        // Send the claims that are due and allowed by the gap
+        for (int j = 0; j < node_count; j++) {
+            node_t *n = &nodes[j];
+            if (now == n->start_ms) {
+                n->due = true;
+            }
+            if (!n->due || (n->ever_sent && now - n->last_sent < CLAIM_GAP_MS)) {
+                continue;
+            }
+            claim_frame_t *f = &bus[on_bus++];
+            f->from = j;
+            f->source = n->ac.address;
+            address_claim_put_name(n->ac.name, f->data);
+            n->due = false;
+            n->ever_sent = true;
+            n->last_sent = now;
+            if (n->ac.address == N2K_NULL_ADDRESS) {
+                n->cannot_claims++;
+            } else {
+                address_claim_sent(&n->ac, now);
+            }
+        }
+
+        // No two nodes free to send from one address, none before its wait is over
+        for (int j = 0; j < node_count; j++) {
+            const node_t *n = &nodes[j];
+            if (!address_claim_ready(&n->ac, now)) {
+                continue;
+            }
+            if (now - n->ac.sent_ms < ADDRESS_CLAIM_WAIT_MS) {
+                printf("  node %d ready %u ms after its claim\n", j, (unsigned)(now - n->ac.sent_ms));
+                errors++;
+            }
+            for (int k = j + 1; k < node_count; k++) {
+                if (address_claim_ready(&nodes[k].ac, now) && nodes[k].ac.address == n->ac.address) {
+                    printf("  nodes %d and %d both on address %d at %u ms\n", j, k, n->ac.address,
+                           (unsigned)now);
+                    errors++;
+                }
+            }
+        }
+        if (errors > 10) {
+            break;
+        }
+    }
+    return errors;
+}
+
+
+/**
+ * @brief Checks where a node ended up.
+ */
+static int expect(int index, uint8_t address)
+{
+    const node_t *n = &nodes[index];
+    bool ready = address_claim_ready(&n->ac, RUN_MS);
+    if (n->ac.address != address || ready != (address != N2K_NULL_ADDRESS) ||
+        (address == N2K_NULL_ADDRESS && n->cannot_claims == 0)) {
+        printf("  node %d on address %d (%s), %u cannot-claims; expected address %d\n", index, n->ac.address,
+               ready ? "ready" : "not ready", (unsigned)n->cannot_claims, address);
+        return 1;
+    }
+    return 0;
+}
+
+
+static bool report(const char *name, int errors)
+{
+    int moved = 0;
+    int lost = 0;
+    for (int j = 0; j < node_count; j++) {
+        moved += nodes[j].ac.stats.moved;
+        lost += (nodes[j].ac.address == N2K_NULL_ADDRESS);
+    }
+    printf("%-40s %3d nodes, %3d moves, %3d without an address: %s\n", name, node_count, moved, lost,
+           errors == 0 ? "pass" : "FAIL");
+    return errors == 0;
+}
+
+
+/**
+ * @brief Units left at the default address 0, distinct NAMEs: the lowest
+ *        keeps 0, the others take 128 on in turn.
+ */
+static bool defaults(int units)
+{
+    node_count = 0;
+    for (int i = 0; i < units; i++) {
+        add_node(NAME_BASE | ADDRESS_CLAIM_ARBITRARY | (uint64_t)(0x1000 + i * 0x3B1 % 0x800), 0, 0);
+    }
+    int errors = run_bus();
+
+    int lowest = 0;
+    for (int i = 1; i < units; i++) {
+        lowest = (nodes[i].ac.name < nodes[lowest].ac.name) ? i : lowest;
+    }
+    errors += expect(lowest, 0);
+    bool seen[256] = { false };
+    for (int i = 0; i < units; i++) {
+        uint8_t a = nodes[i].ac.address;
+        if (i != lowest && (a < ADDRESS_CLAIM_FIRST || a > ADDRESS_CLAIM_LAST || seen[a])) {
+            errors += expect(i, 128);
+        }
+        seen[a] = true;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "%d units at the default address", units);
+    return report(name, errors);
+}
+
+
+/**
+ * @brief A unit settled on 10 and 128 taken; a node with a lower NAME joins
+ *        at 10 after a second. The unit moves past 128 to 129.
+ */
+static bool late_joiner(void)
+{
+    node_count = 0;
+    add_node(NAME_BASE | ADDRESS_CLAIM_ARBITRARY | 0x500, 10, 0);
+    add_node(NAME_BASE | 0x100, 128, 0);
+    add_node(NAME_BASE | 0x200, 10, 1000);
+    int errors = run_bus();
+    errors += expect(0, 129);
+    errors += expect(1, 128);
+    errors += expect(2, 10);
+    return report("lower NAME joins a settled bus", errors);
+}
+
+
+/**
+ * @brief Every address from 128 to 247 held by a node with a lower NAME:
+ *        of three units at 0 the lowest keeps it and the others send the
+ *        cannot-claim.
+ */
+static bool bus_full(void)
+{
+    node_count = 0;
+    for (int a = ADDRESS_CLAIM_FIRST; a <= ADDRESS_CLAIM_LAST; a++) {
+        add_node(NAME_BASE | (uint64_t)a, a, 0);
+    }
+    int first = node_count;
+    for (int i = 0; i < 3; i++) {
+        add_node(NAME_BASE | ADDRESS_CLAIM_ARBITRARY | (uint64_t)(0x900 + i), 0, 0);
+    }
+    int errors = run_bus();
+    errors += expect(first, 0);
+    errors += expect(first + 1, N2K_NULL_ADDRESS);
+    errors += expect(first + 2, N2K_NULL_ADDRESS);
+    return report("no address left to move to", errors);
+}
+
+
+/**
+ * @brief Two units with the same NAME, as when the identity number is not
+ *        set: neither can win, so both send the cannot-claim rather than
+ *        moving in step.
+ */
+static bool same_name(void)
+{
+    node_count = 0;
+    add_node(NAME_BASE | ADDRESS_CLAIM_ARBITRARY, 0, 0);
+    add_node(NAME_BASE | ADDRESS_CLAIM_ARBITRARY, 0, 0);
+    int errors = run_bus();
+    for (int i = 0; i < 2; i++) {
+        errors += expect(i, N2K_NULL_ADDRESS);
+        if (nodes[i].ac.stats.same_name == 0) {
+            printf("  node %d did not count a claim with its own NAME\n", i);
+            errors++;
+        }
+    }
+    return report("two units with the same NAME", errors);
+}
+
+
+int main(void)
+{
+    int failures = 0;
+    failures += !defaults(2);
+    failures += !defaults(8);
+    failures += !late_joiner();
+    failures += !bus_full();
+    failures += !same_name();
+    return failures == 0 ? 0 : 1;
+}
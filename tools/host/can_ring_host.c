@@ -0,0 +1,512 @@
+/*
+ * can_ring_host.c
+ *
+ * Linux stand-in for the NMEA 2000 receive ring (CONFIG_NMEA_RX_RING). A
+ * thread plays the TWAI interrupt, decoding a synthetic frame mix into
+ * can_ring_t slots and notifying the consumer only when a frame lands in
+ * an empty ring; the consumer waits on a sticky notification bit, as the
+ * NMEA task waits in xTaskNotifyWait(), and drains the ring through
+ * pgn_handlers_drain():
+ *
+ *      ./build-host/can_ring [seconds]
+ *
+ * The same frames are then put through the driver's scheme for comparison:
+ * the interrupt copies each frame into a queue, and the task copies them
+ * out again a batch at a time through pgn_handlers_pump(). Each is run at
+ * the frame rate of a fully loaded 250 kbit/s bus, at that rate with the
+ * task held off for 10 ms in every 50 (other work at a higher priority),
+ * and flat out, the interrupt waiting for room. "wakeups" counts the times
+ * the consumer blocked and was woken with frames waiting, the context
+ * switches the frames cost.
+ *
+ * Last, a 16-slot ring is run flat out with every frame numbered, checking
+ * that each frame is seen once and in order.
+ *
+ * The exit status is non-zero if a frame is dropped at full bus load, a
+ * frame is miscounted, lost or repeated.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "can_ring.h"
+#include "pgn_handlers.h"
+
+
+#define OWN_ADDRESS     35
+#define RING_LEN        64                  // CONFIG_NMEA_RX_RING_LEN and CONFIG_NMEA_RX_QUEUE_LEN defaults
+#define CHECK_RING_LEN  16
+#define FULL_LOAD_FPS   1800                // 250 kbit/s of 8-byte extended frames, with stuffing
+#define HOLD_OFF_MS     10                  // Task held off for this long
+#define HOLD_PERIOD_MS  50                  // in every this long
+#define IDLE_MS         100
+#define MIX_LEN         8
+
+
+// Waiting the way a FreeRTOS task waits for a notification: a bit that
+// stays set until the wait clears it
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            bit;
+    uint32_t        wakeups;                // Waits that blocked and were woken by the bit
+} notify_t;
+
+
+// Queue with a copy in and a copy out per frame, as the TWAI driver's
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    n2k_frame_t     frames[RING_LEN];
+    uint32_t        head;
+    uint32_t        count;
+    uint32_t        max_used;
+    bool            waiting;                // Consumer blocked on the queue
+    uint32_t        wakeups;
+} queue_t;
+
+
+// One run
+typedef struct {
+    bool        use_ring;
+    int         fps;                        // 0 for flat out
+    bool        hold_off;
+    int64_t     frames;                     // To produce
+    int64_t     pushed;
+    int64_t     handled;                    // Of those pushed, frames that reach a handler
+    int64_t     dropped;
+    int64_t     end_ns;                     // When the last frame was produced
+    int         done;                       // Producer finished, read atomically
+} run_t;
+
+
+// Local variables
+static n2k_frame_t  mix[MIX_LEN];
+static bool         mix_is_handled[MIX_LEN];
+static n2k_frame_t  slots[RING_LEN];
+static can_ring_t   ring;
+static notify_t     notify;
+static queue_t      queue;
+static int64_t      start_ns;
+static int          failures;
+
+
+static int64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+static void deadline_after(struct timespec *t, uint32_t ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, t);
+    t->tv_sec += ms / 1000;
+    t->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+static void put_le(uint8_t *p, uint32_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+
+/**
+ * @brief Adds a frame to the mix, padded with 0xFF as senders do.
+ */
+static n2k_frame_t *add(int *n, uint32_t pgn, uint8_t source, uint8_t destination, bool handled)
+{
+    n2k_frame_t *f = &mix[*n];
+    f->id = n2k_make_id(pgn, 3, source, destination);
+    f->len = 8;
+    memset(f->data, 0xFF, 8);
+    mix_is_handled[(*n)++] = handled;
+    return f;
+}
+
+
+/**
+ * @brief Builds the traffic mix: single-frame PGNs that are handled, some
+ *        nobody here listens to, and a request addressed to another node.
+ */
+static void build_mix(void)
+{
+    int n = 0;
+    n2k_frame_t *f;
+
+    f = add(&n, 127250, 10, N2K_BROADCAST, true);           // Heading
+    put_le(&f->data[1], 12345, 2);
+    f = add(&n, 129026, 11, N2K_BROADCAST, true);           // COG and SOG
+    put_le(&f->data[2], 30000, 2);
+    put_le(&f->data[4], 456, 2);
+    f = add(&n, 128267, 12, N2K_BROADCAST, true);           // Depth
+    put_le(&f->data[1], 1234, 4);
+    f = add(&n, 127488, 20, N2K_BROADCAST, true);           // Engine speed
+    put_le(&f->data[1], 8600, 2);
+    add(&n, 130306, 13, N2K_BROADCAST, false);              // Wind
+    add(&n, 127257, 10, N2K_BROADCAST, false);              // Attitude
+    add(&n, 127251, 10, N2K_BROADCAST, false);              // Rate of turn
+    add(&n, 59904, 30, 40, false)->len = 3;                 // Request to another node
+}
+
+
+static void notify_give(notify_t *nt)
+{
+    pthread_mutex_lock(&nt->mutex);
+    nt->bit = true;
+    pthread_cond_signal(&nt->cond);
+    pthread_mutex_unlock(&nt->mutex);
+}
+
+
+/**
+ * @brief Waits for the bit and clears it.
+ *
+ * @return Whether it was set before the timeout.
+ */
+static bool notify_wait(notify_t *nt, uint32_t timeout_ms)
+{
+    struct timespec deadline;
+    deadline_after(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&nt->mutex);
+    bool blocked = !nt->bit;
+    while (!nt->bit && pthread_cond_timedwait(&nt->cond, &nt->mutex, &deadline) != ETIMEDOUT) {
+    }
+    bool got = nt->bit;
+    nt->bit = false;
+    nt->wakeups += (blocked && got);
+    pthread_mutex_unlock(&nt->mutex);
+    return got;
+}
+
+
+/**
+ * @brief Interrupt side of the driver's scheme: copies the frame into the
+ *        queue and wakes the consumer if it is waiting.
+ *
+ * @return Whether there was room.
+ */
+static bool queue_send(queue_t *q, const n2k_frame_t *f)
+{
+    pthread_mutex_lock(&q->mutex);
+    bool room = q->count < RING_LEN;
+    if (room) {
+        q->frames[(q->head + q->count) % RING_LEN] = *f;
+        q->count++;
+        q->max_used = (q->count > q->max_used) ? q->count : q->max_used;
+        if (q->waiting) {
+            pthread_cond_signal(&q->cond);
+        }
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return room;
+}
+
+
+/**
+ * @brief Frame source on the queue, as twai_source_receive() on the
+ *        driver: waits for the first frame, then copies out what is
+ *        waiting.
+ */
+static int queue_receive(void *ctx, n2k_frame_t *frames, int max, uint32_t timeout_ms)
+{
+    queue_t *q = (queue_t *)ctx;
+    struct timespec deadline;
+    deadline_after(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->count == 0) {
+        q->waiting = true;
+        while (q->count == 0 && pthread_cond_timedwait(&q->cond, &q->mutex, &deadline) != ETIMEDOUT) {
+        }
+        q->waiting = false;
+        q->wakeups += (q->count > 0);
+    }
+    int n = 0;
+    for (; n < max && q->count > 0; n++) {
+        frames[n] = q->frames[q->head];
+        q->head = (q->head + 1) % RING_LEN;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
+
+
+/**
+ * @brief Plays the controller interrupt: produces the mix round robin,
+ *        paced to r->fps if set, into the ring or the queue. Paced, a frame
+ *        finding no room is dropped, as the controller would lose it; flat
+ *        out, it waits for room, so the run measures the consumer.
+ */
+static void *producer(void *arg)
+{
+    run_t *r = (run_t *)arg;
+
+    for (int64_t i = 0; i < r->frames; i++) {
+        if (r->fps) {
+            int64_t due = start_ns + i * 1000000000 / r->fps;
+            while (now_ns() < due) {
+            }
+        }
+        const n2k_frame_t *m = &mix[i % MIX_LEN];
+        uint32_t now_ms = (uint32_t)(now_ns() / 1000000);
+        bool taken;
+
+        if (r->use_ring) {
+            n2k_frame_t *f = can_ring_slot(&ring);
+            taken = (f != NULL);
+            if (taken) {
+                f->id = m->id;
+                f->len = m->len;
+                f->time_ms = now_ms;
+                memcpy(f->data, m->data, 8);
+                if (can_ring_push(&ring)) {
+                    notify_give(&notify);
+                }
+            }
+        } else {
+            n2k_frame_t f = *m;
+            f.time_ms = now_ms;
+            taken = queue_send(&queue, &f);
+        }
+        if (taken) {
+            r->pushed++;
+            r->handled += mix_is_handled[i % MIX_LEN];
+        } else if (r->fps) {
+            r->dropped++;
+        } else {
+            i--;
+            sched_yield();
+        }
+    }
+    r->end_ns = now_ns();
+    __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+    if (r->use_ring) {
+        notify_give(&notify);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Holds the consumer off for HOLD_OFF_MS at the start of every
+ *        HOLD_PERIOD_MS, if the run asks for it.
+ */
+static void hold_off(const run_t *r)
+{
+    if (!r->hold_off) {
+        return;
+    }
+    int64_t in_period = (now_ns() - start_ns) % ((int64_t)HOLD_PERIOD_MS * 1000000);
+    if (in_period < (int64_t)HOLD_OFF_MS * 1000000) {
+        int64_t wait_ns = (int64_t)HOLD_OFF_MS * 1000000 - in_period;
+        struct timespec t = { 0, (long)wait_ns };
+        nanosleep(&t, NULL);
+    }
+}
+
+
+/**
+ * @brief Runs the producer against one receive path and prints one line.
+ */
+static void run(const char *label, bool use_ring, int fps, bool held, int64_t frames)
+{
+    run_t r = { 0 };
+    r.use_ring = use_ring;
+    r.fps = fps;
+    r.hold_off = held;
+    r.frames = frames;
+
+    can_ring_init(&ring, slots, RING_LEN);
+    notify.bit = false;
+    notify.wakeups = 0;
+    queue.head = 0;
+    queue.count = 0;
+    queue.max_used = 0;
+    queue.wakeups = 0;
+    pgn_handlers_reset_stats();
+
+    const n2k_source_t source = { queue_receive, &queue };
+    pthread_t thread;
+    start_ns = now_ns();
+    pthread_create(&thread, NULL, producer, &r);
+    while (1) {
+        hold_off(&r);
+        bool done = __atomic_load_n(&r.done, __ATOMIC_ACQUIRE);
+        if (use_ring) {
+            // As the NMEA task: empty the ring before waiting
+            if (pgn_handlers_drain(&ring) == 0) {
+                if (done) {
+                    break;
+                }
+                notify_wait(&notify, IDLE_MS);
+            }
+        } else if (pgn_handlers_pump(&source, IDLE_MS) == 0 && done) {
+            break;
+        }
+    }
+    pthread_join(thread, NULL);
+    double s = (r.end_ns - start_ns) / 1e9;
+
+    pgn_stats_t st;
+    pgn_handlers_get_stats(&st);
+    uint32_t wakeups = use_ring ? notify.wakeups : queue.wakeups;
+    uint32_t max_used = use_ring ? ring.max_used : queue.max_used;
+    printf("%-24s %-6s %9lu %9.0f %7lld %8lu %8.2f %9.1f %5lu %6d\n", label, use_ring ? "ring" : "queue",
+           (unsigned long)st.frames, st.frames / s, (long long)r.dropped, (unsigned long)wakeups,
+           st.frames ? (double)wakeups / st.frames : 0.0, st.batches ? (double)st.frames / st.batches : 0.0,
+           (unsigned long)max_used, use_ring ? 1 : 3);
+
+    if (st.frames != (uint32_t)r.pushed || (fps && r.dropped) || st.handled != (uint32_t)r.handled) {
+        fprintf(stderr, "%s, %s: %lld pushed, %lld dropped, %lu received; %lld to handle, %lu handled\n", label,
+                use_ring ? "ring" : "queue", (long long)r.pushed, (long long)r.dropped, (unsigned long)st.frames,
+                (long long)r.handled, (unsigned long)st.handled);
+        failures++;
+    }
+    if (use_ring && fps && ring.dropped != (uint32_t)r.dropped) {
+        fprintf(stderr, "%s: ring counted %lu dropped, %lld were\n", label, (unsigned long)ring.dropped,
+                (long long)r.dropped);
+        failures++;
+    }
+}
+
+
+// Sequence check: producer state
+typedef struct {
+    can_ring_t  *ring;
+    uint32_t    frames;
+    int         done;
+} seq_run_t;
+
+
+static void *seq_producer(void *arg)
+{
+    seq_run_t *r = (seq_run_t *)arg;
+
+    for (uint32_t seq = 0; seq < r->frames;) {
+        n2k_frame_t *f = can_ring_slot(r->ring);
+        if (f == NULL) {
+            sched_yield();                  // Wait for room, numbering only frames pushed
+            continue;
+        }
+        f->id = seq * 7;
+        f->len = 8;
+        put_le(f->data, seq, 4);
+        put_le(&f->data[4], ~seq, 4);
+        can_ring_push(r->ring);
+        seq++;
+    }
+    __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+
+/**
+ * @brief Runs a small ring flat out, checking every frame is seen once,
+ *        in order and whole, across wraps and peeks split at the end.
+ */
+static void check_sequence(uint32_t frames)
+{
+    static n2k_frame_t check_slots[CHECK_RING_LEN];
+    can_ring_t r;
+    can_ring_init(&r, check_slots, CHECK_RING_LEN);
+    seq_run_t sr = { &r, frames, 0 };
+
+    pthread_t thread;
+    int64_t t0 = now_ns();
+    pthread_create(&thread, NULL, seq_producer, &sr);
+
+    uint32_t expected = 0;
+    uint32_t errors = 0;
+    uint32_t peeks = 0;
+    while (expected < frames) {
+        const n2k_frame_t *f;
+        int n = can_ring_peek(&r, &f, N2K_BATCH);
+        for (int i = 0; i < n; i++, expected++) {
+            uint32_t seq = f[i].data[0] | f[i].data[1] << 8 | f[i].data[2] << 16 | (uint32_t)f[i].data[3] << 24;
+            uint32_t inv = f[i].data[4] | f[i].data[5] << 8 | f[i].data[6] << 16 | (uint32_t)f[i].data[7] << 24;
+            if (seq != expected || inv != ~expected || f[i].id != expected * 7) {
+                if (errors++ < 5) {
+                    fprintf(stderr, "sequence: frame %lu read as %lu\n", (unsigned long)expected,
+                            (unsigned long)seq);
+                }
+                expected = seq;
+            }
+        }
+        can_ring_pop(&r, n);
+        if (n > 0) {
+            peeks++;
+        } else {
+            sched_yield();
+        }
+    }
+    pthread_join(thread, NULL);
+    double s = (now_ns() - t0) / 1e9;
+
+    printf("\nSequence check, %d slots: %lu frames in %.2f s (%.1f M/s), %.1f per peek, %lu out of order\n",
+           CHECK_RING_LEN, (unsigned long)frames, s, frames / s / 1e6, peeks ? (double)frames / peeks : 0.0,
+           (unsigned long)errors);
+    if (errors || r.head != frames || r.tail != frames) {
+        failures++;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+    int64_t load_frames = (int64_t)(seconds * FULL_LOAD_FPS);
+
+    build_mix();
+    pthread_mutex_init(&notify.mutex, NULL);
+    cond_init(&notify.cond);
+    pthread_mutex_init(&queue.mutex, NULL);
+    cond_init(&queue.cond);
+    static fast_packet_ctx_t contexts[8];
+    pgn_handlers_init(OWN_ADDRESS, contexts, 8);
+
+    printf("Receive ring against a copying queue, %d slots each, %d-frame mix\n\n", RING_LEN, MIX_LEN);
+    printf("%-24s %-6s %9s %9s %7s %8s %8s %9s %5s %6s\n", "run", "path", "frames", "frames/s", "dropped",
+           "wakeups", "/frame", "per batch", "max", "copies");
+    run("full load, 250 kbit/s", true, FULL_LOAD_FPS, false, load_frames);
+    run("full load, 250 kbit/s", false, FULL_LOAD_FPS, false, load_frames);
+    run("full load, task held off", true, FULL_LOAD_FPS, true, load_frames);
+    run("full load, task held off", false, FULL_LOAD_FPS, true, load_frames);
+    run("flat out", true, 0, false, 2000000);
+    run("flat out", false, 0, false, 2000000);
+
+    check_sequence(5000000);
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * dhcp_join_host.c
+ *
+ * Linux stand-in for the DHCP part of the join-to-portal benchmark (the
+ * 'joins' command). Scripted clients get their leases from the server in
+ * main/dhcp_proto.c over a simulated link with a fixed round trip time,
+ * once set up like the built-in esp_netif server (no rapid commit, leases
+ * lost on restart) and once like the fast server:
+ *
+ *      ./build-host/dhcp_join [rtt_ms] [clients]
+ *
+ * Join times are simulated time from the first message to the lease. The
+ * exit status is non-zero if a client ends without a lease, gets a
+ * malformed reply or shares its address with another client.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dhcp_proto.h"
+
+
+#define SERVER_IP       0xC0A80401          // 192.168.4.1
+#define MAX_CLIENTS     32
+#define MAX_ATTEMPTS    4
+
+
+// A station
+typedef struct {
+    uint8_t     mac[6];
+    bool        rapid_commit;               // Asks for rapid commit
+    uint32_t    ip;                         // Address it holds, 0 if none
+} client_t;
+
+
+// Result of a batch of joins
+typedef struct {
+    int         joins;
+    int         failed;
+    int         messages;                   // Sent by clients and server
+    int         naks;
+    int64_t     total_us;
+    int64_t     max_us;
+} batch_t;
+
+
+// Local variables
+static int64_t  rtt_us = 10000;
+static int64_t  clock_us = 1000000;
+static int      bad_replies;
+
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+
+/**
+ * @brief Builds a client message.
+ *
+ * @return Its length.
+ */
+static size_t client_msg(uint8_t *m, const client_t *c, uint8_t type, uint32_t ciaddr, uint32_t requested_ip,
+                         uint32_t server_id)
+{
+    memset(m, 0, 300);
+    m[0] = 1;                               // BOOTREQUEST
+    m[1] = 1;
+    m[2] = 6;
+    put_u32(&m[4], rand());
+    put_u32(&m[12], ciaddr);
+    memcpy(&m[28], c->mac, 6);
+    put_u32(&m[236], 0x63825363);
+
+    uint8_t *p = m + DHCP_MIN_MSG_LEN;
+    *p++ = 53;
+    *p++ = 1;
+    *p++ = type;
+    if (requested_ip) {
+        *p++ = 50;
+        *p++ = 4;
+        put_u32(p, requested_ip);
+        p += 4;
+    }
+    if (server_id) {
+        *p++ = 54;
+        *p++ = 4;
+        put_u32(p, server_id);
+        p += 4;
+    }
+    if (type == DHCP_DISCOVER && c->rapid_commit) {
+        *p++ = 80;
+        *p++ = 0;
+    }
+    *p++ = 55;                              // Parameter request list, as phones send it
+    *p++ = 3;
+    *p++ = 1;
+    *p++ = 3;
+    *p++ = 6;
+    *p++ = 255;
+    return p - m;
+}
+
+
+/**
+ * @brief Sends a message across the simulated link and returns the reply
+ *        type, 0 if none.
+ */
+static uint8_t exchange(dhcp_proto_server_t *server, const uint8_t *msg, size_t len, batch_t *b,
+                        dhcp_proto_reply_t *info)
+{
+    uint8_t reply[DHCP_REPLY_LEN];
+
+    clock_us += rtt_us / 2;
+    b->messages++;
+    size_t n = dhcp_proto_handle(server, msg, len, clock_us, reply, sizeof(reply), info);
+    if (n == 0) {
+        return 0;
+    }
+    clock_us += rtt_us / 2;
+    b->messages++;
+
+    uint32_t yiaddr = ((uint32_t)reply[16] << 24) | ((uint32_t)reply[17] << 16) | ((uint32_t)reply[18] << 8) | reply[19];
+    if (n != DHCP_REPLY_LEN || reply[0] != 2 || memcmp(&reply[28], &msg[28], 6) != 0 || reply[240] != 53 ||
+        reply[242] != info->type || yiaddr != info->yiaddr) {
+        bad_replies++;
+        return 0;
+    }
+    return info->type;
+}
+
+
+/**
+ * @brief Gets a client a lease, as a phone does after associating: an
+ *        INIT-REBOOT REQUEST for the address it had if any, else (or after
+ *        a NAK) DISCOVER and REQUEST.
+ */
+static void join(dhcp_proto_server_t *server, client_t *c, batch_t *b)
+{
+    uint8_t msg[300];
+    dhcp_proto_reply_t info;
+    int64_t start = clock_us;
+    uint32_t requested = c->ip;
+
+    c->ip = 0;
+    for (int attempt = 0; attempt < MAX_ATTEMPTS && c->ip == 0; attempt++) {
+        uint8_t type;
+        if (requested) {
+            type = exchange(server, msg, client_msg(msg, c, DHCP_REQUEST, 0, requested, 0), b, &info);
+            requested = 0;
+        } else {
+            type = exchange(server, msg, client_msg(msg, c, DHCP_DISCOVER, 0, 0, 0), b, &info);
+            if (type == DHCP_OFFER) {
+                type = exchange(server, msg, client_msg(msg, c, DHCP_REQUEST, 0, info.yiaddr, SERVER_IP), b, &info);
+            }
+        }
+        if (type == DHCP_ACK) {
+            c->ip = info.yiaddr;
+        } else if (type == DHCP_NAK) {
+            b->naks++;
+        }
+    }
+
+    int64_t us = clock_us - start;
+    b->joins++;
+    b->failed += (c->ip == 0);
+    b->total_us += us;
+    b->max_us = (us > b->max_us) ? us : b->max_us;
+}
+
+
+/**
+ * @brief Counts the clients holding an address that another one holds too.
+ */
+static int duplicates(const client_t *clients, int count)
+{
+    int dups = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            dups += (clients[i].ip != 0 && clients[i].ip == clients[j].ip);
+        }
+    }
+    return dups;
+}
+
+
+/**
+ * @brief Prints one line of the results.
+ */
+static void report(const char *scenario, const char *config, const batch_t *b)
+{
+    printf("%-28s %-8s %6d %9.1f %9.1f %9.1f %5d %6d\n", scenario, config, b->joins,
+           b->joins ? (double)b->messages / b->joins : 0.0, b->joins ? b->total_us / 1000.0 / b->joins : 0.0,
+           b->max_us / 1000.0, b->naks, b->failed);
+}
+
+
+/**
+ * @brief Runs the scenarios against one server set up.
+ *
+ * @return The number of failures.
+ */
+static int run(const char *config, bool fast, int count)
+{
+    const dhcp_proto_config_t cfg = {
+        .server_ip = SERVER_IP,
+        .netmask = 0xFFFFFF00,
+        .pool_start = SERVER_IP + 1,
+        .pool_size = 8,
+        .lease_s = 7200,
+        .rapid_commit = fast,
+    };
+    dhcp_lease_t leases[8];
+    dhcp_proto_server_t server;
+    client_t clients[MAX_CLIENTS + 1];
+    int failures = 0;
+
+    for (int phase = 0; phase < 3; phase++) {
+        memset(clients, 0, sizeof(clients));
+        for (int i = 0; i <= count; i++) {
+            clients[i].mac[0] = 0x02;
+            clients[i].mac[5] = i + 1;
+            clients[i].rapid_commit = (phase == 1);
+        }
+        dhcp_proto_init(&server, &cfg, leases, false);
+
+        batch_t first = { 0 }, rejoin = { 0 };
+        for (int i = 0; i < count; i++) {
+            join(&server, &clients[i], &first);
+        }
+        if (phase < 2) {
+            report(phase ? "first join, rapid commit" : "first join", config, &first);
+        } else {
+            // Restart, e.g. into a new image, and a new station joins before the others are back
+            clock_us += 5000000;
+            dhcp_proto_init(&server, &cfg, leases, fast);
+            batch_t newcomer = { 0 };
+            join(&server, &clients[count], &newcomer);
+            for (int i = count - 1; i >= 0; i--) {
+                join(&server, &clients[i], &rejoin);
+            }
+            report("rejoin after restart", config, &rejoin);
+            failures += newcomer.failed;
+        }
+        failures += first.failed + rejoin.failed + duplicates(clients, (phase < 2) ? count : count + 1);
+    }
+    return failures;
+}
+
+
+/**
+ * @brief Times the server on a DISCOVER/REQUEST pair.
+ *
+ * @return Nanoseconds per message.
+ */
+static double handle_ns(void)
+{
+    const dhcp_proto_config_t cfg = {
+        .server_ip = SERVER_IP, .netmask = 0xFFFFFF00, .pool_start = SERVER_IP + 1, .pool_size = 8, .lease_s = 7200,
+    };
+    dhcp_lease_t leases[8];
+    dhcp_proto_server_t server;
+    dhcp_proto_init(&server, &cfg, leases, false);
+
+    uint8_t discover[8][300], request[8][300], reply[DHCP_REPLY_LEN];
+    size_t dlen[8], rlen[8];
+    for (int i = 0; i < 8; i++) {
+        client_t c = { .mac = { 0x02, 0, 0, 0, 1, i } };
+        dlen[i] = client_msg(discover[i], &c, DHCP_DISCOVER, 0, 0, 0);
+        rlen[i] = client_msg(request[i], &c, DHCP_REQUEST, 0, cfg.pool_start + i, SERVER_IP);
+    }
+
+    const int rounds = 200000;
+    dhcp_proto_reply_t info;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < rounds; i++) {
+        dhcp_proto_handle(&server, discover[i & 7], dlen[i & 7], i, reply, sizeof(reply), &info);
+        dhcp_proto_handle(&server, request[i & 7], rlen[i & 7], i, reply, sizeof(reply), &info);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / (2.0 * rounds);
+}
+
+
+int main(int argc, char **argv)
+{
+    rtt_us = (argc > 1) ? (int64_t)(atof(argv[1]) * 1000) : 10000;
+    int count = (argc > 2) ? atoi(argv[2]) : 4;
+    if (count < 1 || count > 7) {
+        fprintf(stderr, "clients: 1 to 7, the pool has 8 addresses\n");
+        return 1;
+    }
+    srand(1);
+
+    printf("Simulated round trip %.1f ms, %d clients, 8 addresses\n\n", rtt_us / 1000.0, count);
+    printf("%-28s %-8s %6s %9s %9s %9s %5s %6s\n", "scenario", "server", "joins", "msgs/join", "mean ms",
+           "max ms", "naks", "failed");
+    int failures = run("built-in", false, count);
+    failures += run("fast", true, count);
+    printf("\nServer time %.0f ns per message\n", handle_ns());
+
+    if (bad_replies) {
+        fprintf(stderr, "%d malformed replies\n", bad_replies);
+    }
+    if (failures) {
+        fprintf(stderr, "%d clients without a lease or with a shared address\n", failures);
+    }
+    return (failures || bad_replies) ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * esp_app_desc.h
+ *
+ * Host stand-in for the ESP-IDF header.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ESP_APP_DESC_H
+#define ESP_APP_DESC_H
+
+typedef struct {
+    char    project_name[32];
+    char    version[32];
+} esp_app_desc_t;
+
+const esp_app_desc_t *esp_app_get_description(void);
+
+#endif
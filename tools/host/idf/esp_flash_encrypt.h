@@ -0,0 +1,17 @@
+/*
+ * esp_flash_encrypt.h
+ *
+ * Host stand-in for the ESP-IDF header.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ESP_FLASH_ENCRYPT_H
+#define ESP_FLASH_ENCRYPT_H
+
+#include <stdbool.h>
+
+bool esp_flash_encryption_enabled(void);
+
+#endif
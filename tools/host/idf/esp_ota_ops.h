@@ -0,0 +1,37 @@
+/*
+ * esp_ota_ops.h
+ *
+ * Host stand-in for the ESP-IDF header, with the partition read the OTA
+ * writer uses. The test supplies the functions.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ESP_OTA_OPS_H
+#define ESP_OTA_OPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_app_desc.h"
+
+#define OTA_SIZE_UNKNOWN        0xffffffff
+
+typedef uint32_t esp_ota_handle_t;
+
+typedef struct {
+    char        label[17];
+    uint32_t    size;
+} esp_partition_t;
+
+const esp_partition_t *esp_ota_get_running_partition(void);
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *app_desc);
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_abort(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+
+#endif
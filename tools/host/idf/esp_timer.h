@@ -0,0 +1,17 @@
+/*
+ * esp_timer.h
+ *
+ * Host stand-in for the ESP-IDF header.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * FreeRTOS.h
+ *
+ * Host stand-in for the spinlock the OTA writer takes; the test runs on
+ * one thread.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+typedef int portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define portENTER_CRITICAL(mux)         (void)(mux)
+#define portEXIT_CRITICAL(mux)          (void)(mux)
+
+#endif
@@ -0,0 +1,500 @@
+/*
+ * iso_tp_host.c
+ *
+ * Linux stand-in for the transport protocol answers of the NMEA task. The
+ * engine in main/iso_tp.c runs in a thread driven by a timed condition
+ * wait, as the device drives it from an esp_timer. Its frames go through
+ * a 16-frame transmit queue onto a simulated 250 kbit/s bus, one frame per
+ * ISO_TP_FRAME_US, where scripted nodes request messages, answer with CTS
+ * and EOMA and record what arrives:
+ *
+ *      ./build-host/iso_tp [sessions] [bam_interval_ms]
+ *
+ * Three runs: the product information broadcast on an idle bus; 1785-byte
+ * transfers to 1 to 16 nodes at once; and the broadcast again while eight
+ * transfers fill the bus. Each shows the payload throughput and the spacing
+ * of the broadcast packets as the engine sent them and as the nodes
+ * received them; the two differ by the connection packets queued ahead.
+ * The exit status is non-zero if a transfer that was not refused fails,
+ * data arrives corrupted, transfers by connection reach less than half
+ * the bus rate, or two broadcast packets are sent closer than the
+ * interval.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iso_tp.h"
+
+
+#define OWN_ADDRESS     35
+#define FIRST_NODE      60
+#define MAX_NODES       16
+#define MAX_SESSIONS    64
+#define TX_QUEUE_LEN    16                  // As the TWAI driver is set up
+#define RX_QUEUE_LEN    256
+#define FRAME_US        ISO_TP_FRAME_US     // 8-byte extended frame at 250 kbit/s, with stuffing
+#define WINDOW          16                  // Packets a node allows per CTS
+#define PGN_PRODUCT     126996
+#define PGN_BIG         65280               // Test message of ISO_TP_MAX_LEN bytes
+#define MAX_GAPS        512
+#define CLOCK_START_US  0x80100000u         // Engine clock at start, over 2^31 us past its initial estimates
+#define RUN_LIMIT_S     30                  // A run still going after this has stalled
+#define MIN_RATE        (7 * 1000000 / FRAME_US / 2)    // Connection payload bytes/s, half the bus
+
+
+// A node on the bus
+typedef struct {
+    uint8_t     address;
+    uint8_t     buf[ISO_TP_MAX_LEN];
+    uint16_t    len;
+    uint8_t     packets;
+    uint8_t     next;                       // Packet expected, from 1
+    uint8_t     window_end;
+    bool        done;
+    bool        aborted;
+    bool        corrupt;
+} node_t;
+
+
+// Spacing of broadcast packets
+typedef struct {
+    int         count;
+    uint32_t    last_us;
+    uint32_t    gaps_us[MAX_GAPS];
+} gaps_t;
+
+
+// Local variables
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   device_cond;        // Frames for the device, or stop
+static pthread_cond_t   bus_cond;           // Frames queued for the bus, or stop
+static bool             stopping;
+
+static iso_tp_t         tp;
+static iso_tp_session_t sessions[MAX_SESSIONS];
+static uint8_t          product_info[134];
+static uint8_t          big[ISO_TP_MAX_LEN];
+
+static n2k_frame_t      tx_queue[TX_QUEUE_LEN];
+static int              tx_head, tx_count;
+static n2k_frame_t      rx_queue[RX_QUEUE_LEN];
+static int              rx_head, rx_count;
+
+static node_t           nodes[MAX_NODES];
+static uint8_t          bam_buf[ISO_TP_MAX_LEN];
+static uint16_t         bam_len;
+static uint8_t          bam_next;
+static int              bams_received;
+static gaps_t           sent_gaps, received_gaps;
+static uint64_t         payload_bytes;
+static int              failures;
+static uint64_t         start_us;
+
+
+/**
+ * @brief The engine's 32-bit clock, as on the device, but started at
+ *        CLOCK_START_US so a stale estimate from before the clock went
+ *        round is exercised from the first run.
+ */
+static uint32_t now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)((uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000 - start_us + CLOCK_START_US);
+}
+
+
+static struct timespec after_us(int64_t us)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    t.tv_nsec += (us % 1000000) * 1000;
+    t.tv_sec += us / 1000000 + t.tv_nsec / 1000000000;
+    t.tv_nsec %= 1000000000;
+    return t;
+}
+
+
+static void add_gap(gaps_t *g, uint32_t t_us)
+{
+    if (g->last_us != 0 && g->count < MAX_GAPS) {
+        g->gaps_us[g->count++] = t_us - g->last_us;
+    }
+    g->last_us = t_us;
+}
+
+
+/**
+ * @brief Frame sink of the engine: the driver's transmit queue. Called with
+ *        lock held.
+ */
+static int queue_send(void *ctx, const n2k_frame_t *frames, int count)
+{
+    int n = 0;
+    while (n < count && tx_count < TX_QUEUE_LEN) {
+        n2k_msg_t msg;
+        n2k_parse(&frames[n], &msg);
+        if (msg.pgn == ISO_TP_PGN_DT && msg.destination == N2K_BROADCAST) {
+            add_gap(&sent_gaps, now_us());
+        }
+        tx_queue[(tx_head + tx_count++) % TX_QUEUE_LEN] = frames[n++];
+    }
+    pthread_cond_signal(&bus_cond);
+    return n;
+}
+
+
+/**
+ * @brief Puts a frame from a node in the device's receive queue. Called
+ *        with lock held.
+ */
+static void node_send(uint8_t source, uint32_t pgn, uint8_t destination, const uint8_t *data)
+{
+    if (rx_count == RX_QUEUE_LEN) {
+        failures++;
+        return;
+    }
+    n2k_frame_t *f = &rx_queue[(rx_head + rx_count++) % RX_QUEUE_LEN];
+    f->id = n2k_make_id(pgn, (pgn == ISO_TP_PGN_CM) ? ISO_TP_PRIORITY : 6, source, destination);
+    f->len = 8;
+    memcpy(f->data, data, 8);
+    pthread_cond_signal(&device_cond);
+}
+
+
+static void node_cm(node_t *n, uint8_t control, uint8_t b1, uint8_t b2, uint32_t pgn)
+{
+    uint8_t d[8] = { control, b1, b2, 0xFF, 0xFF, pgn & 0xFF, (pgn >> 8) & 0xFF, pgn >> 16 };
+    node_send(n->address, ISO_TP_PGN_CM, OWN_ADDRESS, d);
+}
+
+
+/**
+ * @brief A node asks for a PGN, from the device or from all.
+ */
+static void request(uint8_t source, uint32_t pgn, uint8_t destination)
+{
+    uint8_t d[8] = { pgn & 0xFF, (pgn >> 8) & 0xFF, pgn >> 16, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    pthread_mutex_lock(&lock);
+    node_send(source, 59904, destination, d);
+    pthread_mutex_unlock(&lock);
+}
+
+
+/**
+ * @brief A frame reaches the nodes. Called with lock held.
+ */
+static void deliver(const n2k_frame_t *f, uint32_t t_us)
+{
+    n2k_msg_t msg;
+    n2k_parse(f, &msg);
+    const uint8_t *d = msg.data;
+
+    if (msg.destination == N2K_BROADCAST) {
+        if (msg.pgn == ISO_TP_PGN_CM && d[0] == 32) {
+            bam_len = d[1] | (d[2] << 8);
+            bam_next = 1;
+            received_gaps.last_us = 0;
+        } else if (msg.pgn == ISO_TP_PGN_DT) {
+            add_gap(&received_gaps, t_us);
+            if (d[0] != bam_next++) {
+                failures++;
+            }
+            int offset = (d[0] - 1) * 7;
+            int len = (bam_len - offset < 7) ? bam_len - offset : 7;
+            memcpy(&bam_buf[offset], &d[1], len);
+            if (offset + len == bam_len) {
+                bams_received++;
+                payload_bytes += bam_len;
+                if (memcmp(bam_buf, product_info, bam_len) != 0) {
+                    failures++;
+                }
+            }
+        }
+        return;
+    }
+
+    if (msg.destination < FIRST_NODE || msg.destination >= FIRST_NODE + MAX_NODES) {
+        return;
+    }
+    node_t *n = &nodes[msg.destination - FIRST_NODE];
+    if (msg.pgn == ISO_TP_PGN_CM) {
+        uint32_t pgn = d[5] | (d[6] << 8) | (d[7] << 16);
+        if (d[0] == 16) {                                   // RTS
+            n->len = d[1] | (d[2] << 8);
+            n->packets = d[3];
+            n->next = 1;
+            n->window_end = (n->packets < WINDOW) ? n->packets : WINDOW;
+            node_cm(n, 17, n->window_end, 1, pgn);
+        } else if (d[0] == 255) {
+            n->aborted = true;
+        }
+    } else if (msg.pgn == ISO_TP_PGN_DT) {
+        if (d[0] != n->next) {
+            n->corrupt = true;
+            return;
+        }
+        int offset = (d[0] - 1) * 7;
+        int len = (n->len - offset < 7) ? n->len - offset : 7;
+        memcpy(&n->buf[offset], &d[1], len);
+        if (n->next++ < n->window_end) {
+            return;
+        }
+        if (n->window_end == n->packets) {
+            n->done = true;
+            n->corrupt = memcmp(n->buf, big, n->len) != 0;
+            payload_bytes += n->len;
+            node_cm(n, 19, n->len & 0xFF, n->len >> 8, PGN_BIG);
+        } else {
+            int end = n->window_end + WINDOW;
+            n->window_end = (end > n->packets) ? n->packets : end;
+            node_cm(n, 17, n->window_end - n->next + 1, n->next, PGN_BIG);
+        }
+    }
+}
+
+
+/**
+ * @brief The bus: sends queued frames one frame time apart.
+ */
+static void *bus_thread(void *arg)
+{
+    struct timespec slot;
+    clock_gettime(CLOCK_MONOTONIC, &slot);
+
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        if (tx_count == 0) {
+            pthread_cond_wait(&bus_cond, &lock);
+            clock_gettime(CLOCK_MONOTONIC, &slot);          // Bus was idle
+            continue;
+        }
+        n2k_frame_t f = tx_queue[tx_head];
+        tx_head = (tx_head + 1) % TX_QUEUE_LEN;
+        tx_count--;
+        pthread_mutex_unlock(&lock);
+
+        slot.tv_nsec += FRAME_US * 1000;
+        if (slot.tv_nsec >= 1000000000) {
+            slot.tv_nsec -= 1000000000;
+            slot.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slot, NULL);
+
+        pthread_mutex_lock(&lock);
+        deliver(&f, now_us());
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+
+/**
+ * @brief The NMEA task and the timer in one: answers requests, passes on
+ *        TP.CM frames and runs the engine at its deadlines.
+ */
+static void *device_thread(void *arg)
+{
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        while (rx_count > 0) {
+            n2k_msg_t msg;
+            n2k_parse(&rx_queue[rx_head], &msg);
+            rx_head = (rx_head + 1) % RX_QUEUE_LEN;
+            rx_count--;
+            if (msg.pgn == ISO_TP_PGN_CM) {
+                iso_tp_receive(&tp, &msg, now_us());
+            } else if (msg.pgn == 59904) {
+                uint32_t pgn = msg.data[0] | (msg.data[1] << 8) | (msg.data[2] << 16);
+                uint8_t destination = (msg.destination == N2K_BROADCAST) ? N2K_BROADCAST : msg.source;
+                if (pgn == PGN_PRODUCT) {
+                    iso_tp_send(&tp, pgn, destination, product_info, sizeof(product_info), now_us());
+                } else {
+                    iso_tp_send(&tp, pgn, destination, big, sizeof(big), now_us());
+                }
+            }
+        }
+        int32_t wait = iso_tp_poll(&tp, now_us());
+        if (rx_count == 0) {
+            struct timespec deadline = after_us((wait < 0) ? 100000 : wait);
+            pthread_cond_timedwait(&device_cond, &lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+
+static bool idle(void)
+{
+    pthread_mutex_lock(&lock);
+    bool result = tp.in_use == 0 && tx_count == 0 && rx_count == 0;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+
+/**
+ * @brief Waits for the transfers to finish.
+ *
+ * @return false if they have not within RUN_LIMIT_S.
+ */
+static bool wait_idle(void)
+{
+    struct timespec t = { 0, 10000000 };
+    for (int i = 0; i < RUN_LIMIT_S * 100; i++) {
+        nanosleep(&t, NULL);
+        if (idle()) {
+            nanosleep(&t, NULL);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void print_gaps(const char *what, gaps_t *g)
+{
+    uint32_t min = UINT32_MAX, max = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < g->count; i++) {
+        min = (g->gaps_us[i] < min) ? g->gaps_us[i] : min;
+        max = (g->gaps_us[i] > max) ? g->gaps_us[i] : max;
+        total += g->gaps_us[i];
+    }
+    if (g->count == 0) {
+        return;
+    }
+    printf("  %-26s %4d gaps: min %6.2f  mean %6.2f  max %6.2f ms\n", what, g->count, min / 1000.0,
+           total / 1000.0 / g->count, max / 1000.0);
+}
+
+
+/**
+ * @brief Sends the product information by BAM and, at the same time, the
+ *        big message to the first `connections` nodes.
+ */
+static void run(const char *name, bool broadcast, int connections, uint32_t interval_us)
+{
+    pthread_mutex_lock(&lock);
+    memset(nodes, 0, sizeof(nodes));
+    for (int i = 0; i < MAX_NODES; i++) {
+        nodes[i].address = FIRST_NODE + i;
+    }
+    memset(&sent_gaps, 0, sizeof(sent_gaps));
+    memset(&received_gaps, 0, sizeof(received_gaps));
+    payload_bytes = 0;
+    bams_received = 0;
+    iso_tp_reset_stats(&tp);
+    pthread_mutex_unlock(&lock);
+
+    uint32_t t0 = now_us();
+    if (broadcast) {
+        request(FIRST_NODE + MAX_NODES, PGN_PRODUCT, N2K_BROADCAST);
+    }
+    for (int i = 0; i < connections; i++) {
+        request(FIRST_NODE + i, PGN_BIG, OWN_ADDRESS);
+    }
+    if (!wait_idle()) {
+        fprintf(stderr, "%s: not finished after %d s\n", name, RUN_LIMIT_S);
+        exit(1);
+    }
+    double seconds = (now_us() - t0) / 1e6;
+
+    pthread_mutex_lock(&lock);
+    iso_tp_stats_t s = tp.stats;
+    int done = 0;
+    for (int i = 0; i < connections; i++) {
+        done += nodes[i].done;
+        if (nodes[i].corrupt || nodes[i].aborted) {
+            failures++;
+        }
+    }
+    for (int i = 0; i < sent_gaps.count; i++) {
+        if (sent_gaps.gaps_us[i] < interval_us) {
+            failures++;
+        }
+    }
+    if (done + (int)s.refused != connections || (broadcast && bams_received != 1) || s.timeouts || s.aborted) {
+        failures++;
+    }
+    if (connections && payload_bytes / seconds < MIN_RATE) {
+        fprintf(stderr, "%s: %.0f bytes/s, below %d\n", name, payload_bytes / seconds, MIN_RATE);
+        failures++;
+    }
+    printf("%-34s %5d %5d %7lu %7lu %9.0f %8.2f %7lu %7lu\n", name, connections, done, (unsigned long)s.refused,
+           (unsigned long)s.frames, payload_bytes / seconds, seconds, (unsigned long)s.queue_full,
+           (unsigned long)s.in_use_max);
+    print_gaps("BAM packets, as sent", &sent_gaps);
+    print_gaps("BAM packets, as received", &received_gaps);
+    if (s.timed) {
+        printf("  %-26s %4lu late by %lu us on average, %lu us max\n", "BAM packets vs deadline",
+               (unsigned long)s.timed, (unsigned long)(s.late_total_us / s.timed), (unsigned long)s.late_max_us);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+
+int main(int argc, char **argv)
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 8;
+    uint32_t interval_ms = (argc > 2) ? atoi(argv[2]) : 50;
+    count = (count < 1) ? 1 : (count > MAX_SESSIONS) ? MAX_SESSIONS : count;
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    start_us = (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+    for (size_t i = 0; i < sizeof(product_info); i++) {
+        product_info[i] = i * 7 + 1;
+    }
+    for (size_t i = 0; i < sizeof(big); i++) {
+        big[i] = rand();
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&device_cond, &attr);
+    pthread_cond_init(&bus_cond, NULL);
+
+    const n2k_sink_t sink = { queue_send, NULL };
+    iso_tp_init(&tp, sessions, count, OWN_ADDRESS, &sink, interval_ms);
+
+    pthread_t bus, device;
+    pthread_create(&bus, NULL, bus_thread, NULL);
+    pthread_create(&device, NULL, device_thread, NULL);
+
+    printf("Transport protocol on a simulated 250 kbit/s bus, %d sessions, BAM every %lu ms, "
+           "%d-packet CTS windows\n\n", count, (unsigned long)interval_ms, WINDOW);
+    printf("%-34s %5s %5s %7s %7s %9s %8s %7s %7s\n", "run", "conns", "done", "refused", "frames", "bytes/s",
+           "seconds", "retried", "in use");
+    run("product information by BAM, idle", true, 0, interval_ms * 1000);
+    static const int loads[] = { 1, 4, 8, 16 };
+    for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+        char name[40];
+        snprintf(name, sizeof(name), "%d x 1785 bytes by connection", loads[i]);
+        run(name, false, loads[i], interval_ms * 1000);
+    }
+    run("BAM during 8 connections", true, 8, interval_ms * 1000);
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&bus_cond);
+    pthread_cond_broadcast(&device_cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(bus, NULL);
+    pthread_join(device, NULL);
+
+    if (failures) {
+        fprintf(stderr, "\n%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
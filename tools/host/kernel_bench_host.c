@@ -0,0 +1,57 @@
+/*
+ * kernel_bench_host.c
+ *
+ * Host runner for main/kernel_bench.c:
+ *
+ *     ./build-host/kernel_bench [max_bytes]
+ *
+ * The kernels run under the allocation guard; the exit status is non-zero
+ * if a result differs from the reference or a kernel touched the heap.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "alloc_guard.h"
+#include "kernel_bench.h"
+
+
+/**
+ * @brief Checks that the guard sees an allocation, so a build that lost the
+ *        malloc wrappers cannot pass.
+ */
+static bool guard_works(void)
+{
+    static void *volatile sink;
+    alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_KERNELS);
+    sink = malloc(16);
+    free(sink);
+    alloc_guard_exit(guard);
+    bool seen = alloc_guard_violations() == 2;
+    alloc_guard_reset();
+    return seen;
+}
+
+
+int main(int argc, char **argv)
+{
+    if (!guard_works()) {
+        fprintf(stderr, "The allocation guard did not see malloc and free\n");
+        return 1;
+    }
+
+    size_t max_size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 65536;
+    int failures = kernel_bench_run(max_size < 16 ? 16 : max_size);
+    if (failures != 0) {
+        fprintf(stderr, "%d kernel results differ from the reference\n", failures);
+    }
+    if (alloc_guard_violations() != 0) {
+        alloc_guard_print();
+        fprintf(stderr, "Kernels allocated on a guarded path\n");
+        failures++;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,394 @@
+/*
+ * n2k_replay.cpp
+ *
+ * Replays recorded NMEA 2000 bus logs through the fast-packet reassembly
+ * of main/fast_packet.c, to benchmark it:
+ *
+ *      ./build-host/n2k_replay [log ...]
+ *      ./build-host/n2k_replay --write synth.log [seconds]
+ *
+ * Logs are candump -l files ("(1700000000.123456) can0 09F80103#20E6...")
+ * or the canboat plain format ("2023-01-01T00:00:00.000Z,3,129029,3,255,8,
+ * 20,2b,..."), one frame per line. The frames of the fast-packet PGNs that
+ * pgn_handlers.cpp handles are replayed with pools of 2 to 32 contexts,
+ * showing the messages each size drops and the time per frame, and once
+ * through a reassembler that allocates every message on the heap, for
+ * comparison.
+ *
+ * Without a log a synthetic one is made: several GNSS receivers, engines
+ * and logs sending fast packets interleaved at full bus load, all in step
+ * so that every sender has a message in progress at once. With no frames
+ * lost and a pool as large as the number of senders, every message must
+ * come through; the exit status is non-zero if not. The same traffic is
+ * then replayed with 1% of its frames lost, to show how the drops are
+ * counted. --write saves the synthetic log in candump format.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "fast_packet.h"
+
+
+#define FULL_LOAD_FPS   1800
+
+
+// A fast-packet message the synthetic log carries
+typedef struct {
+    uint32_t    pgn;
+    uint8_t     len;
+    int         period_ms;
+    int         senders;                    // From addresses 10, 11, ...
+} synth_msg_t;
+
+
+// Local variables
+static size_t   heap_allocations;
+static const uint32_t fast_pgns[] = { 127489, 128275, 129029 };    // PGN_FAST in pgn_handlers.cpp
+
+
+static int64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+static bool is_fast(uint32_t pgn)
+{
+    for (uint32_t p : fast_pgns) {
+        if (p == pgn) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Parses one log line, in candump -l or canboat plain format.
+ *
+ * @return false if the line holds no frame.
+ */
+static bool parse_line(const char *line, n2k_frame_t *f)
+{
+    unsigned b[8] = { 0 };
+    memset(f, 0, sizeof(*f));
+
+    if (line[0] == '(') {
+        double ts;
+        unsigned id;
+        char hex[64];
+        if (sscanf(line, "(%lf) %*s %x#%63s", &ts, &id, hex) != 3) {
+            return false;
+        }
+        f->id = id & 0x1FFFFFFF;
+        f->time_ms = (uint32_t)(int64_t)(ts * 1000);
+        size_t n = strlen(hex) / 2;
+        f->len = (n > 8) ? 8 : n;
+        for (int i = 0; i < f->len; i++) {
+            sscanf(&hex[2 * i], "%2x", &b[i]);
+            f->data[i] = b[i];
+        }
+        return true;
+    }
+
+    int hh, mm, prio, pgn, src, dst, len;
+    double ss;
+    if (sscanf(line, "%*d-%*d-%*dT%d:%d:%lf%*[^,],%d,%d,%d,%d,%d,%x,%x,%x,%x,%x,%x,%x,%x", &hh, &mm, &ss, &prio,
+               &pgn, &src, &dst, &len, &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &b[6], &b[7]) < 9) {
+        return false;
+    }
+    f->id = n2k_make_id(pgn, prio, src, dst);
+    f->time_ms = (uint32_t)(((hh * 60 + mm) * 60 + ss) * 1000);
+    f->len = (len > 8) ? 8 : len;
+    for (int i = 0; i < f->len; i++) {
+        f->data[i] = b[i];
+    }
+    return true;
+}
+
+
+static bool load(const char *path, std::vector<n2k_frame_t> &frames)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+    char line[256];
+    n2k_frame_t f;
+    while (fgets(line, sizeof(line), fp)) {
+        if (parse_line(line, &f)) {
+            frames.push_back(f);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+
+/**
+ * @brief Makes a synthetic log: the messages below from several senders,
+ *        their frames interleaved round robin as bus arbitration would,
+ *        with single-frame traffic filling the rest of a fully loaded bus.
+ *
+ * @param seconds    Bus time.
+ * @param loss       Share of frames lost, 0 to 1.
+ * @param frames     Filled with the frames.
+ *
+ * @return The number of fast-packet messages sent.
+ */
+static int synthesize(double seconds, double loss, std::vector<n2k_frame_t> &frames)
+{
+    static const synth_msg_t msgs[] = {
+        { 129029,   43,     100,    4 },    // GNSS position, 7 frames
+        { 127489,   26,     500,    3 },    // Engine dynamic, 4 frames
+        { 128275,   14,     1000,   2 },    // Distance log, 2 frames
+    };
+    struct active_t {
+        uint32_t    pgn;
+        uint8_t     source;
+        uint8_t     seq;
+        uint8_t     len;
+        uint8_t     frame;
+        uint8_t     sent;
+    };
+    std::vector<active_t> active;
+    uint8_t seq[256] = { 0 };
+    int messages = 0;
+    size_t next = 0;
+
+    int64_t slots = (int64_t)(seconds * FULL_LOAD_FPS);
+    for (int64_t slot = 0; slot < slots; slot++) {
+        uint32_t t_ms = (uint32_t)(slot * 1000 / FULL_LOAD_FPS);
+
+        // Messages due in this slot
+        for (const auto &m : msgs) {
+            for (int s = 0; s < m.senders; s++) {
+                uint8_t source = 10 + s + 8 * (&m - msgs);
+                if (slot % ((int64_t)m.period_ms * FULL_LOAD_FPS / 1000) == 0) {
+                    active.push_back({ m.pgn, source, (uint8_t)(seq[source]++ & 7), m.len, 0, 0 });
+                    messages++;
+                }
+            }
+        }
+
+        n2k_frame_t f = {};
+        f.time_ms = t_ms;
+        f.len = 8;
+        memset(f.data, 0xFF, 8);
+        if (active.empty()) {
+            f.id = n2k_make_id(127250, 2, 40, N2K_BROADCAST);
+            f.data[1] = slot & 0xFF;
+        } else {
+            next %= active.size();
+            active_t &a = active[next];
+            f.id = n2k_make_id(a.pgn, 3, a.source, N2K_BROADCAST);
+            f.data[0] = (a.seq << 5) | a.frame;
+            int n;
+            if (a.frame == 0) {
+                f.data[1] = a.len;
+                n = (a.len < 6) ? a.len : 6;
+                memset(&f.data[2], a.source, n);
+            } else {
+                n = (a.len - a.sent < 7) ? a.len - a.sent : 7;
+                memset(&f.data[1], a.source, n);
+            }
+            a.sent += n;
+            a.frame++;
+            if (a.sent >= a.len) {
+                active.erase(active.begin() + next);
+            } else {
+                next++;
+            }
+        }
+        if (loss == 0 || rand() >= loss * RAND_MAX) {
+            frames.push_back(f);
+        }
+    }
+    return messages;
+}
+
+
+/**
+ * @brief Reassembles fast packets the naive way: a heap buffer per message
+ *        in a map keyed like fast_packet.c.
+ *
+ * @return Messages completed.
+ */
+static int heap_reassemble(const std::vector<n2k_msg_t> &msgs)
+{
+    struct buffer_t {
+        uint8_t     *data;
+        uint8_t     len;
+        uint8_t     received;
+        uint8_t     next_frame;
+    };
+    std::map<uint32_t, buffer_t> open;
+    int completed = 0;
+
+    for (const auto &msg : msgs) {
+        uint32_t key = ((uint32_t)msg.source << 21) | (msg.pgn << 3) | (msg.data[0] >> 5);
+        uint8_t counter = msg.data[0] & 0x1F;
+        auto it = open.find(key);
+        if (counter == 0) {
+            if (it != open.end()) {
+                free(it->second.data);
+                open.erase(it);
+            }
+            buffer_t b = { (uint8_t *)malloc(msg.data[1]), msg.data[1], 0, 1 };
+            heap_allocations++;
+            int n = (b.len < 6) ? b.len : 6;
+            memcpy(b.data, &msg.data[2], n);
+            b.received = n;
+            it = open.insert({ key, b }).first;
+            heap_allocations++;                     // The map node
+        } else if (it == open.end()) {
+            continue;
+        } else if (counter != it->second.next_frame) {
+            free(it->second.data);
+            open.erase(it);
+            continue;
+        } else {
+            buffer_t &b = it->second;
+            int n = (b.len - b.received < 7) ? b.len - b.received : 7;
+            memcpy(&b.data[b.received], &msg.data[1], n);
+            b.received += n;
+            b.next_frame++;
+        }
+        if (it->second.received >= it->second.len) {
+            completed++;
+            free(it->second.data);
+            open.erase(it);
+        }
+    }
+    for (auto &o : open) {
+        free(o.second.data);
+    }
+    return completed;
+}
+
+
+/**
+ * @brief Reassembles in a pool as the receive task does, expiring once per
+ *        batch of frames.
+ */
+static void pool_reassemble(fast_packet_pool_t *pool, const std::vector<n2k_msg_t> &msgs)
+{
+    uint8_t len;
+    for (size_t i = 0; i < msgs.size(); i++) {
+        fast_packet_add(pool, &msgs[i], &len);
+        if (i % N2K_BATCH == N2K_BATCH - 1) {
+            fast_packet_expire(pool, msgs[i].time_ms);
+        }
+    }
+}
+
+
+/**
+ * @brief Replays the fast-packet frames of a log with pools of several
+ *        sizes, then on the heap.
+ *
+ * @return Messages completed with the largest pool.
+ */
+static uint32_t replay(const char *name, const std::vector<n2k_frame_t> &frames)
+{
+    static fast_packet_ctx_t contexts[32];
+    static const int sizes[] = { 2, 4, 8, 16, 32 };
+    uint32_t completed = 0;
+
+    // Parsed up front, as pgn_handlers_dispatch() does before the pool sees a frame
+    std::vector<n2k_msg_t> msgs;
+    for (const auto &f : frames) {
+        n2k_msg_t msg;
+        n2k_parse(&f, &msg);
+        if (is_fast(msg.pgn)) {
+            msgs.push_back(msg);
+        }
+    }
+
+    printf("%s: %zu frames, %zu of fast-packet PGNs, %.1f s\n\n", name, frames.size(), msgs.size(),
+           frames.empty() ? 0.0 : (frames.back().time_ms - frames.front().time_ms) / 1000.0);
+    printf("%-10s %9s %9s %8s %8s %8s %9s %8s %8s %9s\n", "contexts", "frames", "messages", "timeout", "evicted",
+           "order", "restarted", "orphans", "max used", "ns/frame");
+    for (int size : sizes) {
+        fast_packet_pool_t pool;
+        fast_packet_init(&pool, contexts, size);
+        int64_t t0 = now_ns();
+        pool_reassemble(&pool, msgs);
+        double ns = msgs.empty() ? 0.0 : (double)(now_ns() - t0) / msgs.size();
+
+        const fast_packet_stats_t &s = pool.stats;
+        printf("%-10d %9lu %9lu %8lu %8lu %8lu %9lu %8lu %8lu %9.1f\n", size, (unsigned long)s.frames,
+               (unsigned long)s.completed, (unsigned long)s.timeouts, (unsigned long)s.evicted,
+               (unsigned long)s.out_of_order, (unsigned long)s.restarted, (unsigned long)s.orphans,
+               (unsigned long)s.in_use_max, ns);
+        completed = s.completed;
+    }
+
+    heap_allocations = 0;
+    int64_t t0 = now_ns();
+    int heap_completed = heap_reassemble(msgs);
+    double ns = msgs.empty() ? 0.0 : (double)(now_ns() - t0) / msgs.size();
+    printf("%-10s %9s %9d %8s %8s %8s %9s %8s %8s %9.1f\n", "heap", "", heap_completed, "", "", "", "", "", "", ns);
+    printf("\nHeap reassembly: %zu allocations, %.1f per second of bus time\n\n", heap_allocations,
+           frames.size() ? heap_allocations * 1000.0 / (frames.back().time_ms - frames.front().time_ms + 1) : 0.0);
+    return completed;
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "--write") == 0) {
+        std::vector<n2k_frame_t> frames;
+        synthesize((argc > 3) ? atof(argv[3]) : 10.0, 0, frames);
+        FILE *fp = fopen(argv[2], "w");
+        if (fp == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+        for (const auto &f : frames) {
+            fprintf(fp, "(%u.%06u) can0 %08X#", f.time_ms / 1000, (f.time_ms % 1000) * 1000, f.id);
+            for (int i = 0; i < f.len; i++) {
+                fprintf(fp, "%02X", f.data[i]);
+            }
+            fprintf(fp, "\n");
+        }
+        fclose(fp);
+        printf("%zu frames written to %s\n", frames.size(), argv[2]);
+        return 0;
+    }
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            std::vector<n2k_frame_t> frames;
+            if (!load(argv[i], frames)) {
+                return 1;
+            }
+            replay(argv[i], frames);
+        }
+        return 0;
+    }
+
+    // Synthetic traffic: 9 senders, so 16 contexts or more must lose nothing
+    std::vector<n2k_frame_t> frames;
+    int sent = synthesize(10.0, 0, frames);
+    uint32_t completed = replay("synthetic, 9 senders at full bus load", frames);
+    if (completed != (uint32_t)sent) {
+        fprintf(stderr, "%d messages sent, %lu reassembled\n", sent, (unsigned long)completed);
+        return 1;
+    }
+    frames.clear();
+    srand(1);
+    synthesize(10.0, 0.01, frames);
+    replay("synthetic, 1% of frames lost", frames);
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * ota_session_host.c
+ *
+ * Runs main/ota_session.c and main/ota_writer.c under the allocation guard
+ * against an in-memory update partition:
+ *
+ *     ./build-host/ota_session
+ *
+ * Raw and multipart uploads are written and read back; then a failing
+ * esp_ota_write() and a block that reads back unprogrammed must each abort
+ * the session without an allocation inside the OTA write region. The
+ * image catalog, which the abort rewrites in NVS, is stood in for by a
+ * malloc and free per call, as nvs_open() and nvs_commit() make. The exit
+ * status is non-zero if a run ends differently or the guard saw the heap.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "alloc_guard.h"
+#include "flash_stall.h"
+#include "image_catalog.h"
+#include "ota_relay.h"
+#include "ota_stats.h"
+#include "perf_lock.h"
+#include "esp_flash_encrypt.h"
+#include "esp_timer.h"
+#include "ota_session.h"
+
+
+#define PARTITION_SIZE      (256 * 1024)
+#define IMAGE_SIZE          100003
+#define CHUNK               1000            // Pushed at a time, as received from a socket
+#define BOUNDARY            "----hostBoundary7MA4YWxk"
+
+
+// How the fake flash misbehaves in a run
+typedef enum {
+    FAULT_NONE = 0,
+    FAULT_WRITE_ERROR,                      // esp_ota_write() fails
+    FAULT_NOT_PROGRAMMED,                   // esp_ota_write() succeeds but leaves the flash erased
+} fault_t;
+
+
+// Local variables
+static uint8_t          flash[PARTITION_SIZE];
+static const esp_partition_t update_partition = { "ota_1", PARTITION_SIZE };
+static const esp_partition_t running_partition = { "ota_0", PARTITION_SIZE };
+static size_t           wrote;
+static int              writes;
+static fault_t          fault;
+static int              fault_at;           // esp_ota_write() call that misbehaves
+static int              aborts;
+static int              invalidates;
+static uint8_t          image[IMAGE_SIZE];
+static uint8_t          stream[IMAGE_SIZE + 256];
+static uint8_t          rx[CHUNK + 1];      // Receive buffer, pushed from an odd address
+
+
+// ESP-IDF and firmware functions the OTA sources call
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    return (code == ESP_OK) ? "ESP_OK" : "error";
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+    static const esp_app_desc_t desc = { "ota-demo", "host" };
+    return &desc;
+}
+
+bool esp_flash_encryption_enabled(void)
+{
+    return false;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &running_partition;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *app_desc)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+    memset(flash, 0xFF, sizeof(flash));
+    wrote = 0;
+    writes = 0;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    if (wrote + size > PARTITION_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    writes++;
+    if (writes == fault_at && fault == FAULT_WRITE_ERROR) {
+        return ESP_FAIL;
+    }
+    if (writes != fault_at || fault != FAULT_NOT_PROGRAMMED) {
+        memcpy(flash + wrote, data, size);
+    }
+    wrote += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    aborts++;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    memcpy(dst, flash + src_offset, size);
+    return ESP_OK;
+}
+
+const esp_partition_t *image_catalog_next_update_partition(void)
+{
+    return &update_partition;
+}
+
+/**
+ * @brief Catalog writes go to NVS, whose open and commit allocate.
+ */
+static void nvs_write(void)
+{
+    static void *volatile handle;
+    handle = malloc(64);
+    free(handle);
+}
+
+void image_catalog_invalidate(const esp_partition_t *partition)
+{
+    invalidates++;
+    nvs_write();
+}
+
+void image_catalog_record_install(const esp_partition_t *partition)
+{
+    nvs_write();
+}
+
+flash_op_t flash_stall_op_begin(flash_op_t op)
+{
+    return op;
+}
+
+void flash_stall_op_end(flash_op_t previous)
+{
+}
+
+void perf_lock_acquire(perf_lock_reason_t reason)
+{
+}
+
+void perf_lock_release(perf_lock_reason_t reason)
+{
+}
+
+int ota_relay_begin(size_t content_len, const char *content_type, int hops)
+{
+    return 0;
+}
+
+void ota_relay_push(const void *data, size_t len)
+{
+}
+
+int ota_relay_end(bool complete)
+{
+    return 0;
+}
+
+void ota_stats_begin(ota_stats_run_t *run, ota_path_t path)
+{
+}
+
+void ota_stats_end(ota_stats_run_t *run, const ota_writer_t *writer)
+{
+}
+
+
+/**
+ * @brief Checks that the guard sees an allocation, so a build that lost the
+ *        malloc wrappers cannot pass.
+ */
+static bool guard_works(void)
+{
+    alloc_region_t guard = alloc_guard_enter(ALLOC_REGION_OTA_WRITE);
+    nvs_write();
+    alloc_guard_exit(guard);
+    bool seen = alloc_guard_violations() == 2;
+    alloc_guard_reset();
+    return seen;
+}
+
+
+/**
+ * @brief Uploads the image through a session, CHUNK bytes a push.
+ *
+ * @return true if the run ended as expected.
+ */
+static bool run(const char *name, bool multipart, fault_t run_fault, int run_fault_at)
+{
+    size_t len = 0;
+    if (multipart) {
+        len += sprintf((char *)stream, "--" BOUNDARY "\r\nContent-Disposition: form-data; name=\"file\"; "
+                       "filename=\"fw.bin\"\r\nContent-Type: application/octet-stream\r\n\r\n");
+    }
+    memcpy(stream + len, image, IMAGE_SIZE);
+    len += IMAGE_SIZE;
+    if (multipart) {
+        len += sprintf((char *)stream + len, "\r\n--" BOUNDARY "--\r\n");
+    }
+
+    fault = run_fault;
+    fault_at = run_fault_at;
+    aborts = 0;
+    invalidates = 0;
+    alloc_guard_reset();
+
+    ota_session_config_t config = {
+        .format      = multipart ? OTA_SESSION_MULTIPART : OTA_SESSION_RAW,
+        .boundary    = BOUNDARY,
+        .content_len = len,
+    };
+    static ota_session_t session;
+    esp_err_t err = ota_session_open(&session, &config);
+    ota_session_status_t status = OTA_SESSION_MORE;
+    for (size_t off = 0; err == ESP_OK && off < len && status == OTA_SESSION_MORE; off += CHUNK) {
+        size_t n = (len - off < CHUNK) ? len - off : CHUNK;
+        memcpy(rx + 1, stream + off, n);
+        status = ota_session_push(&session, rx + 1, n);
+    }
+    if (err == ESP_OK) {
+        err = ota_session_finish(&session);
+    }
+
+    bool ok;
+    if (run_fault == FAULT_NONE) {
+        ok = err == ESP_OK && aborts == 0 && wrote == IMAGE_SIZE && memcmp(flash, image, IMAGE_SIZE) == 0;
+    } else {
+        ok = err != ESP_OK && status == OTA_SESSION_FAILED && aborts == 1 && invalidates == 2 &&
+             !session.writer.active && !ota_writer_busy();
+    }
+    uint32_t violations = alloc_guard_violations();
+    printf("%-24s %s, %d esp_ota_write calls, %d aborts, %u guard violations: %s\n", name,
+           (err == ESP_OK) ? "ok" : "failed", writes, aborts, (unsigned)violations,
+           (ok && violations == 0) ? "pass" : "FAIL");
+    if (violations != 0) {
+        alloc_guard_print();
+    }
+    return ok && violations == 0;
+}
+
+
+int main(void)
+{
+    if (!guard_works()) {
+        fprintf(stderr, "The allocation guard did not see malloc and free\n");
+        return 1;
+    }
+
+    uint32_t seed = 1;
+    for (size_t i = 0; i < IMAGE_SIZE; i++) {
+        seed = seed * 1103515245u + 12345u;
+        image[i] = seed >> 16;
+    }
+    image[0] = 0xE9;                        // Image header magic
+
+    int failures = 0;
+    failures += !run("raw", false, FAULT_NONE, 0);
+    failures += !run("multipart", true, FAULT_NONE, 0);
+    failures += !run("raw, write error", false, FAULT_WRITE_ERROR, 7);
+    failures += !run("multipart, write error", true, FAULT_WRITE_ERROR, 7);
+    failures += !run("raw, not programmed", false, FAULT_NOT_PROGRAMMED, 7);
+    return failures == 0 ? 0 : 1;
+}
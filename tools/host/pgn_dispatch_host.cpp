@@ -0,0 +1,403 @@
+/*
+ * pgn_dispatch_host.cpp
+ *
+ * Linux stand-in for the NMEA 2000 receive path. The handlers and dispatch
+ * loop of main/pgn_handlers.cpp read frames from a socket instead of the
+ * TWAI driver:
+ *
+ *      ./build-host/pgn_dispatch [seconds] [can_interface]
+ *
+ * Without an interface the frames cross a socketpair; with one (e.g. a
+ * vcan0 set up with "ip link add vcan0 type vcan") they go through
+ * SocketCAN. A writer thread sends a mix of handled, unknown and
+ * foreign-addressed PGNs at the frame rate of a fully loaded 250 kbit/s
+ * bus, dropping frames like the driver does when more than a driver queue
+ * of them are waiting. Then the same mix is sent flat out, and the
+ * dispatch loop is timed on its own.
+ *
+ * The exit status is non-zero if a frame is dropped at full bus load, a
+ * frame is miscounted or a reading decodes to the wrong value.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <atomic>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include "pgn_handlers.h"
+
+
+#define OWN_ADDRESS     35
+#define QUEUE_LEN       64                  // CONFIG_NMEA_RX_QUEUE_LEN default
+#define FULL_LOAD_FPS   1800                // 250 kbit/s of 8-byte extended frames, with stuffing
+#define MIX_LEN         20
+
+
+// Link between the writer thread and the receive path
+typedef struct {
+    int                     tx;
+    int                     rx;
+    bool                    can;            // SocketCAN frames, else n2k_frame_t records
+    int                     fps;            // 0 for flat out
+    int64_t                 frames;         // To send
+    std::atomic<int64_t>    sent;
+    std::atomic<int64_t>    received;
+    int64_t                 dropped;        // Queue full, as the driver's rx_missed_count
+    int64_t                 max_backlog;
+    std::atomic<bool>       done;
+} link_t;
+
+
+// Local variables
+static n2k_frame_t  mix[MIX_LEN];
+static bool         mix_is_handled[MIX_LEN];
+static int          mix_handled;            // Frames of the mix that reach a handler
+static int          failures;
+
+
+static int64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+static void put_le(uint8_t *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+
+/**
+ * @brief Adds a frame to the mix, padded with 0xFF as senders do.
+ */
+static n2k_frame_t *add(int *n, uint32_t pgn, uint8_t source, uint8_t destination, bool handled)
+{
+    n2k_frame_t *f = &mix[(*n)++];
+    f->id = n2k_make_id(pgn, 3, source, destination);
+    f->len = 8;
+    memset(f->data, 0xFF, 8);
+    mix_is_handled[*n - 1] = handled;
+    mix_handled += handled;
+    return f;
+}
+
+
+/**
+ * @brief Builds the traffic mix: the handled PGNs with known values, PGNs
+ *        nobody here listens to, and requests addressed to another node.
+ */
+static void build_mix(void)
+{
+    int n = 0;
+    n2k_frame_t *f;
+
+    f = add(&n, 127250, 10, N2K_BROADCAST, true);           // Heading 1.2345 rad
+    f->data[0] = 1;
+    put_le(&f->data[1], 12345, 2);
+    f = add(&n, 129026, 11, N2K_BROADCAST, true);           // COG 3.0 rad, SOG 4.56 m/s
+    f->data[1] = 0xFC;
+    put_le(&f->data[2], 30000, 2);
+    put_le(&f->data[4], 456, 2);
+    f = add(&n, 129025, 11, N2K_BROADCAST, true);           // 37.1234567, -122.7654321
+    put_le(&f->data[0], (uint32_t)371234567, 4);
+    put_le(&f->data[4], (uint32_t)-1227654321, 4);
+    f = add(&n, 128267, 12, N2K_BROADCAST, true);           // Depth 12.34 m
+    put_le(&f->data[1], 1234, 4);
+    f = add(&n, 127488, 20, N2K_BROADCAST, true);           // Engine 1, 2150 rpm
+    f->data[0] = 1;
+    put_le(&f->data[1], 8600, 2);
+    f = add(&n, 127508, 21, N2K_BROADCAST, true);           // Battery 0, 12.85 V, -3.2 A
+    f->data[0] = 0;
+    put_le(&f->data[1], 1285, 2);
+    put_le(&f->data[3], (uint16_t)-32, 2);
+    f = add(&n, 127505, 22, N2K_BROADCAST, true);           // Tank 2 (fresh water), 62.5 %
+    f->data[0] = 0x12;
+    put_le(&f->data[1], 15625, 2);
+    f = add(&n, 130310, 12, N2K_BROADCAST, true);           // Water 291.15 K, air unavailable
+    put_le(&f->data[1], 29115, 2);
+    f = add(&n, 130312, 23, N2K_BROADCAST, true);           // Sensor 4, 350.00 K
+    f->data[1] = 4;
+    put_le(&f->data[3], 35000, 2);
+    f = add(&n, 126992, 11, N2K_BROADCAST, true);           // Day 20000, 12:00:00
+    put_le(&f->data[2], 20000, 2);
+    put_le(&f->data[4], 432000000, 4);
+    f = add(&n, 59904, 30, OWN_ADDRESS, true);              // Request to this node
+    f->len = 3;
+    put_le(&f->data[0], 126996, 3);
+    f = add(&n, 59904, 30, N2K_BROADCAST, true);            // Request to all
+    f->len = 3;
+    put_le(&f->data[0], 60928, 3);
+
+    add(&n, 59904, 30, 40, false)->len = 3;                 // Request to another node
+    add(&n, 130306, 13, N2K_BROADCAST, false);              // Wind
+    add(&n, 127257, 10, N2K_BROADCAST, false);              // Attitude
+    add(&n, 127245, 14, N2K_BROADCAST, false);              // Rudder
+    add(&n, 65280, 20, N2K_BROADCAST, false);               // Proprietary
+    add(&n, 130311, 12, N2K_BROADCAST, false);              // Environmental parameters
+    add(&n, 129539, 11, N2K_BROADCAST, false);              // GNSS DOPs
+    add(&n, 127251, 10, N2K_BROADCAST, false);              // Rate of turn
+}
+
+
+/**
+ * @brief Checks that the readings decode to the values the mix carries.
+ */
+static void check_readings(void)
+{
+    static const struct {
+        n2k_reading_id_t    id;
+        float               value;
+        uint8_t             instance;
+    } expected[] = {
+        { N2K_HEADING,          1.2345f,    0 },
+        { N2K_COG,              3.0f,       0 },
+        { N2K_SOG,              4.56f,      0 },
+        { N2K_DEPTH,            12.34f,     0 },
+        { N2K_ENGINE_SPEED,     2150.0f,    1 },
+        { N2K_BATTERY_VOLTAGE,  12.85f,     0 },
+        { N2K_BATTERY_CURRENT,  -3.2f,      0 },
+        { N2K_TANK_LEVEL,       62.5f,      2 },
+        { N2K_WATER_TEMP,       291.15f,    0 },
+        { N2K_TEMPERATURE,      350.0f,     4 },
+    };
+
+    for (const auto &e : expected) {
+        n2k_reading_t r;
+        pgn_handlers_get_reading(e.id, &r);
+        if (!r.valid || fabsf(r.value - e.value) > 1e-3f * fabsf(e.value) || r.instance != e.instance) {
+            fprintf(stderr, "%s: %.4f instance %d, expected %.4f instance %d\n", pgn_reading_name(e.id), r.value,
+                    r.instance, e.value, e.instance);
+            failures++;
+        }
+    }
+    n2k_reading_t air;
+    pgn_handlers_get_reading(N2K_AIR_TEMP, &air);
+    if (air.valid) {
+        fprintf(stderr, "air_temp: stored a value marked as not available\n");
+        failures++;
+    }
+    n2k_fix_t fix;
+    pgn_handlers_get_fix(&fix);
+    if (!fix.has_position || fix.latitude != 371234567 || fix.longitude != -1227654321 || !fix.has_time ||
+        fix.date != 20000 || fix.time != 432000000) {
+        fprintf(stderr, "position or time decoded wrong\n");
+        failures++;
+    }
+}
+
+
+/**
+ * @brief Frame source on the receiving socket: polls for the first frame,
+ *        then reads what is waiting without blocking.
+ */
+static int socket_receive(void *ctx, n2k_frame_t *frames, int max, uint32_t timeout_ms)
+{
+    link_t *l = (link_t *)ctx;
+    struct pollfd pfd = { l->rx, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return l->done ? -1 : 0;
+    }
+
+    int n = 0;
+    while (n < max) {
+        if (l->can) {
+            struct can_frame cf;
+            if (recv(l->rx, &cf, sizeof(cf), MSG_DONTWAIT) != sizeof(cf)) {
+                break;
+            }
+            if (!(cf.can_id & CAN_EFF_FLAG) || (cf.can_id & CAN_RTR_FLAG)) {
+                continue;
+            }
+            frames[n].id = cf.can_id & CAN_EFF_MASK;
+            frames[n].len = cf.can_dlc;
+            memcpy(frames[n].data, cf.data, 8);
+        } else if (recv(l->rx, &frames[n], sizeof(n2k_frame_t), MSG_DONTWAIT) != sizeof(n2k_frame_t)) {
+            break;
+        }
+        frames[n].time_ms = (uint32_t)(now_ns() / 1000000);
+        n++;
+    }
+    l->received += n;
+    return n;
+}
+
+
+/**
+ * @brief Sends the mix round robin, paced to l->fps if set. A frame finding
+ *        QUEUE_LEN frames waiting is dropped, as the driver would.
+ */
+static void *writer(void *arg)
+{
+    link_t *l = (link_t *)arg;
+    int64_t start = now_ns();
+
+    for (int64_t i = 0; i < l->frames; i++) {
+        if (l->fps) {
+            int64_t due = start + i * 1000000000 / l->fps;
+            while (now_ns() < due) {
+            }
+        }
+        int64_t backlog = l->sent - l->received;
+        l->max_backlog = (backlog > l->max_backlog) ? backlog : l->max_backlog;
+        if (l->fps && backlog >= QUEUE_LEN) {
+            l->dropped++;
+            continue;
+        }
+
+        const n2k_frame_t *f = &mix[i % MIX_LEN];
+        ssize_t n;
+        if (l->can) {
+            struct can_frame cf = {};
+            cf.can_id = f->id | CAN_EFF_FLAG;
+            cf.can_dlc = f->len;
+            memcpy(cf.data, f->data, 8);
+            n = send(l->tx, &cf, sizeof(cf), 0);
+        } else {
+            n = send(l->tx, f, sizeof(*f), 0);
+        }
+        if (n > 0) {
+            l->sent++;
+        } else {
+            l->dropped++;
+        }
+    }
+    l->done = true;
+    return NULL;
+}
+
+
+/**
+ * @brief Opens a raw SocketCAN socket on an interface.
+ */
+static int open_can(const char *ifname)
+{
+    int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    struct ifreq ifr = {};
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    if (s < 0 || ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+        return -1;
+    }
+    struct sockaddr_can addr = {};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+
+/**
+ * @brief Runs the writer against the receive path and prints one line.
+ */
+static void run(const char *label, const char *ifname, int fps, int64_t frames)
+{
+    link_t l;
+    l.fps = fps;
+    l.frames = frames;
+    l.sent = 0;
+    l.received = 0;
+    l.dropped = 0;
+    l.max_backlog = 0;
+    l.done = false;
+    l.can = (ifname != NULL);
+    if (l.can) {
+        l.tx = open_can(ifname);
+        l.rx = open_can(ifname);
+    } else {
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv);
+        l.tx = sv[0];
+        l.rx = sv[1];
+    }
+    if (l.tx < 0 || l.rx < 0) {
+        fprintf(stderr, "Cannot open %s\n", ifname ? ifname : "socketpair");
+        exit(1);
+    }
+
+    pgn_handlers_reset_stats();
+    const n2k_source_t source = { socket_receive, &l };
+    pthread_t thread;
+    int64_t start = now_ns();
+    pthread_create(&thread, NULL, writer, &l);
+    while (pgn_handlers_pump(&source, 100) >= 0) {
+    }
+    pthread_join(thread, NULL);
+    double s = (now_ns() - start) / 1e9;
+    close(l.tx);
+    close(l.rx);
+
+    pgn_stats_t st;
+    pgn_handlers_get_stats(&st);
+    printf("%-22s %9lld %9.0f %8lld %8lld %9.1f %7lu\n", label, (long long)st.frames, st.frames / s,
+           (long long)l.dropped, (long long)l.max_backlog, st.batches ? (double)st.frames / st.batches : 0.0,
+           (unsigned long)st.max_batch);
+
+    int64_t handled = (int64_t)(l.sent / MIX_LEN) * mix_handled;
+    for (int64_t i = l.sent - l.sent % MIX_LEN; i < l.sent; i++) {
+        handled += mix_is_handled[i % MIX_LEN];
+    }
+    if (st.frames != (uint32_t)l.sent || (fps && l.dropped)) {
+        fprintf(stderr, "%s: %lld sent, %lu received, %lld dropped\n", label, (long long)l.sent,
+                (unsigned long)st.frames, (long long)l.dropped);
+        failures++;
+    }
+    if (!l.dropped && st.handled != (uint32_t)handled) {
+        fprintf(stderr, "%s: %lu handled, expected %lld\n", label, (unsigned long)st.handled, (long long)handled);
+        failures++;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+    const char *ifname = (argc > 2) ? argv[2] : NULL;
+
+    build_mix();
+    static fast_packet_ctx_t contexts[8];
+    pgn_handlers_init(OWN_ADDRESS, contexts, 8);
+
+    printf("Receive path over %s, %d-frame mix (%d handled), driver queue %d frames\n\n",
+           ifname ? ifname : "a socketpair", MIX_LEN, mix_handled, QUEUE_LEN);
+    printf("%-22s %9s %9s %8s %8s %9s %7s\n", "run", "frames", "frames/s", "dropped", "backlog", "per batch",
+           "max");
+    run("full load, 250 kbit/s", ifname, FULL_LOAD_FPS, (int64_t)(seconds * FULL_LOAD_FPS));
+    check_readings();
+    run("flat out", ifname, 0, 200000);
+
+    // The dispatch loop alone, on frames already in memory
+    static n2k_frame_t frames[MIX_LEN * 500];
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+        frames[i] = mix[i % MIX_LEN];
+    }
+    const int rounds = 200;
+    int64_t t0 = now_ns();
+    for (int i = 0; i < rounds; i++) {
+        pgn_handlers_dispatch(frames, sizeof(frames) / sizeof(frames[0]));
+    }
+    double ns = (double)(now_ns() - t0) / (rounds * (sizeof(frames) / sizeof(frames[0])));
+    printf("\nDispatch %.1f ns per frame, %.0fx the full bus rate\n", ns, 1e9 / ns / FULL_LOAD_FPS);
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,432 @@
+/*
+ * pgn_sched_host.c
+ *
+ * Linux stand-in for the transmit side of the NMEA task. The scheduler in
+ * main/pgn_scheduler.c runs in real time, woken by an absolute
+ * clock_nanosleep() at each deadline it returns, as the device wakes it
+ * from one esp_timer, with 10 to 5000 PGNs: periods from 100 ms to 60 s
+ * at random offsets, a quarter of them fast packets, and one in eight sent
+ * on change, changing about every 200 ms.
+ *
+ *      ./build-host/pgn_sched [seconds]
+ *
+ * Each count of PGNs runs twice: on the timer wheel, and with a table
+ * scanned for the earliest deadline at every wakeup and a driver call per
+ * message. For both it shows the messages and wakeups per second, against
+ * the wakeups a timer or task per PGN would take (one per message), how
+ * late messages were built after their deadline, and the CPU time of the
+ * scheduler per wakeup and as a share of one core. The millisecond clock
+ * wraps two seconds into each run.
+ *
+ * The exit status is non-zero if a message is built before its deadline,
+ * a periodic PGN is sent a different number of times than its period
+ * allows, or a period is skipped.
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pgn_scheduler.h"
+
+
+#define OWN_ADDRESS     35
+#define MAX_PGNS        5000
+#define CHANGE_MS       200                 // Mean interval between changes of an on-change PGN
+#define MIN_GAP_MS      100                 // Of on-change PGNs
+#define WRAP_AFTER_MS   2000                // Millisecond clock wraps this far into a run
+#define LATE_BUCKET_US  10
+#define LATE_BUCKETS    1000
+
+
+// A PGN of the benchmark
+typedef struct {
+    pgn_sched_entry_t   e;                  // Wheel run
+    uint32_t            deadline;           // Scan run
+    uint32_t            last_sent;
+    bool                pending;
+    bool                ever_sent;
+    uint32_t            sent;
+    uint8_t             len;
+} bench_pgn_t;
+
+
+// Results of a run
+typedef struct {
+    uint64_t    sends;
+    uint64_t    frames;
+    uint64_t    wakeups;
+    uint64_t    driver_calls;
+    uint64_t    late_total_us;
+    uint32_t    late_max_us;
+    uint32_t    late_hist[LATE_BUCKETS];
+    uint64_t    cpu_ns;
+    uint32_t    elapsed_ms;
+} result_t;
+
+
+// Local variables
+static bench_pgn_t      pgns[MAX_PGNS];
+static int              pgn_count;
+static uint32_t         clock_bias;         // Added to the monotonic clock, so that it wraps
+static result_t         *current;
+static int              failures;
+
+
+static uint64_t mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint64_t cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * @brief The scheduler's clock: milliseconds, wrapping WRAP_AFTER_MS into
+ *        the run.
+ */
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(mono_us() / 1000) + clock_bias;
+}
+
+
+/**
+ * @brief Sleeps until a tick of the scheduler's clock starts.
+ */
+static void sleep_until(uint32_t tick)
+{
+    uint64_t mono_ms = (uint32_t)(tick - clock_bias);
+    uint64_t now = mono_us() / 1000;
+    mono_ms |= now & ~0xFFFFFFFFull;        // Back to 64 bits near now
+    if (mono_ms + 0x80000000ull < now) {
+        mono_ms += 0x100000000ull;
+    }
+    struct timespec ts = { mono_ms / 1000, (mono_ms % 1000) * 1000000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+
+/**
+ * @brief Records how late a message is built after its deadline.
+ */
+static void record_late(uint32_t deadline)
+{
+    uint64_t now = mono_us();
+    int32_t since = (int32_t)((uint32_t)(now / 1000) + clock_bias - deadline);     // Whole ticks
+    int64_t late = (int64_t)(now % 1000) + (int64_t)since * 1000;
+    if (late < 0) {
+        fprintf(stderr, "message built %lld us before its deadline\n", (long long)-late);
+        failures++;
+        late = 0;
+    }
+    current->late_total_us += late;
+    if (late > current->late_max_us) {
+        current->late_max_us = late;
+    }
+    int b = late / LATE_BUCKET_US;
+    current->late_hist[(b < LATE_BUCKETS) ? b : LATE_BUCKETS - 1]++;
+}
+
+
+/**
+ * @brief Fills a message of the PGN's length.
+ */
+static int fill(bench_pgn_t *p, uint8_t *data)
+{
+    memset(data, p->sent, p->len);
+    p->sent++;
+    current->sends++;
+    return p->len;
+}
+
+
+static int build(void *ctx, uint8_t *data)
+{
+    bench_pgn_t *p = ctx;
+    record_late(p->e.deadline);
+    return fill(p, data);
+}
+
+
+static int sink_send(void *ctx, const n2k_frame_t *frames, int count)
+{
+    current->frames += count;
+    current->driver_calls++;
+    return count;
+}
+
+
+static uint32_t rand_below(uint32_t n)
+{
+    return (uint32_t)(((uint64_t)rand() * n) / ((uint64_t)RAND_MAX + 1));
+}
+
+
+/**
+ * @brief Sets up the PGNs of a run, the same for both designs.
+ */
+static void make_pgns(int count)
+{
+    static const uint16_t periods[] = { 100, 250, 500, 1000, 1000, 2500, 5000, 10000, 60000 };
+
+    srand(count);
+    pgn_count = count;
+    for (int i = 0; i < count; i++) {
+        bench_pgn_t *p = &pgns[i];
+        memset(p, 0, sizeof(*p));
+        p->e.pgn = 130816 + (i % 256);
+        p->e.priority = i % 8;
+        p->e.build = build;
+        p->e.ctx = p;
+        p->len = (i % 4 == 3) ? 9 + rand_below(40) : 8;
+        if (i % 8 == 7) {
+            p->e.min_gap_ms = MIN_GAP_MS;
+        } else {
+            p->e.period_ms = periods[rand_below(sizeof(periods) / sizeof(periods[0]))];
+            p->e.offset_ms = rand_below(p->e.period_ms);
+        }
+    }
+}
+
+
+/**
+ * @brief Time of the next change of an on-change PGN, when there are n.
+ */
+static uint32_t next_change(uint32_t after, int n)
+{
+    return after + 1 + rand_below(2 * CHANGE_MS / (n ? n : 1) + 1);
+}
+
+
+static int on_change_count(void)
+{
+    return pgn_count / 8;
+}
+
+
+/**
+ * @brief A random on-change PGN.
+ */
+static bench_pgn_t *pick_on_change(void)
+{
+    return &pgns[rand_below(on_change_count()) * 8 + 7];
+}
+
+
+/**
+ * @brief Runs the scheduler for a while.
+ */
+static void run_wheel(uint32_t duration_ms, result_t *r)
+{
+    static pgn_scheduler_t s;
+    const n2k_sink_t sink = { sink_send, NULL };
+    int changing = on_change_count();
+
+    current = r;
+    clock_bias = (uint32_t)0 - WRAP_AFTER_MS - (uint32_t)(mono_us() / 1000);
+    uint32_t start = now_ms();
+    uint32_t end = start + duration_ms;
+    uint32_t change_at = next_change(start, changing);
+
+    pgn_scheduler_init(&s, OWN_ADDRESS, &sink, start);
+    for (int i = 0; i < pgn_count; i++) {
+        pgn_scheduler_add(&s, &pgns[i].e, start);
+    }
+
+    uint32_t now = start;
+    while ((int32_t)(end - now) > 0) {
+        uint64_t t0 = cpu_ns();
+        while (changing && (int32_t)(now - change_at) >= 0) {
+            pgn_scheduler_changed(&s, &pick_on_change()->e, now);
+            change_at = next_change(change_at, changing);
+        }
+        int32_t wait = pgn_scheduler_run(&s, now);
+        r->cpu_ns += cpu_ns() - t0;
+        r->wakeups++;
+
+        uint32_t next = (wait < 0) ? end : now + wait;
+        if (changing && (int32_t)(change_at - next) < 0) {
+            next = change_at;
+        }
+        if ((int32_t)(end - next) < 0) {
+            next = end;
+        }
+        sleep_until(next);
+        now = now_ms();
+    }
+    r->elapsed_ms = now - start;
+    if (s.stats.skipped != 0) {
+        fprintf(stderr, "%lu periods skipped\n", (unsigned long)s.stats.skipped);
+        failures++;
+    }
+}
+
+
+/**
+ * @brief The alternative: a table scanned for what is due and for the
+ *        earliest deadline at every wakeup, a driver call per message.
+ */
+static void run_scan(uint32_t duration_ms, result_t *r)
+{
+    uint8_t data[FAST_PACKET_MAX_LEN];
+    n2k_frame_t frames[PGN_SCHED_BATCH];
+    int changing = on_change_count();
+
+    current = r;
+    clock_bias = (uint32_t)0 - WRAP_AFTER_MS - (uint32_t)(mono_us() / 1000);
+    uint32_t start = now_ms();
+    uint32_t end = start + duration_ms;
+    uint32_t change_at = next_change(start, changing);
+
+    for (int i = 0; i < pgn_count; i++) {
+        bench_pgn_t *p = &pgns[i];
+        p->pending = p->e.period_ms != 0;
+        p->deadline = start + p->e.offset_ms;
+    }
+
+    uint32_t now = start;
+    while ((int32_t)(end - now) > 0) {
+        uint64_t t0 = cpu_ns();
+        while (changing && (int32_t)(now - change_at) >= 0) {
+            bench_pgn_t *p = pick_on_change();
+            uint32_t due = now;
+            if (p->ever_sent && (int32_t)(p->last_sent + MIN_GAP_MS - now) > 0) {
+                due = p->last_sent + MIN_GAP_MS;
+            }
+            if (!p->pending || (int32_t)(p->deadline - due) > 0) {
+                p->deadline = due;
+                p->pending = true;
+            }
+            change_at = next_change(change_at, changing);
+        }
+
+        uint32_t next = end;
+        for (int i = 0; i < pgn_count; i++) {
+            bench_pgn_t *p = &pgns[i];
+            if (!p->pending) {
+                continue;
+            }
+            if ((int32_t)(now - p->deadline) >= 0) {
+                record_late(p->deadline);
+                int len = fill(p, data);
+                int count = (len <= 8) ? 1 : 1 + (len - 6 + 7 - 1) / 7;
+                memset(frames, 0, sizeof(frames[0]) * count);
+                sink_send(NULL, frames, count);
+                p->last_sent = now;
+                p->ever_sent = true;
+                if (p->e.period_ms != 0) {
+                    p->deadline += p->e.period_ms;
+                } else {
+                    p->pending = false;
+                    continue;
+                }
+            }
+            if ((int32_t)(p->deadline - next) < 0) {
+                next = p->deadline;
+            }
+        }
+        r->cpu_ns += cpu_ns() - t0;
+        r->wakeups++;
+
+        if (changing && (int32_t)(change_at - next) < 0) {
+            next = change_at;
+        }
+        sleep_until(next);
+        now = now_ms();
+    }
+    r->elapsed_ms = now - start;
+}
+
+
+/**
+ * @brief Checks the periodic PGNs were each sent as often as their period
+ *        and offset allow, give or take the one due as the run ended.
+ */
+static void check_counts(const char *design, uint32_t duration_ms)
+{
+    for (int i = 0; i < pgn_count; i++) {
+        const bench_pgn_t *p = &pgns[i];
+        if (p->e.period_ms == 0) {
+            continue;
+        }
+        uint32_t expected = (p->e.offset_ms < duration_ms) ? (duration_ms - 1 - p->e.offset_ms) / p->e.period_ms + 1 : 0;
+        if (p->sent + 1 < expected || p->sent > expected + 1) {
+            fprintf(stderr, "%s: PGN %d every %u ms sent %lu times, expected %lu\n", design, i, p->e.period_ms,
+                    (unsigned long)p->sent, (unsigned long)expected);
+            failures++;
+        }
+    }
+}
+
+
+static uint32_t percentile_us(const result_t *r, double fraction)
+{
+    uint64_t want = (uint64_t)(r->sends * fraction);
+    uint64_t seen = 0;
+    for (int b = 0; b < LATE_BUCKETS; b++) {
+        seen += r->late_hist[b];
+        if (seen > want) {
+            return (b + 1) * LATE_BUCKET_US;
+        }
+    }
+    return LATE_BUCKETS * LATE_BUCKET_US;
+}
+
+
+static void print_result(int count, const char *design, const result_t *r)
+{
+    double seconds = r->elapsed_ms / 1000.0;
+    printf("%6d %-6s %9.0f %9.0f %9.0f %9.0f %7.0f %7lu %7lu %9.2f %7.3f\n", count, design, r->sends / seconds,
+           r->wakeups / seconds, r->sends / seconds, r->driver_calls / seconds,
+           r->sends ? (double)r->late_total_us / r->sends : 0.0, (unsigned long)percentile_us(r, 0.99),
+           (unsigned long)r->late_max_us, r->wakeups ? r->cpu_ns / 1000.0 / r->wakeups : 0.0,
+           r->cpu_ns / 1e7 / seconds);
+}
+
+
+int main(int argc, char **argv)
+{
+    static const int counts[] = { 10, 100, 1000, 5000 };
+    uint32_t duration_ms = ((argc > 1) ? atoi(argv[1]) : 5) * 1000;
+
+    printf("Transmit scheduler, real time, %lu s per run; messages of 8 bytes and fast packets of 9-48\n",
+           (unsigned long)(duration_ms / 1000));
+    printf("%6s %-6s %9s %9s %9s %9s %7s %7s %7s %9s %7s\n", "PGNs", "design", "msgs/s", "wakeups/s", "per-PGN/s",
+           "drv/s", "late us", "p99 us", "max us", "cpu us/wk", "cpu %");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        static result_t wheel, scan;
+        memset(&wheel, 0, sizeof(wheel));
+        memset(&scan, 0, sizeof(scan));
+
+        make_pgns(counts[i]);
+        run_wheel(duration_ms, &wheel);
+        check_counts("wheel", duration_ms);
+        print_result(counts[i], "wheel", &wheel);
+
+        make_pgns(counts[i]);
+        run_scan(duration_ms, &scan);
+        check_counts("scan", duration_ms);
+        print_result(counts[i], "scan", &scan);
+    }
+    printf("\nper-PGN/s: wakeups a timer or task per PGN would take, one per message\n");
+
+    if (failures != 0) {
+        fprintf(stderr, "\n%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * serial_ota_pty.c
+ *
+ * Linux stand-in for the device side of the serial OTA protocol. It opens a
+ * pseudo terminal, prints the name of the slave side and runs the ota_proto
+ * receiver from main/ on the master side, writing the received image to a
+ * file instead of flash. Point tools/serial_ota.py at the printed device:
+ *
+ *      ./serial_ota_pty received.bin
+ *      python3 tools/serial_ota.py /dev/pts/N image.bin --no-trigger
+ *
+ * Author:  David Hoy
+ * Date:    Oct 2026
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include "ota_proto.h"
+
+
+typedef struct {
+    int     fd;
+    FILE    *out;
+    int     drop_every;     // Drop every Nth read to exercise resends, 0 = never
+    int     reads;
+} pty_ctx_t;
+
+
+static int sink_begin(void *ctx, uint32_t image_size)
+{
+    printf("HELLO: image size %u\n", image_size);
+    return OTA_STATUS_OK;
+}
+
+static int sink_write(void *ctx, const uint8_t *data, size_t len)
+{
+    pty_ctx_t *pty = ctx;
+    return (fwrite(data, 1, len, pty->out) == len) ? OTA_STATUS_OK : OTA_STATUS_WRITE;
+}
+
+static int sink_finish(void *ctx)
+{
+    pty_ctx_t *pty = ctx;
+    return (fflush(pty->out) == 0) ? OTA_STATUS_OK : OTA_STATUS_WRITE;
+}
+
+static void sink_abort(void *ctx)
+{
+    printf("Transfer aborted\n");
+}
+
+static void pty_send(void *ctx, const uint8_t *data, size_t len)
+{
+    pty_ctx_t *pty = ctx;
+    while (len > 0) {
+        ssize_t n = write(pty->fd, data, len);
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <output file> [drop every Nth read]\n", argv[0]);
+        return 2;
+    }
+
+    pty_ctx_t pty = { 0 };
+    pty.out = fopen(argv[1], "wb");
+    pty.drop_every = (argc > 2) ? atoi(argv[2]) : 0;
+    if (pty.out == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    pty.fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty.fd < 0 || grantpt(pty.fd) != 0 || unlockpt(pty.fd) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    struct termios tio;
+    tcgetattr(pty.fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pty.fd, TCSANOW, &tio);
+
+    printf("%s\n", ptsname(pty.fd));
+    fflush(stdout);
+
+    ota_proto_io_t io = {
+        .begin  = sink_begin,
+        .write  = sink_write,
+        .finish = sink_finish,
+        .abort  = sink_abort,
+        .send   = pty_send,
+        .ctx    = &pty,
+    };
+    ota_proto_rx_t rx;
+    ota_proto_rx_init(&rx, &io, 8, 0);
+
+    uint8_t buf[512];
+    int idle_ms = 0;
+    ota_rx_state_t state = OTA_RX_WAIT_HELLO;
+    while (state != OTA_RX_DONE && state != OTA_RX_FAILED) {
+        struct pollfd pfd = { .fd = pty.fd, .events = POLLIN };
+        if (poll(&pfd, 1, 100) <= 0 || !(pfd.revents & POLLIN)) {
+            idle_ms += 100;
+            if (idle_ms % 500 == 0) {
+                ota_proto_rx_idle(&rx);
+            }
+            continue;
+        }
+
+        ssize_t n = read(pty.fd, buf, sizeof(buf));
+        if (n <= 0) {
+            continue;
+        }
+        idle_ms = 0;
+
+        // Optionally lose a read's worth of data to exercise the NAK path
+        if (pty.drop_every && state == OTA_RX_RECEIVING && ++pty.reads % pty.drop_every == 0) {
+            continue;
+        }
+        state = ota_proto_rx_feed(&rx, buf, n);
+    }
+
+    printf("%s: %u bytes, %u CRC errors, %u resends\n", (state == OTA_RX_DONE) ? "Done" : "Failed",
+           rx.received, rx.crc_errors, rx.resends);
+    fclose(pty.out);
+    usleep(200000);     // Let the sender read the final END_ACK before the pty goes away
+    close(pty.fd);
+    return (state == OTA_RX_DONE) ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Compare response latency of an ota-demo unit with a fixed and a dynamic CPU clock.
+
+For each clock policy the tool switches the device with POST /api/pm, then
+times a series of requests spaced --gap seconds apart, so that in dynamic
+mode the device is back at its idle clock when each request arrives. Every
+request uses a new connection, as a phone joining the captive portal would.
+The performance lock counters of /api/pm are read before and after each run
+to show how much of the run the clock spent at the maximum.
+
+    python tools/latency_bench.py 192.168.4.1 --requests 200 --dns
+
+Idle power itself has to be measured on the supply; the share of time at the
+maximum clock is printed as a guide. Run with --bench to try the tool against
+a local mock device (tools/mock_device.py).
+"""
+import argparse
+import http.client
+import json
+import os
+import socket
+import struct
+import sys
+import time
+from typing import Dict
+from typing import List
+from typing import Tuple
+
+MODES = ('fixed', 'dynamic')
+DNS_NAME = 'connectivitycheck.gstatic.com'
+
+
+def percentile(values: List[float], p: float) -> float:
+    ordered = sorted(values)
+    if not ordered:
+        return 0.0
+    k = min(len(ordered) - 1, max(0, int(round(p / 100.0 * (len(ordered) - 1)))))
+    return ordered[k]
+
+
+class Target:
+    def __init__(self, address: str, timeout: float) -> None:
+        host, _, port = address.partition(':')
+        self.host = host
+        self.port = int(port) if port else 80
+        self.timeout = timeout
+
+    def request(self, method: str, path: str) -> Tuple[int, bytes]:
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout)
+        try:
+            conn.request(method, path, headers={'Content-Length': '0'} if method == 'POST' else {})
+            resp = conn.getresponse()
+            return resp.status, resp.read()
+        finally:
+            conn.close()
+
+    def pm(self) -> Dict:
+        status, body = self.request('GET', '/api/pm')
+        if status != 200:
+            raise RuntimeError('GET /api/pm returned HTTP {}'.format(status))
+        return json.loads(body)
+
+    def set_mode(self, mode: str) -> None:
+        status, body = self.request('POST', '/api/pm?mode=' + mode)
+        if status != 200:
+            raise RuntimeError('cannot select {} clock: {}'.format(mode, body.decode(errors='replace').strip()))
+
+    def time_http(self, path: str) -> float:
+        start = time.perf_counter()
+        status, _ = self.request('GET', path)
+        elapsed = time.perf_counter() - start
+        if status >= 400:
+            raise RuntimeError('GET {} returned HTTP {}'.format(path, status))
+        return elapsed * 1000
+
+    def time_dns(self, query_id: int) -> float:
+        labels = b''.join(bytes([len(p)]) + p.encode() for p in DNS_NAME.split('.')) + b'\0'
+        query = struct.pack('>HHHHHH', query_id, 0x0100, 1, 0, 0, 0) + labels + struct.pack('>HH', 1, 1)
+        with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+            sock.settimeout(self.timeout)
+            start = time.perf_counter()
+            sock.sendto(query, (self.host, 53))
+            while True:
+                reply, _ = sock.recvfrom(512)
+                if len(reply) >= 2 and struct.unpack('>H', reply[:2])[0] == query_id:
+                    return (time.perf_counter() - start) * 1000
+
+
+def run_mode(target: Target, mode: str, args: argparse.Namespace) -> Dict:
+    target.set_mode(mode)
+    time.sleep(args.gap)
+    before = target.pm()
+    samples: Dict[str, List[float]] = {p: [] for p in args.paths}
+    if args.dns:
+        samples['dns'] = []
+
+    for i in range(args.requests):
+        for path in args.paths:
+            samples[path].append(target.time_http(path))
+            time.sleep(args.gap)
+        if args.dns:
+            samples['dns'].append(target.time_dns(i & 0xFFFF))
+            time.sleep(args.gap)
+
+    after = target.pm()
+    elapsed_us = max(1, (after['uptime_ms'] - before['uptime_ms']) * 1000)
+    locks = {}
+    for name, st in after['locks'].items():
+        prev = before['locks'].get(name, {})
+        acquired = st['acquired'] - prev.get('acquired', 0)
+        locks[name] = {
+            'acquired': acquired,
+            'held_share': (st['held_us'] - prev.get('held_us', 0)) / elapsed_us,
+            'mean_acquire_us': (st['acquire_us'] - prev.get('acquire_us', 0)) / acquired if acquired else 0.0,
+            'max_acquire_us': st['max_acquire_us'],
+        }
+    return {'mode': after['mode'], 'min_mhz': after['min_mhz'], 'max_mhz': after['max_mhz'],
+            'samples': samples, 'locks': locks}
+
+
+def report(results: List[Dict], tolerance_ms: float) -> int:
+    print('{:8} {:14} {:>8} {:>8} {:>8} {:>8}'.format('mode', 'request', 'p50 ms', 'p90 ms', 'p99 ms', 'max ms'))
+    for r in results:
+        for name, values in r['samples'].items():
+            print('{:8} {:14} {:8.2f} {:8.2f} {:8.2f} {:8.2f}'.format(
+                r['mode'], name, percentile(values, 50), percentile(values, 90), percentile(values, 99), max(values)))
+
+    print('\n{:8} {:>9} {:6} {:>9} {:>10} {:>14} {:>14}'.format(
+        'mode', 'clock MHz', 'lock', 'acquired', 'at max %', 'mean acq us', 'max acq us'))
+    for r in results:
+        clock = '{}-{}'.format(r['min_mhz'], r['max_mhz'])
+        for name, st in r['locks'].items():
+            print('{:8} {:>9} {:6} {:9d} {:10.1f} {:14.1f} {:14d}'.format(
+                r['mode'], clock, name, st['acquired'], st['held_share'] * 100, st['mean_acquire_us'],
+                st['max_acquire_us']))
+
+    by_mode = {r['mode']: r for r in results}
+    if 'fixed' not in by_mode or 'dynamic' not in by_mode:
+        return 0
+    fixed, dynamic = by_mode['fixed'], by_mode['dynamic']
+    worst = 0.0
+    for name in fixed['samples']:
+        worst = max(worst, percentile(dynamic['samples'][name], 50) - percentile(fixed['samples'][name], 50))
+    verdict = 'unchanged' if worst <= tolerance_ms else 'slower'
+    print('\nDynamic clock median latency is {} ({:+.2f} ms worst case, tolerance {:.2f} ms)'.format(
+        verdict, worst, tolerance_ms))
+    return 0 if worst <= tolerance_ms else 1
+
+
+def bench(args: argparse.Namespace) -> int:
+    import mock_device
+
+    mocks = mock_device.start_fleet(1, mock_device.make_image('bench-1'))
+    try:
+        args.dns = False
+        return measure(Target('127.0.0.1:{}'.format(mocks[0].port), args.timeout), args)
+    finally:
+        mock_device.stop_fleet(mocks)
+
+
+def measure(target: Target, args: argparse.Namespace) -> int:
+    original = target.pm()['mode']
+    try:
+        results = [run_mode(target, mode, args) for mode in args.modes]
+    finally:
+        target.set_mode(original)
+    return report(results, args.tolerance)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('device', nargs='?', default='192.168.4.1', help='device address, host[:port]')
+    parser.add_argument('--requests', type=int, default=100, help='requests per path and mode (default 100)')
+    parser.add_argument('--paths', nargs='+', default=['/api/info', '/'], help='paths to time')
+    parser.add_argument('--dns', action='store_true', help='also time DNS queries to the captive portal')
+    parser.add_argument('--gap', type=float, default=0.25,
+                        help='seconds between requests, lets the clock drop back to idle (default 0.25)')
+    parser.add_argument('--modes', nargs='+', default=list(MODES), choices=MODES, help='clock policies to compare')
+    parser.add_argument('--tolerance', type=float, default=2.0,
+                        help='allowed median slowdown of the dynamic clock in ms (default 2)')
+    parser.add_argument('--timeout', type=float, default=5.0, help='per-request timeout in seconds')
+    parser.add_argument('--bench', action='store_true', help='run against a local mock device')
+    args = parser.parse_args()
+
+    if args.bench:
+        sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+        return bench(args)
+    return measure(Target(args.device, args.timeout), args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
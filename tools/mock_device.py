@@ -0,0 +1,379 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Mock ota-demo device for host side testing and benchmarking.
+
+Serves the same HTTP surface as start_webserver() in main/web_server.c
+(/, /index.html, /index.htm, /firmware, /upload, /settings, /api/info,
+/api/images, /api/boot, /api/pm, /reboot, and the captive portal redirect for
+everything else). Each mock has the factory + three OTA slot layout of
+partitions.csv and writes uploads to the slot with the oldest image. Uploads
+are throttled to emulate Wi-Fi airtime shared by all mocks on the same channel
+plus flash write time, and are relayed to the mock's relay_peers exactly like
+a real unit would.
+
+    python tools/mock_device.py --count 6 --base-port 8100
+
+starts six mocks on ports 8100..8105 on channels 1, 6 and 11.
+"""
+import argparse
+import http.client
+import http.server
+import json
+import struct
+import sys
+import threading
+import time
+from typing import Dict
+from typing import List
+from typing import Optional
+from urllib.parse import parse_qs
+from urllib.parse import unquote_plus
+
+from fleet_update import APP_DESC_MAGIC
+from fleet_update import APP_DESC_OFFSET
+from fleet_update import read_app_desc
+
+CHANNELS = (1, 6, 11)
+REBOOT_SECONDS = 1.0
+SLOTS = ('factory', 'ota_0', 'ota_1', 'ota_2')
+
+
+def make_image(version: str, size: int = 512 * 1024, project: str = 'ota-demo') -> bytes:
+    """Build a synthetic application image with a valid esp_app_desc_t."""
+    import hashlib
+    header = bytes([0xE9, 1, 0, 0]) + bytes(APP_DESC_OFFSET - 4)
+    desc = struct.pack('<II8x32s32s16s16s32s32s', APP_DESC_MAGIC, 0, version.encode(), project.encode(),
+                       b'00:00:00', b'Jan  1 2026', b'v5.3.1', hashlib.sha256(version.encode()).digest())
+    body = header + desc
+    return body + bytes((i * 7) & 0xFF for i in range(max(0, size - len(body))))
+
+
+class Airtime:
+    """Serialises transmissions that share a medium with a fixed capacity."""
+
+    def __init__(self, mbps: float) -> None:
+        self.bytes_per_s = mbps * 1e6 / 8
+        self.lock = threading.Lock()
+        self.next_free = 0.0
+
+    def transmit(self, nbytes: int) -> None:
+        with self.lock:
+            start = max(time.monotonic(), self.next_free)
+            self.next_free = start + nbytes / self.bytes_per_s
+            done = self.next_free
+        delay = done - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+
+class MockDevice:
+    def __init__(self, port: int, channel: int, image: bytes, airtime: Airtime, link_mbps: float,
+                 flash_kbps: float, serial: int) -> None:
+        self.port = port
+        self.channel = channel
+        self.airtime = airtime
+        self.link = Airtime(link_mbps)
+        self.flash_s_per_byte = 1.0 / (flash_kbps * 1024)
+        self.serial = serial
+        self.relay_peers = ''
+        self.busy = False
+        self.rebooting_until = 0.0
+        self.lock = threading.Lock()
+        self.slots: Dict[str, Optional[Dict]] = {slot: None for slot in SLOTS}
+        self.install_seq = 0
+        self.running = 'factory'
+        self.pm_mode = 'dynamic'
+        self.pm_locks = {name: {'acquired': 0, 'active': 0, 'held_us': 0, 'max_held_us': 0,
+                                'acquire_us': 0, 'max_acquire_us': 0} for name in ('ota', 'http', 'dns')}
+        self.install('factory', image)
+        self.boot('factory')
+        self.server = http.server.ThreadingHTTPServer(('127.0.0.1', port), self.handler())
+        self.port = self.server.server_address[1]
+        self.thread = threading.Thread(target=self.server.serve_forever, daemon=True)
+
+    def install(self, slot: str, image: bytes) -> None:
+        project, version, sha256 = read_app_desc(image)
+        self.install_seq += 1
+        self.slots[slot] = {'project': project, 'version': version, 'sha256': sha256, 'seq': self.install_seq}
+
+    def next_slot(self) -> str:
+        """Empty OTA slots first, then the oldest one, never the running slot."""
+        candidates = [s for s in SLOTS[1:] if s != self.running]
+        return min(candidates, key=lambda s: (self.slots[s] is not None, (self.slots[s] or {}).get('seq', 0)))
+
+    def boot(self, slot: str) -> None:
+        entry = self.slots[slot]
+        assert entry is not None
+        self.running = slot
+        self.project, self.version, self.sha256 = entry['project'], entry['version'], entry['sha256']
+        self.booted = time.monotonic()
+
+    def images(self) -> List[Dict]:
+        return [{'slot': slot, 'valid': entry is not None, 'version': (entry or {}).get('version', ''),
+                 'sha256': (entry or {}).get('sha256', ''), 'seq': (entry or {}).get('seq', 0),
+                 'running': slot == self.running, 'boot': slot == self.running}
+                for slot, entry in self.slots.items()]
+
+    def info(self) -> Dict:
+        return {
+            'project': self.project,
+            'version': self.version,
+            'idf': 'v5.3.1',
+            'date': 'Jan  1 2026',
+            'time': '00:00:00',
+            'sha256': self.sha256,
+            'running': self.running,
+            'next': self.next_slot(),
+            'ssid': 'OTA-Demo-{:06X}'.format(self.port),
+            'mac': '02:00:00:{:02x}:{:02x}:{:02x}'.format(self.port >> 16 & 0xFF, self.port >> 8 & 0xFF, self.port & 0xFF),
+            'channel': self.channel,
+            'serial': self.serial,
+            'free_heap': 180000,
+            'uptime_ms': int((time.monotonic() - self.booted) * 1000),
+            'ota_busy': self.busy,
+            'relay_peers': self.relay_peers,
+            'caps': ['upload', 'serial', 'relay', 'catalog', 'pm'],
+            'images': [{'slot': i['slot'], 'version': i['version'], 'sha256': i['sha256']}
+                       for i in self.images() if i['valid']],
+        }
+
+    def pm(self) -> Dict:
+        return {'mode': self.pm_mode, 'min_mhz': 80 if self.pm_mode == 'dynamic' else 240, 'max_mhz': 240,
+                'cur_mhz': 240, 'uptime_ms': int((time.monotonic() - self.booted) * 1000), 'locks': self.pm_locks}
+
+    def open_relays(self, headers: Dict[str, str], length: int) -> List[http.client.HTTPConnection]:
+        hops = int(headers.get('X-OTA-Hops', '0') or 0)
+        conns = []
+        if hops >= 8:
+            return conns
+        for peer in self.relay_peers.replace(',', ' ').split():
+            host, _, port = peer.partition(':')
+            try:
+                conn = http.client.HTTPConnection(host, int(port or 80), timeout=30)
+                conn.putrequest('POST', '/upload')
+                conn.putheader('Content-Type', headers.get('Content-Type', 'application/octet-stream'))
+                conn.putheader('Content-Length', str(length))
+                conn.putheader('X-OTA-Hops', str(hops + 1))
+                conn.endheaders()
+                conns.append(conn)
+            except OSError:
+                pass
+        return conns
+
+    def receive_upload(self, rfile, headers: Dict[str, str], length: int) -> bytes:
+        relays = self.open_relays(headers, length)
+        body = bytearray()
+        while len(body) < length:
+            chunk = rfile.read(min(4096, length - len(body)))
+            if not chunk:
+                break
+            self.airtime.transmit(len(chunk))
+            self.link.transmit(len(chunk))
+            for conn in list(relays):
+                try:
+                    conn.send(chunk)
+                except OSError:
+                    relays.remove(conn)
+            time.sleep(len(chunk) * self.flash_s_per_byte)
+            body += chunk
+        for conn in relays:
+            try:
+                conn.getresponse().read()
+            except (OSError, http.client.HTTPException):
+                pass
+            conn.close()
+        return bytes(body)
+
+    def handler(self) -> type:
+        device = self
+
+        class Handler(http.server.BaseHTTPRequestHandler):
+            protocol_version = 'HTTP/1.1'
+
+            def log_message(self, format: str, *args: object) -> None:
+                pass
+
+            def send_text(self, body: str, status: int = 200, content_type: str = 'text/html') -> None:
+                data = body.encode()
+                self.send_response(status)
+                self.send_header('Content-Type', content_type)
+                self.send_header('Content-Length', str(len(data)))
+                self.end_headers()
+                self.wfile.write(data)
+
+            def handle_one_request(self) -> None:
+                start = time.monotonic()
+                super().handle_one_request()
+                held = int((time.monotonic() - start) * 1e6)
+                if self.command:
+                    lock = device.pm_locks['http']
+                    lock['acquired'] += 1
+                    lock['held_us'] += held
+                    lock['max_held_us'] = max(lock['max_held_us'], held)
+
+            def rebooting(self) -> bool:
+                if time.monotonic() < device.rebooting_until:
+                    self.close_connection = True
+                    return True
+                return False
+
+            def do_GET(self) -> None:
+                if self.rebooting():
+                    return
+                path = self.path.split('?')[0]
+                if path in ('/', '/index.html', '/index.htm'):
+                    self.send_text('<html><body><h1>Welcome to the Demo Web Server</h1>'
+                                   '<p>Firmware version {}</p></body></html>'.format(device.version))
+                elif path == '/firmware':
+                    self.send_text('<html><body><h1>Upload Firmware</h1><p>Current Firmware Version: {}</p>'
+                                   '</body></html>'.format(device.version))
+                elif path == '/settings':
+                    self.send_text("<html><body><form method='POST' action='/settings'>"
+                                   "<input name='serial' value='{}'><input name='relay' value='{}'>"
+                                   '</form></body></html>'.format(device.serial, device.relay_peers))
+                elif path == '/api/info':
+                    self.send_text(json.dumps(device.info()), content_type='application/json')
+                elif path == '/api/images':
+                    self.send_text(json.dumps(device.images()), content_type='application/json')
+                elif path == '/api/pm':
+                    self.send_text(json.dumps(device.pm()), content_type='application/json')
+                elif path == '/reboot':
+                    self.send_text('Rebooting...')
+                    device.rebooting_until = time.monotonic() + REBOOT_SECONDS
+                else:
+                    self.send_response(302, 'Temporary Redirect')
+                    self.send_header('Location', '/')
+                    body = b'Redirect to the captive portal'
+                    self.send_header('Content-Length', str(len(body)))
+                    self.end_headers()
+                    self.wfile.write(body)
+
+            def do_POST(self) -> None:
+                if self.rebooting():
+                    return
+                length = int(self.headers.get('Content-Length', '0'))
+                path = self.path.split('?')[0]
+                if path == '/settings':
+                    form = parse_qs(self.rfile.read(length).decode(), keep_blank_values=True)
+                    if 'serial' in form:
+                        device.serial = int(form['serial'][0] or 0)
+                    if 'relay' in form:
+                        device.relay_peers = unquote_plus(form['relay'][0])
+                    self.send_text('<html><body><h1>Settings Saved</h1></body></html>')
+                elif path == '/upload':
+                    self.upload(length)
+                elif path == '/api/boot':
+                    self.rfile.read(length)
+                    slot = parse_qs(self.path.partition('?')[2]).get('slot', [''])[0]
+                    if device.busy:
+                        self.send_text('OTA update in progress', status=500)
+                    elif device.slots.get(slot) is None:
+                        self.send_text('No valid image in that slot', status=404)
+                    else:
+                        self.send_text('Boot partition switched! Rebooting...')
+                        device.rebooting_until = time.monotonic() + REBOOT_SECONDS
+                        device.boot(slot)
+                elif path == '/api/pm':
+                    self.rfile.read(length)
+                    mode = parse_qs(self.path.partition('?')[2]).get('mode', [''])[0]
+                    if mode not in ('fixed', 'dynamic'):
+                        self.send_text('Expected mode=fixed or mode=dynamic', status=400)
+                    else:
+                        device.pm_mode = mode
+                        self.send_text(mode)
+                else:
+                    self.send_error(405)
+
+            def upload(self, length: int) -> None:
+                with device.lock:
+                    if device.busy:
+                        self.rfile.read(length)
+                        self.send_text('OTA already in progress', status=500)
+                        return
+                    device.busy = True
+                try:
+                    body = device.receive_upload(self.rfile, dict(self.headers.items()), length)
+                    start = body.find(b'\r\n\r\n')
+                    image: Optional[bytes] = body[start + 4:] if start >= 0 else None
+                    if len(body) != length or image is None:
+                        self.send_text('Upload failed', status=500)
+                        return
+                    try:
+                        read_app_desc(image)
+                    except ValueError:
+                        self.send_text('Image validation failed', status=500)
+                        return
+                    self.send_text('Upload successful! Rebooting...')
+                    device.rebooting_until = time.monotonic() + REBOOT_SECONDS
+                    slot = device.next_slot()
+                    device.install(slot, image)
+                    device.boot(slot)
+                finally:
+                    device.busy = False
+
+        return Handler
+
+    def start(self) -> 'MockDevice':
+        self.thread.start()
+        return self
+
+    def stop(self) -> None:
+        self.server.shutdown()
+        self.server.server_close()
+
+
+def start_fleet(count: int, image: bytes, current: Optional[bytes] = None, base_port: int = 0,
+                relay_every: int = 0, channel_capacity: float = 8.0, link_mbps: float = 3.0,
+                flash_kbps: float = 400.0, cached: Optional[bytes] = None) -> List[MockDevice]:
+    """Start count mocks spread over channels 1/6/11.
+
+    Every fifth mock already runs `current` (if given) to exercise the identical
+    image short circuit, every seventh holds `cached` (if given) in ota_1 to
+    exercise the slot flip; with relay_every=N every Nth mock relays to the next one.
+    """
+    airtime = {c: Airtime(channel_capacity) for c in CHANNELS}
+    mocks = []
+    for i in range(count):
+        channel = CHANNELS[i % len(CHANNELS)]
+        running = current if (current is not None and i % 5 == 4) else image
+        port = base_port + i if base_port else 0
+        mock = MockDevice(port, channel, running, airtime[channel], link_mbps, flash_kbps, 1000 + i)
+        if cached is not None and i % 7 == 6:
+            mock.install('ota_1', cached)
+        mocks.append(mock.start())
+    if relay_every:
+        for i in range(0, count - 1, relay_every):
+            mocks[i].relay_peers = '127.0.0.1:{}'.format(mocks[i + 1].port)
+    return mocks
+
+
+def stop_fleet(mocks: List[MockDevice]) -> None:
+    for m in mocks:
+        m.stop()
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--count', type=int, default=1, help='number of mock devices')
+    parser.add_argument('--base-port', type=int, default=8100, help='first TCP port')
+    parser.add_argument('--version', default='mock-1', help='firmware version the mocks report')
+    parser.add_argument('--channel-mbps', type=float, default=8.0, help='airtime capacity per channel')
+    parser.add_argument('--link-mbps', type=float, default=3.0, help='per-device link rate')
+    parser.add_argument('--flash-kbps', type=float, default=400.0, help='emulated flash write speed')
+    args = parser.parse_args()
+
+    mocks = start_fleet(args.count, make_image(args.version), base_port=args.base_port,
+                        channel_capacity=args.channel_mbps, link_mbps=args.link_mbps, flash_kbps=args.flash_kbps)
+    for m in mocks:
+        print('mock device on 127.0.0.1:{} channel {}'.format(m.port, m.channel))
+    try:
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        stop_fleet(mocks)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
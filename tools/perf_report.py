@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Report what the performance build profile (sdkconfig.defaults.perf) gains over
+the default build: OTA throughput, HTTP and DNS latency, and the IRAM it costs.
+
+Measure each build on the device, then compare the two link maps and result
+files:
+
+    python tools/perf_report.py measure 192.168.4.1 build/ota-demo.bin --out base.json
+    python tools/perf_report.py measure 192.168.4.1 build-perf/ota-demo.bin --out perf.json
+    python tools/perf_report.py report --base-map build/ota-demo.map --perf-map build-perf/ota-demo.map \\
+                                       --base base.json --perf perf.json
+
+'measure' uploads the image (timing the transfer from the host), waits for
+the device to boot it, and then times requests against the new firmware.
+'report' prints a Markdown summary, including the objects that the linker
+fragments (main/linker.lf, components/dns_server/linker.lf) moved to IRAM.
+"""
+import argparse
+import json
+import os
+import re
+import sys
+from typing import Dict
+from typing import List
+from typing import Optional
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from fleet_update import Device  # noqa: E402
+from fleet_update import read_app_desc  # noqa: E402
+from latency_bench import Target  # noqa: E402
+from latency_bench import percentile  # noqa: E402
+
+# Output sections summed per memory type
+REGIONS = {
+    'IRAM': ('.iram0.vectors', '.iram0.text', '.iram0.data', '.iram0.bss'),
+    'DRAM': ('.dram0.data', '.dram0.bss', '.noinit'),
+    'Flash code': ('.flash.text',),
+    'Flash data': ('.flash.rodata', '.flash.appdesc'),
+}
+HOT_ARCHIVES = ('libmain.a', 'libdns_server.a', 'libapp_update.a')
+
+OUTPUT_RE = re.compile(r'^(\.\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)')
+INPUT_RE = re.compile(r'^\s+(?:(\.\S+)\s+)?0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+\.a\((\S+)\))$')
+
+
+def parse_map(path: str) -> Dict:
+    """Return output section sizes and the bytes of each hot object in IRAM."""
+    sections: Dict[str, int] = {}
+    hot: Dict[str, int] = {}
+    current = ''
+    with open(path, errors='replace') as f:
+        for line in f:
+            m = OUTPUT_RE.match(line)
+            if m:
+                current = m.group(1)
+                sections[current] = sections.get(current, 0) + int(m.group(3), 16)
+                continue
+            if not line.startswith(' ') or not current.startswith('.iram0'):
+                continue
+            m = INPUT_RE.match(line)
+            if m and any(a in m.group(4) for a in HOT_ARCHIVES):
+                archive = os.path.basename(m.group(4).split('(')[0])
+                key = '{}({})'.format(archive, m.group(5))
+                hot[key] = hot.get(key, 0) + int(m.group(3), 16)
+    regions = {name: sum(sections.get(s, 0) for s in names) for name, names in REGIONS.items()}
+    return {'regions': regions, 'hot': hot}
+
+
+def measure(args: argparse.Namespace) -> int:
+    image = open(args.image, 'rb').read()
+    _, version, sha256 = read_app_desc(image)
+    device = Device(args.device)
+    if not device.fetch_info():
+        print('{} is not reachable'.format(args.device))
+        return 1
+
+    print('Uploading {} ({} KB)...'.format(version, len(image) // 1024))
+    device.upload(image, args.timeout, netconn=args.netconn)
+    if not device.wait_for(sha256, args.timeout):
+        print('Device did not boot the new image')
+        return 1
+
+    target = Target(args.device, 5.0)
+    http = [target.time_http(args.path) for _ in range(args.requests)]
+    dns = [target.time_dns(i) for i in range(args.requests)] if args.dns else []
+    result = {
+        'version': version,
+        'image_bytes': len(image),
+        'upload_s': device.seconds,
+        'upload_kbps': len(image) / device.seconds / 1024,
+        'path': args.path,
+        'http_ms': http,
+        'dns_ms': dns,
+    }
+    with open(args.out, 'w') as f:
+        json.dump(result, f, indent=1)
+    print('{}: upload {:.1f} KB/s, {} p50 {:.2f} ms'.format(version, result['upload_kbps'], args.path,
+                                                           percentile(http, 50)))
+    return 0
+
+
+def change(base: float, perf: float, lower_is_better: bool = True) -> str:
+    if base == 0:
+        return '-'
+    pct = (perf - base) / base * 100
+    better = pct < 0 if lower_is_better else pct > 0
+    return '{:+.1f}%{}'.format(pct, ' (better)' if better and abs(pct) >= 1 else '')
+
+
+def report(args: argparse.Namespace) -> int:
+    base_map = parse_map(args.base_map)
+    perf_map = parse_map(args.perf_map)
+
+    print('## Memory\n')
+    print('| Region | Default | Perf profile | Change |')
+    print('|---|---:|---:|---:|')
+    for region in REGIONS:
+        b, p = base_map['regions'][region], perf_map['regions'][region]
+        print('| {} | {} | {} | {:+d} |'.format(region, b, p, p - b))
+
+    print('\n## Hot path objects in IRAM (perf profile)\n')
+    print('| Object | Bytes |')
+    print('|---|---:|')
+    for obj, size in sorted(perf_map['hot'].items(), key=lambda kv: -kv[1]):
+        print('| {} | {} |'.format(obj, size))
+    print('| **Total** | **{}** |'.format(sum(perf_map['hot'].values())))
+
+    if args.base and args.perf:
+        base = json.load(open(args.base))
+        perf = json.load(open(args.perf))
+        print('\n## Throughput and latency\n')
+        print('| Metric | Default | Perf profile | Change |')
+        print('|---|---:|---:|---:|')
+        print('| OTA upload KB/s | {:.1f} | {:.1f} | {} |'.format(
+            base['upload_kbps'], perf['upload_kbps'], change(base['upload_kbps'], perf['upload_kbps'], False)))
+        rows: List[tuple] = [('HTTP {}'.format(base['path']), 'http_ms'), ('DNS', 'dns_ms')]
+        for label, key in rows:
+            if not base.get(key) or not perf.get(key):
+                continue
+            for p in (50, 99):
+                b = percentile(base[key], p)
+                q = percentile(perf[key], p)
+                print('| {} p{} ms | {:.2f} | {:.2f} | {} |'.format(label, p, b, q, change(b, q)))
+    return 0
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    m = sub.add_parser('measure', help='install an image and measure it')
+    m.add_argument('device', help='device address, host[:port]')
+    m.add_argument('image', help='application image (.bin) of the build to measure')
+    m.add_argument('--out', required=True, help='result file (.json)')
+    m.add_argument('--requests', type=int, default=100, help='timed requests (default 100)')
+    m.add_argument('--path', default='/api/info', help='HTTP path to time (default /api/info)')
+    m.add_argument('--dns', action='store_true', help='also time DNS queries')
+    m.add_argument('--netconn', action='store_true', help='upload to the zero-copy listener')
+    m.add_argument('--timeout', type=float, default=120.0, help='upload and reboot timeout in seconds')
+
+    r = sub.add_parser('report', help='compare two builds')
+    r.add_argument('--base-map', required=True, help='link map of the default build')
+    r.add_argument('--perf-map', required=True, help='link map of the perf profile build')
+    r.add_argument('--base', help="'measure' result of the default build")
+    r.add_argument('--perf', help="'measure' result of the perf profile build")
+
+    args = parser.parse_args(argv)
+    return measure(args) if args.command == 'measure' else report(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
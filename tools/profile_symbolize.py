@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Collect a sampling profile from an ota-demo unit and symbolize it against the
+firmware ELF, for flame graphs of e.g. an OTA upload or a DNS flood.
+
+The device folds identical stacks itself and serves them with raw addresses
+from /debug/profile ("task;0xroot;...;0xleaf count"). This tool starts a
+profile (POST /debug/profile), waits, fetches it and replaces every address
+with its function name using addr2line; stacks that become identical are
+merged again. The output is in the folded format read by flamegraph.pl and
+speedscope:
+
+    python tools/profile_symbolize.py 192.168.4.1 --elf build/ota-demo.elf --seconds 20 --out ota.folded
+    flamegraph.pl ota.folded > ota.svg
+
+Use --seconds 0 to fetch a profile started elsewhere (e.g. with the 'profile'
+console command), or --input to symbolize a saved raw profile.
+"""
+import argparse
+import http.client
+import subprocess
+import sys
+import time
+from typing import Dict
+from typing import Iterable
+from typing import List
+from typing import Optional
+from typing import Tuple
+
+ADDR2LINE = 'xtensa-esp32s3-elf-addr2line'
+
+
+def fetch(address: str, hz: int, seconds: float, timeout: float) -> str:
+    host, _, port = address.partition(':')
+
+    def request(method: str, path: str) -> Tuple[int, Dict[str, str], bytes]:
+        conn = http.client.HTTPConnection(host, int(port) if port else 80, timeout=timeout)
+        try:
+            conn.request(method, path, headers={'Content-Length': '0'} if method == 'POST' else {})
+            resp = conn.getresponse()
+            return resp.status, dict(resp.getheaders()), resp.read()
+        finally:
+            conn.close()
+
+    if seconds > 0:
+        status, _, body = request('POST', '/debug/profile?hz={}'.format(hz))
+        if status != 200:
+            raise RuntimeError('cannot start the profiler: {}'.format(body.decode(errors='replace').strip()))
+        print('Sampling for {:g} s at {} Hz per core...'.format(seconds, hz), file=sys.stderr)
+        time.sleep(seconds)
+
+    status, headers, body = request('GET', '/debug/profile')
+    if status != 200:
+        raise RuntimeError('GET /debug/profile returned HTTP {}'.format(status))
+    print('{} samples in {} ms, {} dropped'.format(headers.get('X-Profile-Samples', '?'),
+                                                  headers.get('X-Profile-Duration-Ms', '?'),
+                                                  headers.get('X-Profile-Dropped', '?')), file=sys.stderr)
+    return body.decode(errors='replace')
+
+
+def parse_folded(text: str) -> List[Tuple[List[str], int]]:
+    stacks = []
+    for line in text.splitlines():
+        frames, _, count = line.strip().rpartition(' ')
+        if frames and count.isdigit():
+            stacks.append((frames.split(';'), int(count)))
+    return stacks
+
+
+def symbolize(addresses: Iterable[str], elf: str, addr2line: str) -> Dict[str, str]:
+    """Return the function name of every address, or the address if unknown."""
+    addresses = sorted(set(addresses))
+    if not addresses:
+        return {}
+    out = subprocess.run([addr2line, '-e', elf, '-f', '-C', '-a'], input='\n'.join(addresses) + '\n',
+                         capture_output=True, text=True, check=True).stdout.splitlines()
+    names = {}
+    # -a -f prints three lines per address: address, function, file:line
+    for i in range(0, len(out) - 2, 3):
+        function = out[i + 1]
+        names[addresses[i // 3]] = function if function != '??' else addresses[i // 3]
+    return names
+
+
+def resolve(stacks: List[Tuple[List[str], int]], names: Dict[str, str]) -> Dict[str, int]:
+    folded: Dict[str, int] = {}
+    for frames, count in stacks:
+        key = ';'.join([frames[0]] + [names.get(f, f) for f in frames[1:]])
+        folded[key] = folded.get(key, 0) + count
+    return folded
+
+
+def print_top(folded: Dict[str, int], top: int) -> None:
+    total = sum(folded.values()) or 1
+    self_time: Dict[str, int] = {}
+    for stack, count in folded.items():
+        leaf = stack.rsplit(';', 1)[-1]
+        self_time[leaf] = self_time.get(leaf, 0) + count
+    print('{:>7} {:>6}  {}'.format('samples', 'self%', 'function'), file=sys.stderr)
+    for name, count in sorted(self_time.items(), key=lambda kv: -kv[1])[:top]:
+        print('{:7d} {:5.1f}%  {}'.format(count, 100.0 * count / total, name), file=sys.stderr)
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('device', nargs='?', help='device address, host[:port]')
+    parser.add_argument('--elf', required=True, help='ELF of the firmware running on the device')
+    parser.add_argument('--input', help='symbolize a saved raw profile instead of fetching one')
+    parser.add_argument('--hz', type=int, default=1000, help='samples per second and core (default 1000)')
+    parser.add_argument('--seconds', type=float, default=10.0,
+                        help='profile duration, 0 to fetch the running or last profile (default 10)')
+    parser.add_argument('--addr2line', default=ADDR2LINE, help='addr2line of the toolchain (default %(default)s)')
+    parser.add_argument('--top', type=int, default=15, help='functions listed by self time (default 15)')
+    parser.add_argument('--out', help='output file, default stdout')
+    parser.add_argument('--timeout', type=float, default=10.0, help='per-request timeout in seconds')
+    args = parser.parse_args(argv)
+
+    if args.input:
+        with open(args.input) as f:
+            raw = f.read()
+    elif args.device:
+        raw = fetch(args.device, args.hz, args.seconds, args.timeout)
+    else:
+        parser.error('give a device address or --input')
+
+    stacks = parse_folded(raw)
+    if not stacks:
+        print('The profile is empty', file=sys.stderr)
+        return 1
+    names = symbolize((f for frames, _ in stacks for f in frames[1:] if f.startswith('0x')), args.elf,
+                      args.addr2line)
+    folded = resolve(stacks, names)
+
+    lines = ['{} {}'.format(stack, count) for stack, count in sorted(folded.items())]
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write('\n'.join(lines) + '\n')
+    else:
+        print('\n'.join(lines))
+    if args.top:
+        print_top(folded, args.top)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
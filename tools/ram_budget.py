@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Break the static RAM of an ota-demo build down by subsystem, from the link map.
+
+With CONFIG_STATIC_ALLOCATION the long-lived tasks, stacks and buffers of the
+firmware are in .bss, so this is its worst-case RAM map apart from what
+ESP-IDF allocates itself (see the 'ram' console command for the heap taken
+at start up). Compare against the default build to see what moved:
+
+    python tools/ram_budget.py build-static/ota-demo.map --compare build/ota-demo.map
+    python tools/ram_budget.py build/ota-demo.map --objects 20
+
+The output is Markdown.
+"""
+import argparse
+import os
+import re
+import sys
+from typing import Dict
+from typing import List
+from typing import Optional
+from typing import Tuple
+
+# Output sections counted, by column
+COLUMNS = {
+    '.dram0.data': 'DRAM data',
+    '.dram0.bss': 'DRAM bss',
+    '.noinit': 'DRAM bss',
+    '.iram0.text': 'IRAM',
+    '.iram0.data': 'IRAM',
+    '.iram0.bss': 'IRAM',
+}
+COLUMN_NAMES = ('DRAM data', 'DRAM bss', 'IRAM')
+
+# First match wins; keys are 'archive(object)'
+SUBSYSTEMS: List[Tuple[str, Tuple[str, ...]]] = [
+    ('OTA', ('libmain.a(ota_', 'libmain.a(netconn_ota', 'libmain.a(serial_ota', 'libmain.a(image_catalog',
+             'libapp_update.a', 'libbootloader_support.a')),
+    ('HTTP + DNS', ('libmain.a(web_server', 'libmain.a(uri_decode', 'libmain.a(load_shed', 'libdns_server.a',
+                    'libesp_http_server.a', 'libhttp_parser.a')),
+    ('Diagnostics', ('libmain.a(trace', 'libmain.a(flash_stall', 'libmain.a(profiler', 'libmain.a(perf_lock',
+                     'libmain.a(kernel', 'libmain.a(ram_budget',
+                     'libmain.a(stack_usage', 'libmain.a(join_kpi', 'liballoc_guard.a')),
+    ('Console + settings', ('libmain.a(console', 'libmain.a(settings', 'libconsole.a', 'libcmd_system.a',
+                            'libnvs_flash.a')),
+    ('Wi-Fi', ('libesp_wifi.a', 'libnet80211.a', 'libpp.a', 'libwpa_supplicant.a', 'libcore.a', 'libphy.a',
+               'libesp_phy.a', 'libcoexist.a', 'libesp_coex.a', 'libmesh.a')),
+    ('lwIP + netif', ('liblwip.a', 'libesp_netif.a', 'libmain.a(dhcp_', 'libmain.a(mdns_')),
+    ('NMEA 2000', ('libmain.a(nmea_', 'libmain.a(pgn_', 'libmain.a(fast_packet',
+                   'libmain.a(iso_tp', 'libmain.a(timer_wheel',
+                   'libmain.a(twai_ring')),
+    ('FreeRTOS', ('libfreertos.a',)),
+    ('Flash + cache', ('libspi_flash.a', 'libesp_mm.a', 'libesp_partition.a')),
+    ('C library', ('libc.a', 'libnewlib.a', 'libm.a', 'libgcc.a', 'libstdc++.a', 'libpthread.a')),
+    ('Application, other', ('libmain.a(',)),
+]
+OTHER = 'ESP-IDF, other'
+
+OUTPUT_RE = re.compile(r'^(\.\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)')
+INPUT_RE = re.compile(r'^\s+(?:(\S+)\s+)?0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+\.a)\((\S+)\)$')
+
+
+def parse_map(path: str) -> Dict[str, Dict[str, int]]:
+    """Return the bytes of every archive(object) per column."""
+    objects: Dict[str, Dict[str, int]] = {}
+    column = None
+    with open(path, errors='replace') as f:
+        for line in f:
+            m = OUTPUT_RE.match(line)
+            if m:
+                column = COLUMNS.get(m.group(1))
+                continue
+            if column is None or not line.startswith(' '):
+                continue
+            m = INPUT_RE.match(line)
+            if not m or int(m.group(2), 16) == 0:
+                continue
+            key = '{}({})'.format(os.path.basename(m.group(4)), m.group(5))
+            sizes = objects.setdefault(key, {c: 0 for c in COLUMN_NAMES})
+            sizes[column] += int(m.group(3), 16)
+    return objects
+
+
+def subsystem_of(key: str) -> str:
+    for name, prefixes in SUBSYSTEMS:
+        if any(key.startswith(p) for p in prefixes):
+            return name
+    return OTHER
+
+
+def by_subsystem(objects: Dict[str, Dict[str, int]]) -> Dict[str, Dict[str, int]]:
+    totals: Dict[str, Dict[str, int]] = {}
+    for key, sizes in objects.items():
+        row = totals.setdefault(subsystem_of(key), {c: 0 for c in COLUMN_NAMES})
+        for c in COLUMN_NAMES:
+            row[c] += sizes[c]
+    return totals
+
+
+def ram(sizes: Dict[str, int]) -> int:
+    return sum(sizes[c] for c in COLUMN_NAMES)
+
+
+def print_subsystems(totals: Dict[str, Dict[str, int]], base: Optional[Dict[str, Dict[str, int]]]) -> None:
+    order = [name for name, _ in SUBSYSTEMS] + [OTHER]
+    header = '| Subsystem | ' + ' | '.join(COLUMN_NAMES) + ' | Total |' + (' Change |' if base else '')
+    print(header)
+    print('|---' + '|---:' * (len(COLUMN_NAMES) + 1 + (1 if base else 0)) + '|')
+    empty = {c: 0 for c in COLUMN_NAMES}
+    grand = dict(empty)
+    for name in order:
+        row = totals.get(name, empty)
+        for c in COLUMN_NAMES:
+            grand[c] += row[c]
+        line = '| {} | {} | {} |'.format(name, ' | '.join(str(row[c]) for c in COLUMN_NAMES), ram(row))
+        if base:
+            line += ' {:+d} |'.format(ram(row) - ram(base.get(name, empty)))
+        print(line)
+    line = '| **Total** | {} | **{}** |'.format(' | '.join(str(grand[c]) for c in COLUMN_NAMES), ram(grand))
+    if base:
+        base_total = sum(ram(r) for r in base.values())
+        line += ' {:+d} |'.format(ram(grand) - base_total)
+    print(line)
+
+
+def print_objects(objects: Dict[str, Dict[str, int]], count: int) -> None:
+    print('\n| Object | Subsystem | ' + ' | '.join(COLUMN_NAMES) + ' |')
+    print('|---|---' + '|---:' * len(COLUMN_NAMES) + '|')
+    for key, sizes in sorted(objects.items(), key=lambda kv: -ram(kv[1]))[:count]:
+        print('| {} | {} | {} |'.format(key, subsystem_of(key), ' | '.join(str(sizes[c]) for c in COLUMN_NAMES)))
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('map', help='link map of the build (build/<project>.map)')
+    parser.add_argument('--compare', help='link map of another build to show the change against')
+    parser.add_argument('--objects', type=int, default=10, help='largest objects to list (default 10)')
+    args = parser.parse_args(argv)
+
+    objects = parse_map(args.map)
+    if not objects:
+        print('No RAM sections found in {}'.format(args.map))
+        return 1
+    base = by_subsystem(parse_map(args.compare)) if args.compare else None
+
+    print('## Static RAM by subsystem (bytes)\n')
+    print_subsystems(by_subsystem(objects), base)
+    if args.objects:
+        print_objects(objects, args.objects)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Send a firmware image to an ota-demo device over its serial console.
+
+The device side is the 'serial_ota' console command (main/serial_ota.c); the
+frame format is documented in main/ota_proto.h. Blocks are sent go-back-N
+with a sliding window, acknowledged cumulatively by the device.
+
+    python tools/serial_ota.py /dev/ttyUSB0 build/ota-demo.bin --baud 921600
+
+Use --no-trigger when the receiver is already waiting, e.g. the host stand-in
+from tools/host which listens on a pty pair.
+"""
+import argparse
+import struct
+import sys
+import time
+import zlib
+from typing import List
+from typing import Optional
+from typing import Tuple
+
+import serial
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+
+FRAME_HELLO = 0x01
+FRAME_DATA = 0x02
+FRAME_END = 0x03
+FRAME_ABORT = 0x04
+FRAME_HELLO_ACK = 0x81
+FRAME_ACK = 0x82
+FRAME_NAK = 0x83
+FRAME_END_ACK = 0x84
+FRAME_FAIL = 0x85
+
+STATUS_NAMES = {
+    0: 'ok',
+    1: 'busy',
+    2: 'flash write failed',
+    3: 'size mismatch',
+    4: 'crc mismatch',
+    5: 'image verification failed',
+    6: 'protocol error',
+}
+
+MAX_BLOCK = 1024
+RETRY_TIMEOUT = 1.0
+
+
+def encode(frame_type: int, seq: int, payload: bytes = b'') -> bytes:
+    body = struct.pack('<BHH', frame_type, seq & 0xFFFF, len(payload)) + payload
+    body += struct.pack('<I', zlib.crc32(body))
+    out = bytearray([SLIP_END])
+    for b in body:
+        if b == SLIP_END:
+            out += bytes([SLIP_ESC, SLIP_ESC_END])
+        elif b == SLIP_ESC:
+            out += bytes([SLIP_ESC, SLIP_ESC_ESC])
+        else:
+            out.append(b)
+    out.append(SLIP_END)
+    return bytes(out)
+
+
+class FrameReader:
+    """Incremental SLIP decoder returning (type, seq, payload) tuples."""
+
+    def __init__(self) -> None:
+        self.buf = bytearray()
+        self.escape = False
+
+    def feed(self, data: bytes) -> List[Tuple[int, int, bytes]]:
+        frames = []
+        for b in data:
+            if b == SLIP_END:
+                frame = self._parse(bytes(self.buf))
+                if frame is not None:
+                    frames.append(frame)
+                self.buf.clear()
+                self.escape = False
+            elif b == SLIP_ESC:
+                self.escape = True
+            else:
+                if self.escape:
+                    b = {SLIP_ESC_END: SLIP_END, SLIP_ESC_ESC: SLIP_ESC}.get(b, b)
+                    self.escape = False
+                self.buf.append(b)
+        return frames
+
+    @staticmethod
+    def _parse(raw: bytes) -> Optional[Tuple[int, int, bytes]]:
+        if len(raw) < 9:
+            return None
+        frame_type, seq, length = struct.unpack_from('<BHH', raw)
+        if len(raw) != 5 + length + 4:
+            return None
+        if zlib.crc32(raw[:5 + length]) != struct.unpack_from('<I', raw, 5 + length)[0]:
+            return None
+        return frame_type, seq, raw[5:5 + length]
+
+
+class Sender:
+    def __init__(self, port: serial.Serial, verbose: bool) -> None:
+        self.port = port
+        self.reader = FrameReader()
+        self.verbose = verbose
+        self.pending: List[Tuple[int, int, bytes]] = []
+
+    def send(self, frame_type: int, seq: int, payload: bytes = b'') -> None:
+        self.port.write(encode(frame_type, seq, payload))
+
+    def poll(self, timeout: float) -> Optional[Tuple[int, int, bytes]]:
+        deadline = time.monotonic() + timeout
+        while not self.pending:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            self.port.timeout = min(remaining, 0.05)
+            data = self.port.read(max(1, self.port.in_waiting))
+            if data:
+                self.pending.extend(self.reader.feed(data))
+        return self.pending.pop(0)
+
+    def request(self, frame_type: int, payload: bytes, reply_type: int, retries: int = 5) -> Tuple[int, bytes]:
+        for _ in range(retries):
+            self.send(frame_type, 0, payload)
+            deadline = time.monotonic() + RETRY_TIMEOUT
+            while time.monotonic() < deadline:
+                frame = self.poll(deadline - time.monotonic())
+                if frame is None:
+                    break
+                if frame[0] == FRAME_FAIL:
+                    raise RuntimeError('device aborted: ' + STATUS_NAMES.get(frame[2][0], str(frame[2][0])))
+                if frame[0] == reply_type:
+                    return frame[1], frame[2]
+        raise RuntimeError('no reply from device')
+
+
+def trigger(port: serial.Serial, timeout: float = 5.0) -> None:
+    port.reset_input_buffer()
+    port.write(b'\r\nserial_ota\r\n')
+    deadline = time.monotonic() + timeout
+    line = b''
+    while time.monotonic() < deadline:
+        port.timeout = 0.1
+        line += port.read(256)
+        if b'serial_ota: ready' in line:
+            time.sleep(0.1)     # Let the device re-install its UART driver
+            port.reset_input_buffer()
+            return
+    raise RuntimeError('device did not enter serial OTA mode')
+
+
+def transfer(args: argparse.Namespace) -> None:
+    image = open(args.image, 'rb').read()
+    blocks = [image[i:i + args.block] for i in range(0, len(image), args.block)]
+
+    port = serial.Serial(args.port, args.console_baud, timeout=0.1)
+    if args.trigger:
+        trigger(port)
+
+    sender = Sender(port, args.verbose)
+    hello = struct.pack('<IHBI', len(image), args.block, args.window, args.baud)
+    _, ack = sender.request(FRAME_HELLO, hello, FRAME_HELLO_ACK)
+    status, window, block, baud = struct.unpack_from('<BBHI', ack)
+    if status != 0:
+        raise RuntimeError('device refused update: ' + STATUS_NAMES.get(status, str(status)))
+    if block != args.block:
+        blocks = [image[i:i + block] for i in range(0, len(image), block)]
+    if baud:
+        port.baudrate = baud
+    print('Sending {} bytes in {} blocks of {}, window {}, {} baud'.format(
+        len(image), len(blocks), block, window, baud or args.console_baud))
+
+    start = time.monotonic()
+    base = 0
+    next_block = 0
+    resends = 0
+    last_progress = time.monotonic()
+    while base < len(blocks):
+        while next_block < len(blocks) and next_block < base + window:
+            sender.send(FRAME_DATA, next_block, blocks[next_block])
+            next_block += 1
+
+        frame = sender.poll(RETRY_TIMEOUT)
+        if frame is None or time.monotonic() - last_progress > RETRY_TIMEOUT:
+            next_block = base
+            resends += 1
+            last_progress = time.monotonic()
+            continue
+
+        frame_type, seq, payload = frame
+        if frame_type == FRAME_FAIL:
+            raise RuntimeError('device aborted: ' + STATUS_NAMES.get(payload[0], str(payload[0])))
+        if frame_type not in (FRAME_ACK, FRAME_NAK):
+            continue
+
+        acked = base + ((seq - base) & 0xFFFF)
+        if acked > next_block:
+            continue
+        if acked > base:
+            base = acked
+            last_progress = time.monotonic()
+        if frame_type == FRAME_NAK:
+            next_block = base
+            resends += 1
+
+        if args.verbose:
+            print('\r{:6.1f}%'.format(100.0 * base / len(blocks)), end='', flush=True)
+
+    _, result = sender.request(FRAME_END, struct.pack('<II', len(image), zlib.crc32(image)), FRAME_END_ACK)
+    elapsed = time.monotonic() - start
+    if result[0] != 0:
+        raise RuntimeError('device rejected image: ' + STATUS_NAMES.get(result[0], str(result[0])))
+    print('\nDone: {} bytes in {:.2f} s ({:.1f} KB/s), {} resends'.format(
+        len(image), elapsed, len(image) / elapsed / 1024, resends))
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('port', help='serial port of the device console')
+    parser.add_argument('image', help='application image (.bin)')
+    parser.add_argument('--console-baud', type=int, default=115200, help='console baud rate (default 115200)')
+    parser.add_argument('--baud', type=int, default=0, help='switch to this baud rate for the transfer')
+    parser.add_argument('--block', type=int, default=MAX_BLOCK, help='block size (default 1024)')
+    parser.add_argument('--window', type=int, default=8, help='blocks in flight (default 8)')
+    parser.add_argument('--no-trigger', dest='trigger', action='store_false',
+                        help='do not type the serial_ota command first')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+
+    try:
+        transfer(args)
+    except (RuntimeError, serial.SerialException) as e:
+        print('Error: {}'.format(e), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
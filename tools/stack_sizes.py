@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: CC0-1.0
+"""
+Size the task stacks of ota-demo from high-water marks measured under load.
+
+The tool puts an ota-demo unit through the HTTP and DNS request load, then
+uploads an image (the OTA path runs the deepest calls), and reads the stack
+high-water mark of every task from /debug/stacks. The unit saves its marks
+when it reboots into the new image, so the upload is covered either way;
+if the unit refuses the image (e.g. same version) it has still received
+and written all of it. Each stack the firmware sets itself (the "Task
+stacks" menu) gets the peak use plus a safety margin, rounded up:
+
+    python tools/stack_sizes.py 192.168.4.1 build/ota-demo.bin --out sdkconfig.defaults.stacks
+    idf.py -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;sdkconfig.defaults.stacks" build
+
+Leave out the image to measure the request load only. --save writes the raw
+marks, --input sizes from saved marks without a device. The report on
+stdout is Markdown.
+"""
+import argparse
+import http.client
+import json
+import math
+import os
+import sys
+from typing import Dict
+from typing import List
+from typing import Optional
+from typing import Tuple
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from fleet_update import Device  # noqa: E402
+from fleet_update import read_app_desc  # noqa: E402
+from latency_bench import Target  # noqa: E402
+
+# Tasks whose stack the firmware sets, and the Kconfig option of each
+OPTIONS = {
+    'httpd': 'CONFIG_STACK_SIZE_HTTPD',
+    'dns_server': 'CONFIG_STACK_SIZE_DNS_SERVER',
+    'console_repl': 'CONFIG_STACK_SIZE_CONSOLE',
+    'netconn_ota': 'CONFIG_STACK_SIZE_NETCONN_OTA',
+    'ota_relay': 'CONFIG_STACK_SIZE_OTA_RELAY',
+    'reboot_task': 'CONFIG_STACK_SIZE_REBOOT',
+    'nmea': 'CONFIG_STACK_SIZE_NMEA',
+}
+MIN_STACK = 2048                            # Lower bound of the Kconfig ranges
+LOAD_PATHS = ('/', '/firmware', '/api/info', '/api/images', '/api/ota_stats', '/debug/flash_stalls')
+
+
+def fetch_stacks(target: Target) -> Dict:
+    status, body = target.request('GET', '/debug/stacks')
+    if status != 200:
+        raise RuntimeError('GET /debug/stacks returned HTTP {}'.format(status))
+    return json.loads(body)
+
+
+def run_load(target: Target, requests: int) -> None:
+    for i in range(requests):
+        for path in LOAD_PATHS:
+            target.time_http(path)
+        target.time_dns(i & 0xFFFF)
+
+
+def run_upload(address: str, image_path: str, netconn: bool, timeout: float) -> bool:
+    """Upload the image; return True if the unit rebooted into it."""
+    image = open(image_path, 'rb').read()
+    _, version, sha256 = read_app_desc(image)
+    device = Device(address)
+    if not device.fetch_info():
+        raise RuntimeError('{} is not reachable'.format(address))
+    print('Uploading {} ({} KB)...'.format(version, len(image) // 1024), file=sys.stderr)
+    try:
+        device.upload(image, timeout, netconn=netconn)
+    except (RuntimeError, OSError, http.client.HTTPException) as e:
+        print('Image refused ({}), using the marks of the running boot'.format(e), file=sys.stderr)
+        return False
+    if not device.wait_for(sha256, timeout):
+        raise RuntimeError('the unit did not boot the new image')
+    return True
+
+
+def lowest_free(marks: List[Dict]) -> Dict[str, Tuple[int, int]]:
+    """Return (size, least free bytes) per task name, over all sets of marks."""
+    lowest: Dict[str, Tuple[int, int]] = {}
+    for m in marks:
+        prev = lowest.get(m['name'])
+        if prev is None or m['min_free'] < prev[1]:
+            lowest[m['name']] = (m['size'], m['min_free'])
+    return lowest
+
+
+def recommend(used: int, margin: float, step: int) -> int:
+    return max(MIN_STACK, int(math.ceil(used * (1.0 + margin) / step)) * step)
+
+
+def write_config(path: str, sizes: Dict[str, int], margin: float, note: str) -> None:
+    with open(path, 'w') as f:
+        f.write('# Task stacks sized by tools/stack_sizes.py from high-water marks measured\n')
+        f.write('# under load ({}), with a {:.0f}% margin. Layer on the build with\n'.format(note, margin * 100))
+        f.write('# SDKCONFIG_DEFAULTS="sdkconfig.defaults;{}".\n'.format(os.path.basename(path)))
+        for task, option in OPTIONS.items():
+            if task in sizes:
+                f.write('{}={}\n'.format(option, sizes[task]))
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('device', nargs='?', help='device address, host[:port]')
+    parser.add_argument('image', nargs='?', help='application image (.bin) to upload as part of the load')
+    parser.add_argument('--requests', type=int, default=50, help='rounds of HTTP and DNS requests (default 50)')
+    parser.add_argument('--netconn', action='store_true', help='upload to the zero-copy listener')
+    parser.add_argument('--margin', type=float, default=0.25, help='safety margin over the peak (default 0.25)')
+    parser.add_argument('--step', type=int, default=256, help='round sizes up to a multiple of this (default 256)')
+    parser.add_argument('--out', help='sdkconfig defaults fragment to write')
+    parser.add_argument('--save', help='also write the raw marks to this file (.json)')
+    parser.add_argument('--input', help='size from marks saved with --save instead of measuring')
+    parser.add_argument('--timeout', type=float, default=120.0, help='upload and reboot timeout in seconds')
+    args = parser.parse_args(argv)
+
+    if args.input:
+        with open(args.input) as f:
+            marks = json.load(f)
+        note = 'saved marks'
+    elif args.device:
+        target = Target(args.device, 5.0)
+        print('Request load, {} rounds...'.format(args.requests), file=sys.stderr)
+        run_load(target, args.requests)
+        rebooted = run_upload(args.device, args.image, args.netconn, args.timeout) if args.image else False
+        stacks = fetch_stacks(target)
+        marks = stacks['tasks'] + (stacks['previous'] if rebooted else [])
+        note = 'requests and an OTA upload' if args.image else 'requests only'
+    else:
+        parser.error('give a device address or --input')
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            json.dump(marks, f, indent=1)
+
+    lowest = lowest_free(marks)
+    sizes: Dict[str, int] = {}
+    print('| Task | Size | Peak use | Recommended | Change |')
+    print('|---|---:|---:|---:|---:|')
+    for task in OPTIONS:
+        if task not in lowest:
+            print('| {} | | not running | | |'.format(task))
+            continue
+        size, free = lowest[task]
+        sizes[task] = recommend(size - free, args.margin, args.step)
+        print('| {} | {} | {} | {} | {:+d} |'.format(task, size, size - free, sizes[task], sizes[task] - size))
+    for task, (size, free) in sorted(lowest.items()):
+        if task not in OPTIONS:
+            print('| {} (ESP-IDF) | | {} free | | |'.format(task, free))
+    change = sum(s - lowest[t][0] for t, s in sizes.items())
+    print('\n{} bytes of stack {}.'.format(abs(change), 'added' if change > 0 else 'freed'))
+
+    if args.out:
+        write_config(args.out, sizes, args.margin, note)
+        print('Wrote {}'.format(args.out), file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())